@@ -0,0 +1,159 @@
+// Microbenchmarks for the inter-thread primitives in queue.hh and channel.hh:
+// throughput of SPSC and MPSC queues under each wait policy and the round trip
+// latency of channel handoffs.
+
+#include "janus.hh"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+namespace
+{
+constexpr uint64_t NUM_ITEMS = 10'000'000;
+constexpr uint64_t NUM_ROUND_TRIPS = 100'000;
+constexpr uint64_t QUEUE_CAP = 1024;
+constexpr uint64_t NUM_PRODUCERS = 4;
+
+auto now_ns() -> uint64_t
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		       std::chrono::steady_clock::now().time_since_epoch())
+		.count();
+}
+
+void report(const char* name, uint64_t count, uint64_t elapsed_ns)
+{
+	double per_op_ns = static_cast<double>(elapsed_ns) / static_cast<double>(count);
+	double ops_per_sec = 1e9 / per_op_ns;
+	printf("%-24s - %8.1f ns/op - %8.2f Mops/s\n", name, per_op_ns, ops_per_sec / 1e6);
+}
+
+template<typename WaitPolicy>
+void bench_spsc(const char* name)
+{
+	janus::spsc_queue<uint64_t, WaitPolicy> queue(QUEUE_CAP);
+
+	uint64_t start = now_ns();
+	std::thread producer([&] {
+		for (uint64_t i = 0; i < NUM_ITEMS; i++) {
+			queue.push(i);
+		}
+	});
+	uint64_t sum = 0;
+	for (uint64_t i = 0; i < NUM_ITEMS; i++) {
+		sum += queue.pop();
+	}
+	producer.join();
+	uint64_t elapsed = now_ns() - start;
+
+	if (sum != NUM_ITEMS * (NUM_ITEMS - 1) / 2)
+		printf("%s: bad sum %lu\n", name, sum);
+	report(name, NUM_ITEMS, elapsed);
+}
+
+template<typename WaitPolicy>
+void bench_mpsc(const char* name)
+{
+	janus::mpsc_queue<uint64_t, WaitPolicy> queue(QUEUE_CAP);
+	uint64_t per_producer = NUM_ITEMS / NUM_PRODUCERS;
+
+	uint64_t start = now_ns();
+	std::vector<std::thread> producers;
+	for (uint64_t p = 0; p < NUM_PRODUCERS; p++) {
+		producers.emplace_back([&] {
+			for (uint64_t i = 0; i < per_producer; i++) {
+				queue.push(i);
+			}
+		});
+	}
+	uint64_t sum = 0;
+	for (uint64_t i = 0; i < per_producer * NUM_PRODUCERS; i++) {
+		sum += queue.pop();
+	}
+	for (auto& producer : producers) {
+		producer.join();
+	}
+	uint64_t elapsed = now_ns() - start;
+
+	if (sum != NUM_PRODUCERS * per_producer * (per_producer - 1) / 2)
+		printf("%s: bad sum %lu\n", name, sum);
+	report(name, per_producer * NUM_PRODUCERS, elapsed);
+}
+
+// Ping-pong a value between two threads to measure handoff latency.
+template<typename WaitPolicy>
+void bench_spsc_round_trip(const char* name)
+{
+	janus::spsc_queue<uint64_t, WaitPolicy> ping(1);
+	janus::spsc_queue<uint64_t, WaitPolicy> pong(1);
+
+	uint64_t start = now_ns();
+	std::thread peer([&] {
+		for (uint64_t i = 0; i < NUM_ROUND_TRIPS; i++) {
+			pong.push(ping.pop());
+		}
+	});
+	for (uint64_t i = 0; i < NUM_ROUND_TRIPS; i++) {
+		ping.push(i);
+		pong.pop();
+	}
+	peer.join();
+	report(name, NUM_ROUND_TRIPS, now_ns() - start);
+}
+
+void bench_channel_round_trip(const char* name)
+{
+	janus::channel<uint64_t> ping;
+	janus::channel<uint64_t> pong;
+
+	uint64_t start = now_ns();
+	std::thread peer([&] {
+		for (uint64_t i = 0; i < NUM_ROUND_TRIPS; i++) {
+			pong.send(ping.receive());
+		}
+	});
+	for (uint64_t i = 0; i < NUM_ROUND_TRIPS; i++) {
+		ping.send(i);
+		pong.receive();
+	}
+	peer.join();
+	report(name, NUM_ROUND_TRIPS, now_ns() - start);
+}
+
+void bench_oneshot_round_trip(const char* name)
+{
+	std::vector<janus::oneshot_channel<uint64_t>> pings(NUM_ROUND_TRIPS);
+	std::vector<janus::oneshot_channel<uint64_t>> pongs(NUM_ROUND_TRIPS);
+
+	uint64_t start = now_ns();
+	std::thread peer([&] {
+		for (uint64_t i = 0; i < NUM_ROUND_TRIPS; i++) {
+			pongs[i].send(pings[i].receive());
+		}
+	});
+	for (uint64_t i = 0; i < NUM_ROUND_TRIPS; i++) {
+		pings[i].send(i);
+		pongs[i].receive();
+	}
+	peer.join();
+	report(name, NUM_ROUND_TRIPS, now_ns() - start);
+}
+} // namespace
+
+int main()
+{
+	printf("Throughput (%lu items, capacity %lu):\n", NUM_ITEMS, QUEUE_CAP);
+	bench_spsc<janus::block_wait>("spsc block");
+	bench_spsc<janus::spin_wait>("spsc spin");
+	bench_mpsc<janus::block_wait>("mpsc x4 block");
+	bench_mpsc<janus::spin_wait>("mpsc x4 spin");
+
+	printf("\nRound trip latency (%lu round trips):\n", NUM_ROUND_TRIPS);
+	bench_spsc_round_trip<janus::block_wait>("spsc block");
+	bench_spsc_round_trip<janus::spin_wait>("spsc spin");
+	bench_oneshot_round_trip("oneshot_channel");
+	bench_channel_round_trip("channel");
+}
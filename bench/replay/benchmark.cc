@@ -0,0 +1,431 @@
+// Replay throughput benchmark: replays the test market corpora, along with
+// synthetic markets scaled up beyond them, through a universe with and without
+// a sim. Reports updates/s, ns/update by update type and hardware cache misses
+// per update where the kernel permits. The data replayed and the output format
+// are fixed so that runs before and after a change can be compared directly.
+//
+// Run from the root of the repository, optionally specifying the number of
+// iterations of each measurement, the fastest of which is reported.
+
+#include "janus.hh"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <span>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+constexpr uint64_t DEFAULT_NUM_ITERS = 5;
+constexpr uint64_t NUM_CALIBRATION_ITERS = 1'000'000;
+
+// Synthetic markets have more runners and a longer timeline than any in the
+// test corpora.
+constexpr uint64_t NUM_SYNTHETIC_MARKETS = 4;
+constexpr uint64_t SYNTHETIC_MARKET_ID_BASE = 900'000'000;
+constexpr uint64_t NUM_SYNTHETIC_RUNNERS = 40;
+constexpr uint64_t NUM_SYNTHETIC_SLICES = 50'000;
+constexpr uint64_t SYNTHETIC_RUNNERS_PER_SLICE = 4;
+constexpr uint64_t SYNTHETIC_START_TIMESTAMP = 1'600'000'000'000;
+constexpr uint64_t SYNTHETIC_SLICE_MS = 100;
+constexpr uint64_t SYNTHETIC_RUNNER_ID_BASE = 1000;
+constexpr uint32_t SYNTHETIC_MIN_CENTRE = 20;
+constexpr uint32_t SYNTHETIC_CENTRE_RANGE = 200;
+constexpr uint32_t SYNTHETIC_DEPTH = 3;
+constexpr double SYNTHETIC_MAX_VOL = 500;
+
+// Sim bets are placed on this many of the first runners of each market.
+constexpr uint64_t NUM_SIM_BET_RUNNERS = 3;
+constexpr double SIM_BACK_PRICE = 2;
+constexpr double SIM_LAY_PRICE = 10;
+constexpr double SIM_STAKE = 10;
+
+struct market_data
+{
+	uint64_t id;
+	std::vector<janus::update> updates;
+};
+
+struct corpus
+{
+	std::string name;
+	std::vector<market_data> markets;
+};
+
+auto now_ns() -> uint64_t
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		       std::chrono::steady_clock::now().time_since_epoch())
+		.count();
+}
+
+// A deterministic linear congruential generator so synthetic markets are the
+// same on every run.
+class lcg
+{
+public:
+	explicit lcg(uint64_t seed) : _state{seed} {}
+
+	auto next(uint64_t bound) -> uint64_t
+	{
+		// NOLINTNEXTLINE: Not magical, Knuth's MMIX constants.
+		_state = _state * 6364136223846793005UL + 1442695040888963407UL;
+		return (_state >> 33) % bound; // NOLINT: Not magical, use the high bits.
+	}
+
+private:
+	uint64_t _state;
+};
+
+// A hardware performance counter, unavailable if the kernel doesn't permit
+// it, e.g. in containers.
+class perf_counter
+{
+public:
+	explicit perf_counter(uint64_t config) : _fd{-1}
+	{
+		::perf_event_attr attr = {};
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.size = sizeof(attr);
+		attr.config = config;
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		_fd = static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+	}
+
+	perf_counter(const perf_counter&) = delete;
+	perf_counter(perf_counter&&) = delete;
+	auto operator=(const perf_counter&) -> perf_counter& = delete;
+	auto operator=(perf_counter&&) -> perf_counter& = delete;
+
+	~perf_counter()
+	{
+		if (_fd != -1)
+			::close(_fd);
+	}
+
+	auto available() const -> bool
+	{
+		return _fd != -1;
+	}
+
+	void start()
+	{
+		if (_fd == -1)
+			return;
+		::ioctl(_fd, PERF_EVENT_IOC_RESET, 0);  // NOLINT: vararg ok.
+		::ioctl(_fd, PERF_EVENT_IOC_ENABLE, 0); // NOLINT: vararg ok.
+	}
+
+	auto stop() -> uint64_t
+	{
+		if (_fd == -1)
+			return 0;
+		::ioctl(_fd, PERF_EVENT_IOC_DISABLE, 0); // NOLINT: vararg ok.
+		uint64_t count = 0;
+		if (::read(_fd, &count, sizeof(count)) != sizeof(count))
+			return 0;
+		return count;
+	}
+
+private:
+	int _fd;
+};
+
+auto load_corpus(const std::string& name, const std::string& root) -> corpus
+{
+	janus::config config = {
+		.binary_data_root = root,
+	};
+
+	// Market IDs are sorted so markets are always replayed in the same order.
+	std::vector<uint64_t> ids = janus::get_market_id_list(config);
+	corpus ret = {.name = name};
+	for (uint64_t id : ids) {
+		std::string str = janus::read_market_updates_string(config, id);
+		market_data& market = ret.markets.emplace_back(market_data{.id = id});
+		market.updates.resize(str.size() / sizeof(janus::update));
+		std::memcpy(market.updates.data(), str.data(), str.size());
+	}
+	return ret;
+}
+
+// Generate a pre-off market whose runners have uncrossed books of fixed depth
+// around a centre price, with a few runners trading in each timeslice.
+auto make_synthetic_market(uint64_t index) -> market_data
+{
+	lcg rng(index + 1);
+	market_data ret = {.id = SYNTHETIC_MARKET_ID_BASE + index};
+	std::vector<janus::update>& updates = ret.updates;
+
+	updates.push_back(janus::make_timestamp_update(SYNTHETIC_START_TIMESTAMP));
+	updates.push_back(janus::make_market_id_update(ret.id));
+	updates.push_back(janus::make_market_open_update());
+
+	std::array<uint32_t, NUM_SYNTHETIC_RUNNERS> centres = {};
+	std::array<double, NUM_SYNTHETIC_RUNNERS> traded_vols = {};
+	double market_traded_vol = 0;
+	for (uint64_t runner = 0; runner < NUM_SYNTHETIC_RUNNERS; runner++) {
+		centres[runner] = SYNTHETIC_MIN_CENTRE +
+				  static_cast<uint32_t>(rng.next(SYNTHETIC_CENTRE_RANGE));
+		updates.push_back(janus::make_runner_id_update(SYNTHETIC_RUNNER_ID_BASE + runner));
+	}
+
+	for (uint64_t slice = 1; slice <= NUM_SYNTHETIC_SLICES; slice++) {
+		updates.push_back(janus::make_timestamp_update(SYNTHETIC_START_TIMESTAMP +
+							       slice * SYNTHETIC_SLICE_MS));
+		for (uint64_t i = 0; i < SYNTHETIC_RUNNERS_PER_SLICE; i++) {
+			uint64_t runner = rng.next(NUM_SYNTHETIC_RUNNERS);
+			uint32_t centre = centres[runner];
+			updates.push_back(
+				janus::make_runner_id_update(SYNTHETIC_RUNNER_ID_BASE + runner));
+
+			for (uint32_t depth = 1; depth <= SYNTHETIC_DEPTH; depth++) {
+				auto vol = static_cast<double>(
+					rng.next(static_cast<uint64_t>(SYNTHETIC_MAX_VOL)));
+				updates.push_back(janus::make_runner_unmatched_atb_update(
+					centre - depth, vol));
+				updates.push_back(janus::make_runner_unmatched_atl_update(
+					centre + depth, vol));
+			}
+
+			auto matched = static_cast<double>(
+				rng.next(static_cast<uint64_t>(SYNTHETIC_MAX_VOL)));
+			traded_vols[runner] += matched;
+			market_traded_vol += matched;
+			updates.push_back(janus::make_runner_matched_update(centre, matched));
+			updates.push_back(janus::make_runner_ltp_update(centre));
+			updates.push_back(
+				janus::make_runner_traded_vol_update(traded_vols[runner]));
+		}
+		updates.push_back(janus::make_market_traded_vol_update(market_traded_vol));
+	}
+
+	return ret;
+}
+
+auto num_updates(const corpus& corpus) -> uint64_t
+{
+	uint64_t ret = 0;
+	for (const auto& market : corpus.markets) {
+		ret += market.updates.size();
+	}
+	return ret;
+}
+
+// Replay a market from scratch, stopping at the first faulty update as the
+// analyser does. If a sim is specified, bets are placed on the first runners
+// once the initial state is applied and the sim is updated after each
+// timeslice. Returns the number of updates applied.
+auto replay(janus::betfair::universe<1>& universe, const market_data& market,
+	    janus::betfair::price_range* range, janus::sim_bet_pool* pool) -> uint64_t
+{
+	std::span<const janus::update> updates = market.updates;
+	uint64_t size = updates.size();
+
+	universe.clear();
+	universe.apply_update(janus::make_market_id_update(market.id));
+
+	uint64_t num_applied = 0;
+	if (range == nullptr) {
+		universe.apply_updates(updates, num_applied);
+		return num_applied;
+	}
+
+	// Apply everything up to the second timestamp, as the analyser does.
+	uint64_t pos = janus::find_next_timestamp(updates, 0);
+	if (pos < size)
+		pos = janus::find_next_timestamp(updates, pos + 1);
+	if (universe.apply_updates(updates.first(pos), num_applied) !=
+	    janus::betfair::apply_status::OK)
+		return num_applied;
+
+	janus::betfair::market& state = universe.markets()[0];
+	janus::sim sim(*range, state, *pool);
+	uint64_t num_bet_runners = std::min(NUM_SIM_BET_RUNNERS, state.runners().size());
+	for (uint64_t i = 0; i < num_bet_runners; i++) {
+		uint64_t runner_id = state.runners()[i].id();
+		sim.add_bet(runner_id, SIM_BACK_PRICE, SIM_STAKE, true);
+		sim.add_bet(runner_id, SIM_LAY_PRICE, SIM_STAKE, false);
+	}
+
+	uint64_t ret = num_applied;
+	while (pos < size) {
+		uint64_t end = janus::find_next_timestamp(updates, pos + 1);
+		janus::betfair::apply_status status =
+			universe.apply_updates(updates.subspan(pos, end - pos), num_applied);
+		ret += num_applied;
+		if (status != janus::betfair::apply_status::OK)
+			break;
+
+		sim.update();
+		pos = end;
+	}
+
+	return ret;
+}
+
+// Replay every market of a corpus num_iters times, printing the fastest
+// throughput and, if available, cache misses per update. Returns false if no
+// updates could be applied, in which case there is nothing to report.
+auto bench_corpus(const corpus& corpus, bool with_sim, uint64_t num_iters) -> bool
+{
+	auto universe = std::make_unique<janus::betfair::universe<1>>();
+	janus::betfair::price_range range;
+	janus::sim_bet_pool pool;
+
+	perf_counter misses(PERF_COUNT_HW_CACHE_MISSES);
+	perf_counter refs(PERF_COUNT_HW_CACHE_REFERENCES);
+
+	uint64_t best_ns = ~0UL;
+	uint64_t num_applied = 0;
+	uint64_t num_misses = 0;
+	uint64_t num_refs = 0;
+	for (uint64_t iter = 0; iter < num_iters; iter++) {
+		num_applied = 0;
+		misses.start();
+		refs.start();
+		uint64_t start = now_ns();
+		for (const auto& market : corpus.markets) {
+			num_applied += replay(*universe, market, with_sim ? &range : nullptr,
+					      with_sim ? &pool : nullptr);
+		}
+		uint64_t elapsed = now_ns() - start;
+		uint64_t iter_misses = misses.stop();
+		uint64_t iter_refs = refs.stop();
+
+		if (elapsed < best_ns) {
+			best_ns = elapsed;
+			num_misses = iter_misses;
+			num_refs = iter_refs;
+		}
+	}
+
+	if (num_applied == 0) {
+		fprintf(stderr, "No updates applied replaying %s in %s mode\n", corpus.name.c_str(),
+			with_sim ? "sim" : "replay");
+		return false;
+	}
+
+	double ns_per_update = static_cast<double>(best_ns) / static_cast<double>(num_applied);
+	printf("%-8s %-20s %10lu %14.0f %10.2f", with_sim ? "sim" : "replay",
+	       corpus.name.c_str(), num_applied, 1e9 / ns_per_update, ns_per_update);
+	if (misses.available() && refs.available())
+		printf(" %12.4f %12.4f\n",
+		       static_cast<double>(num_misses) / static_cast<double>(num_applied),
+		       static_cast<double>(num_refs) / static_cast<double>(num_applied));
+	else
+		printf(" %12s %12s\n", "n/a", "n/a");
+
+	return true;
+}
+
+// Get the mean overhead of timing an operation, to be subtracted from timings
+// of individual updates.
+auto calibrate_timer() -> double
+{
+	uint64_t total = 0;
+	for (uint64_t i = 0; i < NUM_CALIBRATION_ITERS; i++) {
+		uint64_t start = now_ns();
+		total += now_ns() - start;
+	}
+	return static_cast<double>(total) / static_cast<double>(NUM_CALIBRATION_ITERS);
+}
+
+// Replay every market of every corpus once, timing each update individually,
+// and print the mean time taken to apply each type of update.
+void bench_update_types(const std::vector<corpus>& corpora)
+{
+	auto universe = std::make_unique<janus::betfair::universe<1>>();
+	std::array<uint64_t, janus::NUM_UPDATE_TYPES> counts = {};
+	std::array<uint64_t, janus::NUM_UPDATE_TYPES> total_ns = {};
+
+	double overhead = calibrate_timer();
+	for (const auto& corpus : corpora) {
+		for (const auto& market : corpus.markets) {
+			universe->clear();
+			universe->apply_update(janus::make_market_id_update(market.id));
+
+			for (const auto& update : market.updates) {
+				uint64_t num_applied;
+				uint64_t start = now_ns();
+				janus::betfair::apply_status status =
+					universe->apply_updates({&update, 1}, num_applied);
+				uint64_t elapsed = now_ns() - start;
+				if (status != janus::betfair::apply_status::OK)
+					break;
+
+				auto type = static_cast<uint64_t>(update.type);
+				counts[type]++;
+				total_ns[type] += elapsed;
+			}
+		}
+	}
+
+	printf("\n%-24s %10s %10s\n", "type", "count", "ns/update");
+	for (uint64_t i = 0; i < janus::NUM_UPDATE_TYPES; i++) {
+		if (counts[i] == 0)
+			continue;
+
+		double ns = static_cast<double>(total_ns[i]) / static_cast<double>(counts[i]) -
+			    overhead;
+		printf("%-24s %10lu %10.2f\n",
+		       janus::update_type_str(static_cast<janus::update_type>(i)), counts[i],
+		       std::max(ns, 0.0));
+	}
+	printf("(timer overhead %.2f ns subtracted)\n", overhead);
+}
+} // namespace
+
+auto main(int argc, char** argv) -> int
+{
+	uint64_t num_iters = DEFAULT_NUM_ITERS;
+	if (argc > 1)
+		num_iters = std::max(std::strtoul(argv[1], nullptr, 10), 1UL);
+
+	std::vector<corpus> corpora;
+	try {
+		corpora.push_back(load_corpus("test-binary", "test/test-binary"));
+		corpora.push_back(load_corpus("test-analyse-binary", "test/test-analyse-binary"));
+	} catch (std::exception& e) {
+		fprintf(stderr, "Unable to load test markets, run from the repository root: %s\n",
+			e.what());
+		return 1;
+	}
+	corpus synthetic = {.name = "synthetic"};
+	for (uint64_t i = 0; i < NUM_SYNTHETIC_MARKETS; i++) {
+		synthetic.markets.push_back(make_synthetic_market(i));
+	}
+	corpora.push_back(std::move(synthetic));
+
+	printf("%-20s %8s %10s\n", "corpus", "markets", "updates");
+	for (const auto& corpus : corpora) {
+		printf("%-20s %8lu %10lu\n", corpus.name.c_str(), corpus.markets.size(),
+		       num_updates(corpus));
+	}
+
+	printf("\n%-8s %-20s %10s %14s %10s %12s %12s\n", "mode", "corpus", "applied",
+	       "updates/s", "ns/update", "misses/upd", "refs/upd");
+	bool ok = true;
+	for (bool with_sim : {false, true}) {
+		for (const auto& corpus : corpora) {
+			if (!bench_corpus(corpus, with_sim, num_iters))
+				ok = false;
+		}
+	}
+
+	bench_update_types(corpora);
+
+	return ok ? 0 : 1;
+}
@@ -1,21 +1,155 @@
 #pragma once
 
+#include "analyse_metrics.hh"
+#include "dataset_image.hh"
 #include "dynamic_array.hh"
 #include "dynamic_buffer.hh"
 #include "market.hh"
 #include "meta.hh"
+#include "result_cache.hh"
+#include "seqlock.hh"
 #include "sim.hh"
 #include "spdlog/spdlog.h"
 #include "stats.hh"
+#include "topology.hh"
 
+#include <atomic>
 #include <cstdint>
+#include <deque>
+#include <exception>
 #include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace janus
 {
 static constexpr uint64_t MAX_ANALYSE_CORES = 256;
 static constexpr uint64_t MAX_ANALYSE_METADATA_BYTES = 250'000'000;
+// Default number of batches markets are divided into per core.
+static constexpr uint64_t DEFAULT_ANALYSE_BATCHES_PER_CORE = 4;
+// Number of markets claimed at a time by each thread filtering markets.
+static constexpr uint64_t ANALYSE_FILTER_CHUNK_SIZE = 256;
+// Maximum interval at which the progress monitor checks for the end of a run.
+static constexpr uint64_t ANALYSE_MONITOR_POLL_MS = 100;
+// Config index of passes whose results aren't cached.
+static constexpr uint64_t UNCACHED_CONFIG_INDEX = ~0UL;
+// Default maximum number of bytes of replay checkpoints held by each core.
+static constexpr uint64_t DEFAULT_ANALYSE_CHECKPOINT_MAX_BYTES = 256UL << 20;
+
+// Options controlling how an analysis is executed.
+struct analyse_options
+{
+	// Number of cores to use, or all available if negative.
+	int num_cores = -1;
+	// If non-zero, batches are sharded across this many worker processes
+	// forked from the calling one, each running its share of the cores and
+	// loading only its own batches. Node aggregate states are returned over
+	// Unix sockets for the final reduction, so the node aggregate state must
+	// be trivially copyable. A worker process crashing fails the run rather
+	// than taking down the caller.
+	uint64_t num_processes = 0;
+	// If non-zero, market data is streamed from disk during the analysis
+	// rather than loaded up front, with each core holding at most this
+	// many markets loaded ahead of those it is replaying. This allows
+	// datasets larger than memory to be analysed at the cost of re-reading
+	// data on every iteration.
+	uint64_t stream_window = 0;
+	// Number of loader threads per core when streaming.
+	uint64_t stream_loaders = 1;
+	// If set, market data loaded up front is backed by transparent huge
+	// pages where possible, reducing TLB misses during replay.
+	bool huge_pages = false;
+	// Number of batches to divide markets into, or
+	// DEFAULT_ANALYSE_BATCHES_PER_CORE per core if 0. Results depend only
+	// on the batches, not on which cores they are scheduled on.
+	uint64_t num_batches = 0;
+	// When sweeping, the maximum number of lanes driven by a single replay
+	// of each market, or all lanes if 0. Lanes beyond this are swept in
+	// further passes, bounding the number of sims held at once.
+	uint64_t sweep_width = 0;
+	// If set, determines for each market the timestamp before which workers
+	// neither act nor abort, e.g. the start of the earliest entry window,
+	// and their state doesn't depend on the configuration. The first replay
+	// of each market saves a checkpoint of the market, worker state and sim
+	// at that point, from which subsequent iterations and sweep passes of
+	// its batch resume rather than replaying the prefix. Workers are not
+	// invoked for the skipped prefix.
+	std::function<uint64_t(const meta_view&)> checkpoint_time;
+	// Maximum number of bytes of checkpoints held by each core, markets
+	// beyond this are replayed in full. Checkpoints are released once their
+	// batch is done.
+	uint64_t checkpoint_max_bytes = DEFAULT_ANALYSE_CHECKPOINT_MAX_BYTES;
+	// If set, and config.dataset_image_root is specified, market data is
+	// replayed from a memory-mapped dataset image of the filtered markets
+	// kept under the image root, keyed by this (typically naming the
+	// strategy, so its predicate) and the version of their data, which
+	// covers the set of markets. The image is built on first use and shared
+	// by subsequent and concurrent runs, taking precedence over loading and
+	// streaming. Building an image evicts those it supersedes, including
+	// the image of the key from before markets were added.
+	std::string dataset_image_key;
+	// If non-zero, the combined throughput of all cores is logged at this
+	// interval while analysing. Cores only publish their progress if so.
+	uint64_t metrics_interval_ms = 0;
+	// If set, a JSON report of the metrics of each core is written here at
+	// the end of the run.
+	std::string metrics_path;
+	// If set, the replay time of each market is split into the time spent
+	// applying updates and that spent in workers, sims and reducers. This
+	// reads the clock around every timeslice so is off by default.
+	bool detailed_metrics = false;
+	// If set, and config.result_cache_root is specified, the market
+	// aggregate state of each market is cached under the root, keyed by
+	// this (typically naming the strategy), result_cache_version, a hash of
+	// the description of each config given by result_cache_config, the
+	// market ID and the version of its data.
+	// Markets with cached results aren't replayed, their results are
+	// merged with the market merger instead, and when sweeping those with
+	// results for every config aren't loaded. The market aggregate state
+	// must be trivially copyable and a market merger must be set.
+	std::string result_cache_key;
+	// Version of the code of the strategy whose results are cached, which
+	// must be changed whenever the results of its configs would, e.g. a
+	// constant bumped with its logic. Must be non-zero to cache results.
+	uint64_t result_cache_version = 0;
+	// Describes the config of each lane when sweeping, or of the first
+	// iteration (0) of a run, e.g. by formatting its parameters. This must
+	// cover everything the results of the config depend on other than the
+	// code and the market, and must be set to cache results.
+	std::function<std::string(uint64_t)> result_cache_config;
+};
+
+// A contiguous range of markets which are analysed together as a node.
+struct analyse_batch
+{
+	uint64_t offset;
+	uint64_t num_markets;
+	uint64_t weight;
+};
+
+// Divide markets with the specified weights into at most num_batches
+// contiguous, non-empty batches of approximately equal total weight.
+auto partition_batches(const std::vector<uint64_t>& weights, uint64_t num_batches)
+	-> std::vector<analyse_batch>;
+
+// Determine the order in which batches should be scheduled - heaviest first so
+// the lightest batches fill in around them at the end of the run.
+auto schedule_batches(const std::vector<analyse_batch>& batches) -> std::vector<uint64_t>;
+
+// Node of batches which weren't loaded up front.
+static constexpr uint64_t NO_BATCH_NODE = ~0UL;
+
+// Write all of the specified bytes to a file descriptor, retrying partial
+// writes. Throws on error.
+void write_fd(int fd, const void* data, uint64_t size);
+
+// Read from a file descriptor until end of file. Throws on error.
+auto read_fd(int fd) -> std::string;
 
 template<typename TWorkerState, typename TMarketAggState, typename TNodeAggState, typename TResult>
 class analyser
@@ -31,6 +165,8 @@ public:
 	using node_reducer_fn_t = std::function<bool(int, const TMarketAggState&, bool,
 						     TNodeAggState&, spdlog::logger*)>;
 	using reducer_fn_t = std::function<TResult(const std::vector<TNodeAggState>&)>;
+	using lane_init_fn_t = std::function<void(uint64_t, TNodeAggState&)>;
+	using market_merge_fn_t = std::function<void(const TMarketAggState&, TMarketAggState&)>;
 
 	analyser(const predicate_fn_t& predicate, const update_worker_fn_t& update_worker,
 		 const market_reducer_fn_t& market_reducer, const node_reducer_fn_t& node_reducer,
@@ -45,15 +181,118 @@ public:
 		  _zero_worker_state{zero_worker_state},
 		  _zero_market_agg_state{zero_market_agg_state},
 		  _zero_node_agg_state{zero_node_agg_state},
-		  _meta_dyn_buf{MAX_ANALYSE_METADATA_BYTES}
+		  _meta_dyn_buf{MAX_ANALYSE_METADATA_BYTES},
+		  _num_lanes{0},
+		  _next_load{0}
 	{
 	}
 
 	// Execute the run against markets. Limit to specified number of cores
 	// or all available if unspecified.
-	auto run(const config& config, int num_cores = -1) -> TResult;
+	auto run(const config& config, int num_cores = -1) -> TResult
+	{
+		return run(config, analyse_options{.num_cores = num_cores});
+	}
+
+	// Execute the run against markets with the specified options.
+	auto run(const config& config, const analyse_options& options) -> TResult
+	{
+		return execute(config, options, 0, nullptr);
+	}
+
+	// Execute a single pass over markets for each of num_lanes lanes, e.g.
+	// one per strategy configuration. Each market is replayed once with
+	// every lane's worker and sim driven from the same market state, which
+	// is equivalent to running one iteration per lane but avoids repeating
+	// the replay.
+	//
+	// Each lane has its own node aggregate state, initialised from the zero
+	// state by lane_init. The node reducer is invoked once per lane after
+	// the pass and its return value is ignored. The reducer is passed the
+	// node aggregate of every lane of every batch.
+	auto sweep(const config& config, uint64_t num_lanes, const lane_init_fn_t& lane_init,
+		   const analyse_options& options = {}) -> TResult
+	{
+		if (num_lanes == 0)
+			throw std::runtime_error("Can't sweep 0 lanes!");
+
+		return execute(config, options, num_lanes, lane_init);
+	}
+
+	// Set the function used when caching results to merge the market
+	// aggregate state of a single market, reduced from the zero state, into
+	// the market aggregate state of all markets before it.
+	void set_market_merger(const market_merge_fn_t& market_merger)
+	{
+		_market_merger = market_merger;
+	}
+
+	// Get the metrics of each core from the last run.
+	auto metrics() const -> const std::vector<core_metrics>&
+	{
+		return _metrics;
+	}
 
 private:
+	// A node aggregate being built up by replaying markets.
+	struct lane
+	{
+		TNodeAggState* node_agg_state;
+		TMarketAggState market_agg_state;
+		bool market_agg_aborted;
+		// Index of the config within the run whose results the lane's
+		// are cached as, or UNCACHED_CONFIG_INDEX if they depend on more
+		// than the config.
+		uint64_t config_index;
+	};
+
+	// The result of replaying a market with a config, as kept in the result
+	// cache.
+	struct cached_result
+	{
+		// Hash of the description of the config.
+		uint64_t config_hash;
+		uint64_t market_agg_aborted;
+		TMarketAggState market_agg_state;
+	};
+
+	// The cached results of a market, indexed by config index.
+	struct market_results
+	{
+		uint64_t data_version;
+		std::vector<std::optional<cached_result>> results;
+		// Raw results for configs outside this run, kept so they're
+		// written back with the rest.
+		std::string other_results;
+		// Whether there are results for every config of the run, in which
+		// case a sweep needn't load the market.
+		bool complete;
+		// Whether results have been read, and whether results have been
+		// added since.
+		bool read;
+		bool dirty;
+	};
+
+	// The state of a market part way through its replay, saved so that
+	// subsequent replays can resume from it.
+	struct replay_checkpoint
+	{
+		// Timestamp at or after which the checkpoint is saved.
+		uint64_t timestamp;
+		// Whether the checkpoint has been attempted - the market may
+		// not have reached the checkpoint cleanly.
+		bool attempted;
+		// Position of the timestamp update at which the checkpoint was
+		// saved, replay resumes from here.
+		uint64_t pos;
+		// Checkpoints of the universe and of a sim, along with the worker
+		// state, before workers were invoked with the market in the
+		// checkpointed state.
+		std::optional<dynamic_buffer> buf;
+		std::optional<dynamic_buffer> sim_buf;
+		std::optional<TWorkerState> worker_state;
+	};
+
 	const predicate_fn_t _predicate;
 	const update_worker_fn_t _update_worker;
 	const market_reducer_fn_t _market_reducer;
@@ -62,12 +301,174 @@ private:
 	const TWorkerState _zero_worker_state;
 	const TMarketAggState _zero_market_agg_state;
 	const TNodeAggState _zero_node_agg_state;
+	market_merge_fn_t _market_merger;
 
 	dynamic_buffer _meta_dyn_buf;
 	std::vector<meta_view> _meta_views;
+	// Replay cost of each filtered market.
+	std::vector<uint64_t> _weights;
+	// Version of the update data of each filtered market if a dataset image
+	// or the result cache is in use, otherwise empty.
+	std::vector<uint64_t> _data_versions;
+	// Replay checkpoints of each filtered market, empty if disabled. Each
+	// market is only ever replayed by the core analysing its batch.
+	std::vector<replay_checkpoint> _checkpoints;
+	// Maximum and current number of bytes of checkpoints held by each core.
+	uint64_t _checkpoint_max_bytes;
+	std::vector<uint64_t> _checkpoint_bytes;
+	// The result cache if in use, along with the cached results of each
+	// filtered market, otherwise empty. As with checkpoints, each market's
+	// results are only accessed by the core analysing its batch.
+	std::optional<result_cache> _result_cache;
+	std::vector<market_results> _results;
+	// Hashes of the description of each config of the run when caching
+	// results, and the index of each.
+	std::vector<uint64_t> _config_hashes;
+	std::unordered_map<uint64_t, uint64_t> _config_indexes;
+
+	// Cores are pinned to CPUs spread across the NUMA nodes of the
+	// machine.
+	cpu_topology _topology;
+	std::vector<worker_placement> _placements;
+	// Sim bet pools of each lane of each core, reused by the sims of
+	// successive markets.
+	std::vector<std::deque<sim_bet_pool>> _bet_pools;
+	// Metrics of each core, along with the throughput published by each
+	// core as it goes for logging progress.
+	std::vector<core_metrics> _metrics;
+	std::unique_ptr<seqlock<core_progress>[]> _progress;
+	// Whether replay time is split and whether progress is published, per
+	// analyse_options.
+	bool _detailed_metrics;
+	bool _publish_progress;
+
+	// Batches are claimed dynamically by cores, first to load them (unless
+	// streaming or replaying from a dataset image) then to analyse them in
+	// the order given by _schedule, preferring those loaded on their node.
+	std::vector<analyse_batch> _batches;
+	std::vector<uint64_t> _schedule;
+	std::vector<std::vector<dynamic_buffer>> _batch_bufs;
+	// Index in _topology of the node each batch was loaded on, or
+	// NO_BATCH_NODE if not loaded up front.
+	std::vector<uint64_t> _batch_nodes;
+	std::unique_ptr<std::atomic<bool>[]> _batch_claimed;
+	// The dataset image replayed from if in use, in which case batches
+	// aren't loaded.
+	std::unique_ptr<dataset_image> _image;
+	// Node aggregate states of each batch, or each lane of each batch if
+	// sweeping.
+	std::vector<TNodeAggState> _node_aggs;
+	// Number of lanes being swept, 0 if iterating.
+	uint64_t _num_lanes;
+	std::atomic<uint64_t> _next_load;
+	// The error which caused each core to abort its batch, if any, in
+	// which case the node aggregate states are incomplete and the run
+	// fails. Once any core has failed the others stop claiming batches.
+	std::vector<std::exception_ptr> _core_errors;
+	std::atomic<bool> _failed;
+
+	auto execute(const config& config, const analyse_options& options, uint64_t num_lanes,
+		     const lane_init_fn_t& lane_init) -> TResult;
+
+	// Read the stats of each market and apply the predicate across
+	// num_threads threads, storing the markets which pass in _meta_views in
+	// their original order, along with their data versions if requested.
+	// Returns the number of markets missing stats.
+	auto filter_markets(const config& config, const std::vector<meta_view>& metas,
+			    uint64_t num_threads, bool data_versions) -> uint64_t;
+
+	void thread_fn(const config& config, const analyse_options& options, int core,
+		       oneshot_channel<bool>& load_chan, oneshot_channel<bool>& start_chan);
+
+	// Run cores [first_core, first_core + num_cores) over all unclaimed
+	// batches, loading their data then analysing them. Throws if any core
+	// fails to load or analyse a batch.
+	void run_cores(const config& config, const analyse_options& options, uint64_t first_core,
+		       uint64_t num_cores);
+
+	// Shard batches across num_processes forked worker processes, sharing
+	// num_cores cores between them, and collect the node aggregate states
+	// of each. Throws if any process fails.
+	void run_processes(const config& config, const analyse_options& options,
+			   uint64_t num_processes, uint64_t num_cores);
+
+	// Analyse the specified batches in a forked worker process using cores
+	// [first_core, first_core + num_cores), writing their node aggregate
+	// states to fd. Returns the exit status of the process.
+	auto run_shard(const config& config, const analyse_options& options,
+		       const std::vector<uint64_t>& shard, uint64_t first_core,
+		       uint64_t num_cores, int fd) -> int;
+
+	// Get the number of node aggregate states held per batch.
+	auto lanes_per_batch() const -> uint64_t
+	{
+		return _num_lanes == 0 ? 1 : _num_lanes;
+	}
+
+	// Claim the next unclaimed batch in schedule order, preferring those
+	// loaded on the specified node. local_pos and global_pos track the
+	// caller's progress through the schedule and must start at 0. Returns
+	// false if there are none left.
+	auto claim_batch(uint64_t node, uint64_t& local_pos, uint64_t& global_pos,
+			 uint64_t& batch) -> bool;
+
+	// Run all iterations, or sweep all lanes, over the markets in the
+	// specified batch, storing node aggregate states in _node_aggs.
+	void run_batch(const config& config, const analyse_options& options, int core,
+		       uint64_t batch, betfair::universe<1>& universe, spdlog::logger* logger);
+
+	// Read the cached results of the markets in the specified batch unless
+	// already read.
+	void read_results(uint64_t batch);
+
+	// Whether the data of the index-th market is needed, i.e. it isn't
+	// merged from the result cache in every pass. Only sweeps merge every
+	// pass, later iterations of a run depend on more than the config.
+	auto needs_data(uint64_t index) const -> bool
+	{
+		return !_result_cache || _num_lanes == 0 || !_results[index].complete;
+	}
+
+	// Write the results added to the cache for the markets in the specified
+	// batch, logging rather than throwing on error.
+	void write_results(uint64_t batch, spdlog::logger* logger);
+
+	// If every lane yet to abort has a cached result for the index-th
+	// market, merge them into the lanes and return true.
+	auto merge_cached(int core, uint64_t index, std::span<lane> lanes) -> bool;
+
+	// Replay each market in the specified batch in turn, from the dataset
+	// image or prefetcher if in use, reducing the results into each lane's market aggregate
+	// state. Stops early if the market reducer aborts in all lanes.
+	void replay_markets(int core, uint64_t batch, market_prefetcher* prefetcher,
+			    betfair::universe<1>& universe, std::span<lane> lanes,
+			    spdlog::logger* logger);
+
+	// Replay the updates of the index-th market, driving the worker of
+	// each lane whose market reducer hasn't aborted and reducing the result
+	// into its market aggregate state. Adds the time spent applying updates
+	// to the core's metrics and returns the number of updates applied.
+	auto replay_market(int core, uint64_t index, std::span<const update> updates,
+			   betfair::universe<1>& universe, std::span<lane> lanes,
+			   spdlog::logger* logger) -> uint64_t;
+
+	// Replay the index-th market as replay_market() does, recording the
+	// replay in the core's metrics and publishing its progress.
+	void replay_timed(int core, uint64_t index, std::span<const update> updates,
+			  betfair::universe<1>& universe, std::span<lane> lanes,
+			  spdlog::logger* logger);
+
+	// Replay the index-th market as replay_timed() does. When caching
+	// results, each lane is instead reduced from the zero market aggregate
+	// state, and the result cached before being merged into the lane.
+	void replay_cached(int core, uint64_t index, std::span<const update> updates,
+			   betfair::universe<1>& universe, std::span<lane> lanes,
+			   spdlog::logger* logger);
 
-	void thread_fn(const config& config, int core, channel<bool>& load_chan,
-		       channel<TNodeAggState>& result_chan, uint64_t offset, uint64_t num_markets);
+	// Log the combined throughput of cores [first_core, first_core +
+	// num_cores) every interval_ms until stop_chan is sent to.
+	void monitor_fn(uint64_t interval_ms, uint64_t first_core, uint64_t num_cores,
+			oneshot_channel<bool>& stop_chan);
 };
 } // namespace janus
 
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "spdlog/spdlog.h"
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace janus
+{
+static constexpr uint64_t NS_PER_US = 1000;
+static constexpr uint64_t NS_PER_MS = NS_PER_US * 1000;
+static constexpr uint64_t NS_PER_SEC = NS_PER_MS * 1000;
+
+// Number of buckets market replay times are counted in. Bucket 0 holds
+// replays taking less than 1us, bucket i those taking [2^(i-1), 2^i)us and
+// the last bucket everything slower.
+static constexpr uint64_t NUM_REPLAY_TIME_BUCKETS = 28;
+// Number of slowest markets tracked by each core and reported.
+static constexpr uint64_t NUM_SLOWEST_MARKETS = 10;
+
+// The time taken by the slowest replay of a market.
+struct market_replay_time
+{
+	uint64_t market_id;
+	uint64_t ns;
+};
+
+// Throughput counters published by each analyser core as it goes, for
+// reporting progress while a run is underway.
+struct core_progress
+{
+	uint64_t num_replays;
+	uint64_t num_updates;
+};
+
+// Metrics collected by a single analyser core over a run. Times are in
+// nanoseconds. Trivially copyable so they can be returned from worker
+// processes.
+struct alignas(64) core_metrics // NOLINT: Not magical, cache line size.
+{
+	uint64_t num_batches;
+	// Number of markets replayed, counting each iteration or sweep pass.
+	uint64_t num_replays;
+	// Number of markets whose cached results were merged rather than
+	// replayed, counting each iteration or sweep pass.
+	uint64_t num_cached;
+	uint64_t num_updates;
+	// Time spent analysing batches, from start to finish.
+	uint64_t run_ns;
+	// Time spent reading market data from disk or, when streaming, waiting
+	// for the prefetcher to deliver it.
+	uint64_t load_ns;
+	// Time spent decompressing market data loaded up front. When streaming
+	// this happens on loader threads and is included in load_ns if they
+	// fall behind.
+	uint64_t decompress_ns;
+	// Time spent replaying markets.
+	uint64_t replay_ns;
+	// Time spent applying updates to the universe and that spent in
+	// workers, sims and reducers, making up the replay time. Only measured
+	// if detailed metrics are enabled, otherwise 0.
+	uint64_t apply_ns;
+	uint64_t callback_ns;
+	// Number of replays falling into each replay time bucket.
+	std::array<uint64_t, NUM_REPLAY_TIME_BUCKETS> replay_time_buckets;
+	// The slowest markets replayed, slowest first.
+	std::array<market_replay_time, NUM_SLOWEST_MARKETS> slowest;
+	uint64_t num_slowest;
+
+	// Record the replay of a market.
+	void add_replay(uint64_t market_id, uint64_t num_updates, uint64_t ns);
+
+	// Add the counts, times and slowest markets of another core's metrics
+	// to our own. Cores run concurrently so the combined run time is the
+	// longest of the two, giving the combined throughput.
+	void merge(const core_metrics& other);
+};
+
+// Get the replay time bucket the specified time in nanoseconds falls into.
+auto get_replay_time_bucket(uint64_t ns) -> uint64_t;
+
+// Log the throughput and the split of time of the specified metrics, prefixed
+// by name.
+void log_core_metrics(spdlog::logger* logger, const std::string& name,
+		      const core_metrics& metrics);
+
+// Log the slowest markets of the specified metrics.
+void log_slowest_markets(spdlog::logger* logger, const core_metrics& metrics);
+
+// Format the metrics of each core along with their totals as a JSON report.
+auto format_metrics_json(const std::vector<core_metrics>& cores) -> std::string;
+
+// Write a JSON report of the metrics of each core to the specified path,
+// throwing on error.
+void write_metrics_json(const std::string& path, const std::vector<core_metrics>& cores);
+} // namespace janus
@@ -0,0 +1,286 @@
+#pragma once
+
+#include "price_range.hh"
+#include "runner.hh"
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace janus::betfair
+{
+// A cache of the top of each runner's book in a market, held as contiguous
+// per-runner arrays (structure of arrays) so that strategies scanning every
+// runner at every timestamp touch a few cache lines rather than each runner's
+// ladder. The arrays are sized to the number of runners, of which there can be
+// at most MaxRunners. A running back and lay overround and a favourite ranking
+// are maintained incrementally as runners are updated.
+//
+// Sides without unmatched volume have a price index of INVALID_PRICE_INDEX and
+// a volume of 0.
+template<uint64_t MaxRunners>
+class book_cache
+{
+public:
+	book_cache() : _num_runners{0}, _back_overround{0}, _lay_overround{0} {}
+
+	// Get the number of runners in the cache.
+	auto num_runners() const -> uint64_t
+	{
+		return _num_runners;
+	}
+
+	// Get the price index of the best price to back the i-th runner at,
+	// i.e. its maximum ATB price index.
+	auto back_index(uint64_t i) const -> uint64_t
+	{
+		return _atb_indexes[i];
+	}
+
+	// Get the volume available at the best price to back the i-th runner at.
+	auto back_vol(uint64_t i) const -> double
+	{
+		return _atb_vols[i];
+	}
+
+	// Get the price index of the best price to lay the i-th runner at, i.e.
+	// its minimum ATL price index.
+	auto lay_index(uint64_t i) const -> uint64_t
+	{
+		return _atl_indexes[i];
+	}
+
+	// Get the volume available at the best price to lay the i-th runner at.
+	auto lay_vol(uint64_t i) const -> double
+	{
+		return _atl_vols[i];
+	}
+
+	// Get the LTP price index of the i-th runner.
+	auto ltp(uint64_t i) const -> uint64_t
+	{
+		return _ltps[i];
+	}
+
+	// Get the state of the i-th runner.
+	auto state(uint64_t i) const -> runner_state
+	{
+		return _states[i];
+	}
+
+	// Get the best back price indexes of all runners.
+	auto back_indexes() const -> std::span<const uint64_t>
+	{
+		return _atb_indexes;
+	}
+
+	// Get the best back volumes of all runners.
+	auto back_vols() const -> std::span<const double>
+	{
+		return _atb_vols;
+	}
+
+	// Get the best lay price indexes of all runners.
+	auto lay_indexes() const -> std::span<const uint64_t>
+	{
+		return _atl_indexes;
+	}
+
+	// Get the best lay volumes of all runners.
+	auto lay_vols() const -> std::span<const double>
+	{
+		return _atl_vols;
+	}
+
+	// Get the LTP price indexes of all runners.
+	auto ltps() const -> std::span<const uint64_t>
+	{
+		return _ltps;
+	}
+
+	// Get the states of all runners.
+	auto states() const -> std::span<const runner_state>
+	{
+		return _states;
+	}
+
+	// Get the back overround - the sum of implied probabilities of the best
+	// back prices of active runners, e.g. 1.02 for a 102% book.
+	auto back_overround() const -> double
+	{
+		return _back_overround;
+	}
+
+	// Get the lay overround - the sum of implied probabilities of the best
+	// lay prices of active runners.
+	auto lay_overround() const -> double
+	{
+		return _lay_overround;
+	}
+
+	// Get the index of the n-th favourite runner, 0 being the favourite.
+	// Runners are ranked by best back price, with ties and runners which
+	// are not active or have no back price ordered by runner index after
+	// those that do. n must be less than num_runners().
+	auto favourite(uint64_t n = 0) const -> uint64_t
+	{
+		return _ranking[n];
+	}
+
+	// Get the rank of the i-th runner, 0 being the favourite.
+	auto rank(uint64_t i) const -> uint64_t
+	{
+		return _rank_of[i];
+	}
+
+	// Reserve space for the specified number of runners so they can be
+	// added without reallocating.
+	void reserve(uint64_t num_runners)
+	{
+		_atb_indexes.reserve(num_runners);
+		_atb_vols.reserve(num_runners);
+		_atl_indexes.reserve(num_runners);
+		_atl_vols.reserve(num_runners);
+		_ltps.reserve(num_runners);
+		_states.reserve(num_runners);
+		_back_inverse.reserve(num_runners);
+		_lay_inverse.reserve(num_runners);
+		_ranking.reserve(num_runners);
+		_rank_of.reserve(num_runners);
+	}
+
+	// Add the specified runner as the i-th runner, which must equal
+	// num_runners().
+	void add_runner(uint64_t i, const runner& runner)
+	{
+		_num_runners = i + 1;
+		_atb_indexes.push_back(INVALID_PRICE_INDEX);
+		_atb_vols.push_back(0);
+		_atl_indexes.push_back(INVALID_PRICE_INDEX);
+		_atl_vols.push_back(0);
+		_ltps.push_back(0);
+		_states.push_back(runner_state::ACTIVE);
+		_back_inverse.push_back(0);
+		_lay_inverse.push_back(0);
+		_ranking.push_back(i);
+		_rank_of.push_back(i);
+
+		update(i, runner);
+	}
+
+	// Update the cached state of the i-th runner from the specified runner.
+	void update(uint64_t i, const runner& runner)
+	{
+		const ladder& ladder = runner.ladder();
+		bool active = runner.state() == runner_state::ACTIVE;
+
+		uint64_t atb_index = ladder.max_atb_index();
+		double atb_vol = -ladder.unmatched(atb_index);
+		if (atb_vol <= 0) {
+			atb_index = INVALID_PRICE_INDEX;
+			atb_vol = 0;
+		}
+
+		uint64_t atl_index = ladder.min_atl_index();
+		double atl_vol = ladder.unmatched(atl_index);
+		if (atl_vol <= 0) {
+			atl_index = INVALID_PRICE_INDEX;
+			atl_vol = 0;
+		}
+
+		_atb_indexes[i] = atb_index;
+		_atb_vols[i] = atb_vol;
+		_atl_indexes[i] = atl_index;
+		_atl_vols[i] = atl_vol;
+		_ltps[i] = runner.ltp();
+		_states[i] = runner.state();
+
+		double back_inverse = active ? inverse(atb_index) : 0;
+		_back_overround += back_inverse - _back_inverse[i];
+		_back_inverse[i] = back_inverse;
+
+		double lay_inverse = active ? inverse(atl_index) : 0;
+		_lay_overround += lay_inverse - _lay_inverse[i];
+		_lay_inverse[i] = lay_inverse;
+
+		rerank(i);
+	}
+
+	// Recalculate the overrounds from scratch, discarding any floating
+	// point error accumulated by incremental updates.
+	void resum()
+	{
+		_back_overround = 0;
+		_lay_overround = 0;
+		for (uint64_t i = 0; i < _num_runners; i++) {
+			_back_overround += _back_inverse[i];
+			_lay_overround += _lay_inverse[i];
+		}
+	}
+
+private:
+	uint64_t _num_runners;
+	double _back_overround;
+	double _lay_overround;
+
+	std::vector<uint64_t> _atb_indexes;
+	std::vector<double> _atb_vols;
+	std::vector<uint64_t> _atl_indexes;
+	std::vector<double> _atl_vols;
+	std::vector<uint64_t> _ltps;
+	std::vector<runner_state> _states;
+
+	// Implied probability contributed by each runner to each overround.
+	std::vector<double> _back_inverse;
+	std::vector<double> _lay_inverse;
+
+	// Runner indexes in order of rank and the rank of each runner index.
+	std::vector<uint64_t> _ranking;
+	std::vector<uint64_t> _rank_of;
+
+	// Get the implied probability of the specified price index, or 0 if
+	// invalid.
+	static auto inverse(uint64_t price_index) -> double
+	{
+		if (price_index == INVALID_PRICE_INDEX)
+			return 0;
+
+		return 1. / price_range::index_to_price(price_index);
+	}
+
+	// Get the key the i-th runner is ranked by, lower keys ranking first.
+	// The runner index breaks ties so the ranking is a strict ordering.
+	auto rank_key(uint64_t i) const -> uint64_t
+	{
+		uint64_t price_index = _atb_indexes[i];
+		if (_states[i] != runner_state::ACTIVE || price_index == INVALID_PRICE_INDEX)
+			price_index = NUM_PRICES;
+
+		return price_index * MaxRunners + i;
+	}
+
+	// Move the i-th runner to its correct position in the ranking. Prices
+	// typically move by a few places at a time so an insertion step is
+	// cheaper than re-sorting.
+	void rerank(uint64_t i)
+	{
+		uint64_t key = rank_key(i);
+		uint64_t pos = _rank_of[i];
+
+		while (pos > 0 && rank_key(_ranking[pos - 1]) > key) {
+			_ranking[pos] = _ranking[pos - 1];
+			_rank_of[_ranking[pos]] = pos;
+			pos--;
+		}
+
+		while (pos + 1 < _num_runners && rank_key(_ranking[pos + 1]) < key) {
+			_ranking[pos] = _ranking[pos + 1];
+			_rank_of[_ranking[pos]] = pos;
+			pos++;
+		}
+
+		_ranking[pos] = i;
+		_rank_of[i] = pos;
+	}
+};
+} // namespace janus::betfair
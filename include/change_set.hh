@@ -0,0 +1,269 @@
+#pragma once
+
+#include "price_range.hh"
+
+#include <bit>
+#include <cstdint>
+#include <vector>
+
+namespace janus::betfair
+{
+// A range of price indexes [min, max], empty if min > max.
+struct index_range
+{
+	uint64_t min;
+	uint64_t max;
+
+	// Does the range contain no price indexes?
+	auto empty() const -> bool
+	{
+		return min > max;
+	}
+
+	// Does the range contain the specified price index?
+	auto contains(uint64_t price_index) const -> bool
+	{
+		return price_index >= min && price_index <= max;
+	}
+
+	// Extend the range to include the specified price index.
+	void extend(uint64_t price_index)
+	{
+		if (price_index < min)
+			min = price_index;
+		if (price_index > max)
+			max = price_index;
+	}
+
+	// Extend the range to include the specified range.
+	void extend(const index_range& range)
+	{
+		if (range.empty())
+			return;
+
+		extend(range.min);
+		extend(range.max);
+	}
+};
+
+// Empty price index range.
+static constexpr index_range EMPTY_INDEX_RANGE = {.min = NUM_PRICES, .max = 0};
+// Price index range containing every price.
+static constexpr index_range FULL_INDEX_RANGE = {.min = 0, .max = NUM_PRICES - 1};
+
+// Records what changed in a market at a specific timestamp: whether
+// market-level state changed, which runners changed and which price index
+// ranges on each side of their ladders changed. This allows consumers to do
+// work proportional to the changes rather than to the size of the market.
+//
+// The change set is reset lazily when a change is recorded at a different
+// timestamp, so if timestamp() is prior to the market's last timestamp then
+// nothing has changed since. Per-runner ranges are held for each runner added,
+// of which there can be at most MaxRunners.
+template<uint64_t MaxRunners>
+class change_set
+{
+	// Changed runners are recorded in a bitmask.
+	static_assert(MaxRunners <= 64, "change_set supports at most 64 runners");
+
+public:
+	change_set() : _timestamp{0}, _market_changed{false}, _runner_mask{0} {}
+
+	// Get the timestamp at which the changes were applied.
+	auto timestamp() const -> uint64_t
+	{
+		return _timestamp;
+	}
+
+	// Did market-level state (e.g. state, inplay, traded volume) change?
+	auto market_changed() const -> bool
+	{
+		return _market_changed;
+	}
+
+	// Get mask of changed runners, bit i set if the i-th runner changed.
+	auto runner_mask() const -> uint64_t
+	{
+		return _runner_mask;
+	}
+
+	// Did the i-th runner change?
+	auto runner_changed(uint64_t i) const -> bool
+	{
+		return (_runner_mask & (1UL << i)) != 0;
+	}
+
+	// Get the number of runners which changed.
+	auto num_changed_runners() const -> uint64_t
+	{
+		return std::popcount(_runner_mask);
+	}
+
+	// Invoke fn(i) for the index of each changed runner in ascending order.
+	template<typename Fn>
+	void for_each_changed_runner(Fn fn) const
+	{
+		for (uint64_t mask = _runner_mask; mask != 0; mask &= mask - 1) {
+			fn(static_cast<uint64_t>(std::countr_zero(mask)));
+		}
+	}
+
+	// Get the range of ATL (back) unmatched price indexes which changed for
+	// the i-th runner. Only valid if the runner changed.
+	auto atl_range(uint64_t i) const -> index_range
+	{
+		return _atl_ranges[i];
+	}
+
+	// Get the range of ATB (lay) unmatched price indexes which changed for
+	// the i-th runner. Only valid if the runner changed.
+	auto atb_range(uint64_t i) const -> index_range
+	{
+		return _atb_ranges[i];
+	}
+
+	// Get the range of matched price indexes which changed for the i-th
+	// runner. Only valid if the runner changed.
+	auto matched_range(uint64_t i) const -> index_range
+	{
+		return _matched_ranges[i];
+	}
+
+	// Reserve space for the specified number of runners so they can be
+	// added without reallocating.
+	void reserve(uint64_t num_runners)
+	{
+		_atl_ranges.reserve(num_runners);
+		_atb_ranges.reserve(num_runners);
+		_matched_ranges.reserve(num_runners);
+	}
+
+	// Add the i-th runner, which must equal the number of runners already
+	// added, so that changes to it can be recorded.
+	void add_runner(uint64_t i)
+	{
+		_atl_ranges.resize(i + 1, EMPTY_INDEX_RANGE);
+		_atb_ranges.resize(i + 1, EMPTY_INDEX_RANGE);
+		_matched_ranges.resize(i + 1, EMPTY_INDEX_RANGE);
+	}
+
+	// Record a change to market-level state.
+	void mark_market(uint64_t timestamp)
+	{
+		refresh(timestamp);
+		_market_changed = true;
+	}
+
+	// Record a change to the i-th runner which doesn't affect its ladder.
+	void mark_runner(uint64_t timestamp, uint64_t i)
+	{
+		refresh(timestamp);
+		refresh_runner(i);
+	}
+
+	// Record a change to the i-th runner's unmatched volume at the
+	// specified price index on the ATL side if atl is true, otherwise ATB.
+	void mark_unmatched(uint64_t timestamp, uint64_t i, uint64_t price_index, bool atl)
+	{
+		refresh(timestamp);
+		refresh_runner(i);
+
+		if (atl)
+			_atl_ranges[i].extend(price_index);
+		else
+			_atb_ranges[i].extend(price_index);
+	}
+
+	// Record a change to the i-th runner's unmatched volume over the
+	// specified range of price indexes on the ATL side if atl is true,
+	// otherwise ATB.
+	void mark_unmatched_range(uint64_t timestamp, uint64_t i, const index_range& range,
+				  bool atl)
+	{
+		refresh(timestamp);
+		refresh_runner(i);
+
+		if (atl)
+			_atl_ranges[i].extend(range);
+		else
+			_atb_ranges[i].extend(range);
+	}
+
+	// Record a change to all of the i-th runner's unmatched volume.
+	void mark_all_unmatched(uint64_t timestamp, uint64_t i)
+	{
+		refresh(timestamp);
+		refresh_runner(i);
+
+		_atl_ranges[i] = FULL_INDEX_RANGE;
+		_atb_ranges[i] = FULL_INDEX_RANGE;
+	}
+
+	// Record a change to the i-th runner's matched volume at the specified
+	// price index.
+	void mark_matched(uint64_t timestamp, uint64_t i, uint64_t price_index)
+	{
+		refresh(timestamp);
+		refresh_runner(i);
+
+		_matched_ranges[i].extend(price_index);
+	}
+
+	// Record a change to the entire market, e.g. it being cleared.
+	void mark_all(uint64_t timestamp, uint64_t num_runners)
+	{
+		refresh(timestamp);
+		_market_changed = true;
+
+		for (uint64_t i = 0; i < num_runners; i++) {
+			_atl_ranges[i] = FULL_INDEX_RANGE;
+			_atb_ranges[i] = FULL_INDEX_RANGE;
+			_matched_ranges[i] = FULL_INDEX_RANGE;
+		}
+		_runner_mask = num_runners == 64 ? ~0UL : (1UL << num_runners) - 1;
+	}
+
+	// Discard all recorded changes.
+	void clear()
+	{
+		_timestamp = 0;
+		_market_changed = false;
+		_runner_mask = 0;
+	}
+
+private:
+	uint64_t _timestamp;
+	bool _market_changed;
+	uint64_t _runner_mask;
+	// Per-runner ranges are only valid if the runner's mask bit is set, so
+	// they don't need resetting along with the mask.
+	std::vector<index_range> _atl_ranges;
+	std::vector<index_range> _atb_ranges;
+	std::vector<index_range> _matched_ranges;
+
+	// If the change is at a new timestamp, discard previous changes.
+	void refresh(uint64_t timestamp)
+	{
+		if (timestamp == _timestamp)
+			return;
+
+		_timestamp = timestamp;
+		_market_changed = false;
+		_runner_mask = 0;
+	}
+
+	// If this is the first change to the i-th runner at this timestamp,
+	// mark it changed and reset its ranges.
+	void refresh_runner(uint64_t i)
+	{
+		uint64_t bit = 1UL << i;
+		if ((_runner_mask & bit) != 0)
+			return;
+
+		_runner_mask |= bit;
+		_atl_ranges[i] = EMPTY_INDEX_RANGE;
+		_atb_ranges[i] = EMPTY_INDEX_RANGE;
+		_matched_ranges[i] = EMPTY_INDEX_RANGE;
+	}
+};
+} // namespace janus::betfair
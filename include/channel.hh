@@ -2,39 +2,98 @@
 
 #include <atomic>
 #include <condition_variable>
+#include <cstdint>
 #include <mutex>
+#include <utility>
 
 namespace janus
 {
+// A rendezvous channel between threads, each value sent is received exactly
+// once and send() returns only once its value has been received. Can be used
+// repeatedly.
 template<typename T>
 class channel
 {
 public:
-	channel() : _val{}, _acked{false} {}
+	channel() : _val{}, _full{false} {}
 
 	void send(T val)
 	{
-		do {
-			std::unique_lock<std::mutex> lock(_mutex);
-			_val = val;
-			lock.unlock();
-			_cond_var.notify_one();
-		} while (!_acked.load());
-		_acked.store(false);
+		std::unique_lock<std::mutex> lock(_mutex);
+		// Wait for any previous value to be taken.
+		_cond_var.wait(lock, [&] { return !_full; });
+		_val = std::move(val);
+		_full = true;
+		_cond_var.notify_all();
+
+		// Then for the receiver to take ours.
+		_cond_var.wait(lock, [&] { return !_full; });
 	}
 
 	auto receive() -> T
 	{
 		std::unique_lock<std::mutex> lock(_mutex);
-		_cond_var.wait(lock);
-		_acked.store(true);
-		return _val;
+		// The predicate is checked before waiting so a value sent before
+		// we got here isn't missed.
+		_cond_var.wait(lock, [&] { return _full; });
+		T ret = std::move(_val);
+		_full = false;
+		lock.unlock();
+		_cond_var.notify_all();
+		return ret;
 	}
 
 private:
 	std::mutex _mutex;
 	std::condition_variable _cond_var;
 	T _val;
-	std::atomic<bool> _acked;
+	bool _full;
+};
+
+// A channel which carries a single value from one thread to another. Sending
+// never blocks, receiving blocks until the value is sent without consuming
+// CPU.
+template<typename T>
+class oneshot_channel
+{
+public:
+	oneshot_channel() : _val{}, _state{EMPTY} {}
+
+	oneshot_channel(const oneshot_channel&) = delete;
+	oneshot_channel(oneshot_channel&&) = delete;
+	auto operator=(const oneshot_channel&) -> oneshot_channel& = delete;
+	auto operator=(oneshot_channel&&) -> oneshot_channel& = delete;
+	~oneshot_channel() = default;
+
+	// Send the value. Must only be called once.
+	void send(T val)
+	{
+		_val = std::move(val);
+		_state.store(SENT, std::memory_order_release);
+		_state.notify_one();
+	}
+
+	// Determine whether the value has been sent.
+	auto ready() const -> bool
+	{
+		return _state.load(std::memory_order_acquire) == SENT;
+	}
+
+	// Wait for the value to be sent and receive it. Must only be called
+	// once.
+	auto receive() -> T
+	{
+		while (_state.load(std::memory_order_acquire) != SENT) {
+			_state.wait(EMPTY, std::memory_order_acquire);
+		}
+		return std::move(_val);
+	}
+
+private:
+	static constexpr uint32_t EMPTY = 0;
+	static constexpr uint32_t SENT = 1;
+
+	T _val;
+	std::atomic<uint32_t> _state;
 };
 } // namespace janus
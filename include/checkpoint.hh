@@ -0,0 +1,17 @@
+#pragma once
+
+#include "dynamic_buffer.hh"
+
+#include <string>
+
+namespace janus
+{
+// Write checkpoint data contained in the specified dynamic buffer to a file. The
+// data is first written to a temporary file which is then renamed over the
+// path so an existing checkpoint is never left partially written.
+void write_checkpoint_file(const std::string& path, const dynamic_buffer& dyn_buf);
+
+// Read checkpoint data from a file into a dynamic buffer which has capacity
+// equal to the size of the file.
+auto read_checkpoint_file(const std::string& path) -> dynamic_buffer;
+} // namespace janus
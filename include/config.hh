@@ -1,11 +1,15 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 
 namespace janus
 {
 // Default location of configuration file (relative to home directory).
 static constexpr const char* DEFAULT_CONFIG_PATH = ".janus/config.json";
+// Default period after a market closes before jupiter evicts it from its
+// universe, in ms. A value of 0 disables eviction.
+static constexpr uint64_t DEFAULT_MARKET_EVICT_GRACE_MS = 10 * 60 * 1000;
 
 // Represents configuration settings.
 // We tolerate allocations here because this will only be read once.
@@ -20,6 +24,14 @@ struct config
 	std::string market_stream_data_filter_json;
 	std::string json_data_root;
 	std::string binary_data_root;
+	// Optional, defaults to DEFAULT_MARKET_EVICT_GRACE_MS if not specified.
+	uint64_t market_evict_grace_ms;
+	// Optional, directory in which dataset images are kept. Empty if not
+	// specified in which case images aren't used.
+	std::string dataset_image_root;
+	// Optional, directory in which the per-market results of analyses are
+	// cached. Empty if not specified in which case results aren't cached.
+	std::string result_cache_root;
 };
 
 namespace internal
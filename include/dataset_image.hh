@@ -0,0 +1,171 @@
+#pragma once
+
+#include "config.hh"
+#include "update.hh"
+
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace janus
+{
+// Identifies a file as a dataset image.
+static constexpr uint64_t DATASET_IMAGE_MAGIC = 0x4547414d494e414a; // "JANIMAGE"
+// Version of the dataset image file format, incremented on incompatible
+// changes so that stale images are rebuilt.
+static constexpr uint64_t DATASET_IMAGE_FORMAT_VERSION = 1;
+// Period after which images which haven't been opened are evicted when another
+// image is built, in ms.
+static constexpr uint64_t DATASET_IMAGE_MAX_IDLE_MS = 7 * 24 * 60 * 60 * 1000UL;
+
+// The header of a dataset image file, followed by an index entry per market
+// then the update data of each market in turn.
+struct dataset_image_header
+{
+	uint64_t magic;
+	uint64_t format_version;
+	uint64_t key_hash;
+	uint64_t data_version;
+	uint64_t num_markets;
+};
+
+// The location of a market's updates within a dataset image.
+struct dataset_image_entry
+{
+	uint64_t market_id;
+	// Offset of the first update in bytes from the start of the file.
+	uint64_t offset;
+	uint64_t num_updates;
+};
+
+// Hash a dataset key, e.g. one identifying the predicate used to filter the
+// markets in a dataset.
+auto hash_dataset_key(const std::string& key) -> uint64_t;
+
+// Determine the version of the on-disk update data of the specified market.
+// This changes if its update file is rewritten. Requires a single stat of the
+// update file.
+auto get_market_data_version(const config& config, uint64_t market_id) -> uint64_t;
+
+// Determine the version of a dataset from the data versions of its markets in
+// order, as returned by get_market_data_version(). As these cover the market
+// IDs this changes if the set of markets does.
+auto get_dataset_version(const std::vector<uint64_t>& market_versions) -> uint64_t;
+
+// Determine the version of the on-disk update data for the specified markets
+// in order. This changes if the set of markets changes or any of their update
+// files are rewritten.
+auto get_dataset_version(const config& config, const std::vector<uint64_t>& market_ids)
+	-> uint64_t;
+
+// Get the path of the dataset image for the specified key hash and data
+// version within the specified directory.
+auto get_dataset_image_path(const std::string& dir, uint64_t key_hash, uint64_t data_version)
+	-> std::string;
+
+// Read and decompress the updates of the specified markets and write them
+// contiguously to a dataset image at the specified path. The image is written
+// to a temporary file which is then renamed over the path so readers never
+// see a partially written image.
+void write_dataset_image(const config& config, const std::string& path, uint64_t key_hash,
+			 uint64_t data_version, const std::vector<uint64_t>& market_ids);
+
+// Remove images under dir which are superseded by the image for the specified
+// key hash and data version - other versions of the same key along with any
+// images which haven't been opened for DATASET_IMAGE_MAX_IDLE_MS. Processes
+// which have already mapped removed images are unaffected. Returns the number
+// of images removed.
+auto evict_dataset_images(const std::string& dir, uint64_t key_hash, uint64_t data_version)
+	-> uint64_t;
+
+// A read-only memory mapping of a dataset image. The mapping is shared so
+// concurrent processes using the same image share its pages in the page
+// cache rather than each holding a copy of the data.
+class dataset_image
+{
+public:
+	// Map the image at the specified path, throwing if it can't be mapped
+	// or isn't a valid image.
+	explicit dataset_image(const std::string& path);
+
+	// Unmaps the image.
+	~dataset_image();
+
+	dataset_image(const dataset_image&) = delete;
+	auto operator=(const dataset_image&) -> dataset_image& = delete;
+	dataset_image(dataset_image&&) = delete;
+	auto operator=(dataset_image&&) -> dataset_image& = delete;
+
+	// Open the image of the specified markets under dir for the specified
+	// key, e.g. naming the predicate the markets were filtered by, building
+	// it first if no image of the key exists for the specified data
+	// versions of each market, as returned by get_market_data_version(), and
+	// evicting the images it supersedes. An image of the key for another
+	// set of markets, e.g. before new markets were added, is superseded.
+	static auto open(const config& config, const std::string& dir, const std::string& key,
+			 const std::vector<uint64_t>& market_ids,
+			 const std::vector<uint64_t>& market_versions)
+		-> std::unique_ptr<dataset_image>;
+
+	// Open the image of the specified markets under dir for the specified
+	// key, determining the version of their data first.
+	static auto open(const config& config, const std::string& dir, const std::string& key,
+			 const std::vector<uint64_t>& market_ids) -> std::unique_ptr<dataset_image>;
+
+	// Get the size of the image in bytes.
+	auto size() const -> uint64_t
+	{
+		return _size;
+	}
+
+	// Get the hash of the key the image was built for.
+	auto key_hash() const -> uint64_t
+	{
+		return header().key_hash;
+	}
+
+	// Get the version of the data the image was built from.
+	auto data_version() const -> uint64_t
+	{
+		return header().data_version;
+	}
+
+	// Get the number of markets in the image.
+	auto num_markets() const -> uint64_t
+	{
+		return header().num_markets;
+	}
+
+	// Get the ID of the i-th market in the image.
+	auto market_id(uint64_t i) const -> uint64_t
+	{
+		return entries()[i].market_id;
+	}
+
+	// Get the updates of the i-th market in the image. These remain valid
+	// for the lifetime of the image.
+	auto updates(uint64_t i) const -> std::span<const update>
+	{
+		const dataset_image_entry& entry = entries()[i];
+		const auto* ptr = reinterpret_cast<const update*>(_data + entry.offset);
+		return {ptr, entry.num_updates};
+	}
+
+private:
+	const uint8_t* _data;
+	uint64_t _size;
+
+	auto header() const -> const dataset_image_header&
+	{
+		return *reinterpret_cast<const dataset_image_header*>(_data);
+	}
+
+	auto entries() const -> const dataset_image_entry*
+	{
+		return reinterpret_cast<const dataset_image_entry*>(_data +
+								    sizeof(dataset_image_header));
+	}
+};
+} // namespace janus
@@ -39,9 +39,21 @@ auto read_market_updates(const config& config, dynamic_buffer& dyn_buf, uint64_t
 // Read market updates into a dynamic buffer which has capacity equal to the updates.
 auto read_market_updates(const config& config, uint64_t id) -> dynamic_buffer;
 
+// Time spent reading market updates from disk and decompressing them, in
+// nanoseconds.
+struct market_read_timing
+{
+	uint64_t read_ns;
+	uint64_t decompress_ns;
+};
+
 // Read market updates into a string object.
 auto read_market_updates_string(const config& config, uint64_t id) -> std::string;
 
+// Read market updates into a string object, adding the time taken to timing.
+auto read_market_updates_string(const config& config, uint64_t id, market_read_timing& timing)
+	-> std::string;
+
 // Returns a vector of the indexes within the buffer which are timestamp
 // updates. This can be used to correctly delineate between blocks of
 // updates. The dynamic buffer has its read offset reset before returning.
@@ -52,4 +64,9 @@ auto have_market_stats(const config& config, uint64_t id) -> bool;
 
 // Read statistics for a specified market.
 auto read_market_stats(const config& config, uint64_t id) -> stats;
+
+// Read statistics for a specified market into out if we have them, otherwise
+// return false. This only opens the stats file once so is cheaper than calling
+// have_market_stats() then read_market_stats().
+auto try_read_market_stats(const config& config, uint64_t id, stats& out) -> bool;
 } // namespace janus
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "price_range.hh"
+
+#include <cstdint>
+#include <vector>
+
+namespace janus::betfair
+{
+// Cumulative depth of one side of a ladder, held as a pair of Fenwick trees
+// over ladder positions - one of volume, the other of volume x price - so that
+// cumulative volume, the position at which a target volume is reached and the
+// VWAP of filling a volume are all O(log n).
+//
+// Position 0 is the end of the ladder nearest the best price for the side, the
+// ladder maps price indexes to positions. An index is disabled until
+// enable() is called, in which case it holds no memory.
+class depth_index
+{
+public:
+	// Determine whether the index is enabled.
+	auto enabled() const -> bool
+	{
+		return !_vol.empty();
+	}
+
+	// Enable the index with all volumes set to 0.
+	void enable()
+	{
+		_vol.assign(NUM_PRICES + 1, 0);
+		_price_vol.assign(NUM_PRICES + 1, 0);
+	}
+
+	// Set all volumes to 0.
+	void clear()
+	{
+		if (enabled())
+			enable();
+	}
+
+	// Add the specified (possibly negative) volume at the specified
+	// position, which has the specified price.
+	void add(uint64_t pos, double vol, double price)
+	{
+		for (uint64_t i = pos + 1; i <= NUM_PRICES; i += i & -i) {
+			_vol[i] += vol;
+			_price_vol[i] += vol * price;
+		}
+	}
+
+	// Get the sum of volume over the first n positions.
+	auto vol(uint64_t n) const -> double
+	{
+		return sum(_vol, n);
+	}
+
+	// Get the sum of volume x price over the first n positions.
+	auto price_vol(uint64_t n) const -> double
+	{
+		return sum(_price_vol, n);
+	}
+
+	// Find the first position at which the cumulative volume from
+	// position 0 reaches the specified volume, or NUM_PRICES if it never
+	// does. Volumes must be non-negative.
+	auto find(double vol) const -> uint64_t
+	{
+		uint64_t pos = 0;
+		double remaining = vol;
+
+		// Binary lifting down the tree, pos being the number of
+		// positions whose cumulative volume is known to fall short.
+		for (uint64_t step = TOP_STEP; step > 0; step >>= 1) {
+			uint64_t next = pos + step;
+			if (next <= NUM_PRICES && _vol[next] < remaining) {
+				pos = next;
+				remaining -= _vol[next];
+			}
+		}
+
+		return pos;
+	}
+
+private:
+	// Largest power of 2 not exceeding NUM_PRICES.
+	static constexpr uint64_t TOP_STEP = 256;
+	static_assert(TOP_STEP <= NUM_PRICES && TOP_STEP * 2 > NUM_PRICES);
+
+	std::vector<double> _vol;
+	std::vector<double> _price_vol;
+
+	static auto sum(const std::vector<double>& tree, uint64_t n) -> double
+	{
+		double ret = 0;
+		for (uint64_t i = n; i > 0; i -= i & -i) {
+			ret += tree[i];
+		}
+
+		return ret;
+	}
+};
+} // namespace janus::betfair
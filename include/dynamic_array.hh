@@ -8,12 +8,15 @@
 namespace janus
 {
 // Represents an array of T elements up to Cap size, taking up sizeof(T) * Cap + sizeof(uint64_t)
-// space. The type allows us to avoid allocations while maintaining a dynamic container.
+// space plus any padding needed to align the elements. The type allows us to avoid allocations
+// while maintaining a dynamic container.
 template<typename T, uint64_t Cap>
 class dynamic_array
 {
 public:
-	dynamic_array() : _size{0}, _raw_buf{0} {}
+	// The buffer is only storage for elements so is deliberately left
+	// uninitialised, zeroing it would touch sizeof(T) * Cap bytes.
+	dynamic_array() : _size{0} {} // NOLINT: See above.
 	// We need to manually destruct emplaced values.
 	~dynamic_array()
 	{
@@ -33,6 +36,12 @@ public:
 		return *get_ptr(i);
 	}
 
+	// Retrieve element at specific index UNCHECKED.
+	auto operator[](uint64_t i) const -> const T&
+	{
+		return *get_ptr(i);
+	}
+
 	// Retrieve element at specified index but check that it is within
 	// bounds first.
 	auto checked(uint64_t i) -> T&
@@ -58,6 +67,23 @@ public:
 		return *new (&_raw_buf[sizeof(T) * _size++]) T(std::forward<Args>(args)...);
 	}
 
+	// Replace the element at the specified index UNCHECKED, destructing
+	// the existing element and constructing a new one in its place.
+	// Returns a reference to the newly emplaced value.
+	template<typename... Args>
+	auto emplace_at(uint64_t i, Args&&... args) -> T&
+	{
+		T* ptr = get_ptr(i);
+		ptr->~T();
+		return *new (ptr) T(std::forward<Args>(args)...);
+	}
+
+	// Destruct the last element and remove it from the array UNCHECKED.
+	void pop_back()
+	{
+		get_ptr(--_size)->~T();
+	}
+
 	// Truncate the array to size 0, destructing existing elements.
 	void clear()
 	{
@@ -76,6 +102,10 @@ private:
 	{
 		return reinterpret_cast<T*>(&_raw_buf[sizeof(T) * i]);
 	}
+	auto get_ptr(uint64_t i) const -> const T*
+	{
+		return reinterpret_cast<const T*>(&_raw_buf[sizeof(T) * i]);
+	}
 
 	// Destruct all elements.
 	void destroy()
@@ -90,6 +120,8 @@ private:
 	}
 
 	uint64_t _size;
-	uint8_t _raw_buf[sizeof(T) * Cap]; // NOLINT: We don't want std::array semantics.
+	// Elements are placement-new'd into the buffer so it must be aligned
+	// as they are.
+	alignas(T) uint8_t _raw_buf[sizeof(T) * Cap]; // NOLINT: We don't want std::array semantics.
 };
 } // namespace janus
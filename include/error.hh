@@ -35,6 +35,12 @@ public:
 	{
 	}
 
+	universe_apply_error(uint64_t market_id, uint64_t runner_id, const std::string& msg)
+		: _what{"m" + std::to_string(market_id) + ":" + "r" + std::to_string(runner_id) +
+			": " + msg}
+	{
+	}
+
 	auto what() const noexcept -> const char* override
 	{
 		return _what.c_str();
@@ -77,7 +83,6 @@ public:
 	invalid_unmatched_update(uint64_t index, double vol, uint64_t limit_index, double limit_vol)
 		: _what{"Invalid unmatched update, "}
 	{
-		betfair::price_range range;
 		double price = betfair::price_range::index_to_price(index);
 
 		if (vol < 0) { // ATB
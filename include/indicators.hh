@@ -0,0 +1,316 @@
+#pragma once
+
+#include "price_range.hh"
+#include "runner.hh"
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+namespace janus::betfair
+{
+// Number of entries retained in each runner's top-of-book history. Must be a
+// power of 2.
+static constexpr uint64_t TOP_OF_BOOK_HISTORY_SIZE = 256;
+static_assert((TOP_OF_BOOK_HISTORY_SIZE & (TOP_OF_BOOK_HISTORY_SIZE - 1)) == 0);
+
+// Configuration of the indicator engine.
+struct indicator_config
+{
+	// Number of price levels on each side of the ladder used to calculate
+	// weight of money.
+	uint64_t wom_levels;
+	// Duration of rolling windows in ms.
+	uint64_t window_ms;
+};
+
+static constexpr indicator_config DEFAULT_INDICATOR_CONFIG = {
+	.wom_levels = 3,
+	.window_ms = 60'000,
+};
+
+// The top of a runner's book at a specific timestamp.
+struct top_of_book
+{
+	uint64_t timestamp;
+	uint64_t atl_index;
+	uint64_t atb_index;
+	uint64_t ltp_index;
+	double traded_vol;
+};
+
+// Indicators derived from a single runner, maintained incrementally as updates
+// are applied to it.
+class runner_indicators
+{
+public:
+	runner_indicators()
+		: _runner{nullptr},
+		  _wom_levels{0},
+		  _window_ms{0},
+		  _wom{0},
+		  _wom_dirty{true},
+		  _vwap_vol{0},
+		  _vwap_sum{0},
+		  _num_history{0},
+		  _window_pos{0},
+		  _history{}
+	{
+	}
+
+	// Attach to the specified runner, recording its current state.
+	void attach(const runner& runner, const indicator_config& config, uint64_t timestamp)
+	{
+		_runner = &runner;
+		_wom_levels = config.wom_levels;
+		_window_ms = config.window_ms;
+		_wom_dirty = true;
+		record(timestamp);
+	}
+
+	// Point at the runner's new location after it was moved, e.g. by the
+	// market's runner storage growing.
+	void rebind(const runner& runner)
+	{
+		_runner = &runner;
+	}
+
+	// Get weight of money - the proportion of unmatched volume over the top
+	// N price levels on each side which is ATL (looking to back), or 0 if
+	// there is no unmatched volume. Recalculated at most once per change to
+	// unmatched volume.
+	auto wom() -> double
+	{
+		if (_wom_dirty)
+			calc_wom();
+
+		return _wom;
+	}
+
+	// Get the volume weighted average price of volume matched since the
+	// runner was attached, or 0 if none has been matched.
+	auto vwap() const -> double
+	{
+		return _vwap_vol == 0 ? 0 : _vwap_sum / _vwap_vol;
+	}
+
+	// Get the change in traded volume over the rolling window ending at the
+	// specified timestamp.
+	auto traded_vol_delta(uint64_t now) -> double
+	{
+		return latest().traded_vol - window_start(now).traded_vol;
+	}
+
+	// Get the number of ticks the best ATL price moved over the rolling
+	// window ending at the specified timestamp, positive if it drifted.
+	auto atl_tick_move(uint64_t now) -> int64_t
+	{
+		return tick_move(latest().atl_index, window_start(now).atl_index);
+	}
+
+	// Get the number of ticks the best ATB price moved over the rolling
+	// window ending at the specified timestamp, positive if it drifted.
+	auto atb_tick_move(uint64_t now) -> int64_t
+	{
+		return tick_move(latest().atb_index, window_start(now).atb_index);
+	}
+
+	// Get the number of ticks the LTP moved over the rolling window ending
+	// at the specified timestamp, positive if it drifted.
+	auto ltp_tick_move(uint64_t now) -> int64_t
+	{
+		return tick_move(latest().ltp_index, window_start(now).ltp_index);
+	}
+
+	// Get the number of top-of-book history entries retained, at most
+	// TOP_OF_BOOK_HISTORY_SIZE.
+	auto num_history() const -> uint64_t
+	{
+		return _num_history < TOP_OF_BOOK_HISTORY_SIZE ? _num_history
+							       : TOP_OF_BOOK_HISTORY_SIZE;
+	}
+
+	// Get the i-th most recent top-of-book history entry, 0 being the
+	// latest. i must be less than num_history().
+	auto history(uint64_t i) const -> const top_of_book&
+	{
+		return _history[(_num_history - 1 - i) & MASK];
+	}
+
+	// Record a change to the runner's unmatched volume.
+	void on_unmatched(uint64_t timestamp)
+	{
+		_wom_dirty = true;
+		record(timestamp);
+	}
+
+	// Record a change to the runner's matched volume at the specified price
+	// index from prev_vol to vol.
+	void on_matched(uint64_t timestamp, uint64_t price_index, double prev_vol, double vol)
+	{
+		double delta = vol - prev_vol;
+		_vwap_vol += delta;
+		_vwap_sum += delta * price_range::index_to_price(price_index);
+		record(timestamp);
+	}
+
+	// Record the runner being cleared, after which its ladder will be
+	// repopulated.
+	void on_clear(uint64_t timestamp)
+	{
+		_wom_dirty = true;
+		_vwap_vol = 0;
+		_vwap_sum = 0;
+		record(timestamp);
+	}
+
+	// Record any other change to the runner.
+	void on_update(uint64_t timestamp)
+	{
+		record(timestamp);
+	}
+
+private:
+	static constexpr uint64_t MASK = TOP_OF_BOOK_HISTORY_SIZE - 1;
+
+	const runner* _runner;
+	uint64_t _wom_levels;
+	uint64_t _window_ms;
+
+	double _wom;
+	bool _wom_dirty;
+
+	double _vwap_vol;
+	double _vwap_sum;
+
+	// Total number of entries ever recorded, the ring retains the most
+	// recent TOP_OF_BOOK_HISTORY_SIZE.
+	uint64_t _num_history;
+	// Absolute position of the entry at the start of the rolling window.
+	uint64_t _window_pos;
+	std::array<top_of_book, TOP_OF_BOOK_HISTORY_SIZE> _history;
+
+	// Difference in ticks between price indexes.
+	static auto tick_move(uint64_t to, uint64_t from) -> int64_t
+	{
+		return static_cast<int64_t>(to) - static_cast<int64_t>(from);
+	}
+
+	auto latest() const -> const top_of_book&
+	{
+		return _history[(_num_history - 1) & MASK];
+	}
+
+	// Find the latest entry at or before the start of the window ending at
+	// now. If the window extends beyond the history retained, the oldest
+	// entry is used. The window position only moves forward, so this is
+	// amortised O(1) as long as now doesn't decrease.
+	auto window_start(uint64_t now) -> const top_of_book&
+	{
+		uint64_t start = now < _window_ms ? 0 : now - _window_ms;
+
+		uint64_t oldest = _num_history - num_history();
+		if (_window_pos < oldest)
+			_window_pos = oldest;
+
+		while (_window_pos + 1 < _num_history &&
+		       _history[(_window_pos + 1) & MASK].timestamp <= start) {
+			_window_pos++;
+		}
+
+		return _history[_window_pos & MASK];
+	}
+
+	// Record the runner's current top of book, replacing the latest entry if
+	// it is at the same timestamp.
+	void record(uint64_t timestamp)
+	{
+		if (_num_history == 0 || latest().timestamp != timestamp)
+			_num_history++;
+
+		const ladder& ladder = _runner->ladder();
+		_history[(_num_history - 1) & MASK] = {
+			.timestamp = timestamp,
+			.atl_index = ladder.min_atl_index(),
+			.atb_index = ladder.max_atb_index(),
+			.ltp_index = _runner->ltp(),
+			.traded_vol = _runner->traded_vol(),
+		};
+	}
+
+	void calc_wom()
+	{
+		std::array<uint64_t, NUM_PRICES> price_indexes; // NOLINT: Output only.
+		std::array<double, NUM_PRICES> vols;            // NOLINT: Output only.
+
+		const ladder& ladder = _runner->ladder();
+		uint64_t levels = _wom_levels < NUM_PRICES ? _wom_levels : NUM_PRICES;
+
+		double atl = 0;
+		uint64_t num_atl = ladder.best_atl(levels, &price_indexes[0], &vols[0]);
+		for (uint64_t i = 0; i < num_atl; i++) {
+			atl += vols[i];
+		}
+
+		double atb = 0;
+		uint64_t num_atb = ladder.best_atb(levels, &price_indexes[0], &vols[0]);
+		for (uint64_t i = 0; i < num_atb; i++) {
+			atb += vols[i];
+		}
+
+		_wom = atl + atb == 0 ? 0 : atl / (atl + atb);
+		_wom_dirty = false;
+	}
+};
+
+// An opt-in engine maintaining derived indicators for each runner in a market
+// as updates are applied, so strategies can read them in O(1) rather than
+// each recomputing them from the ladder at every timestamp. Indicators are held
+// for each runner added, of which there can be at most MaxRunners.
+template<uint64_t MaxRunners>
+class indicator_engine
+{
+public:
+	explicit indicator_engine(const indicator_config& config) : _config{config} {}
+
+	// Get the engine's configuration.
+	auto config() const -> const indicator_config&
+	{
+		return _config;
+	}
+
+	// Get the indicators for the i-th runner in the market.
+	auto operator[](uint64_t i) -> runner_indicators&
+	{
+		return _runners[i];
+	}
+
+	// Reserve space for the specified number of runners so they can be
+	// added without reallocating.
+	void reserve(uint64_t num_runners)
+	{
+		_runners.reserve(num_runners);
+	}
+
+	// Attach the i-th runner in the market, which must equal the number of
+	// runners already attached, to the engine.
+	void add_runner(uint64_t i, const runner& runner, uint64_t timestamp)
+	{
+		_runners.resize(i + 1);
+		_runners[i].attach(runner, _config, timestamp);
+	}
+
+	// Point the indicators of the first num_runners runners in the market
+	// at their new locations after the market's runner storage moved.
+	void rebind(const std::vector<runner>& runners, uint64_t num_runners)
+	{
+		for (uint64_t i = 0; i < num_runners; i++) {
+			_runners[i].rebind(runners[i]);
+		}
+	}
+
+private:
+	indicator_config _config;
+	std::vector<runner_indicators> _runners;
+};
+} // namespace janus::betfair
@@ -8,6 +8,8 @@
 #include "error.hh"
 
 #include "channel.hh"
+#include "queue.hh"
+#include "seqlock.hh"
 #include "util.hh"
 
 #include "decimal7.hh"
@@ -18,13 +20,19 @@
 #include "price_range.hh"
 
 #include "bet.hh"
+#include "book_cache.hh"
+#include "change_set.hh"
+#include "checkpoint.hh"
 #include "config.hh"
+#include "indicators.hh"
 #include "json.hh"
 #include "market.hh"
 #include "meta.hh"
 #include "runner.hh"
 #include "sim.hh"
+#include "snapshot.hh"
 #include "stats.hh"
+#include "topology.hh"
 #include "universe.hh"
 #include "update.hh"
 #include "virtual.hh"
@@ -39,5 +47,9 @@
 #include "network/rng.hh"
 
 #include "db.hh"
+#include "dataset_image.hh"
+#include "prefetch.hh"
+#include "result_cache.hh"
 
 #include "analyse.hh"
+#include "analyse_metrics.hh"
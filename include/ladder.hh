@@ -2,9 +2,14 @@
 
 #include <array>
 #include <cstdint>
+#include <cstring>
 #include <initializer_list>
+#include <stdexcept>
 #include <utility>
 
+#include "change_set.hh"
+#include "depth_index.hh"
+#include "dynamic_buffer.hh"
 #include "error.hh"
 
 namespace janus::betfair
@@ -20,7 +25,9 @@ public:
 		  _total_unmatched_atb{0},
 		  _total_matched{0},
 		  _unmatched{0},
-		  _matched{0}
+		  _matched{0},
+		  _atl_depth{},
+		  _atb_depth{}
 	{
 	}
 
@@ -29,15 +36,11 @@ public:
 	// cppcheck-suppress noExplicitConstructor
 	ladder(std::initializer_list<std::pair<uint64_t, double>> list) : ladder() // NOLINT
 	{
-		// Inefficient to construct a price range here, but typicaly we
-		// will be invoking this ctor when we are testing or otherwise
-		// not concerned about perforamnce. It is far more convenient
-		// for testing purposes to be able to specify pricex100 values
-		// rather than opaque indexes.
-		price_range range;
-
+		// Typically we will be invoking this ctor when we are testing.
+		// It is far more convenient for testing purposes to be able to
+		// specify pricex100 values rather than opaque indexes.
 		for (auto [pricex100, vol] : list) {
-			uint64_t price_index = range.pricex100_to_index(pricex100);
+			uint64_t price_index = price_range::pricex100_to_index(pricex100);
 			set_unmatched_at(price_index, vol);
 		}
 	}
@@ -179,16 +182,42 @@ public:
 	// is on the back (ATL) side, otherwise if negative then volume is on
 	// the lay (ATB) side.
 	// This additionally updates the top ATL/ATB indexes.
+	// Throws invalid_unmatched_update if the volume would cross the book.
 	void set_unmatched_at(uint64_t price_index, double vol)
 	{
-		// This only returns false in cases where the error is
-		// acceptable but we should not apply the unmatched value.
-		if (!check_valid_unmatched(price_index, vol))
-			return;
+		if (!try_set_unmatched_at(price_index, vol))
+			throw_crossed(price_index, vol);
+	}
+
+	// Set the unmatched volume at the specified price index as per
+	// set_unmatched_at(), but rather than throwing if the volume would
+	// cross the book, return false leaving the volume unapplied.
+	auto try_set_unmatched_at(uint64_t price_index, double vol) -> bool
+	{
+		index_range cleared = EMPTY_INDEX_RANGE;
+		return try_set_unmatched_at(price_index, vol, cleared);
+	}
+
+	// Set the unmatched volume as per try_set_unmatched_at(), extending
+	// cleared to cover the price indexes of any trivial volume on the
+	// opposing side cleared to make way for it. Volume may be cleared even
+	// if the volume would cross the book.
+	auto try_set_unmatched_at(uint64_t price_index, double vol, index_range& cleared) -> bool
+	{
+		switch (check_valid_unmatched(price_index, vol, cleared)) {
+		case unmatched_check::VALID:
+			break;
+		case unmatched_check::IGNORE:
+			return true;
+		case unmatched_check::CROSSED:
+			return false;
+		}
 
 		update_total_unmatched(price_index, vol);
+		update_depth(price_index, vol);
 		_unmatched[price_index] = vol;
 		update_limit_indexes(price_index, vol);
+		return true;
 	}
 
 	// Clear the unmatched volume at the specified price index.
@@ -196,6 +225,7 @@ public:
 	void clear_unmatched_at(uint64_t price_index)
 	{
 		update_total_unmatched(price_index, 0);
+		update_depth(price_index, 0);
 		_unmatched[price_index] = 0;
 		update_limit_indexes_clear(price_index);
 	}
@@ -215,6 +245,22 @@ public:
 		_matched[price_index] = 0;
 	}
 
+	// Hint that the unmatched volume at the specified price index is about
+	// to be updated so its cache line can be fetched ahead of time.
+	void prefetch_unmatched(uint64_t price_index) const
+	{
+		if (price_index < NUM_PRICES)
+			__builtin_prefetch(&_unmatched[price_index], 1);
+	}
+
+	// Hint that the matched volume at the specified price index is about to
+	// be updated so its cache line can be fetched ahead of time.
+	void prefetch_matched(uint64_t price_index) const
+	{
+		if (price_index < NUM_PRICES)
+			__builtin_prefetch(&_matched[price_index], 1);
+	}
+
 	// Clear state of ladder.
 	void clear()
 	{
@@ -232,6 +278,132 @@ public:
 		_total_unmatched_atl = 0;
 		_total_unmatched_atb = 0;
 		_unmatched = {0};
+		_atl_depth.clear();
+		_atb_depth.clear();
+	}
+
+	// Enable the cumulative depth index, which is then maintained as
+	// unmatched volume is set, allowing the depth queries below to be
+	// answered in O(log n). This costs an additional ~11 KiB per ladder so
+	// is off by default. If already enabled, this does nothing.
+	void enable_depth_index()
+	{
+		if (_atl_depth.enabled())
+			return;
+
+		_atl_depth.enable();
+		_atb_depth.enable();
+		populate_depth();
+	}
+
+	// Determine whether the cumulative depth index is enabled.
+	auto depth_index_enabled() const -> bool
+	{
+		return _atl_depth.enabled();
+	}
+
+	// Get the unmatched back (ATL) volume from the minimum ATL price up to
+	// and including the price the specified number of ticks beyond it.
+	// The depth index must be enabled.
+	auto atl_depth(uint64_t ticks) const -> double
+	{
+		return _atl_depth.vol(depth_count(_min_atl_index, ticks));
+	}
+
+	// Get the unmatched lay (ATB) volume from the maximum ATB price down to
+	// and including the price the specified number of ticks beyond it,
+	// expressed as a positive value. The depth index must be enabled.
+	auto atb_depth(uint64_t ticks) const -> double
+	{
+		return _atb_depth.vol(depth_count(atb_depth_pos(_max_atb_index), ticks));
+	}
+
+	// Get the price index at which the cumulative unmatched back (ATL)
+	// volume from the minimum ATL price reaches the specified volume, i.e.
+	// how far a lay of that volume would walk the book, or
+	// INVALID_PRICE_INDEX if there is insufficient volume. The depth index
+	// must be enabled.
+	auto atl_index_for_vol(double vol) const -> uint64_t
+	{
+		uint64_t pos = _atl_depth.find(vol);
+		return pos == NUM_PRICES ? INVALID_PRICE_INDEX : pos;
+	}
+
+	// Get the price index at which the cumulative unmatched lay (ATB)
+	// volume from the maximum ATB price reaches the specified (positive)
+	// volume, i.e. how far a back of that volume would walk the book, or
+	// INVALID_PRICE_INDEX if there is insufficient volume. The depth index
+	// must be enabled.
+	auto atb_index_for_vol(double vol) const -> uint64_t
+	{
+		uint64_t pos = _atb_depth.find(vol);
+		return pos == NUM_PRICES ? INVALID_PRICE_INDEX : atb_depth_pos(pos);
+	}
+
+	// Get the volume weighted average price at which a lay of the specified
+	// volume would be filled by unmatched back (ATL) volume, or 0 if there
+	// is insufficient volume. The depth index must be enabled.
+	auto atl_vwap_to_fill(double vol) const -> double
+	{
+		uint64_t pos = _atl_depth.find(vol);
+		if (vol <= 0 || pos == NUM_PRICES)
+			return 0;
+
+		return fill_vwap(_atl_depth, pos, vol, price_range::index_to_price(pos));
+	}
+
+	// Get the volume weighted average price at which a back of the
+	// specified (positive) volume would be filled by unmatched lay (ATB)
+	// volume, or 0 if there is insufficient volume. The depth index must be
+	// enabled.
+	auto atb_vwap_to_fill(double vol) const -> double
+	{
+		uint64_t pos = _atb_depth.find(vol);
+		if (vol <= 0 || pos == NUM_PRICES)
+			return 0;
+
+		return fill_vwap(_atb_depth, pos, vol,
+				 price_range::index_to_price(atb_depth_pos(pos)));
+	}
+
+	// Size in bytes of a ladder checkpoint.
+	static constexpr uint64_t CHECKPOINT_SIZE =
+		5 * sizeof(uint64_t) + 2 * NUM_PRICES * sizeof(double);
+
+	// Save the state of the ladder to the specified dynamic buffer. The
+	// price arrays are copied in bulk.
+	void save_checkpoint(dynamic_buffer& dyn_buf) const
+	{
+		dyn_buf.add_uint64(_min_atl_index);
+		dyn_buf.add_uint64(_max_atb_index);
+		dyn_buf.add(_total_unmatched_atl);
+		dyn_buf.add(_total_unmatched_atb);
+		dyn_buf.add(_total_matched);
+		dyn_buf.add_raw(&_unmatched[0], sizeof(_unmatched));
+		dyn_buf.add_raw(&_matched[0], sizeof(_matched));
+	}
+
+	// Restore the state of the ladder from a checkpoint previously saved
+	// via save_checkpoint(), reading from the specified dynamic buffer.
+	void load_checkpoint(dynamic_buffer& dyn_buf)
+	{
+		_min_atl_index = dyn_buf.read_uint64();
+		_max_atb_index = dyn_buf.read_uint64();
+		if (_min_atl_index >= NUM_PRICES || _max_atb_index >= NUM_PRICES)
+			throw std::runtime_error("Invalid ladder limit index in checkpoint");
+
+		_total_unmatched_atl = dyn_buf.read<double>();
+		_total_unmatched_atb = dyn_buf.read<double>();
+		_total_matched = dyn_buf.read<double>();
+		std::memcpy(&_unmatched[0], dyn_buf.read_raw(sizeof(_unmatched)),
+			    sizeof(_unmatched));
+		std::memcpy(&_matched[0], dyn_buf.read_raw(sizeof(_matched)), sizeof(_matched));
+
+		if (depth_index_enabled()) {
+			_atl_depth.clear();
+			_atb_depth.clear();
+			populate_depth();
+		}
 	}
 
 private:
@@ -249,10 +421,90 @@ private:
 
 	std::array<double, NUM_PRICES> _matched;
 
+	// Cumulative depth of each side, only populated if enabled. ATB
+	// positions run from the top of the ladder down.
+	depth_index _atl_depth;
+	depth_index _atb_depth;
+
+	// Map between ATB price index and depth index position, the mapping
+	// being its own inverse.
+	static auto atb_depth_pos(uint64_t price_index) -> uint64_t
+	{
+		return NUM_PRICES - 1 - price_index;
+	}
+
+	// Get the number of depth index positions from 0 up to and including
+	// the specified number of ticks beyond the specified best position.
+	// There is never volume prior to the best position so counting from 0
+	// is equivalent to counting from it.
+	static auto depth_count(uint64_t best_pos, uint64_t ticks) -> uint64_t
+	{
+		uint64_t last = NUM_PRICES - 1 - best_pos;
+		return best_pos + 1 + (ticks < last ? ticks : last);
+	}
+
+	// Calculate the VWAP of filling the specified volume, the cumulative
+	// volume first reaching it at the specified position with the
+	// specified price.
+	static auto fill_vwap(const depth_index& depth, uint64_t pos, double vol, double price)
+		-> double
+	{
+		double prior_vol = depth.vol(pos);
+		double prior_price_vol = depth.price_vol(pos);
+
+		return (prior_price_vol + (vol - prior_vol) * price) / vol;
+	}
+
+	// Populate the depth index from the unmatched volume, which must
+	// already be zeroed.
+	void populate_depth()
+	{
+		for (uint64_t price_index = 0; price_index < NUM_PRICES; price_index++) {
+			double vol = _unmatched[price_index];
+			double price = price_range::index_to_price(price_index);
+
+			if (vol > 0)
+				_atl_depth.add(price_index, vol, price);
+			else if (vol < 0)
+				_atb_depth.add(atb_depth_pos(price_index), -vol, price);
+		}
+	}
+
+	// Update the depth index, if enabled, for the unmatched volume at the
+	// specified price index being replaced with the specified volume.
+	void update_depth(uint64_t price_index, double vol)
+	{
+		if (!_atl_depth.enabled())
+			return;
+
+		double prev = _unmatched[price_index];
+		double price = price_range::index_to_price(price_index);
+
+		double atl_delta = (vol > 0 ? vol : 0) - (prev > 0 ? prev : 0);
+		if (atl_delta != 0)
+			_atl_depth.add(price_index, atl_delta, price);
+
+		double atb_delta = (vol < 0 ? -vol : 0) - (prev < 0 ? -prev : 0);
+		if (atb_delta != 0)
+			_atb_depth.add(atb_depth_pos(price_index), atb_delta, price);
+	}
+
+	// Result of checking a proposed unmatched (index, vol) pair.
+	enum class unmatched_check
+	{
+		VALID,
+		// Invalid but trivial volume, so should be silently ignored.
+		IGNORE,
+		// Invalid as it would cross the book.
+		CROSSED,
+	};
+
 	// Determine if the specified (index, vol) pair proposed to be added to
-	// unmatched inventory is valid, if not either throw if not trivial
-	// volume.
-	auto check_valid_unmatched(uint64_t price_index, double vol) -> bool
+	// unmatched inventory is valid. Trivial volume at the opposing limit
+	// is cleared to make way for it if need be, extending cleared to cover
+	// its price indexes.
+	auto check_valid_unmatched(uint64_t price_index, double vol, index_range& cleared)
+		-> unmatched_check
 	{
 		// We check whether the proposed unmatched pair would cause a
 		// discontinuity in the unmatched price range, e.g. max ATB 2,
@@ -268,43 +520,55 @@ private:
 
 		if (vol < 0 && price_index > _min_atl_index) {
 			if (-vol <= EPSILON_VOLUME)
-				return false;
+				return unmatched_check::IGNORE;
 
 			double min_atl_vol = _unmatched[_min_atl_index];
 			while (min_atl_vol > 0 && min_atl_vol <= EPSILON_VOLUME) {
+				cleared.extend(_min_atl_index);
 				clear_unmatched_at(_min_atl_index);
 				min_atl_vol = _unmatched[_min_atl_index];
 
 				// Now try again - if we pass then carry on,
-				// otherwise we throw.
+				// otherwise the book is crossed.
 				if (price_index <= _min_atl_index)
-					return true;
+					return unmatched_check::VALID;
 			}
 
-			throw invalid_unmatched_update(price_index, vol, _min_atl_index,
-						       min_atl_vol);
+			return unmatched_check::CROSSED;
 		}
 
 		if (vol > 0 && price_index < _max_atb_index) {
 			if (vol <= EPSILON_VOLUME)
-				return false;
+				return unmatched_check::IGNORE;
 
 			double max_atb_vol = -_unmatched[_max_atb_index];
 			while (max_atb_vol > 0 && max_atb_vol <= EPSILON_VOLUME) {
+				cleared.extend(_max_atb_index);
 				clear_unmatched_at(_max_atb_index);
 				max_atb_vol = -_unmatched[_max_atb_index];
 
 				// Now try again - if we pass then carry on,
-				// otherwise we throw.
+				// otherwise the book is crossed.
 				if (price_index >= _max_atb_index)
-					return true;
+					return unmatched_check::VALID;
 			}
 
-			throw invalid_unmatched_update(price_index, vol, _max_atb_index,
-						       max_atb_vol);
+			return unmatched_check::CROSSED;
 		}
 
-		return true;
+		return unmatched_check::VALID;
+	}
+
+	// Throw an error describing the specified (index, vol) pair crossing
+	// the book. Kept out of line so as not to bloat callers.
+	[[gnu::noinline, noreturn]] void throw_crossed(uint64_t price_index, double vol) const
+	{
+		if (vol < 0)
+			throw invalid_unmatched_update(price_index, vol, _min_atl_index,
+						       _unmatched[_min_atl_index]);
+
+		throw invalid_unmatched_update(price_index, vol, _max_atb_index,
+					       -_unmatched[_max_atb_index]);
 	}
 
 	// Starting from the specified price index, find the first price where
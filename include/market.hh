@@ -1,12 +1,16 @@
 #pragma once
 
-#include "dynamic_array.hh"
+#include "book_cache.hh"
+#include "change_set.hh"
+#include "dynamic_buffer.hh"
+#include "indicators.hh"
 #include "runner.hh"
 
-#include <array>
 #include <cstdint>
+#include <memory>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
 namespace janus::betfair
 {
@@ -23,7 +27,10 @@ enum class market_state : uint64_t
 class market
 {
 public:
-	using runners_t = dynamic_array<runner, MAX_RUNNERS>;
+	using runners_t = std::vector<runner>;
+	using book_t = book_cache<MAX_RUNNERS>;
+	using changes_t = change_set<MAX_RUNNERS>;
+	using indicators_t = indicator_engine<MAX_RUNNERS>;
 
 	explicit market(uint64_t id)
 		: _id{id},
@@ -31,8 +38,7 @@ public:
 		  _inplay{false},
 		  _traded_vol{0},
 		  _num_runners{0},
-		  _last_timestamp{0},
-		  _runner_ids{0}
+		  _last_timestamp{0}
 	{
 	}
 
@@ -90,6 +96,103 @@ public:
 		return _num_runners;
 	}
 
+	// Reserve space for the specified number of runners, e.g. as known
+	// from market metadata, so runners can be added without reallocating
+	// them or their IDs, book, changes and indicators.
+	void reserve_runners(uint64_t num_runners)
+	{
+		if (num_runners > MAX_RUNNERS)
+			num_runners = MAX_RUNNERS;
+
+		_runner_ids.reserve(num_runners);
+		_runners.reserve(num_runners);
+		_book.reserve(num_runners);
+		_changes.reserve(num_runners);
+		if (_indicators)
+			_indicators->reserve(num_runners);
+	}
+
+	// Get the index of the specified runner, which must belong to this
+	// market.
+	auto runner_index(const runner& runner) const -> uint64_t
+	{
+		return find_runner_index(runner.id());
+	}
+
+	// Find the index of the runner with the specified ID, if not present
+	// returns num_runners().
+	auto find_runner_index(uint64_t id) const -> uint64_t
+	{
+		// Iterating through a small array is faster than most
+		// alternative lookup schemes such as hashing.
+		for (uint64_t i = 0; i < _num_runners; i++) {
+			if (_runner_ids[i] == id)
+				return i;
+		}
+
+		return _num_runners;
+	}
+
+	// Get the cached top of book of each runner in the market. This
+	// reflects updates applied via the universe, if runners are modified
+	// directly then refresh_book() must be called.
+	auto book() const -> const book_t&
+	{
+		return _book;
+	}
+
+	// Refresh the cached top of book of every runner in the market.
+	void refresh_book()
+	{
+		for (uint64_t i = 0; i < _num_runners; i++) {
+			_book.update(i, _runners[i]);
+		}
+		_book.resum();
+	}
+
+	// Get MUTABLE reference to the cached top of book of each runner in the
+	// market.
+	auto book() -> book_t&
+	{
+		return _book;
+	}
+
+	// Get the changes applied to the market at its most recently changed
+	// timestamp.
+	auto changes() const -> const changes_t&
+	{
+		return _changes;
+	}
+
+	// Enable the indicator engine for this market, attaching existing
+	// runners to it. Indicators are then maintained as updates are
+	// applied. If already enabled, this does nothing.
+	void enable_indicators(const indicator_config& config = DEFAULT_INDICATOR_CONFIG)
+	{
+		if (_indicators)
+			return;
+
+		_indicators = std::make_unique<indicators_t>(config);
+		_indicators->reserve(_runners.capacity());
+		for (uint64_t i = 0; i < _num_runners; i++) {
+			_indicators->add_runner(i, _runners[i], _last_timestamp);
+		}
+	}
+
+	// Get MUTABLE pointer to the indicator engine, or nullptr if not
+	// enabled.
+	auto indicators() -> indicators_t*
+	{
+		return _indicators.get();
+	}
+
+	// Get MUTABLE reference to the changes applied to the market at its most
+	// recently changed timestamp.
+	auto changes() -> changes_t&
+	{
+		return _changes;
+	}
+
 	// Get last timestamp market was updated at.
 	auto last_timestamp() -> uint64_t
 	{
@@ -102,10 +205,16 @@ public:
 		_last_timestamp = timestamp;
 	}
 
+	// Determine whether the market can move to the specified state.
+	auto can_set_state(market_state state) const -> bool
+	{
+		return _state != market_state::CLOSED || state != market_state::OPEN;
+	}
+
 	// Set market state.
 	void set_state(market_state state)
 	{
-		if (_state == market_state::CLOSED && state == market_state::OPEN)
+		if (!can_set_state(state))
 			throw std::runtime_error("Cannot move from closed state to open");
 
 		_state = state;
@@ -134,14 +243,28 @@ public:
 	//
 	// Note that we do NOT check for duplicates, the caller must ensure this
 	// is a new runner.
+	//
+	// Runners are stored contiguously, so adding a runner beyond those
+	// reserved via reserve_runners() invalidates references to the others.
 	auto add_runner(uint64_t id) -> runner&
 	{
 		if (_num_runners == MAX_RUNNERS)
 			throw std::runtime_error("Already have " + std::to_string(MAX_RUNNERS) +
 						 " runners, cannot add another");
 
-		_runner_ids[_num_runners++] = id;
-		return _runners.emplace_back(id);
+		bool moved = _runners.size() == _runners.capacity();
+		_runner_ids.push_back(id);
+		runner& added = _runners.emplace_back(id);
+		_num_runners++;
+		_book.add_runner(_num_runners - 1, added);
+		_changes.add_runner(_num_runners - 1);
+		if (_indicators) {
+			if (moved)
+				_indicators->rebind(_runners, _num_runners - 1);
+			_indicators->add_runner(_num_runners - 1, added, _last_timestamp);
+		}
+
+		return added;
 	}
 
 	// Clear mutable market state, retaining immutable state.
@@ -152,6 +275,50 @@ public:
 		for (uint64_t i = 0; i < _num_runners; i++) {
 			_runners[i].clear_state();
 		}
+		refresh_book();
+	}
+
+	// Get the size in bytes of a checkpoint of the market, including its
+	// runners.
+	auto checkpoint_size() const -> uint64_t
+	{
+		return 6 * sizeof(uint64_t) + _num_runners * runner::CHECKPOINT_SIZE;
+	}
+
+	// Save the state of the market and its runners to the specified
+	// dynamic buffer.
+	void save_checkpoint(dynamic_buffer& dyn_buf) const
+	{
+		dyn_buf.add_uint64(_id);
+		dyn_buf.add_uint64(static_cast<uint64_t>(_state));
+		dyn_buf.add_uint64(_inplay ? 1 : 0);
+		dyn_buf.add(_traded_vol);
+		dyn_buf.add_uint64(_last_timestamp);
+
+		dyn_buf.add_uint64(_num_runners);
+		for (uint64_t i = 0; i < _num_runners; i++) {
+			_runners[i].save_checkpoint(dyn_buf);
+		}
+	}
+
+	// Restore the state of the market from a checkpoint previously saved
+	// via save_checkpoint(), reading from the specified dynamic buffer. The
+	// market ID is read by the caller in order to create the market, which
+	// must not have any runners.
+	void load_checkpoint(dynamic_buffer& dyn_buf)
+	{
+		_state = static_cast<market_state>(dyn_buf.read_uint64());
+		_inplay = dyn_buf.read_uint64() == 1;
+		_traded_vol = dyn_buf.read<double>();
+		_last_timestamp = dyn_buf.read_uint64();
+
+		uint64_t num_runners = dyn_buf.read_uint64();
+		reserve_runners(num_runners);
+		for (uint64_t i = 0; i < num_runners; i++) {
+			uint64_t id = dyn_buf.read_uint64();
+			add_runner(id).load_checkpoint(dyn_buf);
+		}
+		refresh_book();
 	}
 
 private:
@@ -161,21 +328,18 @@ private:
 	double _traded_vol;
 	uint64_t _num_runners;
 	uint64_t _last_timestamp;
-	std::array<uint64_t, MAX_RUNNERS> _runner_ids;
+	std::vector<uint64_t> _runner_ids;
+	book_t _book;
+	changes_t _changes;
+	std::unique_ptr<indicators_t> _indicators;
 	runners_t _runners;
 
 	// Find a runner with the specified ID, if not present then returns
 	// nullptr.
 	auto get_runner(uint64_t id) -> runner*
 	{
-		// Iterating through a small array is faster than most
-		// alternative lookup schemes such as hashing.
-		for (uint64_t i = 0; i < _num_runners; i++) {
-			if (_runner_ids[i] == id)
-				return &_runners[i];
-		}
-
-		return nullptr;
+		uint64_t i = find_runner_index(id);
+		return i == _num_runners ? nullptr : &_runners[i];
 	}
 };
 } // namespace janus::betfair
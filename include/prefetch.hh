@@ -0,0 +1,81 @@
+#pragma once
+
+#include "config.hh"
+#include "dynamic_buffer.hh"
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace janus
+{
+// Streams market update data from disk on background loader threads, reading
+// and decompressing markets ahead of the consumer so that only a bounded
+// window of markets is ever held in memory.
+//
+// Markets are delivered in the order specified, cycling back to the first
+// once the last has been delivered so that the consumer can iterate over them
+// any number of times.
+class market_prefetcher
+{
+public:
+	// Start loading the specified markets, holding at most window loaded
+	// markets ahead of the consumer, using num_loaders threads.
+	market_prefetcher(const config& config, std::vector<uint64_t> market_ids, uint64_t window,
+			  uint64_t num_loaders = 1);
+
+	// Stops and joins the loader threads.
+	~market_prefetcher();
+
+	market_prefetcher(const market_prefetcher&) = delete;
+	auto operator=(const market_prefetcher&) -> market_prefetcher& = delete;
+	market_prefetcher(market_prefetcher&&) = delete;
+	auto operator=(market_prefetcher&&) -> market_prefetcher& = delete;
+
+	// Get the number of markets being streamed.
+	auto num_markets() const -> uint64_t
+	{
+		return _market_ids.size();
+	}
+
+	// Retrieve the updates for the next market in sequence, blocking until
+	// they have been loaded. Throws if the market could not be loaded, in
+	// which case the next call moves on to the following market.
+	auto next() -> dynamic_buffer;
+
+	// Discard the next n markets in sequence.
+	void skip(uint64_t n);
+
+private:
+	// A loaded (or failed) market awaiting the consumer.
+	struct slot
+	{
+		bool ready;
+		std::optional<dynamic_buffer> buf;
+		std::string error;
+	};
+
+	const config _config;
+	const std::vector<uint64_t> _market_ids;
+	const uint64_t _window;
+
+	std::mutex _mutex;
+	std::condition_variable _cond_var;
+	bool _stopped;
+	// Sequence number of the next market to be claimed by a loader and the
+	// next to be delivered to the consumer. Sequence numbers increase
+	// without bound, the market is the sequence number modulo the number of
+	// markets and the slot it is held in modulo the window.
+	uint64_t _next_load;
+	uint64_t _next_consume;
+	std::vector<slot> _slots;
+
+	std::vector<std::thread> _loaders;
+
+	void loader_fn();
+};
+} // namespace janus
@@ -12,59 +12,95 @@ static constexpr uint64_t MAX_PRICEX100 = 100000;
 static constexpr uint64_t INVALID_PRICE_INDEX = static_cast<uint64_t>(-1);
 static constexpr uint64_t INVALID_PRICEX100 = static_cast<uint64_t>(-2);
 
+// A band of prices sharing the same tick size. Prices in the band are those
+// above from_pricex100 up to and including to_pricex100, from_pricex100 itself
+// being the last price of the previous band.
+struct price_band
+{
+	uint64_t from_pricex100;
+	uint64_t to_pricex100;
+	uint64_t tick;
+	// Price index of from_pricex100.
+	uint64_t from_index;
+};
+
+static constexpr uint64_t NUM_PRICE_BANDS = 10;
+
+// The betfair price bands. The first band starts at 1.00, which is not itself a
+// valid price, hence its index wraps to INVALID_PRICE_INDEX.
+static constexpr std::array<price_band, NUM_PRICE_BANDS> PRICE_BANDS = {{
+	{100, 200, 1, INVALID_PRICE_INDEX},
+	{200, 300, 2, 99},
+	{300, 400, 5, 149},
+	{400, 600, 10, 169},
+	{600, 1000, 20, 189},
+	{1000, 2000, 50, 209},
+	{2000, 3000, 100, 229},
+	{3000, 5000, 200, 239},
+	{5000, 10000, 500, 249},
+	{10000, 100000, 1000, 259},
+}};
+
 // Represents the valid range of prices (i.e. odds) and provides methods to find
 // nearest prices, map between index and price and so on.
+//
+// Mappings from pricex100 to price index are calculated from the price bands
+// rather than looked up, so the price range holds no state and all methods are
+// static. Instances are retained for convenience and are free to construct.
 class price_range
 {
 public:
-	// Initialise price range, this populates the price map.
-	price_range() // NOLINT: We initialise price_map in the ctor body.
-	{
-		populate_price_map();
-	}
-
 	// The [] operator returns pricex100 values as these are more accurate
 	// and easier to work with.
-	auto operator[](uint64_t i) -> uint64_t
+	constexpr auto operator[](uint64_t i) const -> uint64_t
 	{
 		return index_to_pricex100(i);
 	}
 
 	// Obtain pricex100 value at specified price index. Note that the index
 	// is NOT checked.
-	static auto index_to_pricex100(uint64_t i) -> uint64_t
+	static constexpr auto index_to_pricex100(uint64_t i) -> uint64_t
 	{
 		return PRICESX100[i];
 	}
 
 	// Obtain floating point price value at specified price index. Note that the
 	// index is NOT checked.
-	static auto index_to_price(uint64_t i) -> double
+	static constexpr auto index_to_price(uint64_t i) -> double
 	{
 		return PRICES[i];
 	}
 
 	// Obtain the NEAREST price index of the specified pricex100, rounding
 	// down, e.g. 627 -> index of 620.
-	// Note that the pricex100 is NOT checked, i.e. if it is larger than
-	// MAX_PRICEX100 this will buffer overflow.
-	auto pricex100_to_nearest_index(uint64_t pricex100) const -> uint64_t
+	// If the pricex100 is less than MIN_PRICEX100 or greater than
+	// MAX_PRICEX100 then INVALID_PRICE_INDEX is returned.
+	static constexpr auto pricex100_to_nearest_index(uint64_t pricex100) -> uint64_t
 	{
-		return _price_map[pricex100];
+		if (pricex100 < MIN_PRICEX100 || pricex100 > MAX_PRICEX100)
+			return INVALID_PRICE_INDEX;
+
+		const price_band& band = find_band(pricex100);
+		return band.from_index + (pricex100 - band.from_pricex100) / band.tick;
 	}
 
 	// Obtain the NEAREST price index of the specified pricex100, rounding
 	// UP, e.g. 627 -> index of 640.
-	// Note that the pricex100 is NOT checked, i.e. if it is larger than
-	// MAX_PRICEX100 this will buffer overflow.
-	auto pricex100_to_nearest_index_up(uint64_t pricex100) const -> uint64_t
+	// If the pricex100 is less than MIN_PRICEX100 or greater than
+	// MAX_PRICEX100 then INVALID_PRICE_INDEX is returned.
+	static constexpr auto pricex100_to_nearest_index_up(uint64_t pricex100) -> uint64_t
 	{
-		return _price_map_up[pricex100];
+		if (pricex100 < MIN_PRICEX100 || pricex100 > MAX_PRICEX100)
+			return INVALID_PRICE_INDEX;
+
+		const price_band& band = find_band(pricex100);
+		return band.from_index +
+		       (pricex100 - band.from_pricex100 + band.tick - 1) / band.tick;
 	}
 
 	// Obtain the PRECISE price index of the specified pricex100, if it is
 	// not a valid price then INVALID_PRICE_INDEX is returned.
-	auto pricex100_to_index(uint64_t pricex100) const -> uint64_t
+	static constexpr auto pricex100_to_index(uint64_t pricex100) -> uint64_t
 	{
 		uint64_t i = pricex100_to_nearest_index(pricex100);
 		if (i == INVALID_PRICE_INDEX || index_to_pricex100(i) != pricex100)
@@ -75,10 +111,8 @@ public:
 
 	// Find the nearest pricex100 to the input pricex100, rounding down,
 	// e.g. 627 -> 620.
-	// Note that the pricex100 is NOT checked, i.e. if it is larger than
-	// MAX_PRICEX100 this will buffer overflow.
 	// If the price is not valid then INVALID_PRICEX100 is returned.
-	auto nearest_pricex100(uint64_t pricex100) const -> uint64_t
+	static constexpr auto nearest_pricex100(uint64_t pricex100) -> uint64_t
 	{
 		uint64_t i = pricex100_to_nearest_index(pricex100);
 		if (i == INVALID_PRICE_INDEX)
@@ -87,12 +121,65 @@ public:
 		return index_to_pricex100(i);
 	}
 
+	// Find the nearest pricex100 to the input pricex100, rounding up,
+	// e.g. 627 -> 640.
+	// If the price is not valid then INVALID_PRICEX100 is returned.
+	static constexpr auto nearest_pricex100_up(uint64_t pricex100) -> uint64_t
+	{
+		uint64_t i = pricex100_to_nearest_index_up(pricex100);
+		if (i == INVALID_PRICE_INDEX)
+			return INVALID_PRICEX100;
+
+		return index_to_pricex100(i);
+	}
+
+	// Offset the specified price index by the specified number of ticks,
+	// positive being towards longer odds. If the result lies outside of the
+	// price range then INVALID_PRICE_INDEX is returned.
+	static constexpr auto offset_index(uint64_t i, int64_t ticks) -> uint64_t
+	{
+		int64_t offset = static_cast<int64_t>(i) + ticks;
+		if (i == INVALID_PRICE_INDEX || offset < 0 ||
+		    offset >= static_cast<int64_t>(NUM_PRICES))
+			return INVALID_PRICE_INDEX;
+
+		return static_cast<uint64_t>(offset);
+	}
+
+	// Offset the specified pricex100 by the specified number of ticks,
+	// rounding it down to a valid price first. If the result lies outside of
+	// the price range then INVALID_PRICEX100 is returned.
+	static constexpr auto offset_pricex100(uint64_t pricex100, int64_t ticks) -> uint64_t
+	{
+		uint64_t i = offset_index(pricex100_to_nearest_index(pricex100), ticks);
+		if (i == INVALID_PRICE_INDEX)
+			return INVALID_PRICEX100;
+
+		return index_to_pricex100(i);
+	}
+
+	// Obtain the number of ticks between the specified price indexes,
+	// positive if to is at longer odds than from. Note that the indexes are
+	// NOT checked.
+	static constexpr auto tick_distance(uint64_t from, uint64_t to) -> int64_t
+	{
+		return static_cast<int64_t>(to) - static_cast<int64_t>(from);
+	}
+
+	// Obtain the number of ticks between the specified pricex100s, each
+	// rounded down to a valid price. Note that the pricex100s are NOT
+	// checked.
+	static constexpr auto pricex100_tick_distance(uint64_t from, uint64_t to) -> int64_t
+	{
+		return tick_distance(pricex100_to_nearest_index(from),
+				     pricex100_to_nearest_index(to));
+	}
+
 	// Find the index of the nearest price to the specified price, rounding
 	// the price such that 6.19999 is correctly rounded to 6.2, and rounding
 	// down such that 6.27 -> index of 6.2.
-	// Note that the price is NOT checked, i.e. if it is larger than 1000
-	// this will buffer overflow.
-	auto price_to_nearest_index(double price) const -> uint64_t
+	// If the price is out of range then INVALID_PRICE_INDEX is returned.
+	static auto price_to_nearest_index(double price) -> uint64_t
 	{
 		// Round to price x 10,000, which should help avoid rounding
 		// errors, but divide DOWN to x 100 in order that we maintain
@@ -106,9 +193,8 @@ public:
 	// Find the index of the nearest price to the specified price, rounding
 	// the price such that 6.19999 is correctly rounded to 6.2, and rounding
 	// UP such that 6.27 -> index of 6.4.
-	// Note that the price is NOT checked, i.e. if it is larger than 1000
-	// this will buffer overflow.
-	auto price_to_nearest_index_up(double price) const -> uint64_t
+	// If the price is out of range then INVALID_PRICE_INDEX is returned.
+	static auto price_to_nearest_index_up(double price) -> uint64_t
 	{
 		uint64_t pricex10000 = price * 10000.; // NOLINT: Not magical.
 		uint64_t pricex100 =
@@ -119,9 +205,8 @@ public:
 	// Find the nearest pricex100 to the specified price, rounding the price
 	// such that 6.19999 is correctly rounded to 6.2, and rounding down such
 	// that 6.27 -> 620.
-	// Note that the price is NOT checked, i.e. if it is larger than 1000
-	// this will buffer overflow.
-	auto price_to_nearest_pricex100(double price) const -> uint64_t
+	// If the price is out of range then INVALID_PRICEX100 is returned.
+	static auto price_to_nearest_pricex100(double price) -> uint64_t
 	{
 		uint64_t i = price_to_nearest_index(price);
 		if (i == INVALID_PRICE_INDEX)
@@ -192,41 +277,39 @@ private:
 		99000, 100000,
 	};
 
-	// Perfect hash mapping from pricex100 to price index. It maps to the
-	// nearest price rounding down, e.g. 627 -> 620.
-	std::array<uint64_t, MAX_PRICEX100 + 1> _price_map;
-
-	// Perfect hash mapping from pricex100 to price index. It maps to the
-	// nearest price rounding up, e.g. 627 -> 640.
-	std::array<uint64_t, MAX_PRICEX100 + 1> _price_map_up;
-
-	// Populate the price map array.
-	void populate_price_map()
+	// Find the band containing the specified pricex100, which must be in
+	// range. There are few enough bands that a linear scan is cheaper than
+	// a lookup table.
+	static constexpr auto find_band(uint64_t pricex100) -> const price_band&
 	{
-		// All values less than the minimum pricex100 (101) are marked
-		// as invalid.
-		for (uint64_t i = 0; i < MIN_PRICEX100; i++) {
-			_price_map[i] = INVALID_PRICE_INDEX;
-			_price_map_up[i] = INVALID_PRICE_INDEX;
+		uint64_t i = 0;
+		while (pricex100 > PRICE_BANDS[i].to_pricex100) {
+			i++;
 		}
 
-		// For the rest we map the nearest price less than or equal to
-		// the index. This allows for 'fuzzy' matching while still
-		// allowing precise matching by comparing
-		// PRICESX100[price_index] == pricex100.
-		int price_index = 0;
-		int price_index_up = 0;
-		for (uint64_t i = MIN_PRICEX100; i < MAX_PRICEX100; i++) {
-			if (i == PRICESX100[price_index + 1])
-				price_index++;
-			if (i > PRICESX100[price_index_up])
-				price_index_up++;
-
-			_price_map[i] = price_index;
-			_price_map_up[i] = price_index_up;
-		}
-		_price_map[MAX_PRICEX100] = NUM_PRICES - 1;
-		_price_map_up[MAX_PRICEX100] = NUM_PRICES - 1;
+		return PRICE_BANDS[i];
 	}
 };
+
+// Check that the price bands agree with the price table, including that every
+// price maps back to its own index.
+static constexpr auto check_price_bands() -> bool
+{
+	for (uint64_t i = 0; i < NUM_PRICES; i++) {
+		uint64_t pricex100 = price_range::index_to_pricex100(i);
+		if (price_range::pricex100_to_nearest_index(pricex100) != i ||
+		    price_range::pricex100_to_nearest_index_up(pricex100) != i)
+			return false;
+	}
+
+	for (uint64_t i = 1; i < NUM_PRICE_BANDS; i++) {
+		const price_band& band = PRICE_BANDS[i];
+		if (band.from_pricex100 != PRICE_BANDS[i - 1].to_pricex100 ||
+		    price_range::index_to_pricex100(band.from_index) != band.from_pricex100)
+			return false;
+	}
+
+	return PRICE_BANDS[NUM_PRICE_BANDS - 1].to_pricex100 == MAX_PRICEX100;
+}
+static_assert(check_price_bands());
 } // namespace janus::betfair
@@ -0,0 +1,375 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+namespace janus
+{
+// Number of times a waiter polls before yielding or blocking.
+static constexpr uint64_t QUEUE_SPIN_LIMIT = 128;
+
+// Hint to the CPU that we are spinning.
+static inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+// Wait policy which polls until the awaited value changes, yielding the CPU
+// after QUEUE_SPIN_LIMIT polls. Lowest latency but burns a core while waiting.
+struct spin_wait
+{
+	// Waiters never sleep so never need waking.
+	static constexpr bool SLEEPS = false;
+
+	// Wait until val no longer holds old.
+	template<typename T>
+	static void wait(const std::atomic<T>& val, T old)
+	{
+		for (uint64_t i = 0; val.load(std::memory_order_acquire) == old; i++) {
+			if (i < QUEUE_SPIN_LIMIT)
+				cpu_relax();
+			else
+				std::this_thread::yield();
+		}
+	}
+
+	// Waiters poll so there is nothing to do.
+	template<typename T>
+	static void notify(std::atomic<T>& val)
+	{
+	}
+};
+
+// Wait policy which polls briefly then sleeps until notified, so waiting
+// threads don't consume CPU.
+struct block_wait
+{
+	static constexpr bool SLEEPS = true;
+
+	// Wait until val no longer holds old.
+	template<typename T>
+	static void wait(const std::atomic<T>& val, T old)
+	{
+		for (uint64_t i = 0; i < QUEUE_SPIN_LIMIT; i++) {
+			if (val.load(std::memory_order_acquire) != old)
+				return;
+			cpu_relax();
+		}
+
+		while (val.load(std::memory_order_acquire) == old) {
+			val.wait(old, std::memory_order_acquire);
+		}
+	}
+
+	// Wake any threads waiting on val.
+	template<typename T>
+	static void notify(std::atomic<T>& val)
+	{
+		val.notify_all();
+	}
+};
+
+// Round up to the next power of 2, throwing if zero.
+static inline auto queue_capacity(uint64_t cap) -> uint64_t
+{
+	if (cap == 0)
+		throw std::runtime_error("Queue capacity must be non-zero");
+
+	uint64_t ret = 1;
+	while (ret < cap)
+		ret <<= 1;
+	return ret;
+}
+
+// A bounded lock-free single-producer, single-consumer ring queue. Capacity is
+// rounded up to a power of 2. Each side caches the other's index so it only
+// touches the other's cache line when the queue appears full or empty.
+//
+// With a sleeping wait policy a side only notifies when the other may be
+// waiting, i.e. the queue was empty or full. Each side issues a full fence
+// between publishing its index and reading the other's before deciding, so
+// either the waiter sees the new index or the notifier sees it waiting.
+template<typename T, typename WaitPolicy = block_wait>
+class spsc_queue
+{
+public:
+	explicit spsc_queue(uint64_t cap)
+		: _cap{queue_capacity(cap)},
+		  _mask{_cap - 1},
+		  _slots{std::make_unique<T[]>(_cap)} // NOLINT: Can't use std::array here.
+	{
+	}
+
+	// Indexes are shared between threads so cannot be copied or moved.
+	spsc_queue(const spsc_queue&) = delete;
+	spsc_queue(spsc_queue&&) = delete;
+	auto operator=(const spsc_queue&) -> spsc_queue& = delete;
+	auto operator=(spsc_queue&&) -> spsc_queue& = delete;
+	~spsc_queue() = default;
+
+	// Get the capacity of the queue.
+	auto cap() const -> uint64_t
+	{
+		return _cap;
+	}
+
+	// Push a value, returning false if the queue is full. Producer only.
+	auto try_push(T val) -> bool
+	{
+		uint64_t tail = _producer.index.load(std::memory_order_relaxed);
+		if (tail - _producer.cached >= _cap) {
+			_producer.cached = _consumer.index.load(std::memory_order_acquire);
+			if (tail - _producer.cached >= _cap)
+				return false;
+		}
+
+		publish(tail, std::move(val));
+		return true;
+	}
+
+	// Push a value, waiting for space if the queue is full. Producer only.
+	void push(T val)
+	{
+		uint64_t tail = _producer.index.load(std::memory_order_relaxed);
+		while (tail - _producer.cached >= _cap) {
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			_producer.cached = _consumer.index.load(std::memory_order_acquire);
+			if (tail - _producer.cached >= _cap)
+				WaitPolicy::wait(_consumer.index, _producer.cached);
+		}
+
+		publish(tail, std::move(val));
+	}
+
+	// Pop a value into out, returning false if the queue is empty. Consumer
+	// only.
+	auto try_pop(T& out) -> bool
+	{
+		uint64_t head = _consumer.index.load(std::memory_order_relaxed);
+		if (head == _consumer.cached) {
+			_consumer.cached = _producer.index.load(std::memory_order_acquire);
+			if (head == _consumer.cached)
+				return false;
+		}
+
+		out = consume(head);
+		return true;
+	}
+
+	// Pop a value, waiting for one if the queue is empty. Consumer only.
+	auto pop() -> T
+	{
+		uint64_t head = _consumer.index.load(std::memory_order_relaxed);
+		while (head == _consumer.cached) {
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			_consumer.cached = _producer.index.load(std::memory_order_acquire);
+			if (head == _consumer.cached)
+				WaitPolicy::wait(_producer.index, _consumer.cached);
+		}
+
+		return consume(head);
+	}
+
+private:
+	// The index each side advances along with its cached copy of the
+	// other's, each on its own cache line so the sides don't contend.
+	struct alignas(64) side // NOLINT: Not magical, cache line size.
+	{
+		std::atomic<uint64_t> index;
+		uint64_t cached;
+	};
+
+	const uint64_t _cap;
+	const uint64_t _mask;
+	std::unique_ptr<T[]> _slots; // NOLINT: Can't use std::array here.
+	side _producer = {};
+	side _consumer = {};
+
+	void publish(uint64_t tail, T&& val)
+	{
+		_slots[tail & _mask] = std::move(val);
+		_producer.index.store(tail + 1, std::memory_order_release);
+
+		if constexpr (WaitPolicy::SLEEPS) {
+			// The consumer can only be waiting if the queue was empty.
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (_consumer.index.load(std::memory_order_relaxed) == tail)
+				WaitPolicy::notify(_producer.index);
+		}
+	}
+
+	auto consume(uint64_t head) -> T
+	{
+		T ret = std::move(_slots[head & _mask]);
+		_consumer.index.store(head + 1, std::memory_order_release);
+
+		if constexpr (WaitPolicy::SLEEPS) {
+			// The producer can only be waiting if the queue was full.
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (_producer.index.load(std::memory_order_relaxed) - head == _cap)
+				WaitPolicy::notify(_consumer.index);
+		}
+		return ret;
+	}
+};
+
+// A bounded lock-free multi-producer, single-consumer ring queue. Capacity is
+// rounded up to a power of 2. Each slot carries a sequence number indicating
+// whether it is free for the producer claiming that position or holds a value
+// for the consumer, so producers only contend on claiming positions. As with
+// spsc_queue, sleeping waiters are only notified when they may be waiting.
+template<typename T, typename WaitPolicy = block_wait>
+class mpsc_queue
+{
+public:
+	explicit mpsc_queue(uint64_t cap)
+		: _cap{queue_capacity(cap)},
+		  _mask{_cap - 1},
+		  _slots{std::make_unique<slot[]>(_cap)}, // NOLINT: Can't use std::array here.
+		  _tail{0},
+		  _head{0}
+	{
+		for (uint64_t i = 0; i < _cap; i++) {
+			_slots[i].seq.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	// Slots are shared between threads so cannot be copied or moved.
+	mpsc_queue(const mpsc_queue&) = delete;
+	mpsc_queue(mpsc_queue&&) = delete;
+	auto operator=(const mpsc_queue&) -> mpsc_queue& = delete;
+	auto operator=(mpsc_queue&&) -> mpsc_queue& = delete;
+	~mpsc_queue() = default;
+
+	// Get the capacity of the queue.
+	auto cap() const -> uint64_t
+	{
+		return _cap;
+	}
+
+	// Push a value, returning false if the queue is full. Any thread.
+	auto try_push(T val) -> bool
+	{
+		uint64_t pos = _tail.load(std::memory_order_relaxed);
+		while (true) {
+			slot& slot = _slots[pos & _mask];
+			uint64_t seq = slot.seq.load(std::memory_order_acquire);
+			if (seq == pos) {
+				// Free for this position, claim it.
+				if (_tail.compare_exchange_weak(pos, pos + 1,
+								std::memory_order_relaxed)) {
+					publish(slot, pos, std::move(val));
+					return true;
+				}
+			} else if (seq < pos) {
+				// Still holds the value from a lap ago.
+				return false;
+			} else {
+				// Another producer claimed it, move on.
+				pos = _tail.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	// Push a value, waiting for space if the queue is full. Any thread.
+	void push(T val)
+	{
+		uint64_t pos = _tail.fetch_add(1, std::memory_order_relaxed);
+		slot& slot = _slots[pos & _mask];
+
+		// Wait for the consumer to free the slot from a lap ago.
+		uint64_t seq;
+		while ((seq = slot.seq.load(std::memory_order_acquire)) != pos) {
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			seq = slot.seq.load(std::memory_order_acquire);
+			if (seq != pos)
+				WaitPolicy::wait(slot.seq, seq);
+		}
+
+		publish(slot, pos, std::move(val));
+	}
+
+	// Pop a value into out, returning false if the queue is empty. Consumer
+	// only.
+	auto try_pop(T& out) -> bool
+	{
+		uint64_t head = _head.load(std::memory_order_relaxed);
+		slot& slot = _slots[head & _mask];
+		if (slot.seq.load(std::memory_order_acquire) != head + 1)
+			return false;
+
+		out = consume(slot, head);
+		return true;
+	}
+
+	// Pop a value, waiting for one if the queue is empty. Consumer only.
+	auto pop() -> T
+	{
+		uint64_t head = _head.load(std::memory_order_relaxed);
+		slot& slot = _slots[head & _mask];
+		uint64_t seq;
+		while ((seq = slot.seq.load(std::memory_order_acquire)) != head + 1) {
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			seq = slot.seq.load(std::memory_order_acquire);
+			if (seq != head + 1)
+				WaitPolicy::wait(slot.seq, seq);
+		}
+
+		return consume(slot, head);
+	}
+
+private:
+	// A slot is free for the producer of position pos when its sequence
+	// number is pos, and holds that producer's value when it is pos + 1.
+	struct alignas(64) slot // NOLINT: Not magical, cache line size.
+	{
+		std::atomic<uint64_t> seq;
+		T val;
+	};
+
+	const uint64_t _cap;
+	const uint64_t _mask;
+	std::unique_ptr<slot[]> _slots; // NOLINT: Can't use std::array here.
+	alignas(64) std::atomic<uint64_t> _tail; // NOLINT: Not magical, cache line size.
+	// Only written by the consumer, read by producers deciding whether to
+	// notify it.
+	alignas(64) std::atomic<uint64_t> _head; // NOLINT: Not magical, cache line size.
+
+	void publish(slot& slot, uint64_t pos, T&& val)
+	{
+		slot.val = std::move(val);
+		slot.seq.store(pos + 1, std::memory_order_release);
+
+		if constexpr (WaitPolicy::SLEEPS) {
+			// The consumer can only be waiting on this slot if it is
+			// next.
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (_head.load(std::memory_order_relaxed) == pos)
+				WaitPolicy::notify(slot.seq);
+		}
+	}
+
+	auto consume(slot& slot, uint64_t head) -> T
+	{
+		T ret = std::move(slot.val);
+		// Free the slot for the producer a lap from now.
+		_head.store(head + 1, std::memory_order_relaxed);
+		slot.seq.store(head + _cap, std::memory_order_release);
+
+		if constexpr (WaitPolicy::SLEEPS) {
+			// A producer can only be waiting on this slot if it has
+			// claimed that position.
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (_tail.load(std::memory_order_relaxed) > head + _cap)
+				WaitPolicy::notify(slot.seq);
+		}
+		return ret;
+	}
+};
+} // namespace janus
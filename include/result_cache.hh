@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace janus
+{
+// Identifies a file as holding the cached results of a market.
+static constexpr uint64_t RESULT_CACHE_MAGIC = 0x544c5345524e414a; // "JANRESLT"
+// Version of the result cache file format, incremented on incompatible changes
+// so that stale results are recomputed.
+static constexpr uint64_t RESULT_CACHE_FORMAT_VERSION = 1;
+// Period after which the results of strategy versions which haven't been used
+// are evicted when a result cache is opened, in ms.
+static constexpr uint64_t RESULT_CACHE_MAX_IDLE_MS = 7 * 24 * 60 * 60 * 1000UL;
+
+// The header of a market's result cache file, followed by num_results results
+// of result_size bytes each.
+struct result_cache_header
+{
+	uint64_t magic;
+	uint64_t format_version;
+	uint64_t key_hash;
+	uint64_t strategy_version;
+	uint64_t market_id;
+	uint64_t data_version;
+	uint64_t result_size;
+	uint64_t num_results;
+};
+
+// Get the directory holding cached results for the specified key hash and
+// strategy version within the specified root.
+auto get_result_cache_dir(const std::string& root, uint64_t key_hash, uint64_t strategy_version)
+	-> std::string;
+
+// Remove the directories of results cached under root, other than that of the
+// specified key hash and strategy version, which haven't been used for
+// RESULT_CACHE_MAX_IDLE_MS. Other versions of a strategy may yet be used
+// again, e.g. by another build, so are only removed once idle. Returns the
+// number of directories removed.
+auto evict_result_caches(const std::string& root, uint64_t key_hash, uint64_t strategy_version)
+	-> uint64_t;
+
+// The results of replaying each market with a version of a strategy, cached on
+// disk so that later runs need only replay new or changed markets. Results are
+// opaque fixed-size records kept in a file per market, under a directory named
+// after the key and version of the strategy.
+class result_cache
+{
+public:
+	// Use the cache for the specified key, typically naming the strategy,
+	// and strategy version under root, creating its directory if needed.
+	// Opening the cache records that it is in use and evicts idle results.
+	result_cache(const std::string& root, const std::string& key, uint64_t strategy_version,
+		     uint64_t result_size);
+
+	// Get the directory the results are kept in.
+	auto dir() const -> const std::string&
+	{
+		return _dir;
+	}
+
+	// Get the path of the file holding the specified market's results.
+	auto path(uint64_t market_id) const -> std::string;
+
+	// Read the cached results of the specified version of a market's data
+	// into results, returning the number read. Results which are missing,
+	// stale or unreadable are treated as absent.
+	auto read(uint64_t market_id, uint64_t data_version, std::string& results) const
+		-> uint64_t;
+
+	// Write the results of the specified version of a market's data,
+	// replacing any cached before. The results are written to a temporary
+	// file which is then renamed over the market's file so readers never
+	// see partially written results. Throws on error.
+	void write(uint64_t market_id, uint64_t data_version, const std::string& results) const;
+
+private:
+	std::string _dir;
+	uint64_t _key_hash;
+	uint64_t _strategy_version;
+	uint64_t _result_size;
+};
+} // namespace janus
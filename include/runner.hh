@@ -1,5 +1,6 @@
 #pragma once
 
+#include "dynamic_buffer.hh"
 #include "ladder.hh"
 
 #include <cstdint>
@@ -41,10 +42,16 @@ public:
 		return _state;
 	}
 
+	// Determine whether the runner can be marked won.
+	auto can_set_won() const -> bool
+	{
+		return _state == runner_state::ACTIVE || _state == runner_state::WON;
+	}
+
 	// Indicate that the event is over and the runner won.
 	void set_won()
 	{
-		if (_state != runner_state::ACTIVE && _state != runner_state::WON)
+		if (!can_set_won())
 			throw std::runtime_error("Trying to set runner won when state = " +
 						 std::to_string(static_cast<uint64_t>(_state)) +
 						 " expected ACTIVE");
@@ -119,6 +126,12 @@ public:
 		return _ladder;
 	}
 
+	// Get runner underlying ladder.
+	auto ladder() const -> const janus::betfair::ladder&
+	{
+		return _ladder;
+	}
+
 	// For convenience, the [] operator accesses the unmatched volume in the
 	// underlying ladder at the specified price index.
 	auto operator[](uint64_t price_index) -> double
@@ -146,6 +159,37 @@ public:
 		_last_timestamp = timestamp;
 	}
 
+	// Size in bytes of a runner checkpoint, including its ladder.
+	static constexpr uint64_t CHECKPOINT_SIZE = 7 * sizeof(uint64_t) + ladder::CHECKPOINT_SIZE;
+
+	// Save the state of the runner and its ladder to the specified dynamic
+	// buffer.
+	void save_checkpoint(dynamic_buffer& dyn_buf) const
+	{
+		dyn_buf.add_uint64(_id);
+		dyn_buf.add_uint64(static_cast<uint64_t>(_state));
+		dyn_buf.add(_traded_vol);
+		dyn_buf.add(_adj_factor);
+		dyn_buf.add_uint64(_ltp_price_index);
+		dyn_buf.add(_sp);
+		dyn_buf.add_uint64(_last_timestamp);
+		_ladder.save_checkpoint(dyn_buf);
+	}
+
+	// Restore the state of the runner from a checkpoint previously saved
+	// via save_checkpoint(), reading from the specified dynamic buffer. The
+	// runner ID is read by the caller in order to create the runner.
+	void load_checkpoint(dynamic_buffer& dyn_buf)
+	{
+		_state = static_cast<runner_state>(dyn_buf.read_uint64());
+		_traded_vol = dyn_buf.read<double>();
+		_adj_factor = dyn_buf.read<double>();
+		_ltp_price_index = dyn_buf.read_uint64();
+		_sp = dyn_buf.read<double>();
+		_last_timestamp = dyn_buf.read_uint64();
+		_ladder.load_checkpoint(dyn_buf);
+	}
+
 private:
 	uint64_t _id;
 	runner_state _state;
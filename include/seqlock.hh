@@ -0,0 +1,114 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <type_traits>
+
+namespace janus
+{
+// A single-writer, multi-reader double-buffered seqlock. The writer publishes
+// values without ever blocking and readers obtain consistent copies without
+// taking a lock.
+//
+// Each publication is written to the buffer readers are NOT currently directed
+// to, so a reader only has to retry if the writer publishes twice during the
+// course of a single read.
+//
+// The value type must be trivially copyable as it is copied bytewise while the
+// writer might be modifying it, with the sequence counter used to detect (and
+// discard) torn reads.
+template<typename T>
+class seqlock
+{
+	static_assert(std::is_trivially_copyable_v<T>, "seqlock requires trivially copyable type");
+
+public:
+	seqlock() : _version{0}, _bufs{} {}
+
+	// The buffers are shared between threads so cannot be copied or moved.
+	seqlock(const seqlock&) = delete;
+	seqlock(seqlock&&) = delete;
+	auto operator=(const seqlock&) -> seqlock& = delete;
+	auto operator=(seqlock&&) -> seqlock& = delete;
+	~seqlock() = default;
+
+	// Publish a new value. Must only be called from a single writer thread.
+	void store(const T& val)
+	{
+		// The writer is the only thread that modifies the version so a
+		// relaxed load is fine.
+		uint64_t version = _version.load(std::memory_order_relaxed) + 1;
+		buffer& buf = _bufs[version & 1];
+
+		// An odd sequence number indicates a write is in progress.
+		uint64_t seq = buf.seq.load(std::memory_order_relaxed);
+		buf.seq.store(seq + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		std::memcpy(&buf.val, &val, sizeof(T));
+
+		buf.seq.store(seq + 2, std::memory_order_release);
+		// Direct readers to the newly written buffer.
+		_version.store(version, std::memory_order_release);
+	}
+
+	// Attempt to read the most recently published value into out. Returns
+	// false if the read was torn by a concurrent write, in which case out
+	// is unspecified.
+	//      out: Value to copy the published value into.
+	//  version: Output parameter, set to the version of the value read, 0
+	//           if nothing has been published yet.
+	//  returns: true if the read was consistent.
+	auto try_load(T& out, uint64_t& version) const -> bool
+	{
+		version = _version.load(std::memory_order_acquire);
+		const buffer& buf = _bufs[version & 1];
+
+		uint64_t seq1 = buf.seq.load(std::memory_order_acquire);
+		if ((seq1 & 1) == 1)
+			return false;
+
+		std::memcpy(&out, &buf.val, sizeof(T));
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		uint64_t seq2 = buf.seq.load(std::memory_order_relaxed);
+		return seq1 == seq2;
+	}
+
+	// Read the most recently published value into out, retrying until a
+	// consistent copy is obtained. Returns the version of the value read, 0
+	// if nothing has been published yet.
+	auto load(T& out) const -> uint64_t
+	{
+		uint64_t version;
+		while (!try_load(out, version)) {
+			std::this_thread::yield();
+		}
+
+		return version;
+	}
+
+	// Get the version of the most recently published value, 0 if nothing
+	// has been published yet. Readers can use this to cheaply determine
+	// whether there is anything new to read.
+	auto version() const -> uint64_t
+	{
+		return _version.load(std::memory_order_acquire);
+	}
+
+private:
+	// Each buffer sits on its own cache lines so readers of one do not
+	// contend with the writer of the other.
+	struct alignas(64) buffer // NOLINT: Not magical, cache line size.
+	{
+		std::atomic<uint64_t> seq;
+		T val;
+	};
+
+	std::atomic<uint64_t> _version;
+	std::array<buffer, 2> _bufs;
+};
+} // namespace janus
@@ -1,26 +1,128 @@
 #pragma once
 
 #include "bet.hh"
-#include "dynamic_array.hh"
+#include "dynamic_buffer.hh"
 #include "market.hh"
 
 #include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
 #include <vector>
 
 namespace janus
 {
+// Maximum number of bets a single sim will accept.
 static constexpr uint64_t MAX_SIM_BETS = 10000;
+// Number of bets allocated at a time by a sim bet pool.
+static constexpr uint64_t SIM_BET_POOL_CHUNK_SIZE = 64;
 // Represents the target volume we specify if the bet is at an invalid level.
 static constexpr double INVALID_PRICE_TARGET_VOL = 1e20;
 
+// Growable storage for simulated bets. Bets are allocated in chunks so they
+// don't move as the pool grows, and clearing the pool retains its chunks so
+// it can be reused by successive sims without reallocating.
+class sim_bet_pool
+{
+public:
+	sim_bet_pool() : _size{0} {}
+	~sim_bet_pool()
+	{
+		clear();
+	}
+
+	// Sims hold pointers to bets in the pool.
+	sim_bet_pool(const sim_bet_pool&) = delete;
+	sim_bet_pool(sim_bet_pool&&) = delete;
+	auto operator=(const sim_bet_pool&) -> sim_bet_pool& = delete;
+	auto operator=(sim_bet_pool&&) -> sim_bet_pool& = delete;
+
+	// Retrieve MUTABLE bet at specific index UNCHECKED.
+	auto operator[](uint64_t i) -> bet&
+	{
+		return *get_ptr(i);
+	}
+
+	// Retrieve bet at specific index UNCHECKED.
+	auto operator[](uint64_t i) const -> const bet&
+	{
+		return *get_ptr(i);
+	}
+
+	// Obtain the number of bets in the pool.
+	auto size() const -> uint64_t
+	{
+		return _size;
+	}
+
+	// Obtain the number of bets the pool can hold before allocating.
+	auto capacity() const -> uint64_t
+	{
+		return _chunks.size() * SIM_BET_POOL_CHUNK_SIZE;
+	}
+
+	// Emplace a bet at the back of the pool, allocating a new chunk if
+	// full. Returns a reference to the newly emplaced bet.
+	template<typename... Args>
+	auto emplace_back(Args&&... args) -> bet&
+	{
+		if (_size == capacity())
+			_chunks.push_back(std::make_unique<chunk>());
+
+		return *new (get_ptr(_size++)) bet(std::forward<Args>(args)...);
+	}
+
+	// Destruct all bets, retaining allocated chunks.
+	void clear()
+	{
+		for (uint64_t i = 0; i < _size; i++) {
+			get_ptr(i)->~bet();
+		}
+		_size = 0;
+	}
+
+private:
+	// Raw storage for bets, constructed in place as they are added.
+	struct chunk
+	{
+		alignas(bet) uint8_t raw[sizeof(bet) * SIM_BET_POOL_CHUNK_SIZE]; // NOLINT
+	};
+
+	std::vector<std::unique_ptr<chunk>> _chunks;
+	uint64_t _size;
+
+	auto get_ptr(uint64_t i) const -> bet*
+	{
+		chunk& chunk = *_chunks[i / SIM_BET_POOL_CHUNK_SIZE];
+		return reinterpret_cast<bet*>(
+			&chunk.raw[sizeof(bet) * (i % SIM_BET_POOL_CHUNK_SIZE)]);
+	}
+};
+
 class sim
 {
 public:
-	using bets_t = dynamic_array<bet, MAX_SIM_BETS>;
+	using bets_t = sim_bet_pool;
 
+	// Create a sim which allocates its own bets.
 	explicit sim(betfair::price_range& range, betfair::market& market)
-		: _range{range}, _market{market}, _next_bet_id{0}, _went_inplay{false}
+		: _range{range},
+		  _market{market},
+		  _own_bets{std::make_unique<sim_bet_pool>()},
+		  _bets{*_own_bets},
+		  _next_bet_id{0},
+		  _went_inplay{false}
+	{
+		init();
+	}
+
+	// Create a sim which places its bets in the specified pool, clearing
+	// it. Only one sim may use a pool at a time, reusing the pool across
+	// sims avoids allocating for each.
+	explicit sim(betfair::price_range& range, betfair::market& market, sim_bet_pool& bets)
+		: _range{range}, _market{market}, _bets{bets}, _next_bet_id{0}, _went_inplay{false}
 	{
+		_bets.clear();
 		init();
 	}
 
@@ -54,11 +156,63 @@ public:
 	// Cancel all unmatched bets.
 	void cancel_all();
 
+	// Get the size in bytes of a checkpoint of the sim.
+	auto checkpoint_size() const -> uint64_t
+	{
+		return (2 + _runners.size()) * sizeof(uint64_t);
+	}
+
+	// Save the state of the sim to the specified dynamic buffer. Only sims
+	// which have no bets can be checkpointed, throws otherwise.
+	void save_checkpoint(dynamic_buffer& dyn_buf) const;
+
+	// Restore the state of the sim from a checkpoint previously saved via
+	// save_checkpoint(), reading from the specified dynamic buffer. The sim
+	// must be of a market restored from a checkpoint taken alongside it.
+	void load_checkpoint(dynamic_buffer& dyn_buf);
+
 private:
+	// A bet which may still have unmatched volume along with what would
+	// cause it to match. These are kept compact and separate from the
+	// bets so that updates only touch bets which may have matched.
+	struct sim_trigger
+	{
+		bet* placed;
+		// Price index of the bet, INVALID_PRICE_INDEX if its price is
+		// not on the ladder in which case it never matches.
+		uint64_t price_index;
+		// Matched volume at the price beyond which the bet matches.
+		double target_matched;
+		// Matched volume at the price when last evaluated, unless this
+		// changes the bet can only match by the market moving past it.
+		double last_matched;
+		bool is_back;
+	};
+
+	// Bets placed against a runner in the market, so work is proportional
+	// to the bets on the runners concerned rather than all bets placed.
+	struct sim_runner
+	{
+		// Index of the runner in the market, which is held rather than
+		// a pointer as adding runners can move them.
+		uint64_t index;
+		// All bets on the runner in the order they were placed.
+		std::vector<bet*> bets;
+		// Triggers of bets which may still have unmatched volume,
+		// those of completed bets are dropped when next triggered.
+		std::vector<sim_trigger> active;
+		// Number of bets voided since the runner was removed.
+		uint64_t num_voided;
+		// Whether the runner's removal has been applied to all bets.
+		bool removal_applied;
+	};
+
 	betfair::price_range& _range;
 	betfair::market& _market;
-	bets_t _bets;
-	dynamic_array<bool, betfair::MAX_RUNNERS> _removed;
+	std::unique_ptr<sim_bet_pool> _own_bets;
+	sim_bet_pool& _bets;
+	// Indexed by runner index in the market.
+	std::vector<sim_runner> _runners;
 	uint64_t _next_bet_id;
 	bool _went_inplay;
 
@@ -69,26 +223,48 @@ private:
 	// Perform initialisation on object creation.
 	void init();
 
-	// Determine the matched volume for the bet's runner at the bet
-	// price. If the market has moved such that this price has now swapped
-	// side the function returns -1. If better price available, sets bet to
-	// that price.
-	auto get_matched(bet& bet, betfair::runner& runner, bool first) -> double;
+	// Track any runners added to the market since we last checked.
+	void sync_runners();
 
-	// Determine the target matched volume for the bet's runner at the bet
-	// price. If the market has moved such that this price has now swapped
+	// Determine the matched volume for the bet's runner at the bet's price
+	// index. If the market has moved such that this price has now swapped
 	// side the function returns -1. If better price available, sets bet to
 	// that price.
-	auto get_target_matched(bet& bet, betfair::runner& runner) -> double;
+	auto get_matched(bet& bet, betfair::runner& runner, uint64_t price_index, bool first)
+		-> double;
+
+	// Determine the target matched volume for the bet's runner at the bet's
+	// price index. If the market has moved such that this price has now
+	// swapped side the function returns -1. If better price available, sets
+	// bet to that price.
+	auto get_target_matched(bet& bet, betfair::runner& runner, uint64_t price_index)
+		-> double;
+
+	// Get the market's runner which the specified sim runner tracks.
+	auto market_runner(const sim_runner& runner) -> betfair::runner&
+	{
+		return _market[runner.index];
+	}
+
+	// Look up specific runner in the attached market, returns nullptr if
+	// not present.
+	auto get_runner(uint64_t id) -> sim_runner*;
+
+	// Look up specific runner in the attached market, throwing if not
+	// present.
+	auto find_runner(uint64_t id) -> sim_runner&;
 
-	// Look up specific runner in the attached market.
-	auto find_runner(uint64_t id) -> betfair::runner&;
+	// Update an individual bet on the specified runner.
+	void update_bet(bet& bet, betfair::runner& runner);
 
-	// Determine if the runner associated with the bet won.
-	auto runner_won(bet& bet) -> bool;
+	// Update the bet of a trigger given the ladder and its top of book,
+	// only touching the bet if it may have matched. Returns true if the bet
+	// was touched.
+	auto fire_trigger(sim_trigger& trigger, const betfair::ladder& ladder, uint64_t max_atb,
+			  uint64_t min_atl) -> bool;
 
-	// Update an individual bet.
-	void update_bet(bet& bet);
+	// Update the runner's active bets, dropping those which complete.
+	void update_runner(sim_runner& runner);
 
 	// Apply a removal to all bets.
 	void apply_removal(double adj_factor);
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "market.hh"
+#include "runner.hh"
+#include "seqlock.hh"
+
+#include <array>
+#include <cstdint>
+
+namespace janus::betfair
+{
+// Number of price levels on each side of the ladder captured in a snapshot.
+static constexpr uint64_t SNAPSHOT_LADDER_LEVELS = 10;
+
+// A compact copy of a runner's state and the top of its ladder.
+struct runner_snapshot
+{
+	uint64_t id;
+	runner_state state;
+	uint64_t ltp;
+	double traded_vol;
+	double adj_factor;
+
+	uint64_t num_atl;
+	std::array<uint64_t, SNAPSHOT_LADDER_LEVELS> atl_price_indexes;
+	std::array<double, SNAPSHOT_LADDER_LEVELS> atl_vols;
+
+	uint64_t num_atb;
+	std::array<uint64_t, SNAPSHOT_LADDER_LEVELS> atb_price_indexes;
+	std::array<double, SNAPSHOT_LADDER_LEVELS> atb_vols;
+};
+
+// A compact copy of a market's state suitable for publishing to other threads.
+struct market_snapshot
+{
+	uint64_t id;
+	market_state state;
+	bool inplay;
+	double traded_vol;
+	uint64_t last_timestamp;
+
+	uint64_t num_runners;
+	std::array<runner_snapshot, MAX_RUNNERS> runners;
+};
+
+// Publishes market snapshots from the thread applying updates to any number of
+// reader threads, e.g. at each timestamp boundary. Readers never block the
+// writer.
+using market_snapshot_publisher = seqlock<market_snapshot>;
+
+// Populate a runner snapshot from the specified runner.
+static inline void make_runner_snapshot(runner& runner, runner_snapshot& snap)
+{
+	snap.id = runner.id();
+	snap.state = runner.state();
+	snap.ltp = runner.ltp();
+	snap.traded_vol = runner.traded_vol();
+	snap.adj_factor = runner.adj_factor();
+
+	const ladder& ladder = runner.ladder();
+	snap.num_atl = ladder.best_atl(SNAPSHOT_LADDER_LEVELS, &snap.atl_price_indexes[0],
+				       &snap.atl_vols[0]);
+	snap.num_atb = ladder.best_atb(SNAPSHOT_LADDER_LEVELS, &snap.atb_price_indexes[0],
+				       &snap.atb_vols[0]);
+}
+
+// Populate a market snapshot from the specified market.
+static inline void make_market_snapshot(market& market, market_snapshot& snap)
+{
+	snap.id = market.id();
+	snap.state = market.state();
+	snap.inplay = market.inplay();
+	snap.traded_vol = market.traded_vol();
+	snap.last_timestamp = market.last_timestamp();
+
+	uint64_t num_runners = market.num_runners();
+	snap.num_runners = num_runners;
+	for (uint64_t i = 0; i < num_runners; i++) {
+		make_runner_snapshot(market[i], snap.runners[i]);
+	}
+}
+
+// Snapshot the specified market and publish it to readers.
+//   market: Market to snapshot.
+//     snap: Scratch snapshot the market is copied into prior to publishing.
+//      pub: Publisher readers obtain the snapshot from.
+static inline void publish_market_snapshot(market& market, market_snapshot& snap,
+					   market_snapshot_publisher& pub)
+{
+	make_market_snapshot(market, snap);
+	pub.store(snap);
+}
+} // namespace janus::betfair
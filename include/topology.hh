@@ -0,0 +1,78 @@
+#pragma once
+
+#include "dynamic_buffer.hh"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace janus
+{
+// Default location of per-NUMA node information in sysfs.
+static constexpr const char* DEFAULT_NUMA_NODE_ROOT = "/sys/devices/system/node";
+
+// A NUMA node along with the CPUs on it which we are permitted to run on.
+struct numa_node
+{
+	uint64_t id;
+	std::vector<uint64_t> cpus;
+};
+
+// The NUMA nodes of the machine which have CPUs we are permitted to run on,
+// ordered by node ID.
+struct cpu_topology
+{
+	std::vector<numa_node> nodes;
+
+	// Get the total number of CPUs across all nodes.
+	auto num_cpus() const -> uint64_t
+	{
+		uint64_t ret = 0;
+		for (const auto& node : nodes) {
+			ret += node.cpus.size();
+		}
+		return ret;
+	}
+};
+
+// The CPU a worker is pinned to and the index of its node in the topology.
+struct worker_placement
+{
+	uint64_t cpu;
+	uint64_t node;
+};
+
+// Parse a sysfs CPU list such as "0-3,8,10-11" into a sorted list of CPUs.
+// Throws on malformed input.
+auto parse_cpu_list(const std::string& str) -> std::vector<uint64_t>;
+
+// Get the CPUs the calling thread is permitted to run on.
+auto get_allowed_cpus() -> std::vector<uint64_t>;
+
+// Read the NUMA topology from the specified sysfs node directory, restricted
+// to the specified CPUs. If there is no NUMA information all CPUs are placed
+// on a single node 0. Nodes without any of the CPUs are omitted.
+auto read_cpu_topology(const std::string& node_root, const std::vector<uint64_t>& allowed_cpus)
+	-> cpu_topology;
+
+// Read the NUMA topology of the CPUs the calling thread is permitted to run on.
+auto get_cpu_topology() -> cpu_topology;
+
+// Place num_workers workers on distinct CPUs, spreading them across nodes in
+// turn so each node's memory bandwidth is used, then packing them onto
+// consecutive CPUs within each node. If there are more workers than CPUs
+// they wrap around. The topology must have at least one CPU.
+auto place_workers(const cpu_topology& topology, uint64_t num_workers)
+	-> std::vector<worker_placement>;
+
+// Allocate a dynamic buffer of the specified capacity in bytes without
+// touching its memory, so that its pages are placed on the NUMA node of the
+// thread which first writes to them. If huge_pages is set the kernel is
+// advised to back the buffer with transparent huge pages.
+auto make_local_buffer(uint64_t cap, bool huge_pages) -> dynamic_buffer;
+
+// Describe the placement of workers for logging, e.g. "node 0: CPUs 0,1 node
+// 1: CPUs 8".
+auto describe_placements(const cpu_topology& topology,
+			 const std::vector<worker_placement>& placements) -> std::string;
+} // namespace janus
@@ -1,17 +1,80 @@
 #pragma once
 
 #include "dynamic_array.hh"
+#include "dynamic_buffer.hh"
 #include "market.hh"
 #include "runner.hh"
+#include "snapshot.hh"
 #include "update.hh"
 
 #include <array>
 #include <cstdint>
+#include <memory>
+#include <span>
 #include <stdexcept>
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace janus::betfair
 {
+// Result of applying updates to a universe. Anything other than OK indicates a
+// fault in the update data.
+enum class apply_status
+{
+	OK,
+	// Market-specific update received prior to any market ID.
+	NO_MARKET,
+	// Runner-specific update received prior to any runner ID.
+	NO_RUNNER,
+	// Market or runner data received prior to any timestamp.
+	NO_TIMESTAMP,
+	// Timestamp prior to the last timestamp received.
+	TIMESTAMP_BACKWARDS,
+	// Price index outside of the price range.
+	INVALID_PRICE_INDEX,
+	// Update type not recognised.
+	UNKNOWN_UPDATE,
+	// Unmatched volume which would cross the book.
+	CROSSED_BOOK,
+	// Market or runner state change which is not permitted, e.g. a closed
+	// market reopening.
+	INVALID_TRANSITION,
+};
+
+static constexpr uint64_t NUM_APPLY_STATUSES =
+	static_cast<uint64_t>(apply_status::INVALID_TRANSITION) + 1;
+
+// Get name of apply status.
+static inline auto apply_status_str(apply_status status) -> const char*
+{
+	switch (status) {
+	case apply_status::OK:
+		return "OK";
+	case apply_status::NO_MARKET:
+		return "no market ID received yet";
+	case apply_status::NO_RUNNER:
+		return "no runner ID received yet";
+	case apply_status::NO_TIMESTAMP:
+		return "no timestamp received yet";
+	case apply_status::TIMESTAMP_BACKWARDS:
+		return "timestamp goes backwards";
+	case apply_status::INVALID_PRICE_INDEX:
+		return "invalid price index";
+	case apply_status::UNKNOWN_UPDATE:
+		return "unknown update type";
+	case apply_status::CROSSED_BOOK:
+		return "unmatched volume crosses the book";
+	case apply_status::INVALID_TRANSITION:
+		return "invalid state transition";
+	}
+
+	return "UNKNOWN APPLY STATUS??";
+}
+
+// Version of the universe checkpoint format, checked when restoring.
+static constexpr uint64_t CHECKPOINT_VERSION = 1;
+
 // Represents a 'universe' of markets. It has a fixed capacity of markets which
 // is specified as a template parameter.
 template<uint64_t Cap>
@@ -22,27 +85,47 @@ public:
 
 	universe()
 		: _num_markets{0},
+		  _num_evicted{0},
 		  _last_timestamp{0},
 		  _num_updates{0},
 		  _last_market{nullptr},
 		  _last_runner{nullptr},
-		  _market_ids{0}
+		  _last_runner_index{0},
+		  _market_ids{0},
+		  _num_faults{0}
 	{
 	}
 
-	// Clear universe of markets.
+	// Clear universe of markets. Watched markets remain watched.
 	void clear()
 	{
 		_markets.clear();
 		_num_markets = 0;
+		_num_evicted = 0;
 		_last_timestamp = 0;
 		_num_updates = 0;
 		_last_market = nullptr;
 		_last_runner = nullptr;
+		_last_runner_index = 0;
 		_market_ids.fill(0);
 	}
 
-	// Get MUTABLE reference to markets in universe.
+	// Get the number of faulty updates encountered with the specified
+	// status. Counts are retained when the universe is cleared.
+	auto num_faults(apply_status status) const -> uint64_t
+	{
+		return _num_faults[static_cast<uint64_t>(status)];
+	}
+
+	// Reset the counts of faulty updates.
+	void reset_num_faults()
+	{
+		_num_faults.fill(0);
+	}
+
+	// Get MUTABLE reference to markets in universe. Removing a market moves
+	// the last market into its place so this only ever contains live
+	// markets, though not necessarily in the order they were added.
 	auto markets() -> markets_t&
 	{
 		return _markets;
@@ -74,6 +157,13 @@ public:
 		return _num_markets;
 	}
 
+	// Get the number of markets evicted from the universe since it was
+	// created or last cleared.
+	auto num_evicted() const -> uint64_t
+	{
+		return _num_evicted;
+	}
+
 	// Get last timestamp universe was updated at.
 	auto last_timestamp() const -> uint64_t
 	{
@@ -117,19 +207,102 @@ public:
 		return _markets.emplace_back(id);
 	}
 
+	// Remove the market with the specified ID from the universe, freeing
+	// capacity for a subsequently added market. The last market is moved
+	// into its place, invalidating references to it. Returns false if the
+	// market does not exist.
+	auto remove_market(uint64_t id) -> bool;
+
+	// Evict all closed markets which have not been updated for at least
+	// grace_ms milliseconds prior to the last universe timestamp as
+	// remove_market() does. The market most recently updated is never
+	// evicted as the update stream may continue to reference it
+	// implicitly. Returns the number of markets evicted.
+	auto evict_closed_markets(uint64_t grace_ms) -> uint64_t;
+
+	// Publish snapshots of the market with the specified ID, which need
+	// not exist yet, to reader threads until it is removed. A snapshot is
+	// published at each timestamp boundary following updates to the
+	// market, and on publish_snapshots(). Readers take consistent copies
+	// from the returned publisher without ever blocking updates, and may
+	// keep it after the market is removed.
+	auto watch_market(uint64_t id) -> std::shared_ptr<const market_snapshot_publisher>;
+
+	// Publish snapshots of watched markets updated since they were last
+	// published, e.g. once a batch of updates ending a timestamp has been
+	// applied rather than waiting for the next timestamp.
+	void publish_snapshots();
+
+	// Get the size in bytes of a checkpoint of the universe's current
+	// state.
+	auto checkpoint_size() const -> uint64_t;
+
+	// Save the state of the universe, its markets, runners and ladders to
+	// the specified dynamic buffer, which must have at least
+	// checkpoint_size() bytes available. See doc/binary_file_format.md for
+	// the format.
+	void save_checkpoint(dynamic_buffer& dyn_buf) const;
+
+	// Restore the state of the universe from a checkpoint previously saved
+	// via save_checkpoint(), reading from the specified dynamic buffer.
+	// Existing state is cleared. Updates can then continue to be applied
+	// from the point at which the checkpoint was saved. Throws if the
+	// checkpoint is invalid.
+	void load_checkpoint(dynamic_buffer& dyn_buf);
+
 	// Apply update to universe, this might create a market, runner, or
-	// update an existing market/runner.
+	// update an existing market/runner. Throws universe_apply_error on
+	// error.
 	void apply_update(const update& update);
 
+	// Apply a sequence of updates to the universe, typically a timeslice,
+	// stopping at the first which is faulty. Faults in the update data,
+	// including crossed books and invalid state transitions, are reported
+	// via the returned status rather than thrown and counted by category
+	// (see num_faults()). Truly exceptional conditions, e.g. exceeding
+	// capacity, still throw universe_apply_error.
+	//      updates: Updates to apply in order.
+	//  num_applied: Output parameter, set to the number of updates
+	//               successfully applied. If the status is not OK then
+	//               updates[num_applied] is the faulty update.
+	//      returns: Status of the first faulty update, or OK if all were
+	//               applied.
+	auto apply_updates(std::span<const update> updates, uint64_t& num_applied)
+		-> apply_status;
+
 private:
 	uint64_t _num_markets;
+	uint64_t _num_evicted;
 	uint64_t _last_timestamp;
 	uint64_t _num_updates;
 	market* _last_market;
 	runner* _last_runner;
+	// Index of the last runner within the last market.
+	uint64_t _last_runner_index;
 	std::array<uint64_t, Cap> _market_ids;
+	// Count of faulty updates by status.
+	std::array<uint64_t, NUM_APPLY_STATUSES> _num_faults;
 	markets_t _markets;
 
+	// A market whose snapshots are published to readers.
+	struct market_watch
+	{
+		uint64_t market_id;
+		// Whether the market may have been updated since its snapshot
+		// was last published.
+		bool dirty;
+		std::unique_ptr<market_snapshot> snap;
+		std::shared_ptr<market_snapshot_publisher> pub;
+	};
+	std::vector<market_watch> _watches;
+
+	// Mark the last market's watch, if any, as needing publishing.
+	void mark_watched();
+
+	// Remove the market at the specified index, moving the last market
+	// into its place.
+	void remove_market_at(uint64_t index);
+
 	// Get pointer to market with specified ID. Returns nullptr if not
 	// found.
 	auto get_market(uint64_t id) -> market*
@@ -143,7 +316,92 @@ private:
 		return nullptr;
 	}
 
-	// Internal functions implementing apply_update().
+	// Internal functions implementing apply_update() and apply_updates().
+
+	// Pointer to member function handling a specific update type.
+	using handler_fn_t = auto (universe::*)(const update&) -> apply_status;
+
+	// Number of updates following a runner ID whose ladder lines are
+	// prefetched.
+	static constexpr uint64_t PREFETCH_UPDATES = 8;
+
+	// Generate a table of update handlers indexed by update type.
+	template<bool Resolved, uint64_t... Types>
+	static constexpr auto make_handlers(std::integer_sequence<uint64_t, Types...> /*unused*/)
+		-> std::array<handler_fn_t, sizeof...(Types)>
+	{
+		return {&universe::handle_update<static_cast<update_type>(Types), Resolved>...};
+	}
+
+	// Dispatch update to the handler for its type via a jump table. If
+	// Resolved the last market, runner and timestamp are known to be set.
+	template<bool Resolved>
+	auto dispatch_update(const update& update) -> apply_status;
+
+	// Check the preconditions for, then apply, an update of the specified
+	// type. The checks are determined at compile time for each type, and
+	// those for the last market, runner and timestamp being set are
+	// skipped if Resolved.
+	template<update_type Type, bool Resolved>
+	auto handle_update(const update& update) -> apply_status;
+
+	// Determine whether the last market, runner and timestamp are all set
+	// so updates can be dispatched without checking for them.
+	auto resolved() const -> bool
+	{
+		return _last_market != nullptr && _last_runner != nullptr && _last_timestamp != 0;
+	}
+
+	// Determine whether an update of the specified type can change whether
+	// the last market, runner and timestamp are set.
+	static constexpr auto changes_resolved(update_type type) -> bool
+	{
+		return type == update_type::TIMESTAMP || type == update_type::MARKET_ID ||
+		       type == update_type::RUNNER_ID || type == update_type::MARKET_CLEAR;
+	}
+
+	// Apply the data contained in a market/runner update of the specified
+	// type, all preconditions having been checked. Returns a status other
+	// than OK if the data is inconsistent with existing state, in which
+	// case it is not applied.
+	template<update_type Type>
+	auto apply_data(const update& update) -> apply_status;
+
+	// Record the change made by a market/runner update of the specified
+	// type in the last market's change set.
+	template<update_type Type>
+	void record_change(const update& update);
+
+	// Update the last market's cached top of book following a market/runner
+	// update of the specified type.
+	template<update_type Type>
+	void update_book();
+
+	// Update the last market's indicators following a market/runner update
+	// of the specified type. prev_matched is the matched volume at the
+	// update's price index prior to a runner matched update being applied.
+	template<update_type Type>
+	void update_indicators(market::indicators_t& indicators, const update& update,
+			       double prev_matched);
+
+	// Prefetch the ladder lines of the last runner which the specified
+	// updates, following a runner ID update, are about to modify.
+	void prefetch_ladder(std::span<const update> updates);
+
+	// Generate an error message describing a faulty update.
+	auto fault_message(apply_status status, const update& update, uint64_t prev_timestamp)
+		-> std::string;
+
+	// Get ID of last market and runner respectively for error reporting, 0
+	// if not set.
+	auto last_market_id() const -> uint64_t
+	{
+		return _last_market == nullptr ? 0 : _last_market->id();
+	}
+	auto last_runner_id() const -> uint64_t
+	{
+		return _last_runner == nullptr ? 0 : _last_runner->id();
+	}
 
 	// Apply market ID update.
 	void apply_market_id(uint64_t id);
@@ -151,15 +409,18 @@ private:
 	// Apply runner ID update.
 	void apply_runner_id(uint64_t id);
 
-	// Apply timestamp update (to universe specifically).
-	void apply_timestamp(uint64_t timestamp);
+	// Apply timestamp update (to universe specifically). Returns false if
+	// the timestamp goes backwards, though it is still adopted so that a
+	// single bad timestamp doesn't cause every one after it to fail.
+	auto apply_timestamp(uint64_t timestamp) -> bool;
 
 	// Apply clear of market, clearing mutable values in market, runners and
 	// ladders.
 	void apply_market_clear();
 
-	// Apply market state.
-	void apply_market_state(market_state state);
+	// Apply market state. Returns false if the market cannot move to the
+	// state.
+	auto apply_market_state(market_state state) -> bool;
 
 	// Apply market inplay, setting market inplay to true.
 	void apply_market_inplay();
@@ -182,15 +443,17 @@ private:
 	// Apply runner SP.
 	void apply_runner_sp(double sp);
 
-	// Apply runner won state - mark it as won.
-	void apply_runner_won();
+	// Apply runner won state - mark it as won. Returns false if the runner
+	// cannot be marked won.
+	auto apply_runner_won() -> bool;
 
 	// Apply runner matched data at specified price index.
 	void apply_runner_matched(uint64_t price_index, double vol);
 
 	// Apply runner unmatched data at specified price index, positive volume
-	// indicates ATL, negative ATB.
-	void apply_runner_unmatched(uint64_t price_index, double vol);
+	// indicates ATL, negative ATB. Returns false if the volume would cross
+	// the book.
+	auto apply_runner_unmatched(uint64_t price_index, double vol) -> bool;
 
 	// Set market timestamp to universe timestamp - invoked when
 	// market/runner update occurs.
@@ -199,9 +462,6 @@ private:
 	// Set runner timestamp to universe timestamp - invoked when runner
 	// update occurs.
 	void set_runner_timestamp();
-
-	// Underlying apply update implementation.
-	void do_apply_update(const update& update);
 };
 } // namespace janus::betfair
 
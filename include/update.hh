@@ -4,6 +4,7 @@
 #include "price_range.hh"
 
 #include <cstdint>
+#include <span>
 #include <utility>
 
 namespace janus
@@ -42,6 +43,9 @@ enum class update_type : uint32_t
 	RUNNER_WON,
 };
 
+// Number of update types, update_type values lie in [0, NUM_UPDATE_TYPES).
+static constexpr uint64_t NUM_UPDATE_TYPES = static_cast<uint64_t>(update_type::RUNNER_WON) + 1;
+
 // Get name of update type.
 static inline auto update_type_str(update_type type) -> const char*
 {
@@ -88,7 +92,7 @@ static inline auto update_type_str(update_type type) -> const char*
 }
 
 // Is the specified update type a runner-specific update?
-static inline auto is_runner_update(update_type type) -> bool
+static constexpr auto is_runner_update(update_type type) -> bool
 {
 	switch (type) {
 	// Note that runner ID is NOT a runner update, rather runne decl.
@@ -121,6 +125,34 @@ struct update
 };
 static_assert(sizeof(update) == 16); // NOLINT: Not magical.
 
+// Read all remaining updates from the specified dynamic buffer, advancing its
+// read offset to the end of the buffer. The buffer MUST contain only updates
+// from the read offset onwards. The returned span is invalidated by any
+// subsequent write to the buffer.
+static inline auto read_updates(dynamic_buffer& dyn_buf) -> std::span<const update>
+{
+	uint64_t num_updates = (dyn_buf.size() - dyn_buf.read_offset()) / sizeof(update);
+	if (num_updates == 0)
+		return {};
+
+	auto* updates = static_cast<const update*>(dyn_buf.read_raw(num_updates * sizeof(update)));
+	return {updates, num_updates};
+}
+
+// Find the index of the first timestamp update in updates at or after the
+// specified index, or updates.size() if there is none. Updates between
+// timestamps form a single 'timeslice'.
+static inline auto find_next_timestamp(std::span<const update> updates, uint64_t from) -> uint64_t
+{
+	uint64_t size = updates.size();
+	for (uint64_t i = from; i < size; i++) {
+		if (updates[i].type == update_type::TIMESTAMP)
+			return i;
+	}
+
+	return size;
+}
+
 // Generate a new timestamp update object.
 static inline auto make_timestamp_update(uint64_t timestamp) -> const update
 {
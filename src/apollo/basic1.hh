@@ -21,7 +21,7 @@ public:
 	{
 		const janus::config& config = janus::parse_config();
 
-		auto res = _analyser.run(config);
+		auto res = _analyser.run(config, {.dataset_image_key = "basic1"});
 
 		betfair::price_range range;
 		for (uint64_t price_index = 0; price_index < betfair::NUM_PRICES; price_index++) {
@@ -238,7 +238,13 @@ public:
 	{
 		const janus::config& config = janus::parse_config();
 
-		result res = _analyser.run(config);
+		// Configs only differ in thresholds so sweep them all over a
+		// single replay of each market.
+		result res = _analyser.sweep(config, TOTAL_NUM_CONFIGS,
+					     [](uint64_t lane, node_agg_state& state) {
+						     state.config_index = lane;
+					     },
+					     {.dataset_image_key = "catch1"});
 		for (uint64_t i = 0; i < TOTAL_NUM_CONFIGS; i++) {
 			std::cout << res.pls[i] << "\t" << res.num_enters[i] << "\t" << i
 				  << std::endl;
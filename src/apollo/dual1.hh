@@ -119,7 +119,13 @@ public:
 	{
 		const janus::config& config = janus::parse_config();
 
-		auto res = _analyser.run(config);
+		// Configs only differ in thresholds so sweep them all over a
+		// single replay of each market.
+		auto res = _analyser.sweep(config, TOTAL_NUM_CONFIGS_DUAL,
+					   [](uint64_t lane, node_agg_state& state) {
+						   state.config_index = lane;
+					   },
+					   {.dataset_image_key = "dual1"});
 
 		for (uint64_t i = 0; i < TOTAL_NUM_CONFIGS_DUAL; i++) {
 			std::cout << res.pls[i] << "\t" << i << "\t" << res.num_enters[i]
@@ -32,7 +32,7 @@ public:
 	{
 		const janus::config& config = janus::parse_config();
 
-		auto res = _analyser.run(config);
+		auto res = _analyser.run(config, {.dataset_image_key = "micro1"});
 		std::cout << res.pl << std::endl;
 	}
 
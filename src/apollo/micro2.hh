@@ -49,9 +49,9 @@ public:
 		const janus::config& config = janus::parse_config();
 
 #ifdef PRINT_OUT
-		auto res = _analyser.run(config, 1);
+		auto res = _analyser.run(config, {.num_cores = 1, .dataset_image_key = "micro2"});
 #else
-		auto res = _analyser.run(config);
+		auto res = _analyser.run(config, {.dataset_image_key = "micro2"});
 #endif
 		std::cout << res.pl << std::endl;
 	}
@@ -119,7 +119,7 @@ public:
 	void run()
 	{
 		const janus::config& config = janus::parse_config();
-		auto res = _analyser.run(config);
+		auto res = _analyser.run(config, {.dataset_image_key = "question1"});
 
 		for (uint64_t i = 0; i < TOTAL_NUM_CONFIGS_QUESTION; i++) {
 			std::cout << i << "\t" << res.num_exceeded[i] << "\t"
@@ -383,9 +383,9 @@ public:
 		const janus::config& config = janus::parse_config();
 
 #ifdef PRINT_ORDERS
-		auto res = _analyser.run(config, 1);
+		auto res = _analyser.run(config, {.num_cores = 1, .dataset_image_key = "steve1"});
 #else
-		auto res = _analyser.run(config);
+		auto res = _analyser.run(config, {.dataset_image_key = "steve1"});
 #endif
 		std::cout << std::fixed << std::setprecision(2) << res.pl << std::endl;
 	}
@@ -16,6 +16,9 @@
 namespace janus::apollo::tote1
 {
 static constexpr double STAKE_SIZE = 500;
+// Version of the strategy's logic, bump on changing it so that cached results
+// are recomputed.
+static constexpr uint64_t RESULT_CACHE_VERSION = 1;
 
 static constexpr uint64_t NUM_PRE_POST_MS = 3;
 const static std::array<uint64_t, NUM_PRE_POST_MS> pre_post_ms_params = {5 * 60 * 1000,
@@ -92,13 +95,27 @@ public:
 		: _analyser(predicate, update_worker, market_reducer, node_reducer, reducer,
 			    zero_worker_state, zero_market_agg_state, zero_node_agg_state)
 	{
+		_analyser.set_market_merger(market_merger);
 	}
 
 	void run()
 	{
 		const janus::config& config = janus::parse_config();
 
-		result res = _analyser.run(config);
+		// Configs only differ in thresholds so sweep them over a replay
+		// of each market per tracking window. Workers do nothing before
+		// the earliest window so later passes resume from there. Results
+		// of each config are cached so only new markets are replayed.
+		result res = _analyser.sweep(config, TOTAL_NUM_CONFIGS,
+					     [](uint64_t lane, node_agg_state& state) {
+						     state.config_index = lane;
+					     },
+					     {.sweep_width = NUM_MULT * NUM_LAY_MULT,
+					      .checkpoint_time = checkpoint_time,
+					      .dataset_image_key = "tote1",
+					      .result_cache_key = "tote1",
+					      .result_cache_version = RESULT_CACHE_VERSION,
+					      .result_cache_config = describe_config});
 		for (uint64_t i = 0; i < TOTAL_NUM_CONFIGS; i++) {
 			std::cout << res.pls[i] << "\t" << res.num_enters[i] << "\t" << i
 				  << std::endl;
@@ -190,6 +207,24 @@ private:
 		return true;
 	}
 
+	static auto checkpoint_time(const janus::meta_view& meta) -> uint64_t
+	{
+		uint64_t max_pre_post_ms = 0;
+		for (uint64_t pre_post_ms : pre_post_ms_params) {
+			if (pre_post_ms > max_pre_post_ms)
+				max_pre_post_ms = pre_post_ms;
+		}
+
+		return meta.market_start_timestamp() - max_pre_post_ms;
+	}
+
+	static auto describe_config(uint64_t index) -> std::string
+	{
+		const config& conf = configs[index];
+		return std::to_string(conf.pre_post_ms) + " " + std::to_string(conf.mult) + " " +
+		       std::to_string(conf.lay_mult);
+	}
+
 	static auto update_worker(int core, const janus::meta_view& meta,
 				  janus::betfair::market& market, janus::sim& sim,
 				  const node_agg_state& node_agg_state, worker_state& state,
@@ -248,9 +283,6 @@ private:
 		// Enter.
 
 		sim.add_bet(fav_id, 1.01, STAKE_SIZE, true);
-		// TODO(lorenzo): Use something better than instantiating price
-		// range each time.
-		betfair::price_range range;
 
 		double lay = 0;
 		if (conf.lay_mult > 0) {
@@ -293,6 +325,12 @@ private:
 		return true;
 	}
 
+	static void market_merger(const market_agg_state& market, market_agg_state& state)
+	{
+		state.num_enters += market.num_enters;
+		state.pl += market.pl;
+	}
+
 	static auto node_reducer(int core, const market_agg_state& market_agg_state,
 				 bool market_reducer_aborted, node_agg_state& state,
 				 spdlog::logger* logger) -> bool
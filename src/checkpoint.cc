@@ -0,0 +1,47 @@
+#include "janus.hh"
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+namespace janus
+{
+void write_checkpoint_file(const std::string& path, const dynamic_buffer& dyn_buf)
+{
+	std::string tmp_path = path + ".tmp";
+
+	auto file = std::ofstream(tmp_path, std::ios::binary | std::ios::trunc);
+	if (!file)
+		throw std::runtime_error(std::string("Cannot open ") + tmp_path +
+					 " for checkpoint write");
+
+	// Closing flushes the file so we check for errors afterwards.
+	file.write(reinterpret_cast<const char*>(dyn_buf.data()), dyn_buf.size());
+	file.close();
+	if (!file)
+		throw std::runtime_error(std::string("Error writing checkpoint to ") + tmp_path);
+
+	if (std::rename(tmp_path.c_str(), path.c_str()) != 0)
+		throw std::runtime_error(std::string("Cannot rename ") + tmp_path + " to " + path);
+}
+
+auto read_checkpoint_file(const std::string& path) -> dynamic_buffer
+{
+	auto file = std::ifstream(path, std::ios::binary | std::ios::ate);
+	if (!file)
+		throw std::runtime_error(std::string("Cannot open ") + path +
+					 " for checkpoint read");
+
+	uint64_t size = file.tellg();
+	file.seekg(0);
+
+	dynamic_buffer ret(size);
+	char* ptr = static_cast<char*>(ret.reserve(size));
+	if (!file.read(ptr, size))
+		throw std::runtime_error(std::string("Error reading checkpoint from ") + path);
+
+	return ret;
+}
+} // namespace janus
@@ -57,6 +57,24 @@ static void parse_config_json(const std::string& path, std::string& json, config
 	config.binary_data_root =
 		root.get_value_of_key(sajson::literal("binary_data_root")).as_cstring();
 
+	sajson::value grace_node = root.get_value_of_key(sajson::literal("market_evict_grace_ms"));
+	if (grace_node.get_type() == sajson::TYPE_NULL)
+		config.market_evict_grace_ms = DEFAULT_MARKET_EVICT_GRACE_MS;
+	else
+		config.market_evict_grace_ms = grace_node.get_integer_value();
+
+	sajson::value image_node = root.get_value_of_key(sajson::literal("dataset_image_root"));
+	if (image_node.get_type() == sajson::TYPE_NULL)
+		config.dataset_image_root = "";
+	else
+		config.dataset_image_root = image_node.as_cstring();
+
+	sajson::value cache_node = root.get_value_of_key(sajson::literal("result_cache_root"));
+	if (cache_node.get_type() == sajson::TYPE_NULL)
+		config.result_cache_root = "";
+	else
+		config.result_cache_root = cache_node.as_cstring();
+
 	std::string dir_name = extract_dir_name(path);
 	normalise_path(dir_name, config.cert_path);
 	normalise_path(dir_name, config.key_path);
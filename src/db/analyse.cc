@@ -0,0 +1,110 @@
+#include "janus.hh"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace janus
+{
+auto partition_batches(const std::vector<uint64_t>& weights, uint64_t num_batches)
+	-> std::vector<analyse_batch>
+{
+	uint64_t num_markets = weights.size();
+	if (num_batches > num_markets)
+		num_batches = num_markets;
+
+	uint64_t total = 0;
+	for (uint64_t weight : weights) {
+		total += weight;
+	}
+
+	std::vector<analyse_batch> ret;
+	ret.reserve(num_batches);
+
+	uint64_t offset = 0;
+	uint64_t cum = 0;
+	for (uint64_t i = 0; i < num_batches; i++) {
+		// Cumulative weight at which this batch should end, and the
+		// last market it can end at while leaving at least one market
+		// for each remaining batch.
+		uint64_t target = static_cast<uint64_t>(static_cast<double>(total) *
+							static_cast<double>(i + 1) /
+							static_cast<double>(num_batches));
+		uint64_t max_end = num_markets - (num_batches - i - 1);
+		if (i == num_batches - 1)
+			target = total;
+
+		uint64_t end = offset + 1;
+		uint64_t weight = weights[offset];
+		while (end < max_end && cum + weight + weights[end] <= target) {
+			weight += weights[end];
+			end++;
+		}
+
+		ret.push_back({
+			.offset = offset,
+			.num_markets = end - offset,
+			.weight = weight,
+		});
+		cum += weight;
+		offset = end;
+	}
+
+	return ret;
+}
+
+auto schedule_batches(const std::vector<analyse_batch>& batches) -> std::vector<uint64_t>
+{
+	std::vector<uint64_t> ret(batches.size());
+	for (uint64_t i = 0; i < batches.size(); i++) {
+		ret[i] = i;
+	}
+
+	std::stable_sort(ret.begin(), ret.end(), [&](uint64_t a, uint64_t b) {
+		return batches[a].weight > batches[b].weight;
+	});
+
+	return ret;
+}
+
+void write_fd(int fd, const void* data, uint64_t size)
+{
+	const auto* ptr = static_cast<const uint8_t*>(data);
+	while (size > 0) {
+		ssize_t written = ::write(fd, ptr, size);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			throw std::runtime_error(std::string("Unable to write to fd ") +
+						 std::to_string(fd) + " error " +
+						 std::to_string(errno));
+		}
+		ptr += written;
+		size -= static_cast<uint64_t>(written);
+	}
+}
+
+auto read_fd(int fd) -> std::string
+{
+	// NOLINTNEXTLINE: Not magical, a reasonable chunk size.
+	char buf[65536];
+	std::string ret;
+	while (true) {
+		ssize_t num_read = ::read(fd, buf, sizeof(buf));
+		if (num_read == 0)
+			return ret;
+		if (num_read < 0) {
+			if (errno == EINTR)
+				continue;
+			throw std::runtime_error(std::string("Unable to read from fd ") +
+						 std::to_string(fd) + " error " +
+						 std::to_string(errno));
+		}
+		ret.append(buf, static_cast<uint64_t>(num_read));
+	}
+}
+} // namespace janus
@@ -4,291 +4,1280 @@
 
 #include "spdlog/sinks/stdout_color_sinks.h"
 #include "spdlog/spdlog.h"
+#include <algorithm>
+#include <atomic>
+#include <array>
+#include <cerrno>
 #include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <exception>
 #include <memory>
+#include <optional>
+#include <span>
 #include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <sys/wait.h>
 #include <thread>
+#include <type_traits>
+#include <unistd.h>
 #include <vector>
 
 namespace janus
 {
 template<typename TWorkerState, typename TMarketAggState, typename TNodeAggState, typename TResult>
-void analyser<TWorkerState, TMarketAggState, TNodeAggState, TResult>::thread_fn(
-	const config& config, int core, channel<bool>& load_chan,
-	channel<TNodeAggState>& result_chan, uint64_t offset, uint64_t num_markets)
+auto analyser<TWorkerState, TMarketAggState, TNodeAggState, TResult>::replay_market(
+	int core, uint64_t index, std::span<const update> updates, betfair::universe<1>& universe,
+	std::span<lane> lanes, spdlog::logger* logger) -> uint64_t
 {
-	// TODO(lorenzo): Big mess, needs refactoring. First draft staff!
+	const meta_view& meta = _meta_views[index];
+	uint64_t market_id = meta.market_id();
+	replay_checkpoint* checkpoint = _checkpoints.empty() ? nullptr : &_checkpoints[index];
+	core_metrics& metrics = _metrics[core];
+	uint64_t num_replayed = 0;
 
-	std::shared_ptr<spdlog::logger> logger = spdlog::get("thread");
+	// Apply a timeslice of updates, logging and returning false on error.
+	// If we can't apply an update in this market we should just abort
+	// analysing it.
+	auto apply = [&](std::span<const update> slice, const char* where) -> bool {
+		std::chrono::steady_clock::time_point start_time;
+		if (_detailed_metrics)
+			start_time = std::chrono::steady_clock::now();
+		uint64_t num_applied = 0;
+		auto finish = [&] {
+			num_replayed += num_applied;
+			if (!_detailed_metrics)
+				return;
+
+			auto stop_time = std::chrono::steady_clock::now();
+			metrics.apply_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+						    stop_time - start_time)
+						    .count();
+		};
+
+		try {
+			betfair::apply_status status = universe.apply_updates(slice, num_applied);
+			finish();
+			if (status == betfair::apply_status::OK)
+				return true;
+
+			logger->error(
+				"Core {}: Market {}: Got {} update error {} on market parse, skipping! [{}]",
+				core, market_id, update_type_str(slice[num_applied].type),
+				betfair::apply_status_str(status), where);
+		} catch (janus::universe_apply_error& e) {
+			finish();
+			logger->error(
+				"Core {}: Market {}: Got error {} on market parse, skipping! [{}]",
+				core, market_id, e.what(), where);
+		}
+		return false;
+	};
+
+	uint64_t num_updates = updates.size();
+
+	uint64_t pos;
+	// Timestamp at which to save a checkpoint, or 0 if not saving.
+	uint64_t checkpoint_timestamp = 0;
+	bool resuming = checkpoint != nullptr && checkpoint->buf;
+	if (resuming) {
+		checkpoint->buf->reset_read();
+		universe.load_checkpoint(*checkpoint->buf);
+		pos = checkpoint->pos;
+	} else {
+		if (checkpoint != nullptr && !checkpoint->attempted) {
+			checkpoint->attempted = true;
+			checkpoint_timestamp = checkpoint->timestamp;
+		}
+
+		universe.clear();
+		universe.apply_update(janus::make_market_id_update(market_id));
+		universe[market_id].reserve_runners(meta.runners().size());
+
+		// Get first set of data. First timestamp will be prior to first
+		// market state data so we apply everything up to the second.
+		pos = find_next_timestamp(updates, 0);
+		if (pos < num_updates)
+			pos = find_next_timestamp(updates, pos + 1);
+		if (pos == num_updates || !apply(updates.first(pos), "1"))
+			return num_replayed;
+	}
+
+	betfair::price_range range;
+	betfair::market& market = universe.markets()[0];
+
+	// Each lane has its own worker state and sim driven by the one market.
+	// Lanes drop out once reduced, which happens as soon as their worker
+	// aborts so they observe the market in the state they would have had
+	// they been replayed alone.
+	uint64_t num_lanes = lanes.size();
+	std::vector<TWorkerState> states(num_lanes, _zero_worker_state);
+	std::deque<sim_bet_pool>& bet_pools = _bet_pools[core];
+	while (bet_pools.size() < num_lanes) {
+		bet_pools.emplace_back();
+	}
+	std::deque<sim> sims;
+	std::vector<bool> active(num_lanes);
+	uint64_t num_active = 0;
+
+	auto reduce = [&](uint64_t i, bool worker_aborted) {
+		// Perform final update to pick up winner.
+		sims[i].update();
+
+		lane& lane = lanes[i];
+		if (!_market_reducer(core, states[i], sims[i], market, worker_aborted,
+				     lane.market_agg_state, logger))
+			lane.market_agg_aborted = true;
+
+		active[i] = false;
+		num_active--;
+	};
+
+	// Save a checkpoint before workers are invoked with the market in the
+	// state preceding the first timeslice at or after the checkpoint
+	// timestamp, so resuming invokes them exactly as replaying does.
+	// Workers' state doesn't depend on the configuration before this point
+	// so that of any active lane stands for all of them.
+	auto save_checkpoint = [&](uint64_t i) {
+		if (checkpoint_timestamp == 0 ||
+		    get_update_timestamp(updates[pos]) < checkpoint_timestamp)
+			return;
+		checkpoint_timestamp = 0;
+
+		// Workers which have acted can't be resumed, nor can we hold
+		// more checkpoints than allowed.
+		uint64_t size = universe.checkpoint_size() + sims[i].checkpoint_size();
+		if (sims[i].bets().size() > 0 ||
+		    _checkpoint_bytes[core] + size > _checkpoint_max_bytes)
+			return;
+		_checkpoint_bytes[core] += size;
+
+		checkpoint->pos = pos;
+		checkpoint->buf.emplace(universe.checkpoint_size());
+		universe.save_checkpoint(*checkpoint->buf);
+		checkpoint->sim_buf.emplace(sims[i].checkpoint_size());
+		sims[i].save_checkpoint(*checkpoint->sim_buf);
+		checkpoint->worker_state = states[i];
+	};
+
+	for (uint64_t i = 0; i < num_lanes; i++) {
+		sims.emplace_back(range, market, bet_pools[i]);
+		if (!resuming)
+			continue;
+
+		checkpoint->sim_buf->reset_read();
+		sims[i].load_checkpoint(*checkpoint->sim_buf);
+		states[i] = *checkpoint->worker_state;
+	}
+	if (num_lanes > 0)
+		save_checkpoint(0);
+
+	for (uint64_t i = 0; i < num_lanes; i++) {
+		if (lanes[i].market_agg_aborted)
+			continue;
+
+		// If we can't even update our very first state then just skip
+		// this market.
+		if (_update_worker(core, meta, market, sims[i], *lanes[i].node_agg_state,
+				   states[i], logger)) {
+			active[i] = true;
+			num_active++;
+		}
+	}
+
+	bool went_inplay = false;
+
+	// Now iterate through rest of market timeline one timeslice at a time,
+	// pos always indicating a timestamp update.
+	while (pos < num_updates && num_active > 0) {
+		// We skip inplay updates currently so apply the remainder of the
+		// market in one go.
+		uint64_t end = went_inplay ? num_updates : find_next_timestamp(updates, pos + 1);
+		if (!apply(updates.subspan(pos, end - pos), "2")) {
+			// Indicate workers aborted also.
+			for (uint64_t i = 0; i < num_lanes; i++) {
+				if (active[i])
+					reduce(i, true);
+			}
+			return num_replayed;
+		}
+		pos = end;
+
+		if (went_inplay || pos == num_updates)
+			break;
+
+		if (market.inplay()) {
+			went_inplay = true;
+			// The sim will handle bet operations at inplay.
+			for (uint64_t i = 0; i < num_lanes; i++) {
+				if (active[i])
+					sims[i].update();
+			}
+			continue;
+		}
+
+		for (uint64_t i = 0; i < num_lanes; i++) {
+			if (active[i]) {
+				save_checkpoint(i);
+				break;
+			}
+		}
+
+		for (uint64_t i = 0; i < num_lanes; i++) {
+			if (!active[i] || _update_worker(core, meta, market, sims[i],
+							 *lanes[i].node_agg_state, states[i],
+							 logger))
+				continue;
+
+			sims[i].update();
+			reduce(i, true);
+		}
+	} // timeslices
+
+	for (uint64_t i = 0; i < num_lanes; i++) {
+		if (active[i])
+			reduce(i, false);
+	}
+
+	return num_replayed;
+}
 
-	// If we have no markets to analyse, abort.
-	if (num_markets == 0) {
-		logger->error("No markets to analyse, aborting!");
-		load_chan.send(false);
+template<typename TWorkerState, typename TMarketAggState, typename TNodeAggState, typename TResult>
+void analyser<TWorkerState, TMarketAggState, TNodeAggState, TResult>::replay_timed(
+	int core, uint64_t index, std::span<const update> updates, betfair::universe<1>& universe,
+	std::span<lane> lanes, spdlog::logger* logger)
+{
+	core_metrics& metrics = _metrics[core];
+	uint64_t apply_ns = metrics.apply_ns;
+
+	auto start_time = std::chrono::steady_clock::now();
+	uint64_t num_updates = replay_market(core, index, updates, universe, lanes, logger);
+	auto stop_time = std::chrono::steady_clock::now();
+	auto duration = stop_time - start_time;
+	uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+
+	// Whatever wasn't spent applying updates was spent in workers, sims
+	// and reducers.
+	if (_detailed_metrics)
+		metrics.callback_ns += ns - (metrics.apply_ns - apply_ns);
+	metrics.add_replay(_meta_views[index].market_id(), num_updates, ns);
+	if (_publish_progress)
+		_progress[core].store({
+			.num_replays = metrics.num_replays,
+			.num_updates = metrics.num_updates,
+		});
+}
+
+template<typename TWorkerState, typename TMarketAggState, typename TNodeAggState, typename TResult>
+void analyser<TWorkerState, TMarketAggState, TNodeAggState, TResult>::replay_cached(
+	int core, uint64_t index, std::span<const update> updates, betfair::universe<1>& universe,
+	std::span<lane> lanes, spdlog::logger* logger)
+{
+	// All lanes of a pass are cached or none are.
+	if (!_result_cache || lanes[0].config_index == UNCACHED_CONFIG_INDEX) {
+		replay_timed(core, index, updates, universe, lanes, logger);
 		return;
 	}
 
-	std::vector<dynamic_buffer> bufs;
-	// Load data.
-	try {
+	// Reduce the market alone in each lane so that its result can be merged
+	// into later runs.
+	std::vector<lane> market_lanes(lanes.begin(), lanes.end());
+	for (lane& lane : market_lanes) {
+		lane.market_agg_state = _zero_market_agg_state;
+	}
+	replay_timed(core, index, updates, universe, market_lanes, logger);
+
+	market_results& results = _results[index];
+	for (uint64_t i = 0; i < lanes.size(); i++) {
+		if (lanes[i].market_agg_aborted)
+			continue;
+
+		const lane& market_lane = market_lanes[i];
+		results.results[market_lane.config_index] = cached_result{
+			.config_hash = _config_hashes[market_lane.config_index],
+			.market_agg_aborted = market_lane.market_agg_aborted ? 1UL : 0UL,
+			.market_agg_state = market_lane.market_agg_state,
+		};
+		_market_merger(market_lane.market_agg_state, lanes[i].market_agg_state);
+		if (market_lane.market_agg_aborted)
+			lanes[i].market_agg_aborted = true;
+	}
+	results.dirty = true;
+}
+
+template<typename TWorkerState, typename TMarketAggState, typename TNodeAggState, typename TResult>
+auto analyser<TWorkerState, TMarketAggState, TNodeAggState, TResult>::merge_cached(
+	int core, uint64_t index, std::span<lane> lanes) -> bool
+{
+	if (!_result_cache || lanes[0].config_index == UNCACHED_CONFIG_INDEX)
+		return false;
+
+	// Unless every lane has a result the market has to be replayed anyway.
+	const std::vector<std::optional<cached_result>>& results = _results[index].results;
+	for (const lane& lane : lanes) {
+		if (!lane.market_agg_aborted && !results[lane.config_index])
+			return false;
+	}
+
+	for (lane& lane : lanes) {
+		if (lane.market_agg_aborted)
+			continue;
+
+		const cached_result& result = *results[lane.config_index];
+		_market_merger(result.market_agg_state, lane.market_agg_state);
+		if (result.market_agg_aborted != 0)
+			lane.market_agg_aborted = true;
+	}
+	_metrics[core].num_cached++;
+	return true;
+}
+
+template<typename TWorkerState, typename TMarketAggState, typename TNodeAggState, typename TResult>
+void analyser<TWorkerState, TMarketAggState, TNodeAggState, TResult>::read_results(uint64_t batch)
+{
+	if constexpr (std::is_trivially_copyable_v<TMarketAggState>) {
+		uint64_t offset = _batches[batch].offset;
+		uint64_t num_markets = _batches[batch].num_markets;
+		uint64_t num_configs = lanes_per_batch();
+
+		std::string str;
 		for (uint64_t i = offset; i < offset + num_markets; i++) {
+			market_results& results = _results[i];
+			if (results.read)
+				continue;
+
 			uint64_t id = _meta_views[i].market_id();
-			bufs.emplace_back(read_market_updates(config, id));
+			results.data_version = _data_versions[i];
+			results.results.assign(num_configs, std::nullopt);
+			results.other_results.clear();
+			results.read = true;
+			results.dirty = false;
+
+			// Results are matched to the configs of this run by the
+			// hash of their description, not their index.
+			uint64_t num_matched = 0;
+			uint64_t num_results = _result_cache->read(id, results.data_version, str);
+			for (uint64_t j = 0; j < num_results; j++) {
+				const char* ptr = str.data() + j * sizeof(cached_result);
+				cached_result result = {
+					.config_hash = 0,
+					.market_agg_aborted = 0,
+					.market_agg_state = _zero_market_agg_state,
+				};
+				std::memcpy(&result, ptr, sizeof(cached_result));
+
+				auto it = _config_indexes.find(result.config_hash);
+				if (it == _config_indexes.end()) {
+					results.other_results.append(ptr, sizeof(cached_result));
+					continue;
+				}
+				if (!results.results[it->second])
+					num_matched++;
+				results.results[it->second] = result;
+			}
+			results.complete = num_matched == num_configs;
 		}
-	} catch (std::exception& e) {
-		logger->error("Core {}: got error {} on data read aborting!", core, e.what());
+	}
+}
 
-		load_chan.send(false);
-		return;
+template<typename TWorkerState, typename TMarketAggState, typename TNodeAggState, typename TResult>
+void analyser<TWorkerState, TMarketAggState, TNodeAggState, TResult>::write_results(
+	uint64_t batch, spdlog::logger* logger)
+{
+	uint64_t offset = _batches[batch].offset;
+	uint64_t num_markets = _batches[batch].num_markets;
+
+	for (uint64_t i = offset; i < offset + num_markets; i++) {
+		market_results& results = _results[i];
+		if (results.dirty) {
+			std::string str = results.other_results;
+			for (const std::optional<cached_result>& result : results.results) {
+				if (result)
+					str.append(reinterpret_cast<const char*>(&*result),
+						   sizeof(cached_result));
+			}
+
+			uint64_t id = _meta_views[i].market_id();
+			try {
+				_result_cache->write(id, results.data_version, str);
+			} catch (std::exception& e) {
+				logger->warn("Market {}: Unable to cache results: {}", id,
+					     e.what());
+			}
+		}
+
+		// The batch is done with so we needn't hold its results.
+		results = market_results{};
 	}
+}
 
-	load_chan.send(true);
+template<typename TWorkerState, typename TMarketAggState, typename TNodeAggState, typename TResult>
+void analyser<TWorkerState, TMarketAggState, TNodeAggState, TResult>::replay_markets(
+	int core, uint64_t batch, market_prefetcher* prefetcher, betfair::universe<1>& universe,
+	std::span<lane> lanes, spdlog::logger* logger)
+{
+	uint64_t offset = _batches[batch].offset;
+	uint64_t num_markets = _batches[batch].num_markets;
 
-	// Wait to start analysis.
-	load_chan.receive();
+	for (uint64_t i = 0; i < num_markets; i++) {
+		bool all_aborted = true;
+		for (const lane& lane : lanes) {
+			if (!lane.market_agg_aborted)
+				all_aborted = false;
+		}
+		if (all_aborted) {
+			// Keep the prefetcher in step with the next pass.
+			for (; prefetcher != nullptr && i < num_markets; i++) {
+				if (needs_data(offset + i))
+					prefetcher->skip(1);
+			}
+			return;
+		}
 
-	TNodeAggState node_agg_state = _zero_node_agg_state;
+		if (merge_cached(core, offset + i, lanes)) {
+			// Markets whose data isn't needed aren't streamed.
+			if (prefetcher != nullptr && needs_data(offset + i))
+				prefetcher->skip(1);
+			continue;
+		}
 
-	betfair::price_range range;
-	betfair::universe<1> universe;
+		const meta_view& meta = _meta_views[offset + i];
+		if (_image) {
+			replay_cached(core, offset + i, _image->updates(offset + i), universe,
+				      lanes, logger);
+			continue;
+		}
+		if (prefetcher == nullptr) {
+			dynamic_buffer& buf = _batch_bufs[batch][i];
+			buf.reset_read();
+			replay_cached(core, offset + i, read_updates(buf), universe, lanes, logger);
+			continue;
+		}
+
+		// Time spent waiting on the prefetcher is time spent loading.
+		std::optional<dynamic_buffer> buf;
+		auto load_start_time = std::chrono::steady_clock::now();
+		try {
+			buf.emplace(prefetcher->next());
+		} catch (std::exception& e) {
+			logger->error("Core {}: Market {}: Got error {} on data read, skipping!",
+				      core, meta.market_id(), e.what());
+			continue;
+		}
+		auto load_stop_time = std::chrono::steady_clock::now();
+		_metrics[core].load_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+						  load_stop_time - load_start_time)
+						  .count();
+		replay_cached(core, offset + i, read_updates(*buf), universe, lanes, logger);
+	}
+}
+
+template<typename TWorkerState, typename TMarketAggState, typename TNodeAggState, typename TResult>
+void analyser<TWorkerState, TMarketAggState, TNodeAggState, TResult>::run_batch(
+	const config& config, const analyse_options& options, int core, uint64_t batch,
+	betfair::universe<1>& universe, spdlog::logger* logger)
+{
+	uint64_t offset = _batches[batch].offset;
+	uint64_t num_markets = _batches[batch].num_markets;
+
+	// Results determine which markets' data is needed so are read on
+	// loading up front, otherwise here.
+	if (_result_cache)
+		read_results(batch);
+	uint64_t num_cached = _metrics[core].num_cached;
+
+	// Either all data was loaded up front or it is streamed by a
+	// prefetcher for the duration of the batch.
+	std::unique_ptr<market_prefetcher> prefetcher;
+	if (options.stream_window > 0 && !_image) {
+		std::vector<uint64_t> ids;
+		ids.reserve(num_markets);
+		for (uint64_t i = offset; i < offset + num_markets; i++) {
+			if (needs_data(i))
+				ids.push_back(_meta_views[i].market_id());
+		}
+		if (!ids.empty())
+			prefetcher = std::make_unique<market_prefetcher>(
+				config, std::move(ids), options.stream_window,
+				options.stream_loaders);
+	}
 
 	auto start_time = std::chrono::steady_clock::now();
 
-	uint64_t num_iters = 0;
-	while (true) {
-		num_iters++;
+	uint64_t num_passes = 0;
+	if (_num_lanes == 0) {
+		TNodeAggState& node_agg_state = _node_aggs[batch];
+		while (true) {
+			num_passes++;
 
-		bool market_agg_aborted = false;
+			// State that is aggregated across ALL markets.
+			std::array<lane, 1> lanes = {lane{
+				.node_agg_state = &node_agg_state,
+				.market_agg_state = _zero_market_agg_state,
+				.market_agg_aborted = false,
+				// Later iterations depend on the results of
+				// the whole batch so can't be cached.
+				.config_index = num_passes == 1 ? 0 : UNCACHED_CONFIG_INDEX,
+			}};
+			replay_markets(core, batch, prefetcher.get(), universe, lanes, logger);
 
-		// State that is aggregated across ALL markets.
-		TMarketAggState market_agg_state = _zero_market_agg_state;
-		for (uint64_t i = 0; i < num_markets; i++) {
-			dynamic_buffer& buf = bufs[i];
-			buf.reset_read();
-			universe.clear();
-
-			const meta_view& meta = _meta_views[offset + i];
-			uint64_t market_id = meta.market_id();
-			universe.apply_update(janus::make_market_id_update(market_id));
-
-			// Get first set of data. First timestamp will be prior
-			// to first market state data.
-			uint64_t next = 0;
-			bool first = true;
-			bool abort_first = false;
-			while (buf.read_offset() != buf.size()) {
-				auto& u = buf.read<janus::update>();
-				if (u.type == update_type::TIMESTAMP) {
-					if (first) {
-						first = false;
-					} else {
-						next = get_update_timestamp(u);
-						break;
+			// Reducer across all markets.
+			if (!_node_reducer(core, lanes[0].market_agg_state,
+					   lanes[0].market_agg_aborted, node_agg_state, logger))
+				break;
+		} // iterations
+	} else {
+		uint64_t width = options.sweep_width == 0 ? _num_lanes : options.sweep_width;
+		for (uint64_t first = 0; first < _num_lanes; first += width) {
+			num_passes++;
+
+			uint64_t last = first + width < _num_lanes ? first + width : _num_lanes;
+			std::vector<lane> lanes;
+			lanes.reserve(last - first);
+			for (uint64_t i = first; i < last; i++) {
+				lanes.push_back({
+					.node_agg_state = &_node_aggs[batch * _num_lanes + i],
+					.market_agg_state = _zero_market_agg_state,
+					.market_agg_aborted = false,
+					.config_index = i,
+				});
+			}
+			replay_markets(core, batch, prefetcher.get(), universe, lanes, logger);
+
+			for (lane& lane : lanes) {
+				_node_reducer(core, lane.market_agg_state, lane.market_agg_aborted,
+					      *lane.node_agg_state, logger);
+			}
+		} // passes
+	}
+
+	auto stop_time = std::chrono::steady_clock::now();
+	auto duration_ms =
+		std::chrono::duration_cast<std::chrono::milliseconds>(stop_time - start_time)
+			.count();
+	logger->info("Core {}: Batch {}: Executed {} passes over {} markets taking {}ms", core,
+		     batch, num_passes, num_markets, duration_ms);
+
+	if (!_checkpoints.empty()) {
+		uint64_t num_checkpoints = 0;
+		for (uint64_t i = offset; i < offset + num_markets; i++) {
+			if (_checkpoints[i].buf)
+				num_checkpoints++;
+		}
+		logger->info("Core {}: Batch {}: Resumed {} of {} markets from checkpoints", core,
+			     batch, num_checkpoints, num_markets);
+
+		// No other batch replays these markets.
+		for (uint64_t i = offset; i < offset + num_markets; i++) {
+			_checkpoints[i].buf.reset();
+			_checkpoints[i].sim_buf.reset();
+			_checkpoints[i].worker_state.reset();
+		}
+		_checkpoint_bytes[core] = 0;
+	}
+
+	if (_result_cache) {
+		logger->info("Core {}: Batch {}: Merged {} cached market results", core, batch,
+			     _metrics[core].num_cached - num_cached);
+		write_results(batch, logger);
+	}
+}
+
+template<typename TWorkerState, typename TMarketAggState, typename TNodeAggState, typename TResult>
+auto analyser<TWorkerState, TMarketAggState, TNodeAggState, TResult>::claim_batch(
+	uint64_t node, uint64_t& local_pos, uint64_t& global_pos, uint64_t& batch) -> bool
+{
+	uint64_t num_batches = _schedule.size();
+
+	// First batches whose data is local to us, then any left over.
+	for (; local_pos < num_batches; local_pos++) {
+		batch = _schedule[local_pos];
+		if (_batch_nodes[batch] == node && !_batch_claimed[batch].exchange(true)) {
+			local_pos++;
+			return true;
+		}
+	}
+	for (; global_pos < num_batches; global_pos++) {
+		batch = _schedule[global_pos];
+		if (!_batch_claimed[batch].exchange(true)) {
+			global_pos++;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+template<typename TWorkerState, typename TMarketAggState, typename TNodeAggState, typename TResult>
+void analyser<TWorkerState, TMarketAggState, TNodeAggState, TResult>::thread_fn(
+	const config& config, const analyse_options& options, int core,
+	oneshot_channel<bool>& load_chan, oneshot_channel<bool>& start_chan)
+{
+	std::shared_ptr<spdlog::logger> logger = spdlog::get("thread");
+
+	// Pin ourselves before touching any memory so that market data we load
+	// is placed on our node. Threads we start, e.g. prefetch loaders,
+	// inherit our affinity.
+	const worker_placement& placement = _placements[core];
+	::cpu_set_t cpuset;
+	CPU_ZERO(&cpuset);
+	CPU_SET(placement.cpu, &cpuset);
+	int err_num = ::pthread_setaffinity_np(::pthread_self(), sizeof(cpu_set_t), &cpuset);
+	if (err_num != 0)
+		logger->warn("Core {}: Unable to set affinity to CPU {} error {}", core,
+			     placement.cpu, err_num);
+
+	core_metrics& metrics = _metrics[core];
+
+	// Unless streaming or replaying from a dataset image, claim batches and
+	// load their data until there are none left.
+	if (options.stream_window == 0 && !_image) {
+		market_read_timing timing = {};
+		uint64_t batch;
+		while ((batch = _next_load++) < _batches.size()) {
+			// Batches claimed before we start belong to another
+			// process.
+			if (_batch_claimed[batch])
+				continue;
+
+			uint64_t offset = _batches[batch].offset;
+			uint64_t num_markets = _batches[batch].num_markets;
+
+			std::vector<dynamic_buffer>& bufs = _batch_bufs[batch];
+			bufs.reserve(num_markets);
+			_batch_nodes[batch] = placement.node;
+			try {
+				if (_result_cache)
+					read_results(batch);
+				for (uint64_t i = offset; i < offset + num_markets; i++) {
+					// Markets merged from the result cache in
+					// every pass are left empty.
+					if (!needs_data(i)) {
+						bufs.emplace_back(0);
+						continue;
 					}
+
+					uint64_t id = _meta_views[i].market_id();
+					std::string str =
+						read_market_updates_string(config, id, timing);
+					dynamic_buffer& buf = bufs.emplace_back(
+						make_local_buffer(str.size(), options.huge_pages));
+					buf.add_raw(str.c_str(), str.size());
 				}
-				try {
-					universe.apply_update(u);
-				} catch (janus::universe_apply_error& e) {
-					logger->error(
-						"Core {}: Market {}: Got error {} on market parse, skipping! [1]",
-						core, market_id, e.what());
-
-					// If we can't apply an update in this
-					// market we should just abort analysing it.
-					abort_first = true;
-					break;
+			} catch (std::exception& e) {
+				logger->error("Core {}: got error {} on data read aborting!", core,
+					      e.what());
+
+				load_chan.send(false);
+				return;
+			}
+		}
+
+		metrics.load_ns = timing.read_ns;
+		metrics.decompress_ns = timing.decompress_ns;
+	}
+
+	load_chan.send(true);
+
+	// Wait to start analysis, another core may have failed to load.
+	if (!start_chan.receive())
+		return;
+
+	betfair::universe<1> universe;
+
+	auto start_time = std::chrono::steady_clock::now();
+
+	// Claim batches in schedule order until there are none left, so cores
+	// which finish early pick up work rather than idling.
+	uint64_t num_batches = 0;
+	uint64_t num_markets = 0;
+	uint64_t local_pos = 0;
+	uint64_t global_pos = 0;
+	uint64_t batch;
+	while (!_failed && claim_batch(placement.node, local_pos, global_pos, batch)) {
+		// The batch's node aggregate states are left incomplete, so the
+		// whole run fails rather than reducing them.
+		try {
+			run_batch(config, options, core, batch, universe, logger.get());
+		} catch (std::exception& e) {
+			logger->error("Core {}: Batch {}: Got error {}, aborting run!", core,
+				      batch, e.what());
+			_core_errors[core] = std::current_exception();
+			_failed = true;
+			break;
+		}
+
+		num_batches++;
+		num_markets += _batches[batch].num_markets;
+	}
+
+	auto stop_time = std::chrono::steady_clock::now();
+	metrics.num_batches = num_batches;
+	auto duration = stop_time - start_time;
+	metrics.run_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+	logger->info("Core {}: Analysed {} batches of {} markets taking {}ms", core, num_batches,
+		     num_markets, metrics.run_ns / NS_PER_MS);
+	log_core_metrics(logger.get(), "Core " + std::to_string(core), metrics);
+	for (uint64_t i = 0; i < betfair::NUM_APPLY_STATUSES; i++) {
+		auto status = static_cast<betfair::apply_status>(i);
+		uint64_t num_faults = universe.num_faults(status);
+		if (num_faults > 0)
+			logger->info("Core {}: {} updates faulted with error {}", core, num_faults,
+				     betfair::apply_status_str(status));
+	}
+}
+
+template<typename TWorkerState, typename TMarketAggState, typename TNodeAggState, typename TResult>
+void analyser<TWorkerState, TMarketAggState, TNodeAggState, TResult>::run_cores(
+	const config& config, const analyse_options& options, uint64_t first_core,
+	uint64_t num_cores)
+{
+	std::vector<std::thread> threads(num_cores);
+	std::vector<oneshot_channel<bool>> load_chans(num_cores);
+	std::vector<oneshot_channel<bool>> start_chans(num_cores);
+
+	// Start all threads up front and load data in parallel.
+	for (uint64_t i = 0; i < num_cores; i++) {
+		oneshot_channel<bool>& load_chan = load_chans[i];
+		oneshot_channel<bool>& start_chan = start_chans[i];
+		int core = static_cast<int>(first_core + i);
+		threads[i] = std::thread([&, core] {
+			thread_fn(config, options, core, load_chan, start_chan);
+		});
+	}
+
+	std::vector<bool> loaded(num_cores);
+	uint64_t num_failed = 0;
+	for (uint64_t i = 0; i < num_cores; i++) {
+		loaded[i] = load_chans[i].receive();
+		if (!loaded[i]) {
+			spdlog::error("Unable to load data on core {}", first_core + i);
+			num_failed++;
+		}
+	}
+
+	// If any core failed to load, stop the rest before we bail.
+	if (num_failed > 0) {
+		for (uint64_t i = 0; i < num_cores; i++) {
+			if (loaded[i])
+				start_chans[i].send(false);
+		}
+		for (uint64_t i = 0; i < num_cores; i++) {
+			threads[i].join();
+		}
+		throw std::runtime_error(std::string("Unable to load data on ") +
+					 std::to_string(num_failed) + " cores");
+	}
+
+	if (_image)
+		spdlog::info("All cores ready to replay markets from dataset image.");
+	else if (options.stream_window > 0)
+		spdlog::info("All cores ready to stream markets.");
+	else
+		spdlog::info("All cores loaded markets.");
+
+	// Kick off worker threads.
+	spdlog::info("Starting worker threads...");
+	for (uint64_t i = 0; i < num_cores; i++) {
+		start_chans[i].send(true);
+	}
+	spdlog::info("All {} cores started!", num_cores);
+
+	std::thread monitor;
+	oneshot_channel<bool> stop_chan;
+	if (options.metrics_interval_ms > 0)
+		monitor = std::thread([&] {
+			monitor_fn(options.metrics_interval_ms, first_core, num_cores, stop_chan);
+		});
+
+	for (uint64_t i = 0; i < num_cores; i++) {
+		threads[i].join();
+	}
+
+	if (monitor.joinable()) {
+		stop_chan.send(true);
+		monitor.join();
+	}
+
+	for (uint64_t core = first_core; core < first_core + num_cores; core++) {
+		if (_core_errors[core])
+			std::rethrow_exception(_core_errors[core]);
+	}
+}
+
+template<typename TWorkerState, typename TMarketAggState, typename TNodeAggState, typename TResult>
+void analyser<TWorkerState, TMarketAggState, TNodeAggState, TResult>::monitor_fn(
+	uint64_t interval_ms, uint64_t first_core, uint64_t num_cores,
+	oneshot_channel<bool>& stop_chan)
+{
+	auto interval = std::chrono::milliseconds(interval_ms);
+	// Check for the end of the run more often than we log so we don't hold
+	// it up.
+	auto poll = std::min(interval, std::chrono::milliseconds(ANALYSE_MONITOR_POLL_MS));
+
+	core_progress last = {};
+	auto last_time = std::chrono::steady_clock::now();
+	while (!stop_chan.ready()) {
+		std::this_thread::sleep_for(poll);
+		auto now = std::chrono::steady_clock::now();
+		if (now - last_time < interval)
+			continue;
+
+		core_progress total = {};
+		for (uint64_t core = first_core; core < first_core + num_cores; core++) {
+			core_progress progress;
+			_progress[core].load(progress);
+			total.num_replays += progress.num_replays;
+			total.num_updates += progress.num_updates;
+		}
+
+		double secs = std::chrono::duration<double>(now - last_time).count();
+		spdlog::info("Progress: {} markets, {} updates, {:.0f} updates/s, {:.1f} markets/s",
+			     total.num_replays, total.num_updates,
+			     static_cast<double>(total.num_updates - last.num_updates) / secs,
+			     static_cast<double>(total.num_replays - last.num_replays) / secs);
+		last = total;
+		last_time = now;
+	}
+}
+
+template<typename TWorkerState, typename TMarketAggState, typename TNodeAggState, typename TResult>
+auto analyser<TWorkerState, TMarketAggState, TNodeAggState, TResult>::run_shard(
+	const config& config, const analyse_options& options, const std::vector<uint64_t>& shard,
+	uint64_t first_core, uint64_t num_cores, int fd) -> int
+{
+	try {
+		// Batches outside our shard are left to the other processes.
+		std::vector<bool> ours(_batches.size());
+		for (uint64_t batch : shard) {
+			ours[batch] = true;
+		}
+		for (uint64_t batch = 0; batch < _batches.size(); batch++) {
+			if (!ours[batch])
+				_batch_claimed[batch] = true;
+		}
+
+		run_cores(config, options, first_core, num_cores);
+
+		uint64_t lanes = lanes_per_batch();
+		for (uint64_t batch : shard) {
+			write_fd(fd, &_node_aggs[batch * lanes], lanes * sizeof(TNodeAggState));
+		}
+		write_fd(fd, &_metrics[first_core], num_cores * sizeof(core_metrics));
+		return 0;
+	} catch (std::exception& e) {
+		spdlog::error("Process {}: got error {}, aborting!", ::getpid(), e.what());
+		return 1;
+	}
+}
+
+template<typename TWorkerState, typename TMarketAggState, typename TNodeAggState, typename TResult>
+void analyser<TWorkerState, TMarketAggState, TNodeAggState, TResult>::run_processes(
+	const config& config, const analyse_options& options, uint64_t num_processes,
+	uint64_t num_cores)
+{
+	if constexpr (!std::is_trivially_copyable_v<TNodeAggState>) {
+		throw std::runtime_error(
+			"Node aggregate state must be trivially copyable to use processes");
+	} else {
+		if (num_processes > num_cores)
+			num_processes = num_cores;
+
+		// Deal batches out in schedule order so each process gets a
+		// similar share of the heaviest.
+		std::vector<std::vector<uint64_t>> shards(num_processes);
+		for (uint64_t i = 0; i < _schedule.size(); i++) {
+			shards[i % num_processes].push_back(_schedule[i]);
+		}
+
+		spdlog::info("Sharding {} batches across {} processes", _schedule.size(),
+			     num_processes);
+
+		// Flush logs so buffered output isn't duplicated by children.
+		spdlog::apply_all([](const std::shared_ptr<spdlog::logger>& l) { l->flush(); });
+		std::fflush(stdout);
+
+		std::vector<::pid_t> pids;
+		std::vector<int> fds;
+		// The cores run by each process.
+		std::vector<uint64_t> first_cores;
+		std::vector<uint64_t> nums_cores;
+		uint64_t first_core = 0;
+		bool fork_failed = false;
+		for (uint64_t p = 0; p < num_processes; p++) {
+			uint64_t n = num_cores / num_processes;
+			if (p < num_cores % num_processes)
+				n++;
+
+			std::array<int, 2> sock = {};
+			if (::socketpair(AF_UNIX, SOCK_STREAM, 0, sock.data()) != 0) {
+				fork_failed = true;
+				break;
+			}
+
+			::pid_t pid = ::fork();
+			if (pid == 0) {
+				// We only hold our own end, so the parent sees end of
+				// file on each socket once its process exits.
+				::close(sock[0]);
+				for (int fd : fds) {
+					::close(fd);
 				}
+				int status = run_shard(config, options, shards[p], first_core, n,
+						       sock[1]);
+				::close(sock[1]);
+				spdlog::apply_all([](const std::shared_ptr<spdlog::logger>& l) {
+					l->flush();
+				});
+				std::fflush(stdout);
+				// Don't run destructors of state shared with the parent.
+				::_exit(status);
 			}
-			if (abort_first || next == 0)
-				continue;
 
-			betfair::market& market = universe.markets()[0];
-			sim sim(range, market);
-			TWorkerState state = _zero_worker_state;
-			// If we can't even update our very first state then
-			// just skip this market.
-			if (!_update_worker(core, meta, market, sim, node_agg_state, state,
-					    logger.get()))
-				continue;
+			::close(sock[1]);
+			if (pid < 0) {
+				::close(sock[0]);
+				fork_failed = true;
+				break;
+			}
+			pids.push_back(pid);
+			fds.push_back(sock[0]);
+			first_cores.push_back(first_core);
+			nums_cores.push_back(n);
+			first_core += n;
+		}
 
+		uint64_t lanes = lanes_per_batch();
+		uint64_t num_failed = 0;
+		for (uint64_t p = 0; p < pids.size(); p++) {
+			std::string data;
 			try {
-				universe.apply_update(make_timestamp_update(next));
-			} catch (janus::universe_apply_error& e) {
-				logger->error(
-					"Core {}: Market {}: {} - Error apply first timestamp?? Skipping!",
-					core, market_id, e.what());
+				data = read_fd(fds[p]);
+			} catch (std::exception& e) {
+				spdlog::error("Process {}: got error {} reading results", pids[p],
+					      e.what());
+			}
+			::close(fds[p]);
+
+			int status = 0;
+			int ret;
+			while ((ret = ::waitpid(pids[p], &status, 0)) < 0 && errno == EINTR) {
+			}
+			// If we can't reap the process we can't tell how it exited.
+			if (ret < 0) {
+				spdlog::error("Process {}: waitpid failed with errno {}", pids[p],
+					      errno);
+				num_failed++;
 				continue;
 			}
 
-			bool worker_aborted = false;
-			bool went_inplay = false;
-
-			// Now iterate through rest of market timeline.
-			while (buf.read_offset() != buf.size()) {
-				auto& u = buf.read<janus::update>();
-
-				// We skip inplay updates currently.
-				if (u.type == update_type::TIMESTAMP && !went_inplay) {
-					if (market.inplay()) {
-						went_inplay = true;
-						// The sim will handle bet
-						// operations at inplay.
-						sim.update();
-					} else if (!_update_worker(core, meta, market, sim,
-								   node_agg_state, state,
-								   logger.get())) {
-						worker_aborted = true;
-						sim.update();
-						break;
-					}
+			uint64_t expected = shards[p].size() * lanes * sizeof(TNodeAggState) +
+					    nums_cores[p] * sizeof(core_metrics);
+			if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 ||
+			    data.size() != expected) {
+				if (WIFSIGNALED(status))
+					spdlog::error("Process {} killed by signal {}", pids[p],
+						      WTERMSIG(status));
+				else
+					spdlog::error("Process {} failed with status {}, {} of {} "
+						      "result bytes",
+						      pids[p], WEXITSTATUS(status), data.size(),
+						      expected);
+				num_failed++;
+				continue;
+			}
+
+			const char* ptr = data.data();
+			for (uint64_t batch : shards[p]) {
+				uint64_t size = lanes * sizeof(TNodeAggState);
+				std::memcpy(&_node_aggs[batch * lanes], ptr, size);
+				ptr += size;
+			}
+			std::memcpy(&_metrics[first_cores[p]], ptr,
+				    nums_cores[p] * sizeof(core_metrics));
+		}
+
+		if (fork_failed)
+			throw std::runtime_error("Unable to start analyser processes");
+		if (num_failed > 0)
+			throw std::runtime_error(std::to_string(num_failed) + " of " +
+						 std::to_string(num_processes) +
+						 " analyser processes failed");
+	}
+}
+
+template<typename TWorkerState, typename TMarketAggState, typename TNodeAggState, typename TResult>
+auto analyser<TWorkerState, TMarketAggState, TNodeAggState, TResult>::filter_markets(
+	const config& config, const std::vector<meta_view>& metas, uint64_t num_threads,
+	bool data_versions) -> uint64_t
+{
+	uint64_t num_metas = metas.size();
+
+	// Results are recorded per market then gathered in order so the
+	// filtered markets don't depend on how the work was divided.
+	std::vector<uint8_t> passed(num_metas);
+	std::vector<uint64_t> weights(num_metas);
+	std::vector<uint64_t> versions(data_versions ? num_metas : 0);
+	std::atomic<uint64_t> next_chunk = 0;
+	std::atomic<uint64_t> num_missing_stats = 0;
+
+	auto filter_fn = [&] {
+		uint64_t first;
+		while ((first = next_chunk++ * ANALYSE_FILTER_CHUNK_SIZE) < num_metas) {
+			uint64_t last = first + ANALYSE_FILTER_CHUNK_SIZE;
+			if (last > num_metas)
+				last = num_metas;
+
+			for (uint64_t i = first; i < last; i++) {
+				// We need stats to process a market.
+				stats stats; // NOLINT: Output only.
+				if (!try_read_market_stats(config, metas[i].market_id(), stats)) {
+					num_missing_stats++;
+					continue;
 				}
 
-				try {
-					universe.apply_update(u);
-				} catch (janus::universe_apply_error& e) {
-					logger->error(
-						"Core {}: Market {}: got error {} on market parse, skipping! [2]",
-						core, market_id, e.what());
-
-					// If we can't apply an update in this
-					// market we should just abort analysing
-					// it. Indicate worker aborted also.
-					worker_aborted = true;
-					break;
+				if (_predicate(metas[i], stats)) {
+					passed[i] = 1;
+					// Replay cost is dominated by the number of
+					// updates, count each market as at least one.
+					weights[i] = stats.num_updates + 1;
+					if (data_versions)
+						versions[i] = get_market_data_version(
+							config, metas[i].market_id());
 				}
-			} // updates
+			}
+		}
+	};
 
-			// Perform final update to pick up winner.
-			sim.update();
+	uint64_t max_threads =
+		(num_metas + ANALYSE_FILTER_CHUNK_SIZE - 1) / ANALYSE_FILTER_CHUNK_SIZE;
+	if (num_threads > max_threads)
+		num_threads = max_threads;
 
-			// Per-market reducer.
-			if (!_market_reducer(core, state, sim, market, worker_aborted,
-					     market_agg_state, logger.get())) {
-				market_agg_aborted = true;
-				break;
+	// Errors reading stats are rethrown once all threads have stopped.
+	std::vector<std::thread> threads;
+	std::vector<std::exception_ptr> errors(num_threads);
+	threads.reserve(num_threads);
+	for (uint64_t i = 0; i < num_threads; i++) {
+		threads.emplace_back([&, i] {
+			try {
+				filter_fn();
+			} catch (...) {
+				errors[i] = std::current_exception();
+				// Stop the other threads claiming more work.
+				next_chunk = num_metas;
 			}
-		} // markets
-		// Reducer across all markets.
-		if (!_node_reducer(core, market_agg_state, market_agg_aborted, node_agg_state,
-				   logger.get()))
-			break;
-	} // iterations
+		});
+	}
+	for (auto& thread : threads) {
+		thread.join();
+	}
+	for (auto& error : errors) {
+		if (error)
+			std::rethrow_exception(error);
+	}
 
-	auto stop_time = std::chrono::steady_clock::now();
-	auto duration_ms =
-		std::chrono::duration_cast<std::chrono::milliseconds>(stop_time - start_time)
-			.count();
-	logger->info("Core {}: Executed {} iterations over {} markets taking {}ms", core, num_iters,
-		     num_markets, duration_ms);
+	for (uint64_t i = 0; i < num_metas; i++) {
+		if (passed[i] == 0)
+			continue;
 
-	logger->info("Core {}: Sending result data...", core);
-	result_chan.send(node_agg_state);
-	logger->info("Core {}: Sent!", core);
+		_meta_views.emplace_back(metas[i]);
+		_weights.push_back(weights[i]);
+		if (data_versions)
+			_data_versions.push_back(versions[i]);
+	}
+
+	return num_missing_stats;
 }
 
 template<typename TWorkerState, typename TMarketAggState, typename TNodeAggState, typename TResult>
-auto analyser<TWorkerState, TMarketAggState, TNodeAggState, TResult>::run(const config& config,
-									  int req_cores) -> TResult
+auto analyser<TWorkerState, TMarketAggState, TNodeAggState, TResult>::execute(
+	const config& config, const analyse_options& options, uint64_t num_lanes,
+	const lane_init_fn_t& lane_init) -> TResult
 {
+	int req_cores = options.num_cores;
 	if (req_cores == 0)
 		throw std::runtime_error("Can't run with 0 cores!");
 
 	// TODO(lorenzo): Maybe shouldn't be using a thread-based logger?
-	spdlog::stdout_color_mt("thread");
+	// The logger is shared by successive runs.
+	if (!spdlog::get("thread"))
+		spdlog::stdout_color_mt("thread");
 
 	spdlog::info("Reading metadata...");
 
 	std::vector<meta_view> metas = read_all_metadata(config, _meta_dyn_buf);
+	_meta_views.clear();
 	_meta_views.reserve(metas.size());
+	_weights.clear();
+	_weights.reserve(metas.size());
+	_data_versions.clear();
 
-	spdlog::info("Processing {} market metadata/stats against predicate...", metas.size());
+	uint64_t num_cores;
+	if (req_cores < 0)
+		num_cores = std::thread::hardware_concurrency();
+	else
+		num_cores = static_cast<uint64_t>(req_cores);
 
-	uint64_t num_missing_stats = 0;
-	// Apply predicate to all meta views and stats.
-	for (const auto& view : metas) {
-		// We need stats to process a market.
-		if (!have_market_stats(config, view.market_id())) {
-			num_missing_stats++;
-			continue;
-		}
+	spdlog::info("Processing {} market metadata/stats against predicate on {} cores...",
+		     metas.size(), num_cores);
+
+	auto filter_start_time = std::chrono::steady_clock::now();
+	// Data versions identify dataset images and cached results, reading
+	// them while filtering spreads the cost across cores.
+	bool use_image = !config.dataset_image_root.empty() && !options.dataset_image_key.empty();
+	bool use_result_cache =
+		!config.result_cache_root.empty() && !options.result_cache_key.empty();
+	uint64_t num_missing_stats =
+		filter_markets(config, metas, num_cores, use_image || use_result_cache);
+	auto filter_stop_time = std::chrono::steady_clock::now();
+	auto filter_ms = std::chrono::duration_cast<std::chrono::milliseconds>(filter_stop_time -
+										 filter_start_time)
+				 .count();
 
-		const stats stats = read_market_stats(config, view.market_id());
-		if (_predicate(view, stats))
-			_meta_views.emplace_back(view);
-	}
 	uint64_t total_num_markets = _meta_views.size();
 	if (total_num_markets == 0)
 		throw std::runtime_error("Filtered out all markets!");
 
-	spdlog::info("Filtered {} markets from {} ({} were missing stats)", total_num_markets,
-		     metas.size(), num_missing_stats);
+	spdlog::info("Filtered {} markets from {} ({} were missing stats) taking {}ms",
+		     total_num_markets, metas.size(), num_missing_stats, filter_ms);
 
-	uint64_t num_cores;
-	if (req_cores < 0)
-		num_cores = std::thread::hardware_concurrency();
-	else
-		num_cores = static_cast<uint64_t>(req_cores);
 	if (total_num_markets < num_cores)
 		num_cores = total_num_markets;
-	std::vector<std::thread> threads(num_cores);
-	std::vector<channel<bool>> load_chans(num_cores);
-	std::vector<channel<TNodeAggState>> result_chans(num_cores);
-	uint64_t markets_per_core = total_num_markets / num_cores;
-	spdlog::info("Will use {} cores which will each analyse {} markets each", num_cores,
-		     markets_per_core);
-
-	// Start threads and load data in each in order that the allocations are
-	// local to each core.
-	uint64_t offset = 0;
-	for (uint64_t core = 0; core < num_cores; core++) {
-		uint64_t num_markets;
-		if (core == num_cores - 1)
-			num_markets = total_num_markets - offset;
-		else
-			num_markets = markets_per_core;
-
-		channel<bool>& load_chan = load_chans[core];
-		threads[core] = std::thread([&] {
-			thread_fn(config, core, load_chan, result_chans[core], offset, num_markets);
-		});
 
-		::cpu_set_t cpuset;
-		CPU_ZERO(&cpuset);
-		CPU_SET(core, &cpuset);
-		int err_num = ::pthread_setaffinity_np(threads[core].native_handle(),
-						       sizeof(cpu_set_t), &cpuset);
-		if (err_num != 0)
-			throw std::runtime_error(
-				std::string("Unable to set core affinity on core ") +
-				std::to_string(core) + " error " + std::to_string(err_num));
+	uint64_t num_batches = options.num_batches;
+	if (num_batches == 0)
+		num_batches = num_cores * DEFAULT_ANALYSE_BATCHES_PER_CORE;
+	_batches = partition_batches(_weights, num_batches);
+	_schedule = schedule_batches(_batches);
+	num_batches = _batches.size();
+	if (num_cores > num_batches)
+		num_cores = num_batches;
 
-		if (!load_chan.receive())
-			throw std::runtime_error(std::string("Unable to load data on core ") +
-						 std::to_string(core));
+	_batch_bufs.clear();
+	_batch_bufs.resize(num_batches);
+	_image.reset();
+	if (use_image) {
+		std::vector<uint64_t> ids;
+		ids.reserve(total_num_markets);
+		for (const auto& view : _meta_views) {
+			ids.push_back(view.market_id());
+		}
 
-		spdlog::info("Core {} loaded {} markets.", core, num_markets);
-		offset += num_markets;
+		spdlog::info("Opening dataset image in {}...", config.dataset_image_root);
+		_image = dataset_image::open(config, config.dataset_image_root,
+					     options.dataset_image_key, ids, _data_versions);
+		spdlog::info("Mapped {} markets, {} bytes from dataset image",
+			     _image->num_markets(), _image->size());
 	}
+	_result_cache.reset();
+	_results.clear();
+	_config_hashes.clear();
+	_config_indexes.clear();
+	if (use_result_cache) {
+		if constexpr (!std::is_trivially_copyable_v<TMarketAggState>)
+			throw std::runtime_error("Market aggregate state must be trivially "
+						 "copyable to cache results");
+		if (!_market_merger)
+			throw std::runtime_error("A market merger must be set to cache results");
+		if (options.result_cache_version == 0)
+			throw std::runtime_error("A strategy version must be set to cache results");
+		if (!options.result_cache_config)
+			throw std::runtime_error("Configs must be described to cache results");
 
-	// Kick off worker threads.
-	spdlog::info("Starting worker threads...");
-	for (uint64_t core = 0; core < num_cores; core++) {
-		load_chans[core].send(true);
+		// Results are keyed by what the configs are rather than their
+		// index, so they can be shared by runs of different configs.
+		uint64_t num_configs = num_lanes == 0 ? 1 : num_lanes;
+		for (uint64_t i = 0; i < num_configs; i++) {
+			uint64_t hash = hash_dataset_key(options.result_cache_config(i));
+			auto [it, inserted] = _config_indexes.emplace(hash, i);
+			if (!inserted)
+				throw std::runtime_error("Configs " + std::to_string(it->second) +
+							 " and " + std::to_string(i) +
+							 " are described the same");
+			_config_hashes.push_back(hash);
+		}
+
+		_result_cache.emplace(config.result_cache_root, options.result_cache_key,
+				      options.result_cache_version, sizeof(cached_result));
+		_results.resize(total_num_markets);
+		spdlog::info("Caching market results in {}", _result_cache->dir());
+	}
+	_checkpoints.clear();
+	_checkpoint_max_bytes = options.checkpoint_max_bytes;
+	if (options.checkpoint_time) {
+		_checkpoints.resize(total_num_markets);
+		for (uint64_t i = 0; i < total_num_markets; i++) {
+			_checkpoints[i].timestamp = options.checkpoint_time(_meta_views[i]);
+			_checkpoints[i].attempted = false;
+		}
 	}
-	spdlog::info("All {} cores started!", num_cores);
 
-	std::vector<TNodeAggState> node_aggs(num_cores);
-	for (uint64_t core = 0; core < num_cores; core++) {
-		node_aggs.emplace_back(result_chans[core].receive());
-		spdlog::info("Core {} received data!", core);
+	_num_lanes = num_lanes;
+	if (num_lanes == 0) {
+		_node_aggs.assign(num_batches, _zero_node_agg_state);
+	} else {
+		_node_aggs.assign(num_batches * num_lanes, _zero_node_agg_state);
+		for (uint64_t batch = 0; batch < num_batches; batch++) {
+			for (uint64_t i = 0; i < num_lanes; i++) {
+				lane_init(i, _node_aggs[batch * num_lanes + i]);
+			}
+		}
+		spdlog::info("Sweeping {} lanes", num_lanes);
+	}
+	_next_load = 0;
+	_batch_nodes.assign(num_batches, NO_BATCH_NODE);
+	_batch_claimed = std::make_unique<std::atomic<bool>[]>(num_batches);
+	for (uint64_t i = 0; i < num_batches; i++) {
+		_batch_claimed[i] = false;
 	}
 
-	spdlog::info("Data from {} cores received! Joining all threads...", num_cores);
-	for (uint64_t core = 0; core < num_cores; core++) {
-		threads[core].join();
+	_topology = get_cpu_topology();
+	_placements = place_workers(_topology, num_cores);
+	_bet_pools.clear();
+	_bet_pools.resize(num_cores);
+	_metrics.assign(num_cores, core_metrics{});
+	_core_errors.assign(num_cores, nullptr);
+	_checkpoint_bytes.assign(num_cores, 0);
+	_failed = false;
+	_progress = std::make_unique<seqlock<core_progress>[]>(num_cores);
+	_detailed_metrics = options.detailed_metrics;
+	_publish_progress = options.metrics_interval_ms > 0;
+	spdlog::info("Placing {} cores on {} NUMA nodes: {}", num_cores, _topology.nodes.size(),
+		     describe_placements(_topology, _placements));
+
+	spdlog::info("Will use {} cores which will analyse {} batches of ~{} markets each",
+		     num_cores, num_batches, total_num_markets / num_batches);
+	if (options.num_processes > 0)
+		run_processes(config, options, options.num_processes, num_cores);
+	else
+		run_cores(config, options, 0, num_cores);
+
+	// Release market data as soon as we're done with it.
+	_batch_bufs.clear();
+	_image.reset();
+	_checkpoints.clear();
+	_result_cache.reset();
+	_results.clear();
+	_bet_pools.clear();
+	_progress.reset();
+
+	core_metrics total = {};
+	for (const auto& metrics : _metrics) {
+		total.merge(metrics);
+	}
+	log_core_metrics(spdlog::default_logger_raw(), "All cores", total);
+	log_slowest_markets(spdlog::default_logger_raw(), total);
+	if (!options.metrics_path.empty()) {
+		write_metrics_json(options.metrics_path, _metrics);
+		spdlog::info("Wrote metrics report to {}", options.metrics_path);
 	}
 
+	// Node aggregates are held per batch and reduced in batch order so the
+	// result doesn't depend on scheduling.
 	spdlog::info("All threads complete, reducing aggregate data...");
-	return _reducer(node_aggs);
+	return _reducer(_node_aggs);
 }
 } // namespace janus
@@ -0,0 +1,194 @@
+#include "janus.hh"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace janus
+{
+// Convert nanoseconds to fractional milliseconds.
+static auto to_ms(uint64_t ns) -> double
+{
+	return static_cast<double>(ns) / static_cast<double>(NS_PER_MS);
+}
+
+// Get the rate per second of count over the specified nanoseconds.
+static auto per_sec(uint64_t count, uint64_t ns) -> double
+{
+	if (ns == 0)
+		return 0;
+	return static_cast<double>(count) * static_cast<double>(NS_PER_SEC) /
+	       static_cast<double>(ns);
+}
+
+// Insert a market into a slowest first list of at most NUM_SLOWEST_MARKETS,
+// keeping only its slowest time if already present.
+static void insert_slowest(std::array<market_replay_time, NUM_SLOWEST_MARKETS>& slowest,
+			   uint64_t& num_slowest, market_replay_time time)
+{
+	// Replace any existing entry for the market, otherwise fill a free
+	// slot or replace the fastest if we're slower.
+	uint64_t pos = 0;
+	while (pos < num_slowest && slowest[pos].market_id != time.market_id)
+		pos++;
+	if (pos < num_slowest) {
+		if (slowest[pos].ns >= time.ns)
+			return;
+	} else if (num_slowest < NUM_SLOWEST_MARKETS) {
+		num_slowest++;
+	} else {
+		pos = NUM_SLOWEST_MARKETS - 1;
+		if (slowest[pos].ns >= time.ns)
+			return;
+	}
+
+	// Move faster entries down until we reach our place.
+	for (; pos > 0 && slowest[pos - 1].ns < time.ns; pos--) {
+		slowest[pos] = slowest[pos - 1];
+	}
+	slowest[pos] = time;
+}
+
+auto get_replay_time_bucket(uint64_t ns) -> uint64_t
+{
+	auto bucket = static_cast<uint64_t>(std::bit_width(ns / NS_PER_US));
+	return std::min(bucket, NUM_REPLAY_TIME_BUCKETS - 1);
+}
+
+void core_metrics::add_replay(uint64_t market_id, uint64_t num_updates, uint64_t ns)
+{
+	num_replays++;
+	this->num_updates += num_updates;
+	replay_ns += ns;
+	replay_time_buckets[get_replay_time_bucket(ns)]++;
+	insert_slowest(slowest, num_slowest, {.market_id = market_id, .ns = ns});
+}
+
+void core_metrics::merge(const core_metrics& other)
+{
+	num_batches += other.num_batches;
+	num_replays += other.num_replays;
+	num_cached += other.num_cached;
+	num_updates += other.num_updates;
+	run_ns = std::max(run_ns, other.run_ns);
+	load_ns += other.load_ns;
+	decompress_ns += other.decompress_ns;
+	replay_ns += other.replay_ns;
+	apply_ns += other.apply_ns;
+	callback_ns += other.callback_ns;
+	for (uint64_t i = 0; i < NUM_REPLAY_TIME_BUCKETS; i++) {
+		replay_time_buckets[i] += other.replay_time_buckets[i];
+	}
+	for (uint64_t i = 0; i < other.num_slowest; i++) {
+		insert_slowest(slowest, num_slowest, other.slowest[i]);
+	}
+}
+
+// Write the counts and times of the specified metrics as JSON fields.
+static void write_metrics_fields(std::ostringstream& oss, const core_metrics& metrics)
+{
+	oss << R"("batches":)" << metrics.num_batches;
+	oss << R"(,"replays":)" << metrics.num_replays;
+	oss << R"(,"cached":)" << metrics.num_cached;
+	oss << R"(,"updates":)" << metrics.num_updates;
+	oss << R"(,"updates_per_sec":)" << per_sec(metrics.num_updates, metrics.run_ns);
+	oss << R"(,"replays_per_sec":)" << per_sec(metrics.num_replays, metrics.run_ns);
+	oss << R"(,"run_ms":)" << to_ms(metrics.run_ns);
+	oss << R"(,"load_ms":)" << to_ms(metrics.load_ns);
+	oss << R"(,"decompress_ms":)" << to_ms(metrics.decompress_ns);
+	oss << R"(,"replay_ms":)" << to_ms(metrics.replay_ns);
+	oss << R"(,"apply_ms":)" << to_ms(metrics.apply_ns);
+	oss << R"(,"callback_ms":)" << to_ms(metrics.callback_ns);
+}
+
+void log_core_metrics(spdlog::logger* logger, const std::string& name,
+		      const core_metrics& metrics)
+{
+	// The split of replay time is only known if detailed metrics are
+	// enabled.
+	std::string split;
+	if (metrics.apply_ns > 0 || metrics.callback_ns > 0)
+		split = " (apply " + std::to_string(metrics.apply_ns / NS_PER_MS) +
+			"ms, callbacks " + std::to_string(metrics.callback_ns / NS_PER_MS) + "ms)";
+	logger->info("{}: {:.0f} updates/s, {:.1f} markets/s, load {:.0f}ms, decompress "
+		     "{:.0f}ms, replay {:.0f}ms{}",
+		     name, per_sec(metrics.num_updates, metrics.run_ns),
+		     per_sec(metrics.num_replays, metrics.run_ns), to_ms(metrics.load_ns),
+		     to_ms(metrics.decompress_ns), to_ms(metrics.replay_ns), split);
+}
+
+void log_slowest_markets(spdlog::logger* logger, const core_metrics& metrics)
+{
+	std::string str;
+	for (uint64_t i = 0; i < metrics.num_slowest; i++) {
+		if (i > 0)
+			str += ", ";
+		str += std::to_string(metrics.slowest[i].market_id) + " " +
+		       std::to_string(metrics.slowest[i].ns / NS_PER_MS) + "ms";
+	}
+	logger->info("Slowest markets: {}", str);
+}
+
+auto format_metrics_json(const std::vector<core_metrics>& cores) -> std::string
+{
+	core_metrics total = {};
+	for (const auto& metrics : cores) {
+		total.merge(metrics);
+	}
+
+	std::ostringstream oss;
+	oss << std::fixed << std::setprecision(3); // NOLINT: Not magical, microseconds.
+
+	oss << R"({"cores":[)";
+	for (uint64_t core = 0; core < cores.size(); core++) {
+		if (core > 0)
+			oss << ",";
+		oss << R"({"core":)" << core << ",";
+		write_metrics_fields(oss, cores[core]);
+		oss << "}";
+	}
+	oss << R"(],"total":{)";
+	write_metrics_fields(oss, total);
+
+	oss << R"(},"replay_time_histogram":[)";
+	for (uint64_t i = 0; i < NUM_REPLAY_TIME_BUCKETS; i++) {
+		if (i > 0)
+			oss << ",";
+		uint64_t min_us = i == 0 ? 0 : 1UL << (i - 1);
+		oss << R"({"min_us":)" << min_us;
+		if (i < NUM_REPLAY_TIME_BUCKETS - 1)
+			oss << R"(,"max_us":)" << (1UL << i);
+		oss << R"(,"count":)" << total.replay_time_buckets[i] << "}";
+	}
+
+	oss << R"(],"slowest_markets":[)";
+	for (uint64_t i = 0; i < total.num_slowest; i++) {
+		if (i > 0)
+			oss << ",";
+		oss << R"({"market_id":)" << total.slowest[i].market_id;
+		oss << R"(,"replay_ms":)" << to_ms(total.slowest[i].ns) << "}";
+	}
+	oss << "]}";
+
+	return oss.str();
+}
+
+void write_metrics_json(const std::string& path, const std::vector<core_metrics>& cores)
+{
+	auto file = std::ofstream(path, std::ios::trunc);
+	if (!file)
+		throw std::runtime_error(std::string("Cannot open ") + path +
+					 " for metrics report write");
+
+	file << format_metrics_json(cores) << "\n";
+	file.close();
+	if (!file)
+		throw std::runtime_error(std::string("Error writing metrics report to ") + path);
+}
+} // namespace janus
@@ -0,0 +1,283 @@
+#include "janus.hh"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+namespace fs = std::filesystem;
+
+namespace janus
+{
+static constexpr uint64_t FNV_OFFSET_BASIS = 0xcbf29ce484222325;
+static constexpr uint64_t FNV_PRIME = 0x100000001b3;
+
+// Mix the bytes of the specified value into a 64-bit FNV-1a hash.
+static void fnv1a(uint64_t& hash, const void* ptr, uint64_t size)
+{
+	const auto* bytes = static_cast<const uint8_t*>(ptr);
+	for (uint64_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= FNV_PRIME;
+	}
+}
+
+auto hash_dataset_key(const std::string& key) -> uint64_t
+{
+	uint64_t hash = FNV_OFFSET_BASIS;
+	fnv1a(hash, key.data(), key.size());
+	return hash;
+}
+
+auto get_market_data_version(const config& config, uint64_t market_id) -> uint64_t
+{
+	std::string path =
+		config.binary_data_root + "/market/" + std::to_string(market_id) + ".jan";
+
+	// A file which doesn't exist contributes only its ID, the image build
+	// will fail on it.
+	struct ::stat st = {};
+	if (::stat(path.c_str(), &st) != 0 && ::stat((path + ".snap").c_str(), &st) != 0)
+		st = {};
+	uint64_t size = st.st_size;
+	uint64_t mtime_ns = st.st_mtim.tv_sec * 1'000'000'000UL + st.st_mtim.tv_nsec;
+
+	uint64_t hash = FNV_OFFSET_BASIS;
+	fnv1a(hash, &market_id, sizeof(market_id));
+	fnv1a(hash, &size, sizeof(size));
+	fnv1a(hash, &mtime_ns, sizeof(mtime_ns));
+	return hash;
+}
+
+auto get_dataset_version(const std::vector<uint64_t>& market_versions) -> uint64_t
+{
+	uint64_t hash = FNV_OFFSET_BASIS;
+	fnv1a(hash, market_versions.data(), market_versions.size() * sizeof(uint64_t));
+	return hash;
+}
+
+auto get_dataset_version(const config& config, const std::vector<uint64_t>& market_ids)
+	-> uint64_t
+{
+	std::vector<uint64_t> versions;
+	versions.reserve(market_ids.size());
+	for (uint64_t id : market_ids) {
+		versions.push_back(get_market_data_version(config, id));
+	}
+	return get_dataset_version(versions);
+}
+
+auto get_dataset_image_path(const std::string& dir, uint64_t key_hash, uint64_t data_version)
+	-> std::string
+{
+	// NOLINTNEXTLINE: Not magical, 16 hex digits and a separator each.
+	char name[40];
+	std::snprintf(name, sizeof(name), "%016lx-%016lx.img", key_hash, data_version);
+	return dir + "/" + name;
+}
+
+void write_dataset_image(const config& config, const std::string& path, uint64_t key_hash,
+			 uint64_t data_version, const std::vector<uint64_t>& market_ids)
+{
+	// Concurrent builders of the same image each write their own
+	// temporary file, whichever renames last wins.
+	std::string tmp_path = path + "." + std::to_string(::getpid()) + ".tmp";
+
+	auto file = std::ofstream(tmp_path, std::ios::binary | std::ios::trunc);
+	if (!file)
+		throw std::runtime_error(std::string("Cannot open ") + tmp_path +
+					 " for dataset image write");
+
+	uint64_t num_markets = market_ids.size();
+	dataset_image_header header = {
+		.magic = DATASET_IMAGE_MAGIC,
+		.format_version = DATASET_IMAGE_FORMAT_VERSION,
+		.key_hash = key_hash,
+		.data_version = data_version,
+		.num_markets = num_markets,
+	};
+	std::vector<dataset_image_entry> entries(num_markets);
+
+	// The index is written once the size of each market is known, we
+	// leave space for it and write updates after.
+	uint64_t offset = sizeof(dataset_image_header) + num_markets * sizeof(dataset_image_entry);
+	file.seekp(static_cast<std::streamoff>(offset));
+
+	try {
+		for (uint64_t i = 0; i < num_markets; i++) {
+			std::string str = read_market_updates_string(config, market_ids[i]);
+			entries[i] = {
+				.market_id = market_ids[i],
+				.offset = offset,
+				.num_updates = str.size() / sizeof(update),
+			};
+			file.write(str.data(), static_cast<std::streamsize>(str.size()));
+			offset += str.size();
+		}
+
+		file.seekp(0);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(entries.data()),
+			   static_cast<std::streamsize>(num_markets * sizeof(dataset_image_entry)));
+
+		// Closing flushes the file so we check for errors afterwards.
+		file.close();
+		if (!file)
+			throw std::runtime_error(std::string("Error writing dataset image to ") +
+						 tmp_path);
+	} catch (std::exception&) {
+		file.close();
+		std::remove(tmp_path.c_str());
+		throw;
+	}
+
+	if (std::rename(tmp_path.c_str(), path.c_str()) != 0)
+		throw std::runtime_error(std::string("Cannot rename ") + tmp_path + " to " + path);
+}
+
+auto evict_dataset_images(const std::string& dir, uint64_t key_hash, uint64_t data_version)
+	-> uint64_t
+{
+	auto idle_since = fs::file_time_type::clock::now() -
+			  std::chrono::milliseconds(DATASET_IMAGE_MAX_IDLE_MS);
+
+	uint64_t num_evicted = 0;
+	std::error_code err;
+	for (const auto& entry : fs::directory_iterator(dir, err)) {
+		// Temporary files of images being built don't match.
+		std::string name = entry.path().filename();
+		uint64_t entry_key_hash;
+		uint64_t entry_data_version;
+		int len = 0;
+		if (std::sscanf(name.c_str(), "%16lx-%16lx.img%n", &entry_key_hash,
+				&entry_data_version, &len) != 2 ||
+		    static_cast<uint64_t>(len) != name.size())
+			continue;
+
+		if (entry_key_hash == key_hash && entry_data_version == data_version)
+			continue;
+
+		// Images of other datasets may yet be used again.
+		if (entry_key_hash != key_hash) {
+			auto last_write = entry.last_write_time(err);
+			if (err || last_write > idle_since)
+				continue;
+		}
+
+		if (fs::remove(entry.path(), err))
+			num_evicted++;
+	}
+
+	return num_evicted;
+}
+
+dataset_image::dataset_image(const std::string& path) : _data{nullptr}, _size{0}
+{
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd == -1)
+		throw std::runtime_error(std::string("Cannot open ") + path +
+					 " for dataset image read");
+
+	struct ::stat st = {};
+	if (::fstat(fd, &st) != 0) {
+		::close(fd);
+		throw std::runtime_error(std::string("Cannot stat dataset image ") + path);
+	}
+	uint64_t size = st.st_size;
+	if (size < sizeof(dataset_image_header)) {
+		::close(fd);
+		throw std::runtime_error(std::string("Dataset image ") + path + " is truncated");
+	}
+
+	// The mapping holds a reference to the file so we can close it
+	// straight away.
+	void* ptr = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (ptr == MAP_FAILED) // NOLINT: Macro casts.
+		throw std::runtime_error(std::string("Cannot map dataset image ") + path);
+
+	_data = static_cast<const uint8_t*>(ptr);
+	_size = size;
+
+	const dataset_image_header& hdr = header();
+	std::string error;
+	if (hdr.magic != DATASET_IMAGE_MAGIC)
+		error = " is not a dataset image";
+	else if (hdr.format_version != DATASET_IMAGE_FORMAT_VERSION)
+		error = " is of format version " + std::to_string(hdr.format_version) +
+			" expected " + std::to_string(DATASET_IMAGE_FORMAT_VERSION);
+	else if (sizeof(dataset_image_header) + hdr.num_markets * sizeof(dataset_image_entry) >
+		 size)
+		error = " has a truncated index";
+
+	for (uint64_t i = 0; error.empty() && i < hdr.num_markets; i++) {
+		const dataset_image_entry& entry = entries()[i];
+		if (entry.offset + entry.num_updates * sizeof(update) > size)
+			error = " has truncated data for market " + std::to_string(entry.market_id);
+	}
+
+	if (!error.empty()) {
+		::munmap(ptr, size);
+		throw std::runtime_error(std::string("Dataset image ") + path + error);
+	}
+}
+
+dataset_image::~dataset_image()
+{
+	::munmap(const_cast<uint8_t*>(_data), _size); // NOLINT: Mapping is ours.
+}
+
+auto dataset_image::open(const config& config, const std::string& dir, const std::string& key,
+			 const std::vector<uint64_t>& market_ids,
+			 const std::vector<uint64_t>& market_versions)
+	-> std::unique_ptr<dataset_image>
+{
+	uint64_t key_hash = hash_dataset_key(key);
+	uint64_t data_version = get_dataset_version(market_versions);
+	std::string path = get_dataset_image_path(dir, key_hash, data_version);
+
+	if (file_exists(path)) {
+		// Record that the image is in use so it isn't evicted as idle.
+		std::error_code err;
+		fs::last_write_time(path, fs::file_time_type::clock::now(), err);
+	} else {
+		fs::create_directories(dir);
+		write_dataset_image(config, path, key_hash, data_version, market_ids);
+		evict_dataset_images(dir, key_hash, data_version);
+	}
+
+	auto ret = std::make_unique<dataset_image>(path);
+
+	// The data version covers the markets so this only fails if the file
+	// has been tampered with.
+	bool match = ret->key_hash() == key_hash && ret->num_markets() == market_ids.size();
+	for (uint64_t i = 0; match && i < market_ids.size(); i++) {
+		if (ret->market_id(i) != market_ids[i])
+			match = false;
+	}
+	if (!match)
+		throw std::runtime_error(std::string("Dataset image ") + path +
+					 " doesn't match the markets requested");
+
+	return ret;
+}
+
+auto dataset_image::open(const config& config, const std::string& dir, const std::string& key,
+			 const std::vector<uint64_t>& market_ids) -> std::unique_ptr<dataset_image>
+{
+	std::vector<uint64_t> versions;
+	versions.reserve(market_ids.size());
+	for (uint64_t id : market_ids) {
+		versions.push_back(get_market_data_version(config, id));
+	}
+	return open(config, dir, key, market_ids, versions);
+}
+} // namespace janus
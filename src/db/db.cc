@@ -1,6 +1,7 @@
 #include "janus.hh"
 
 #include <algorithm>
+#include <chrono>
 #include <cstdint>
 #include <filesystem>
 #include <fstream>
@@ -93,6 +94,15 @@ auto read_all_metadata(const config& config, dynamic_buffer& dyn_buf) -> std::ve
 
 auto read_market_updates_string(const config& config, uint64_t id) -> std::string
 {
+	market_read_timing timing = {};
+	return read_market_updates_string(config, id, timing);
+}
+
+auto read_market_updates_string(const config& config, uint64_t id, market_read_timing& timing)
+	-> std::string
+{
+	auto start_time = std::chrono::steady_clock::now();
+
 	std::string path = config.binary_data_root + "/market/" + std::to_string(id) + ".jan";
 
 	bool is_compressed = false;
@@ -113,6 +123,11 @@ auto read_market_updates_string(const config& config, uint64_t id) -> std::strin
 	if (!file.read(&str[0], size))
 		throw std::runtime_error(std::string("Error reading market updates from ") + path);
 
+	auto read_time = std::chrono::steady_clock::now();
+	auto read_duration = read_time - start_time;
+	timing.read_ns +=
+		std::chrono::duration_cast<std::chrono::nanoseconds>(read_duration).count();
+
 	// Simple case - just read the data and put it in the dynamic buffer.
 	if (!is_compressed)
 		return str;
@@ -122,6 +137,11 @@ auto read_market_updates_string(const config& config, uint64_t id) -> std::strin
 		throw std::runtime_error(std::string("Unable to decompress ") + path +
 					 " file corrupted?");
 
+	auto decompress_time = std::chrono::steady_clock::now();
+	auto decompress_duration = decompress_time - read_time;
+	timing.decompress_ns +=
+		std::chrono::duration_cast<std::chrono::nanoseconds>(decompress_duration).count();
+
 	return uncompressed;
 }
 
@@ -165,14 +185,9 @@ auto have_market_stats(const config& config, uint64_t id) -> bool
 	return file_exists(path);
 }
 
-auto read_market_stats(const config& config, uint64_t id) -> stats
+// Read statistics from an open stats file.
+static void read_market_stats_file(const std::string& path, std::ifstream& file, stats& out)
 {
-	std::string path = config.binary_data_root + "/stats/" + std::to_string(id) + ".jan";
-
-	auto file = std::ifstream(path, std::ios::binary | std::ios::ate);
-	if (!file)
-		throw std::runtime_error(std::string("Cannot open ") + path + " for stats read");
-
 	uint64_t size = file.tellg();
 	file.seekg(0);
 	if (size != sizeof(stats))
@@ -180,10 +195,32 @@ auto read_market_stats(const config& config, uint64_t id) -> stats
 					 " not of expected size " + std::to_string(sizeof(stats)) +
 					 " is of size " + std::to_string(size));
 
-	stats ret;
-	if (!file.read(reinterpret_cast<char*>(&ret), size))
+	if (!file.read(reinterpret_cast<char*>(&out), size))
 		throw std::runtime_error(std::string("Error while reading stats file ") + path);
+}
+
+auto read_market_stats(const config& config, uint64_t id) -> stats
+{
+	std::string path = config.binary_data_root + "/stats/" + std::to_string(id) + ".jan";
+
+	auto file = std::ifstream(path, std::ios::binary | std::ios::ate);
+	if (!file)
+		throw std::runtime_error(std::string("Cannot open ") + path + " for stats read");
 
+	stats ret;
+	read_market_stats_file(path, file, ret);
 	return ret;
 }
+
+auto try_read_market_stats(const config& config, uint64_t id, stats& out) -> bool
+{
+	std::string path = config.binary_data_root + "/stats/" + std::to_string(id) + ".jan";
+
+	auto file = std::ifstream(path, std::ios::binary | std::ios::ate);
+	if (!file)
+		return false;
+
+	read_market_stats_file(path, file, out);
+	return true;
+}
 } // namespace janus
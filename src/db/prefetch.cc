@@ -0,0 +1,119 @@
+#include "janus.hh"
+
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace janus
+{
+market_prefetcher::market_prefetcher(const config& config, std::vector<uint64_t> market_ids,
+				     uint64_t window, uint64_t num_loaders)
+	: _config{config},
+	  _market_ids{std::move(market_ids)},
+	  _window{window},
+	  _stopped{false},
+	  _next_load{0},
+	  _next_consume{0},
+	  _slots(window)
+{
+	if (_market_ids.empty())
+		throw std::runtime_error("No markets to prefetch");
+	if (window == 0 || num_loaders == 0)
+		throw std::runtime_error("Prefetch window and number of loaders must be non-zero");
+
+	_loaders.reserve(num_loaders);
+	for (uint64_t i = 0; i < num_loaders; i++) {
+		_loaders.emplace_back([this] { loader_fn(); });
+	}
+}
+
+market_prefetcher::~market_prefetcher()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stopped = true;
+	}
+	_cond_var.notify_all();
+
+	for (auto& loader : _loaders) {
+		loader.join();
+	}
+}
+
+auto market_prefetcher::next() -> dynamic_buffer
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+	slot& slot = _slots[_next_consume % _window];
+	_cond_var.wait(lock, [&] { return slot.ready; });
+
+	// Free up the slot for the loaders whether or not the load succeeded.
+	slot.ready = false;
+	_next_consume++;
+	if (!slot.buf) {
+		std::string error = std::move(slot.error);
+		lock.unlock();
+		_cond_var.notify_all();
+		throw std::runtime_error(error);
+	}
+
+	dynamic_buffer ret(std::move(*slot.buf));
+	slot.buf.reset();
+	lock.unlock();
+	_cond_var.notify_all();
+
+	return ret;
+}
+
+void market_prefetcher::skip(uint64_t n)
+{
+	for (uint64_t i = 0; i < n; i++) {
+		try {
+			next();
+		} catch (std::exception&) {
+			// Failed loads are discarded along with the rest.
+		}
+	}
+}
+
+void market_prefetcher::loader_fn()
+{
+	while (true) {
+		uint64_t seq;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_cond_var.wait(lock, [&] {
+				return _stopped || _next_load < _next_consume + _window;
+			});
+			if (_stopped)
+				return;
+
+			seq = _next_load++;
+		}
+
+		// Loading happens outside of the lock so loaders proceed in
+		// parallel, each filling its own slot.
+		std::optional<dynamic_buffer> buf;
+		std::string error;
+		try {
+			buf.emplace(read_market_updates(_config,
+							_market_ids[seq % _market_ids.size()]));
+		} catch (std::exception& e) {
+			error = e.what();
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			slot& slot = _slots[seq % _window];
+			if (buf)
+				slot.buf.emplace(std::move(*buf));
+			slot.error = std::move(error);
+			slot.ready = true;
+		}
+		_cond_var.notify_all();
+	}
+}
+} // namespace janus
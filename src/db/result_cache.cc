@@ -0,0 +1,149 @@
+#include "janus.hh"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <unistd.h>
+namespace fs = std::filesystem;
+
+namespace janus
+{
+auto get_result_cache_dir(const std::string& root, uint64_t key_hash, uint64_t strategy_version)
+	-> std::string
+{
+	// NOLINTNEXTLINE: Not magical, 16 hex digits and a separator each.
+	char name[40];
+	std::snprintf(name, sizeof(name), "%016lx-%016lx", key_hash, strategy_version);
+	return root + "/" + name;
+}
+
+auto evict_result_caches(const std::string& root, uint64_t key_hash, uint64_t strategy_version)
+	-> uint64_t
+{
+	auto idle_since = fs::file_time_type::clock::now() -
+			  std::chrono::milliseconds(RESULT_CACHE_MAX_IDLE_MS);
+
+	uint64_t num_evicted = 0;
+	std::error_code err;
+	for (const auto& entry : fs::directory_iterator(root, err)) {
+		std::string name = entry.path().filename();
+		uint64_t entry_key_hash;
+		uint64_t entry_strategy_version;
+		int len = 0;
+		if (std::sscanf(name.c_str(), "%16lx-%16lx%n", &entry_key_hash,
+				&entry_strategy_version, &len) != 2 ||
+		    static_cast<uint64_t>(len) != name.size())
+			continue;
+
+		if (entry_key_hash == key_hash && entry_strategy_version == strategy_version)
+			continue;
+
+		auto last_write = entry.last_write_time(err);
+		if (err || last_write > idle_since)
+			continue;
+
+		fs::remove_all(entry.path(), err);
+		if (!err)
+			num_evicted++;
+	}
+
+	return num_evicted;
+}
+
+result_cache::result_cache(const std::string& root, const std::string& key,
+			   uint64_t strategy_version, uint64_t result_size)
+	: _key_hash{hash_dataset_key(key)},
+	  _strategy_version{strategy_version},
+	  _result_size{result_size}
+{
+	_dir = get_result_cache_dir(root, _key_hash, strategy_version);
+	fs::create_directories(_dir);
+
+	// Writing results updates the directory's modification time, reading
+	// them doesn't, so record that they're in use.
+	std::error_code err;
+	fs::last_write_time(_dir, fs::file_time_type::clock::now(), err);
+	evict_result_caches(root, _key_hash, strategy_version);
+}
+
+auto result_cache::path(uint64_t market_id) const -> std::string
+{
+	return _dir + "/" + std::to_string(market_id) + ".res";
+}
+
+auto result_cache::read(uint64_t market_id, uint64_t data_version, std::string& results) const
+	-> uint64_t
+{
+	results.clear();
+
+	auto file = std::ifstream(path(market_id), std::ios::binary);
+	if (!file)
+		return 0;
+	std::stringstream ss;
+	ss << file.rdbuf();
+	std::string str = ss.str();
+
+	if (str.size() < sizeof(result_cache_header))
+		return 0;
+	result_cache_header header; // NOLINT: Output only.
+	std::memcpy(&header, str.data(), sizeof(header));
+
+	// Results of other versions of the market's data are stale.
+	if (header.magic != RESULT_CACHE_MAGIC ||
+	    header.format_version != RESULT_CACHE_FORMAT_VERSION ||
+	    header.key_hash != _key_hash || header.strategy_version != _strategy_version ||
+	    header.market_id != market_id || header.data_version != data_version ||
+	    header.result_size != _result_size ||
+	    str.size() != sizeof(header) + header.num_results * _result_size)
+		return 0;
+
+	results = str.substr(sizeof(header));
+	return header.num_results;
+}
+
+void result_cache::write(uint64_t market_id, uint64_t data_version,
+			 const std::string& results) const
+{
+	std::string market_path = path(market_id);
+	// Concurrent writers of the same market each write their own
+	// temporary file, whichever renames last wins.
+	std::string tmp_path = market_path + "." + std::to_string(::getpid()) + ".tmp";
+
+	auto file = std::ofstream(tmp_path, std::ios::binary | std::ios::trunc);
+	if (!file)
+		throw std::runtime_error(std::string("Cannot open ") + tmp_path +
+					 " for result cache write");
+
+	result_cache_header header = {
+		.magic = RESULT_CACHE_MAGIC,
+		.format_version = RESULT_CACHE_FORMAT_VERSION,
+		.key_hash = _key_hash,
+		.strategy_version = _strategy_version,
+		.market_id = market_id,
+		.data_version = data_version,
+		.result_size = _result_size,
+		.num_results = results.size() / _result_size,
+	};
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(results.data(), static_cast<std::streamsize>(results.size()));
+
+	// Closing flushes the file so we check for errors afterwards.
+	file.close();
+	if (!file) {
+		std::remove(tmp_path.c_str());
+		throw std::runtime_error(std::string("Error writing cached results to ") +
+					 tmp_path);
+	}
+
+	if (std::rename(tmp_path.c_str(), market_path.c_str()) != 0)
+		throw std::runtime_error(std::string("Cannot rename ") + tmp_path + " to " +
+					 market_path);
+}
+} // namespace janus
@@ -28,6 +28,16 @@ static constexpr uint64_t MAX_NUM_STREAM_ERRORS = 10;
 // How many lines before we flush output.
 static constexpr uint64_t FLUSH_INTERVAL_LINES = 100;
 
+// How many lines between checks for closed markets to evict from the universe.
+static constexpr uint64_t EVICT_INTERVAL_LINES = 1000;
+
+// Maximum age in ms of a checkpoint relative to the stream's initial image for
+// it to be restored.
+static constexpr uint64_t CHECKPOINT_MAX_AGE_MS = 600'000;
+
+// Name of universe checkpoint file, relative to the JSON data root.
+static constexpr const char* CHECKPOINT_FILENAME = "universe.ckpt";
+
 // Indicates whether a signal has occured and we should abort.
 std::atomic<bool> signalled{false};
 
@@ -114,14 +124,101 @@ static void print_status_line(uint64_t num_lines)
 }
 #endif
 
+// Apply the updates parsed from a stream line to the universe. Faulty updates
+// are logged and skipped so a single bad update doesn't discard the rest of
+// the line.
 static void update_universe(janus::betfair::universe<MAX_NUM_MARKETS>& universe,
 			    janus::dynamic_buffer& dyn_buf)
 {
-	while (dyn_buf.read_offset() != dyn_buf.size()) {
-		auto u = dyn_buf.read<janus::update>();
-		universe.apply_update(u);
-	}
+	auto updates = janus::read_updates(dyn_buf);
+	// Resetting the buffer leaves its contents intact and ensures we don't
+	// reapply updates should applying them throw.
 	dyn_buf.reset();
+
+	while (!updates.empty()) {
+		uint64_t num_applied;
+		janus::betfair::apply_status status = universe.apply_updates(updates, num_applied);
+		if (status == janus::betfair::apply_status::OK)
+			break;
+
+		const janus::update& u = updates[num_applied];
+		spdlog::warn("Skipping faulty {} update: {}", janus::update_type_str(u.type),
+			     janus::betfair::apply_status_str(status));
+		updates = updates.subspan(num_applied + 1);
+	}
+}
+
+// Evict closed markets from the universe which have passed the grace period
+// specified in config, logging the universe's state if any are evicted.
+static void evict_markets(janus::betfair::universe<MAX_NUM_MARKETS>& universe,
+			  uint64_t grace_ms)
+{
+	// A grace period of 0 indicates eviction is disabled.
+	if (grace_ms == 0)
+		return;
+
+	uint64_t num_evicted = universe.evict_closed_markets(grace_ms);
+	if (num_evicted == 0)
+		return;
+
+	spdlog::info("Evicted {} closed markets, {} live, {} evicted this session", num_evicted,
+		     universe.num_markets(), universe.num_evicted());
+}
+
+// Save a checkpoint of the universe so a subsequent run can warm start from it.
+// This is only done on exit or reload as saving blocks the stream. Errors are
+// logged rather than thrown as we can continue without a checkpoint.
+static void save_checkpoint(const janus::betfair::universe<MAX_NUM_MARKETS>& universe,
+			    const std::string& path)
+{
+	try {
+		janus::dynamic_buffer dyn_buf(universe.checkpoint_size());
+		universe.save_checkpoint(dyn_buf);
+		janus::write_checkpoint_file(path, dyn_buf);
+	} catch (std::exception& e) {
+		spdlog::error("Unable to save checkpoint {}: {}", path, e.what());
+	}
+}
+
+// Restore the universe from a checkpoint if one exists, otherwise the universe
+// is populated from scratch by the stream.
+static void load_checkpoint(janus::betfair::universe<MAX_NUM_MARKETS>& universe,
+			    const std::string& path)
+{
+	if (!std::filesystem::exists(path))
+		return;
+
+	try {
+		auto start = std::chrono::steady_clock::now();
+		janus::dynamic_buffer dyn_buf = janus::read_checkpoint_file(path);
+		universe.load_checkpoint(dyn_buf);
+		auto duration_ms = std::chrono::duration_cast<ms_t>(
+					   std::chrono::steady_clock::now() - start)
+					   .count();
+
+		spdlog::info("Restored {} markets from checkpoint {} in {}ms",
+			     universe.num_markets(), path, duration_ms);
+	} catch (std::exception& e) {
+		spdlog::error("Unable to restore checkpoint {}: {}", path, e.what());
+		universe.clear();
+	}
+}
+
+// Discard the universe restored from a checkpoint whose last update was at
+// checkpoint_timestamp if it is stale relative to the stream's initial image at
+// image_timestamp - either too old to be worth keeping or from later than the
+// image, in which case the stream's updates would be rejected as going
+// backwards.
+static void validate_checkpoint(janus::betfair::universe<MAX_NUM_MARKETS>& universe,
+				uint64_t checkpoint_timestamp, uint64_t image_timestamp)
+{
+	if (image_timestamp >= checkpoint_timestamp &&
+	    image_timestamp - checkpoint_timestamp <= CHECKPOINT_MAX_AGE_MS)
+		return;
+
+	spdlog::warn("Discarding stale checkpoint at {} vs. initial image at {}",
+		     checkpoint_timestamp, image_timestamp);
+	universe.clear();
 }
 
 static auto run_loop(janus::config& config, janus::betfair::session& session) -> bool
@@ -174,11 +271,20 @@ static auto run_loop(janus::config& config, janus::betfair::session& session) ->
 	janus::dynamic_buffer dyn_buf(DYN_BUF_BYTES);
 	auto universe = std::make_unique<janus::betfair::universe<MAX_NUM_MARKETS>>();
 
+	std::string checkpoint_path = config.json_data_root + "/" + CHECKPOINT_FILENAME;
+	load_checkpoint(*universe, checkpoint_path);
+	// Timestamp of the restored checkpoint, cleared once it has been
+	// validated against the first timestamped line of the stream.
+	uint64_t checkpoint_timestamp = universe->last_timestamp();
+
 	uint64_t num_lines = 0;
 	uint64_t num_errors = 0;
 	while (true) {
 		if (signalled.load()) {
 			spdlog::info("Signal received, aborting...");
+			spdlog::info("Session processed {} lines, {} markets live, {} evicted",
+				     num_lines, universe->num_markets(), universe->num_evicted());
+			save_checkpoint(*universe, checkpoint_path);
 			return true;
 		}
 
@@ -190,7 +296,14 @@ static auto run_loop(janus::config& config, janus::betfair::session& session) ->
 			write_stream_line(stream_file, line, size, num_lines);
 
 			janus::betfair::parse_update_stream_json(state, line, size, dyn_buf);
+			if (checkpoint_timestamp != 0 && state.timestamp != 0) {
+				validate_checkpoint(*universe, checkpoint_timestamp,
+						    state.timestamp);
+				checkpoint_timestamp = 0;
+			}
 			update_universe(*universe, dyn_buf);
+			if (num_lines % EVICT_INTERVAL_LINES == 0)
+				evict_markets(*universe, config.market_evict_grace_ms);
 
 #ifdef SHOW_STATUS_LINE
 			print_status_line(num_lines);
@@ -202,6 +315,7 @@ static auto run_loop(janus::config& config, janus::betfair::session& session) ->
 			if (num_errors >= MAX_NUM_STREAM_ERRORS) {
 				spdlog::critical("{} errors, cap is {}, aborting...", num_errors,
 						 MAX_NUM_STREAM_ERRORS);
+				save_checkpoint(*universe, checkpoint_path);
 				return false;
 			}
 		}
@@ -9,24 +9,69 @@ namespace janus
 {
 void sim::init()
 {
-	// Initialise removal state for each runner.
-	betfair::market::runners_t& runners = _market.runners();
-	for (uint64_t i = 0; i < runners.size(); i++) {
-		betfair::runner& runner = runners[i];
-		_removed.emplace_back(runner.state() == betfair::runner_state::REMOVED);
+	// Runners are never removed from a market so reserving for the
+	// maximum means references to them remain valid.
+	_runners.reserve(betfair::MAX_RUNNERS);
+	sync_runners();
+}
+
+void sim::sync_runners()
+{
+	// Runners already removed when we first see them have no removal to
+	// apply.
+	for (uint64_t i = _runners.size(); i < _market.num_runners(); i++) {
+		betfair::runner& runner = _market[i];
+		_runners.push_back({
+			.index = i,
+			.num_voided = 0,
+			.removal_applied = runner.state() == betfair::runner_state::REMOVED,
+		});
+	}
+}
+
+void sim::save_checkpoint(dynamic_buffer& dyn_buf) const
+{
+	if (_bets.size() > 0)
+		throw std::runtime_error("Cannot checkpoint sim with " +
+					 std::to_string(_bets.size()) + " bets");
+
+	dyn_buf.add_uint64(_went_inplay ? 1 : 0);
+	dyn_buf.add_uint64(_runners.size());
+	// Removals the sim has yet to see are applied to bets placed after
+	// the checkpoint, so are kept rather than rederived on restore.
+	for (const sim_runner& runner : _runners) {
+		dyn_buf.add_uint64(runner.removal_applied ? 1 : 0);
 	}
 }
 
-auto sim::get_matched(bet& bet, betfair::runner& runner, bool first) -> double
+void sim::load_checkpoint(dynamic_buffer& dyn_buf)
+{
+	_bets.clear();
+	_next_bet_id = 0;
+	_went_inplay = dyn_buf.read_uint64() == 1;
+
+	uint64_t num_runners = dyn_buf.read_uint64();
+	if (num_runners > _market.num_runners())
+		throw std::runtime_error("Sim checkpoint contains " + std::to_string(num_runners) +
+					 " runners, market has " +
+					 std::to_string(_market.num_runners()));
+
+	_runners.clear();
+	for (uint64_t i = 0; i < num_runners; i++) {
+		_runners.push_back({
+			.index = i,
+			.num_voided = 0,
+			.removal_applied = dyn_buf.read_uint64() == 1,
+		});
+	}
+}
+
+auto sim::get_matched(bet& bet, betfair::runner& runner, uint64_t price_index, bool first)
+	-> double
 {
 	// Note that this expects the caller to have determined that this is a
 	// valid runner and bet.
 
-	// TODO(lorenzo): perf: Good idea to do this every time? Maybe store
-	// price index in bet as well as double value (for adjustment
-	// factor-invoked invalid prices).
-	uint64_t price_index = _range.price_to_nearest_index(bet.price());
-
 	// If we cannot determine price, don't raise an error, rather indicate
 	// that no traded volume is present. This is to reduce simulation run
 	// fragility.
@@ -61,16 +106,13 @@ auto sim::get_matched(bet& bet, betfair::runner& runner, bool first) -> double
 	return ladder.matched(price_index);
 }
 
-auto sim::get_target_matched(bet& bet, betfair::runner& runner) -> double
+auto sim::get_target_matched(bet& bet, betfair::runner& runner, uint64_t price_index)
+	-> double
 {
-	double matched = get_matched(bet, runner, true);
+	double matched = get_matched(bet, runner, price_index, true);
 	if (matched == -1)
 		return -1;
 
-	// TODO(lorenzo): perf: We duplicate this with get_matched(). Since it
-	// only happens on initial bet placement it is probably not a huge big
-	// deal.
-	uint64_t price_index = _range.price_to_nearest_index(bet.price());
 	if (price_index == betfair::INVALID_PRICE_INDEX)
 		return INVALID_PRICE_TARGET_VOL;
 
@@ -97,6 +139,9 @@ auto sim::add_bet(uint64_t runner_id, double price, double stake, bool is_back,
 	if (stake < 0 || price < 1)
 		return nullptr;
 
+	if (_bets.size() == MAX_SIM_BETS)
+		return nullptr;
+
 	// If the market is suspended or closed then clearly we cannot place a
 	// bet.
 	if (!bypass && _market.state() != betfair::market_state::OPEN)
@@ -107,17 +152,20 @@ auto sim::add_bet(uint64_t runner_id, double price, double stake, bool is_back,
 	if (!bypass && _market.inplay())
 		return nullptr;
 
-	betfair::runner& runner = find_runner(runner_id);
+	sim_runner& sim_runner = find_runner(runner_id);
+	betfair::runner& runner = market_runner(sim_runner);
 	// Can only bet on active runners.
 	if (!bypass && runner.state() != betfair::runner_state::ACTIVE)
 		return nullptr;
 
 	bet& bet = _bets.emplace_back(runner_id, price, stake, is_back, true, persist);
 	bet.set_bet_id(_next_bet_id++);
+	sim_runner.bets.push_back(&bet);
 
 	// Note that this will set the correct best available price if the input
 	// price is suboptimal.
-	double target_matched = get_target_matched(bet, runner);
+	uint64_t price_index = _range.price_to_nearest_index(bet.price());
+	double target_matched = get_target_matched(bet, runner, price_index);
 	if (target_matched < 0) {
 		// When the market has moved past our bet this simulation
 		// simplifies things by simply matching the whole bet.
@@ -128,15 +176,35 @@ auto sim::add_bet(uint64_t runner_id, double price, double stake, bool is_back,
 		// determines the matched volume at the bet's price level at
 		// which we can start matching this bet.
 		bet.set_target_matched(target_matched);
+
+		// The price is only changed by removals, which complete the
+		// bet, so its index remains valid.
+		bool valid = price_index != betfair::INVALID_PRICE_INDEX;
+		sim_runner.active.push_back({
+			.placed = &bet,
+			.price_index = price_index,
+			.target_matched = target_matched,
+			.last_matched = valid ? runner.ladder().matched(price_index) : 0,
+			.is_back = is_back,
+		});
 	}
 
 	return &bet;
 }
 
-auto sim::find_runner(uint64_t id) -> betfair::runner&
+auto sim::get_runner(uint64_t id) -> sim_runner*
+{
+	uint64_t index = _market.find_runner_index(id);
+	if (index == _market.num_runners())
+		return nullptr;
+
+	sync_runners();
+	return &_runners[index];
+}
+
+auto sim::find_runner(uint64_t id) -> sim_runner&
 {
-	// TODO(lorenzo): perf: Looking up runner per-bet?
-	betfair::runner* runner = _market.find_runner(id);
+	sim_runner* runner = get_runner(id);
 	if (runner == nullptr) {
 		std::ostringstream oss;
 		oss << "Cannot find runner " << id << " in market " << _market.id();
@@ -146,9 +214,8 @@ auto sim::find_runner(uint64_t id) -> betfair::runner&
 	return *runner;
 }
 
-void sim::update_bet(bet& bet)
+void sim::update_bet(bet& bet, betfair::runner& runner)
 {
-	betfair::runner& runner = find_runner(bet.runner_id());
 	if (runner.state() == betfair::runner_state::REMOVED) {
 		bet.void_bet();
 		return;
@@ -160,7 +227,8 @@ void sim::update_bet(bet& bet)
 	if (bet.is_complete())
 		return;
 
-	double matched = get_matched(bet, runner, false);
+	uint64_t price_index = _range.price_to_nearest_index(bet.price());
+	double matched = get_matched(bet, runner, price_index, false);
 	// If the market has moved over us, we simply mark the bet fully
 	// matched. TODO(lorenzo): Reconsider.
 	if (matched == -1) {
@@ -181,6 +249,72 @@ void sim::update_bet(bet& bet)
 	}
 }
 
+auto sim::fire_trigger(sim_trigger& trigger, const betfair::ladder& ladder, uint64_t max_atb,
+			uint64_t min_atl) -> bool
+{
+	uint64_t price_index = trigger.price_index;
+	if (price_index == betfair::INVALID_PRICE_INDEX)
+		return false;
+
+	// If the market has moved over us, we simply mark the bet fully
+	// matched. TODO(lorenzo): Reconsider.
+	bool crossed = trigger.is_back ? max_atb >= price_index : min_atl <= price_index;
+	double matched = 0;
+	if (!crossed) {
+		matched = ladder.matched(price_index);
+		if (matched == trigger.last_matched)
+			return false;
+		trigger.last_matched = matched;
+	}
+
+	// The bet may have been completed since we last looked, e.g. by being
+	// cancelled.
+	bet& bet = *trigger.placed;
+	if (bet.is_complete())
+		return true;
+
+	if (crossed) {
+		bet.match(bet.unmatched());
+	} else if (matched > trigger.target_matched) {
+		// Since the matched volume contains both back and lay side we
+		// have to divide by 2 to determine what portion of our bet has
+		// matched. This handles the case where diff > unmatched.
+		bet.match((matched - trigger.target_matched) / 2.);
+	}
+
+	return true;
+}
+
+void sim::update_runner(sim_runner& runner)
+{
+	// Bets on removed runners are voided whether complete or not,
+	// including any placed since the removal.
+	if (market_runner(runner).state() == betfair::runner_state::REMOVED) {
+		for (uint64_t i = runner.num_voided; i < runner.bets.size(); i++) {
+			runner.bets[i]->void_bet();
+		}
+		runner.num_voided = runner.bets.size();
+		runner.active.clear();
+		return;
+	}
+
+	// The top of book is read once for all of the runner's bets, which
+	// are then only touched if triggered.
+	const betfair::ladder& ladder = market_runner(runner).ladder();
+	uint64_t max_atb = ladder.max_atb_index();
+	uint64_t min_atl = ladder.min_atl_index();
+
+	uint64_t num_active = 0;
+	for (sim_trigger& trigger : runner.active) {
+		bool fired = fire_trigger(trigger, ladder, max_atb, min_atl);
+		if (fired && trigger.placed->is_complete())
+			continue;
+
+		runner.active[num_active++] = trigger;
+	}
+	runner.active.resize(num_active);
+}
+
 void sim::apply_removal(double adj_factor)
 {
 	uint64_t size = _bets.size();
@@ -197,20 +331,19 @@ void sim::apply_removal(double adj_factor)
 
 void sim::apply_removals()
 {
-	// Note that bets on the removed horses are voided in update_bet().
-	betfair::market::runners_t& runners = _market.runners();
-
-	for (uint64_t i = 0; i < runners.size(); i++) {
+	// Note that bets on the removed horses are voided in update_runner().
+	// Applying a removal can add bets so we index rather than iterate.
+	for (uint64_t i = 0; i < _runners.size(); i++) {
 		// If we already know about this removal then nothing to do.
-		if (_removed[i])
+		if (_runners[i].removal_applied)
 			continue;
 
-		betfair::runner& runner = runners[i];
+		betfair::runner& runner = market_runner(_runners[i]);
 		if (runner.state() != betfair::runner_state::REMOVED)
 			continue;
 
 		apply_removal(runner.adj_factor());
-		_removed[i] = true;
+		_runners[i].removal_applied = true;
 	}
 }
 
@@ -222,21 +355,15 @@ void sim::update()
 	if (_market.state() != betfair::market_state::OPEN)
 		return;
 
-	for (uint64_t i = 0; i < _bets.size(); i++) {
-		bet& bet = _bets[i];
-		update_bet(bet);
+	sync_runners();
+	for (auto& runner : _runners) {
+		update_runner(runner);
 	}
 
 	// TODO(lorenzo): perf: Check this on each update?
 	apply_removals();
 }
 
-auto sim::runner_won(bet& bet) -> bool
-{
-	betfair::runner& runner = find_runner(bet.runner_id());
-	return runner.state() == betfair::runner_state::WON;
-}
-
 auto sim::pl() -> double
 {
 	// Ensure at least one of the runners won otherwise we return 0.
@@ -253,11 +380,11 @@ auto sim::pl() -> double
 		return 0;
 
 	double ret = 0;
-	for (uint64_t i = 0; i < _bets.size(); i++) {
-		bet& bet = _bets[i];
-		double delta = bet.pl(runner_won(bet));
-
-		ret += delta;
+	for (auto& runner : _runners) {
+		bool won = market_runner(runner).state() == betfair::runner_state::WON;
+		for (bet* bet : runner.bets) {
+			ret += bet->pl(won);
+		}
 	}
 
 	return ret;
@@ -323,20 +450,18 @@ auto sim::get_vwap_back_lay(uint64_t runner_id, double& vwap_back, double& vwap_
 	vol_back = 0;
 	vol_lay = 0;
 	double sum_back = 0, sum_lay = 0;
-	for (uint64_t i = 0; i < _bets.size(); i++) {
-		bet& bet = _bets[i];
-
-		if (bet.runner_id() != runner_id)
-			continue;
-
-		double matched = bet.matched();
-
-		if (bet.is_back()) {
-			sum_back += bet.price() * matched;
-			vol_back += matched;
-		} else {
-			sum_lay += bet.price() * matched;
-			vol_lay += matched;
+	sim_runner* runner = get_runner(runner_id);
+	if (runner != nullptr) {
+		for (bet* bet : runner->bets) {
+			double matched = bet->matched();
+
+			if (bet->is_back()) {
+				sum_back += bet->price() * matched;
+				vol_back += matched;
+			} else {
+				sum_lay += bet->price() * matched;
+				vol_lay += matched;
+			}
 		}
 	}
 
@@ -415,7 +540,7 @@ auto sim::hedge(uint64_t runner_id, double price) -> bool
 		bet->scale_stake_sim(mult);
 		// If we have scaled we have to update the sim to take into account that
 		// the scaled portion could now include some unmatched component.
-		update_bet(*bet);
+		update_bet(*bet, market_runner(find_runner(runner_id)));
 	}
 
 	return true;
@@ -423,27 +548,30 @@ auto sim::hedge(uint64_t runner_id, double price) -> bool
 
 void sim::cancel_all()
 {
-	for (uint64_t i = 0; i < _bets.size(); i++) {
-		bet& bet = _bets[i];
-		bet.cancel();
+	// Only bets which may have unmatched volume have anything to cancel.
+	for (auto& runner : _runners) {
+		for (sim_trigger& trigger : runner.active) {
+			trigger.placed->cancel();
+		}
 	}
 }
 
 void sim::handle_inplay()
 {
-	for (uint64_t i = 0; i < _bets.size(); i++) {
-		bet& bet = _bets[i];
-
-		switch (bet.persist()) {
-		case bet_persist_type::LAPSE:
-			bet.cancel();
-			break;
-		case bet_persist_type::PERSIST:
-			// Leave the bet in the market.
-			break;
-		case bet_persist_type::MARKET_ON_CLOSE:
-			// TODO(lorenzo): Implement taking BSP at inplay.
-			break;
+	for (auto& runner : _runners) {
+		for (sim_trigger& trigger : runner.active) {
+			bet& bet = *trigger.placed;
+			switch (bet.persist()) {
+			case bet_persist_type::LAPSE:
+				bet.cancel();
+				break;
+			case bet_persist_type::PERSIST:
+				// Leave the bet in the market.
+				break;
+			case bet_persist_type::MARKET_ON_CLOSE:
+				// TODO(lorenzo): Implement taking BSP at inplay.
+				break;
+			}
 		}
 	}
 
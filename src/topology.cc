@@ -0,0 +1,212 @@
+#include "janus.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <sched.h>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <vector>
+namespace fs = std::filesystem;
+
+namespace janus
+{
+// Size of a transparent huge page on x86-64.
+static constexpr uint64_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+// Parse a non-negative decimal CPU number, throwing if it isn't one.
+static auto parse_cpu(const std::string& str, const std::string& list) -> uint64_t
+{
+	if (str.empty() || str.find_first_not_of("0123456789") != std::string::npos)
+		throw std::runtime_error(std::string("Invalid CPU list '") + list + "'");
+
+	return std::stoull(str);
+}
+
+auto parse_cpu_list(const std::string& str) -> std::vector<uint64_t>
+{
+	std::vector<uint64_t> ret;
+
+	// sysfs files are newline terminated.
+	std::string list = str;
+	while (!list.empty() && (list.back() == '\n' || list.back() == ' '))
+		list.pop_back();
+	if (list.empty())
+		return ret;
+
+	uint64_t pos = 0;
+	while (pos <= list.size()) {
+		uint64_t end = list.find(',', pos);
+		if (end == std::string::npos)
+			end = list.size();
+		std::string range = list.substr(pos, end - pos);
+
+		uint64_t dash = range.find('-');
+		if (dash == std::string::npos) {
+			ret.push_back(parse_cpu(range, list));
+		} else {
+			uint64_t first = parse_cpu(range.substr(0, dash), list);
+			uint64_t last = parse_cpu(range.substr(dash + 1), list);
+			if (last < first)
+				throw std::runtime_error(std::string("Invalid CPU list '") + list +
+							 "'");
+			for (uint64_t cpu = first; cpu <= last; cpu++) {
+				ret.push_back(cpu);
+			}
+		}
+
+		pos = end + 1;
+	}
+
+	std::sort(ret.begin(), ret.end());
+	ret.erase(std::unique(ret.begin(), ret.end()), ret.end());
+	return ret;
+}
+
+auto get_allowed_cpus() -> std::vector<uint64_t>
+{
+	::cpu_set_t cpuset;
+	CPU_ZERO(&cpuset);
+	if (::sched_getaffinity(0, sizeof(cpuset), &cpuset) != 0)
+		throw std::runtime_error("Unable to determine CPU affinity");
+
+	std::vector<uint64_t> ret;
+	for (uint64_t cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (CPU_ISSET(cpu, &cpuset))
+			ret.push_back(cpu);
+	}
+	return ret;
+}
+
+auto read_cpu_topology(const std::string& node_root, const std::vector<uint64_t>& allowed_cpus)
+	-> cpu_topology
+{
+	cpu_topology ret;
+
+	std::error_code err;
+	if (fs::is_directory(node_root, err)) {
+		for (const auto& entry : fs::directory_iterator(node_root)) {
+			std::string name = entry.path().filename().string();
+			if (name.rfind("node", 0) != 0 || name.size() == 4 ||
+			    name.find_first_not_of("0123456789", 4) != std::string::npos)
+				continue;
+
+			auto file = std::ifstream(entry.path() / "cpulist");
+			if (!file)
+				continue;
+			std::string list;
+			std::getline(file, list);
+
+			numa_node node = {
+				.id = std::stoull(name.substr(4)),
+			};
+			for (uint64_t cpu : parse_cpu_list(list)) {
+				if (std::find(allowed_cpus.begin(), allowed_cpus.end(), cpu) !=
+				    allowed_cpus.end())
+					node.cpus.push_back(cpu);
+			}
+			if (!node.cpus.empty())
+				ret.nodes.push_back(std::move(node));
+		}
+	}
+
+	if (ret.nodes.empty()) {
+		ret.nodes.push_back({
+			.id = 0,
+			.cpus = allowed_cpus,
+		});
+		return ret;
+	}
+
+	std::sort(ret.nodes.begin(), ret.nodes.end(),
+		  [](const numa_node& a, const numa_node& b) { return a.id < b.id; });
+	return ret;
+}
+
+auto get_cpu_topology() -> cpu_topology
+{
+	return read_cpu_topology(DEFAULT_NUMA_NODE_ROOT, get_allowed_cpus());
+}
+
+auto place_workers(const cpu_topology& topology, uint64_t num_workers)
+	-> std::vector<worker_placement>
+{
+	if (topology.num_cpus() == 0)
+		throw std::runtime_error("No CPUs to place workers on");
+
+	uint64_t num_nodes = topology.nodes.size();
+	std::vector<worker_placement> ret;
+	ret.reserve(num_workers);
+
+	// Index of the next free CPU on each node.
+	std::vector<uint64_t> next(num_nodes);
+	uint64_t node = 0;
+	for (uint64_t i = 0; i < num_workers; i++) {
+		uint64_t tries = 0;
+		while (tries < num_nodes && next[node] == topology.nodes[node].cpus.size()) {
+			node = (node + 1) % num_nodes;
+			tries++;
+		}
+		// Every CPU is in use, start again.
+		if (tries == num_nodes) {
+			std::fill(next.begin(), next.end(), 0);
+			node = 0;
+		}
+
+		ret.push_back({
+			.cpu = topology.nodes[node].cpus[next[node]++],
+			.node = node,
+		});
+		node = (node + 1) % num_nodes;
+	}
+
+	return ret;
+}
+
+auto make_local_buffer(uint64_t cap, bool huge_pages) -> dynamic_buffer
+{
+	uint64_t words = (cap + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+	// Default initialisation leaves the memory untouched. Large
+	// allocations are freshly mapped so pages aren't placed until written.
+	auto* ptr = new uint64_t[words]; // NOLINT: Owned by the buffer.
+
+	if (huge_pages) {
+		// Only whole huge pages within the buffer can be backed by them.
+		auto addr = reinterpret_cast<uintptr_t>(ptr);
+		uintptr_t start = (addr + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+		uintptr_t end = (addr + words * sizeof(uint64_t)) & ~(HUGE_PAGE_SIZE - 1);
+		// This is only advice so failure is harmless.
+		if (end > start)
+			::madvise(reinterpret_cast<void*>(start), end - start, MADV_HUGEPAGE);
+	}
+
+	return dynamic_buffer(ptr, words * sizeof(uint64_t));
+}
+
+auto describe_placements(const cpu_topology& topology,
+			 const std::vector<worker_placement>& placements) -> std::string
+{
+	std::string ret;
+	for (uint64_t node = 0; node < topology.nodes.size(); node++) {
+		std::string cpus;
+		for (const auto& placement : placements) {
+			if (placement.node != node)
+				continue;
+
+			if (!cpus.empty())
+				cpus += ",";
+			cpus += std::to_string(placement.cpu);
+		}
+		if (cpus.empty())
+			continue;
+
+		if (!ret.empty())
+			ret += " ";
+		ret += "node " + std::to_string(topology.nodes[node].id) + ": CPUs " + cpus;
+	}
+	return ret;
+}
+} // namespace janus
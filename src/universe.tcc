@@ -2,13 +2,197 @@
 
 #include "janus.hh"
 
+#include <algorithm>
+#include <array>
 #include <cstdint>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <utility>
 
 namespace janus::betfair
 {
+template<uint64_t Cap>
+auto universe<Cap>::watch_market(uint64_t id) -> std::shared_ptr<const market_snapshot_publisher>
+{
+	for (const market_watch& watch : _watches) {
+		if (watch.market_id == id)
+			return watch.pub;
+	}
+
+	// An existing market is published with the next batch of snapshots.
+	market_watch& watch = _watches.emplace_back(market_watch{
+		.market_id = id,
+		.dirty = contains_market(id),
+		.snap = std::make_unique<market_snapshot>(),
+		.pub = std::make_shared<market_snapshot_publisher>(),
+	});
+	return watch.pub;
+}
+
+template<uint64_t Cap>
+void universe<Cap>::publish_snapshots()
+{
+	for (market_watch& watch : _watches) {
+		if (!watch.dirty)
+			continue;
+
+		market* market = find_market(watch.market_id);
+		if (market != nullptr)
+			publish_market_snapshot(*market, *watch.snap, *watch.pub);
+		watch.dirty = false;
+	}
+}
+
+template<uint64_t Cap>
+void universe<Cap>::mark_watched()
+{
+	uint64_t id = _last_market->id();
+	for (market_watch& watch : _watches) {
+		if (watch.market_id == id)
+			watch.dirty = true;
+	}
+}
+
+template<uint64_t Cap>
+void universe<Cap>::remove_market_at(uint64_t index)
+{
+	// Readers of a removed market see its final state.
+	if (!_watches.empty()) {
+		publish_snapshots();
+		uint64_t id = _market_ids[index];
+		std::erase_if(_watches, [id](const market_watch& watch) {
+			return watch.market_id == id;
+		});
+	}
+
+	// Removing the market invalidates the last market and runner if it
+	// was the last updated.
+	market* removed = &_markets[index];
+	if (_last_market == removed) {
+		_last_market = nullptr;
+		_last_runner = nullptr;
+	}
+
+	// Keep markets contiguous by moving the last into the gap. Its runners
+	// move with their storage so the last runner remains valid.
+	uint64_t last = _num_markets - 1;
+	if (index != last) {
+		market* moved = &_markets[last];
+		_markets.emplace_at(index, std::move(*moved));
+		_market_ids[index] = _market_ids[last];
+		if (_last_market == moved)
+			_last_market = removed;
+	}
+
+	_markets.pop_back();
+	_market_ids[last] = 0;
+	_num_markets--;
+	_num_evicted++;
+}
+
+template<uint64_t Cap>
+auto universe<Cap>::remove_market(uint64_t id) -> bool
+{
+	for (uint64_t i = 0; i < _num_markets; i++) {
+		if (_market_ids[i] == id) {
+			remove_market_at(i);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+template<uint64_t Cap>
+auto universe<Cap>::evict_closed_markets(uint64_t grace_ms) -> uint64_t
+{
+	uint64_t num_evicted = 0;
+
+	// Removing a market moves the last into its place, which we then
+	// check in turn.
+	uint64_t i = 0;
+	while (i < _num_markets) {
+		market& market = _markets[i];
+		if (&market == _last_market || market.state() != market_state::CLOSED ||
+		    market.last_timestamp() + grace_ms > _last_timestamp) {
+			i++;
+			continue;
+		}
+
+		remove_market_at(i);
+		num_evicted++;
+	}
+
+	return num_evicted;
+}
+
+template<uint64_t Cap>
+auto universe<Cap>::checkpoint_size() const -> uint64_t
+{
+	// Version, last timestamp, number of updates, last market ID, last
+	// runner ID and number of markets.
+	uint64_t size = 6 * sizeof(uint64_t);
+
+	for (uint64_t i = 0; i < _num_markets; i++) {
+		size += _markets[i].checkpoint_size();
+	}
+
+	return size;
+}
+
+template<uint64_t Cap>
+void universe<Cap>::save_checkpoint(dynamic_buffer& dyn_buf) const
+{
+	dyn_buf.add_uint64(CHECKPOINT_VERSION);
+	dyn_buf.add_uint64(_last_timestamp);
+	dyn_buf.add_uint64(_num_updates);
+	// Updates may continue to implicitly reference the last market and
+	// runner.
+	dyn_buf.add_uint64(last_market_id());
+	dyn_buf.add_uint64(last_runner_id());
+
+	dyn_buf.add_uint64(_num_markets);
+	for (uint64_t i = 0; i < _num_markets; i++) {
+		_markets[i].save_checkpoint(dyn_buf);
+	}
+}
+
+template<uint64_t Cap>
+void universe<Cap>::load_checkpoint(dynamic_buffer& dyn_buf)
+{
+	clear();
+
+	uint64_t version = dyn_buf.read_uint64();
+	if (version != CHECKPOINT_VERSION)
+		throw std::runtime_error("Checkpoint version " + std::to_string(version) +
+					 " does not match expected version " +
+					 std::to_string(CHECKPOINT_VERSION));
+
+	_last_timestamp = dyn_buf.read_uint64();
+	_num_updates = dyn_buf.read_uint64();
+	uint64_t last_market_id = dyn_buf.read_uint64();
+	uint64_t last_runner_id = dyn_buf.read_uint64();
+
+	uint64_t num_markets = dyn_buf.read_uint64();
+	if (num_markets > Cap)
+		throw std::runtime_error("Checkpoint contains " + std::to_string(num_markets) +
+					 " markets exceeding capacity of " + std::to_string(Cap));
+
+	for (uint64_t i = 0; i < num_markets; i++) {
+		uint64_t id = dyn_buf.read_uint64();
+		add_market(id).load_checkpoint(dyn_buf);
+	}
+
+	_last_market = find_market(last_market_id);
+	if (_last_market == nullptr)
+		return;
+
+	_last_runner = _last_market->find_runner(last_runner_id);
+	if (_last_runner != nullptr)
+		_last_runner_index = _last_market->runner_index(*_last_runner);
+}
+
 template<uint64_t Cap>
 void universe<Cap>::apply_market_id(uint64_t id)
 {
@@ -18,37 +202,33 @@ void universe<Cap>::apply_market_id(uint64_t id)
 
 	// Changing market invalidates the last known runner.
 	_last_runner = nullptr;
+
+	// We assume the market is selected in order to update it.
+	if (!_watches.empty())
+		mark_watched();
 }
 
 template<uint64_t Cap>
 void universe<Cap>::apply_runner_id(uint64_t id)
 {
-	_last_runner = _last_market->find_runner(id);
-	if (_last_runner == nullptr)
+	_last_runner_index = _last_market->find_runner_index(id);
+	if (_last_runner_index == _last_market->num_runners()) {
 		_last_runner = &_last_market->add_runner(id);
+		_last_market->changes().mark_runner(_last_timestamp, _last_runner_index);
+		return;
+	}
+
+	_last_runner = &(*_last_market)[_last_runner_index];
 }
 
 template<uint64_t Cap>
-void universe<Cap>::apply_timestamp(uint64_t timestamp)
+auto universe<Cap>::apply_timestamp(uint64_t timestamp) -> bool
 {
-	// The ISO-8601 timestamp buffer is 25 characters long.
-	static constexpr uint64_t MAX_TIMESTAMP_SIZE = 25;
-
-	if (_last_timestamp != 0 && timestamp < _last_timestamp) {
-		std::array<char, MAX_TIMESTAMP_SIZE> buf{};
-		std::ostringstream oss;
-		oss << "ERROR: Timestamp goes backwards?! ";
-		oss << "prev timestamp=" << _last_timestamp << " ("
-		    << print_iso8601(&buf[0], _last_timestamp) << ") ";
-		oss << "timestamp=" << timestamp << " (" << print_iso8601(&buf[0], timestamp)
-		    << ") ";
-
-		// Reset last timestamp so we don't unnecessarily repeat errors.
-		_last_timestamp = timestamp;
-		throw std::runtime_error(oss.str());
-	}
-
+	bool backwards = _last_timestamp != 0 && timestamp < _last_timestamp;
+	// If the timestamp goes backwards we still reset the last timestamp so
+	// we don't unnecessarily repeat errors.
 	_last_timestamp = timestamp;
+	return !backwards;
 }
 
 template<uint64_t Cap>
@@ -72,9 +252,13 @@ void universe<Cap>::apply_market_clear()
 }
 
 template<uint64_t Cap>
-void universe<Cap>::apply_market_state(market_state state)
+auto universe<Cap>::apply_market_state(market_state state) -> bool
 {
+	if (!_last_market->can_set_state(state))
+		return false;
+
 	_last_market->set_state(state);
+	return true;
 }
 
 template<uint64_t Cap>
@@ -122,10 +306,18 @@ void universe<Cap>::apply_runner_matched(uint64_t price_index, double vol)
 }
 
 template<uint64_t Cap>
-void universe<Cap>::apply_runner_unmatched(uint64_t price_index, double vol)
+auto universe<Cap>::apply_runner_unmatched(uint64_t price_index, double vol) -> bool
 {
 	ladder& ladder = _last_runner->ladder();
-	ladder.set_unmatched_at(price_index, vol);
+	index_range cleared = EMPTY_INDEX_RANGE;
+	bool valid = ladder.try_set_unmatched_at(price_index, vol, cleared);
+
+	// Trivial volume cleared from the opposing side changes the book even
+	// if the update turns out to cross it.
+	if (!cleared.empty())
+		_last_market->changes().mark_unmatched_range(_last_timestamp, _last_runner_index,
+							     cleared, vol < 0);
+	return valid;
 }
 
 template<uint64_t Cap>
@@ -134,145 +326,357 @@ void universe<Cap>::apply_runner_sp(double sp)
 	_last_runner->set_sp(sp);
 }
 template<uint64_t Cap>
-void universe<Cap>::apply_runner_won()
+auto universe<Cap>::apply_runner_won() -> bool
 {
+	if (!_last_runner->can_set_won())
+		return false;
+
 	_last_runner->set_won();
+	return true;
 }
 
 template<uint64_t Cap>
-void universe<Cap>::do_apply_update(const update& update)
+template<update_type Type>
+auto universe<Cap>::apply_data(const update& update) -> apply_status
 {
-	update_type type = update.type;
-
-	// Handle market ID.
+	if constexpr (Type == update_type::MARKET_CLEAR) {
+		apply_market_clear();
+	} else if constexpr (Type == update_type::MARKET_OPEN) {
+		if (!apply_market_state(market_state::OPEN))
+			return apply_status::INVALID_TRANSITION;
+	} else if constexpr (Type == update_type::MARKET_CLOSE) {
+		if (!apply_market_state(market_state::CLOSED))
+			return apply_status::INVALID_TRANSITION;
+	} else if constexpr (Type == update_type::MARKET_SUSPEND) {
+		if (!apply_market_state(market_state::SUSPENDED))
+			return apply_status::INVALID_TRANSITION;
+	} else if constexpr (Type == update_type::MARKET_INPLAY) {
+		apply_market_inplay();
+	} else if constexpr (Type == update_type::MARKET_TRADED_VOL) {
+		apply_market_traded_vol(get_update_market_traded_vol(update));
+	} else if constexpr (Type == update_type::RUNNER_REMOVAL) {
+		apply_runner_removal(get_update_runner_adj_factor(update));
+	} else if constexpr (Type == update_type::RUNNER_CLEAR_UNMATCHED) {
+		apply_runner_clear_unmatched();
+	} else if constexpr (Type == update_type::RUNNER_TRADED_VOL) {
+		apply_runner_traded_vol(get_update_runner_traded_vol(update));
+	} else if constexpr (Type == update_type::RUNNER_LTP) {
+		apply_runner_ltp(get_update_runner_ltp(update));
+	} else if constexpr (Type == update_type::RUNNER_MATCHED) {
+		auto [price_index, vol] = get_update_runner_matched(update);
+		apply_runner_matched(price_index, vol);
+	} else if constexpr (Type == update_type::RUNNER_UNMATCHED_ATL) {
+		auto [price_index, vol] = get_update_runner_unmatched_atl(update);
+		// ATL so positive volume.
+		if (!apply_runner_unmatched(price_index, vol))
+			return apply_status::CROSSED_BOOK;
+	} else if constexpr (Type == update_type::RUNNER_UNMATCHED_ATB) {
+		auto [price_index, vol] = get_update_runner_unmatched_atb(update);
+		// ATB so negative volume.
+		if (!apply_runner_unmatched(price_index, -vol))
+			return apply_status::CROSSED_BOOK;
+	} else if constexpr (Type == update_type::RUNNER_SP) {
+		apply_runner_sp(get_update_runner_sp(update));
+	} else if constexpr (Type == update_type::RUNNER_WON) {
+		if (!apply_runner_won())
+			return apply_status::INVALID_TRANSITION;
+	} else {
+		static_assert(Type != Type, "Unhandled update type");
+	}
 
-	// If we haven't set any market ID yet we can't do anything else.
-	if (_last_market == nullptr && type != update_type::MARKET_ID &&
-	    type != update_type::TIMESTAMP)
-		throw std::runtime_error(std::string("Received ") + update_type_str(type) +
-					 " update but no market ID received yet?!");
+	return apply_status::OK;
+}
 
-	if (type == update_type::MARKET_ID) {
-		apply_market_id(get_update_market_id(update));
-		_num_updates++;
-		return;
+template<uint64_t Cap>
+template<update_type Type>
+void universe<Cap>::record_change(const update& update)
+{
+	auto& changes = _last_market->changes();
+
+	if constexpr (Type == update_type::MARKET_CLEAR) {
+		changes.mark_all(_last_timestamp, _last_market->num_runners());
+	} else if constexpr (!is_runner_update(Type)) {
+		changes.mark_market(_last_timestamp);
+	} else if constexpr (Type == update_type::RUNNER_MATCHED) {
+		changes.mark_matched(_last_timestamp, _last_runner_index, update.key);
+	} else if constexpr (Type == update_type::RUNNER_UNMATCHED_ATL ||
+			     Type == update_type::RUNNER_UNMATCHED_ATB) {
+		// An update at the opposing side's limit replaces the volume
+		// there, so either side may have changed.
+		changes.mark_unmatched(_last_timestamp, _last_runner_index, update.key, true);
+		changes.mark_unmatched(_last_timestamp, _last_runner_index, update.key, false);
+	} else if constexpr (Type == update_type::RUNNER_CLEAR_UNMATCHED) {
+		changes.mark_all_unmatched(_last_timestamp, _last_runner_index);
+	} else {
+		changes.mark_runner(_last_timestamp, _last_runner_index);
 	}
+}
 
-	// Handle runner ID.
-
-	bool was_runner_update = is_runner_update(type);
-	// If we haven't set any runner ID yet then we can't apply runner updates.
-	if (_last_runner == nullptr && was_runner_update)
-		throw std::runtime_error(
-			std::string("Received ") + update_type_str(type) + " update for market " +
-			std::to_string(_last_market->id()) + " but no runner ID received yet?!");
+template<uint64_t Cap>
+template<update_type Type>
+void universe<Cap>::update_book()
+{
+	if constexpr (Type == update_type::MARKET_CLEAR) {
+		_last_market->refresh_book();
+	} else if constexpr (Type == update_type::RUNNER_UNMATCHED_ATL ||
+			     Type == update_type::RUNNER_UNMATCHED_ATB ||
+			     Type == update_type::RUNNER_CLEAR_UNMATCHED ||
+			     Type == update_type::RUNNER_LTP ||
+			     Type == update_type::RUNNER_REMOVAL ||
+			     Type == update_type::RUNNER_WON) {
+		_last_market->book().update(_last_runner_index, *_last_runner);
+	}
+}
 
-	if (type == update_type::RUNNER_ID) {
-		apply_runner_id(get_update_runner_id(update));
-		_num_updates++;
-		return;
+template<uint64_t Cap>
+template<update_type Type>
+void universe<Cap>::update_indicators(market::indicators_t& indicators, const update& update,
+				      double prev_matched)
+{
+	if constexpr (Type == update_type::MARKET_CLEAR) {
+		uint64_t num_runners = _last_market->num_runners();
+		for (uint64_t i = 0; i < num_runners; i++) {
+			indicators[i].on_clear(_last_timestamp);
+		}
+	} else if constexpr (Type == update_type::RUNNER_MATCHED) {
+		indicators[_last_runner_index].on_matched(_last_timestamp, update.key, prev_matched,
+							  get_update_runner_matched(update).second);
+	} else if constexpr (Type == update_type::RUNNER_UNMATCHED_ATL ||
+			     Type == update_type::RUNNER_UNMATCHED_ATB ||
+			     Type == update_type::RUNNER_CLEAR_UNMATCHED) {
+		indicators[_last_runner_index].on_unmatched(_last_timestamp);
+	} else if constexpr (is_runner_update(Type)) {
+		indicators[_last_runner_index].on_update(_last_timestamp);
 	}
+}
 
-	// Handle timestamp.
+template<uint64_t Cap>
+template<update_type Type, bool Resolved>
+auto universe<Cap>::handle_update(const update& update) -> apply_status
+{
+	if constexpr (Type == update_type::TIMESTAMP) {
+		// Updates at the previous timestamp are complete so watched
+		// markets are published before moving on.
+		uint64_t timestamp = get_update_timestamp(update);
+		if (!_watches.empty() && timestamp > _last_timestamp)
+			publish_snapshots();
 
-	if (type == update_type::TIMESTAMP) {
-		apply_timestamp(get_update_timestamp(update));
-		_num_updates++;
+		if (!apply_timestamp(timestamp))
+			return apply_status::TIMESTAMP_BACKWARDS;
 
-		if (_last_market != nullptr)
+		if (_last_market != nullptr) {
+			set_market_timestamp();
+			// Subsequent updates apply to the last market implicitly.
+			if (!_watches.empty())
+				mark_watched();
+		}
+	} else if constexpr (Type == update_type::MARKET_ID) {
+		apply_market_id(get_update_market_id(update));
+	} else {
+		// If we haven't set any market ID yet we can't do anything
+		// else.
+		if (!Resolved && _last_market == nullptr)
+			return apply_status::NO_MARKET;
+
+		if constexpr (Type == update_type::RUNNER_ID) {
+			apply_runner_id(get_update_runner_id(update));
+		} else {
+			// If we haven't set any runner ID yet then we can't
+			// apply runner updates.
+			if constexpr (is_runner_update(Type)) {
+				if (!Resolved && _last_runner == nullptr)
+					return apply_status::NO_RUNNER;
+			}
+
+			// If we haven't seen a timestamp yet we can't apply any
+			// non-market ID/runner ID updates.
+			if (!Resolved && _last_timestamp == 0)
+				return apply_status::NO_TIMESTAMP;
+
+			// The key of ladder updates is a price index which
+			// we use to index directly into the ladder.
+			if constexpr (Type == update_type::RUNNER_MATCHED ||
+				      Type == update_type::RUNNER_UNMATCHED_ATL ||
+				      Type == update_type::RUNNER_UNMATCHED_ATB) {
+				if (update.key >= NUM_PRICES)
+					return apply_status::INVALID_PRICE_INDEX;
+			}
+
+			// Indicators need the matched volume being replaced.
+			double prev_matched = 0;
+			if constexpr (Type == update_type::RUNNER_MATCHED)
+				prev_matched = _last_runner->ladder().matched(update.key);
+
+			// Faulty data leaves the market and runner untouched,
+			// including their timestamps.
+			apply_status status = apply_data<Type>(update);
+			if (status != apply_status::OK)
+				return status;
+
+			// This is a market/runner update so market timestamp
+			// should be set.
 			set_market_timestamp();
+			// If it's a runner update we set runner timestamp too.
+			if constexpr (is_runner_update(Type))
+				set_runner_timestamp();
 
-		return;
+			record_change<Type>(update);
+			update_book<Type>();
+
+			market::indicators_t* indicators = _last_market->indicators();
+			if (indicators != nullptr)
+				update_indicators<Type>(*indicators, update, prev_matched);
+		}
 	}
 
-	// If we haven't seen a timestamp yet we can't apply any non-market ID/runner ID updates.
-	if (_last_timestamp == 0)
-		throw std::runtime_error(std::string("Received ") + update_type_str(type) +
-					 " update but no timestamp received yet?!");
+	_num_updates++;
+	return apply_status::OK;
+}
 
-	// Handle all other updates.
+template<uint64_t Cap>
+template<bool Resolved>
+auto universe<Cap>::dispatch_update(const update& update) -> apply_status
+{
+	static constexpr std::array<handler_fn_t, NUM_UPDATE_TYPES> handlers =
+		make_handlers<Resolved>(std::make_integer_sequence<uint64_t, NUM_UPDATE_TYPES>{});
 
-	// This is a market/runner update so market timestamp should be set.
-	set_market_timestamp();
-	// If it's a runner update we set runner timestamp too.
-	if (was_runner_update)
-		set_runner_timestamp();
+	auto index = static_cast<uint64_t>(update.type);
+	apply_status status = apply_status::UNKNOWN_UPDATE;
+	if (index < NUM_UPDATE_TYPES)
+		status = (this->*handlers[index])(update);
 
-	switch (type) {
-	case update_type::MARKET_CLEAR:
-		apply_market_clear();
-		break;
-	case update_type::MARKET_OPEN:
-		apply_market_state(market_state::OPEN);
-		break;
-	case update_type::MARKET_CLOSE:
-		apply_market_state(market_state::CLOSED);
-		break;
-	case update_type::MARKET_SUSPEND:
-		apply_market_state(market_state::SUSPENDED);
-		break;
-	case update_type::MARKET_INPLAY:
-		apply_market_inplay();
-		break;
-	case update_type::MARKET_TRADED_VOL:
-		apply_market_traded_vol(get_update_market_traded_vol(update));
-		break;
-	case update_type::RUNNER_REMOVAL:
-		apply_runner_removal(get_update_runner_adj_factor(update));
-		break;
-	case update_type::RUNNER_CLEAR_UNMATCHED:
-		apply_runner_clear_unmatched();
-		break;
-	case update_type::RUNNER_TRADED_VOL:
-		apply_runner_traded_vol(get_update_runner_traded_vol(update));
-		break;
-	case update_type::RUNNER_LTP:
-		apply_runner_ltp(get_update_runner_ltp(update));
-		break;
-	case update_type::RUNNER_MATCHED:
-	{
-		auto [price_index, vol] = get_update_runner_matched(update);
-		apply_runner_matched(price_index, vol);
-		break;
-	}
-	case update_type::RUNNER_UNMATCHED_ATL:
-	{
-		auto [price_index, vol] = get_update_runner_unmatched_atl(update);
-		// ATL so positive volume.
-		apply_runner_unmatched(price_index, vol);
+	if (status != apply_status::OK)
+		_num_faults[static_cast<uint64_t>(status)]++;
 
-		break;
+	return status;
+}
+
+template<uint64_t Cap>
+void universe<Cap>::prefetch_ladder(std::span<const update> updates)
+{
+	const ladder& ladder = _last_runner->ladder();
+
+	uint64_t num = std::min(updates.size(), PREFETCH_UPDATES);
+	for (uint64_t i = 0; i < num; i++) {
+		const update& update = updates[i];
+
+		switch (update.type) {
+		case update_type::RUNNER_MATCHED:
+			ladder.prefetch_matched(update.key);
+			break;
+		case update_type::RUNNER_UNMATCHED_ATL:
+		case update_type::RUNNER_UNMATCHED_ATB:
+			ladder.prefetch_unmatched(update.key);
+			break;
+		case update_type::TIMESTAMP:
+		case update_type::MARKET_ID:
+		case update_type::RUNNER_ID:
+			// Subsequent updates are for a different runner.
+			return;
+		default:
+			break;
+		}
 	}
-	case update_type::RUNNER_UNMATCHED_ATB:
+}
+
+template<uint64_t Cap>
+auto universe<Cap>::fault_message(apply_status status, const update& update,
+				  uint64_t prev_timestamp) -> std::string
+{
+	// The ISO-8601 timestamp buffer is 25 characters long.
+	static constexpr uint64_t MAX_TIMESTAMP_SIZE = 25;
+
+	std::ostringstream oss;
+	switch (status) {
+	case apply_status::TIMESTAMP_BACKWARDS:
 	{
-		auto [price_index, vol] = get_update_runner_unmatched_atb(update);
-		// ATB so negative volume.
-		apply_runner_unmatched(price_index, -vol);
+		uint64_t timestamp = get_update_timestamp(update);
+		std::array<char, MAX_TIMESTAMP_SIZE> buf{};
+		oss << "ERROR: Timestamp goes backwards?! ";
+		oss << "prev timestamp=" << prev_timestamp << " ("
+		    << print_iso8601(&buf[0], prev_timestamp) << ") ";
+		oss << "timestamp=" << timestamp << " (" << print_iso8601(&buf[0], timestamp)
+		    << ") ";
 		break;
 	}
-	case update_type::RUNNER_SP:
-		apply_runner_sp(get_update_runner_sp(update));
+	case apply_status::NO_RUNNER:
+		oss << "Received " << update_type_str(update.type) << " update for market "
+		    << last_market_id() << " but no runner ID received yet?!";
+		break;
+	case apply_status::INVALID_PRICE_INDEX:
+		oss << "Received " << update_type_str(update.type) << " update with price index "
+		    << update.key << " outside of price range?!";
+		break;
+	case apply_status::UNKNOWN_UPDATE:
+		oss << "Received unknown update type " << static_cast<uint32_t>(update.type);
 		break;
-	case update_type::RUNNER_WON:
-		apply_runner_won();
+	case apply_status::CROSSED_BOOK:
+		oss << "Received " << update_type_str(update.type) << " update at price "
+		    << price_range::index_to_price(update.key) << " which crosses the book?!";
 		break;
 	default:
-		throw std::runtime_error(std::string("Dind't catch update type ") +
-					 update_type_str(type));
+		oss << "Received " << update_type_str(update.type) << " update but "
+		    << apply_status_str(status) << "?!";
+		break;
 	}
 
-	_num_updates++;
+	return oss.str();
 }
 
 template<uint64_t Cap>
 void universe<Cap>::apply_update(const update& update)
 {
+	uint64_t prev_timestamp = _last_timestamp;
+
+	apply_status status;
+	try {
+		status = dispatch_update<false>(update);
+	} catch (std::exception& e) {
+		throw universe_apply_error(last_market_id(), last_runner_id(), e);
+	}
+
+	if (status != apply_status::OK)
+		throw universe_apply_error(last_market_id(), last_runner_id(),
+					   fault_message(status, update, prev_timestamp));
+}
+
+template<uint64_t Cap>
+auto universe<Cap>::apply_updates(std::span<const update> updates, uint64_t& num_applied)
+	-> apply_status
+{
+	uint64_t size = updates.size();
+	uint64_t i = 0;
+	// The last market, runner and timestamp only change on declarations
+	// and market clears, so rather than checking they're set for each
+	// update we check once for each run of updates following them.
+	bool is_resolved = resolved();
 	try {
-		do_apply_update(update);
+		for (; i < size; i++) {
+			const update& update = updates[i];
+
+			apply_status status = is_resolved ? dispatch_update<true>(update)
+							  : dispatch_update<false>(update);
+			if (status != apply_status::OK) {
+				num_applied = i;
+				return status;
+			}
+
+			if (!changes_resolved(update.type))
+				continue;
+			is_resolved = resolved();
+
+			// Runner ID updates are followed by updates to the
+			// runner's ladder which are usually spread over
+			// several cache lines.
+			if (update.type == update_type::RUNNER_ID)
+				prefetch_ladder(updates.subspan(i + 1));
+		}
 	} catch (std::exception& e) {
-		uint64_t market_id = _last_market == nullptr ? 0 : _last_market->id();
-		uint64_t runner_id = _last_runner == nullptr ? 0 : _last_runner->id();
-		throw universe_apply_error(market_id, runner_id, e);
+		num_applied = i;
+		throw universe_apply_error(last_market_id(), last_runner_id(), e);
 	}
+
+	num_applied = size;
+	return apply_status::OK;
 }
 } // namespace janus::betfair
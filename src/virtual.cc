@@ -142,6 +142,10 @@ auto gen_virt_ladder(const janus::betfair::price_range& range, janus::betfair::l
 			price_index = NUM_PRICES - 1;
 		else
 			price_index = range.price_to_nearest_index_up(price);
+		// Prices are clamped above so this shouldn't happen, but if it
+		// does we can't place the bet.
+		if (price_index == INVALID_PRICE_INDEX)
+			continue;
 
 		double nearest_price = janus::betfair::price_range::index_to_price(price_index);
 
@@ -167,6 +171,8 @@ auto gen_virt_ladder(const janus::betfair::price_range& range, janus::betfair::l
 			price_index = NUM_PRICES - 1;
 		else
 			price_index = range.price_to_nearest_index(price);
+		if (price_index == INVALID_PRICE_INDEX)
+			continue;
 
 		double nearest_price = janus::betfair::price_range::index_to_price(price_index);
 
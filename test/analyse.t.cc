@@ -3,8 +3,14 @@
 #include "test_util.hh"
 
 #include <array>
+#include <atomic>
+#include <csignal>
 #include <cstdint>
+#include <filesystem>
 #include <gtest/gtest.h>
+#include <memory>
+#include <stdexcept>
+#include <unistd.h>
 #include <unordered_set>
 #include <vector>
 
@@ -22,8 +28,9 @@ TEST(analyse_test, basic)
 					       170462863, 170462866, 170462892,
 					       170462893, 170462894, 170462895};
 
-	uint64_t seen_markets = 0;
-	uint64_t unknown_markets = 0;
+	// The predicate is applied concurrently.
+	std::atomic<uint64_t> seen_markets = 0;
+	std::atomic<uint64_t> unknown_markets = 0;
 
 	auto predicate = [&](const janus::meta_view& meta, const janus::stats& stats) -> bool {
 		uint64_t id = meta.market_id();
@@ -139,6 +146,7 @@ TEST(analyse_test, basic)
 
 	struct result
 	{
+		uint64_t num_states;
 		int num_iters;
 		std::vector<worker_state> workers;
 		bool failed;
@@ -146,6 +154,7 @@ TEST(analyse_test, basic)
 
 	auto reducer = [&](const std::vector<node_agg_state>& states) -> result {
 		result ret = {
+			.num_states = states.size(),
 			.num_iters = 0,
 			.failed = false,
 		};
@@ -163,58 +172,484 @@ TEST(analyse_test, basic)
 		return ret;
 	};
 
+	// Dataset images are only used by runs which ask for them.
+	config.dataset_image_root = std::filesystem::temp_directory_path() / "analyse_test_images";
+	std::filesystem::remove_all(config.dataset_image_root);
+
+	const std::vector<janus::analyse_options> runs = {
+		{.num_cores = 3},
+		// Streamed rather than loaded up front.
+		{.num_cores = 3, .stream_window = 2},
+		// The same batches scheduled on different numbers of cores.
+		{.num_cores = 1, .num_batches = 4},
+		{.num_cores = 3, .num_batches = 4},
+		{.num_cores = 2, .huge_pages = true},
+		// Replayed from a dataset image, built then reused.
+		{.num_cores = 3, .dataset_image_key = "basic"},
+		{.num_cores = 2, .dataset_image_key = "basic"},
+		// Logging progress as it goes and splitting replay time.
+		{.num_cores = 2, .metrics_interval_ms = 100, .detailed_metrics = true},
+	};
+	std::vector<std::vector<uint64_t>> market_orders;
+
+	for (const auto& options : runs) {
+		seen_markets = 0;
+		unknown_markets = 0;
+
+		janus::analyser<worker_state, market_agg_state, node_agg_state, result> a(
+			predicate, update_worker, market_reducer, node_reducer, reducer,
+			zero_worker_state, zero_market_agg_state, zero_node_agg_state);
+		result res = a.run(config, options);
+
+		EXPECT_EQ(seen_markets.load(), id_set.size());
+		ASSERT_EQ(unknown_markets.load(), 0);
+
+		EXPECT_FALSE(res.failed);
+		EXPECT_GT(res.num_states, 0);
+		EXPECT_EQ(static_cast<uint64_t>(res.num_iters), NUM_ITERS * res.num_states);
+		if (options.num_batches > 0) {
+			EXPECT_EQ(res.num_states, options.num_batches);
+		}
+
+		// Each market is replayed once per iteration plus the pass on
+		// which the node reducer stops.
+		janus::core_metrics total = {};
+		for (const auto& metrics : a.metrics()) {
+			total.merge(metrics);
+		}
+		EXPECT_EQ(total.num_replays, id_set.size() * (NUM_ITERS + 1));
+		EXPECT_EQ(total.num_slowest, id_set.size());
+		EXPECT_GT(total.num_updates, 0);
+		EXPECT_GT(total.replay_ns, 0);
+		if (options.detailed_metrics) {
+			EXPECT_GT(total.apply_ns, 0);
+			EXPECT_GE(total.replay_ns, total.apply_ns + total.callback_ns);
+		} else {
+			EXPECT_EQ(total.apply_ns, 0);
+			EXPECT_EQ(total.callback_ns, 0);
+		}
+
+		ASSERT_EQ(res.workers.size(), 9);
+		std::vector<uint64_t> market_order;
+		for (const auto& worker : res.workers) {
+			market_order.push_back(worker.market_id);
+		}
+		market_orders.push_back(market_order);
+
+		for (const auto& worker : res.workers) {
+			ASSERT_TRUE(id_set.contains(worker.market_id));
+			switch (worker.market_id) {
+			case 170462852:
+				EXPECT_EQ(worker.num_updates, 19851);
+				EXPECT_DOUBLE_EQ(round_2dp(worker.traded_vol), 64034.97);
+				break;
+			case 170462855:
+				EXPECT_EQ(worker.num_updates, 21868);
+				EXPECT_DOUBLE_EQ(round_2dp(worker.traded_vol), 39810.30);
+				break;
+			case 170462859:
+				EXPECT_EQ(worker.num_updates, 14528);
+				EXPECT_DOUBLE_EQ(round_2dp(worker.traded_vol), 49683.60);
+				break;
+			case 170462863:
+				EXPECT_EQ(worker.num_updates, 26779);
+				EXPECT_DOUBLE_EQ(round_2dp(worker.traded_vol), 77970.46);
+				break;
+			case 170462866:
+				EXPECT_EQ(worker.num_updates, 34789);
+				EXPECT_DOUBLE_EQ(round_2dp(worker.traded_vol), 34093.09);
+				break;
+			case 170462892:
+				EXPECT_EQ(worker.num_updates, 29122);
+				EXPECT_DOUBLE_EQ(round_2dp(worker.traded_vol), 32303.18);
+				break;
+			case 170462893:
+				EXPECT_EQ(worker.num_updates, 22679);
+				EXPECT_DOUBLE_EQ(round_2dp(worker.traded_vol), 78655.02);
+				break;
+			case 170462894:
+				EXPECT_EQ(worker.num_updates, 18316);
+				EXPECT_DOUBLE_EQ(round_2dp(worker.traded_vol), 32131.79);
+				break;
+			case 170462895:
+				EXPECT_EQ(worker.num_updates, 14376);
+				EXPECT_DOUBLE_EQ(round_2dp(worker.traded_vol), 34531.72);
+				break;
+			}
+		}
+	}
+
+	// Results are reduced in market order regardless of scheduling.
+	for (const auto& market_order : market_orders) {
+		EXPECT_EQ(market_order, market_orders[0]);
+	}
+
+	// Node aggregate states holding pointers can't be returned from other
+	// processes.
 	janus::analyser<worker_state, market_agg_state, node_agg_state, result> a(
 		predicate, update_worker, market_reducer, node_reducer, reducer, zero_worker_state,
 		zero_market_agg_state, zero_node_agg_state);
-	result res = a.run(config, 3);
+	EXPECT_THROW(a.run(config, {.num_cores = 2, .num_processes = 2}), std::runtime_error);
+	// Nor can market aggregate states holding pointers be cached.
+	config.result_cache_root = std::filesystem::temp_directory_path() / "analyse_test_results";
+	EXPECT_THROW(a.run(config, {.num_cores = 2, .result_cache_key = "basic"}),
+		     std::runtime_error);
+
+	EXPECT_EQ(std::distance(std::filesystem::directory_iterator(config.dataset_image_root),
+				std::filesystem::directory_iterator{}),
+		  1);
+	std::filesystem::remove_all(config.dataset_image_root);
+}
 
-	EXPECT_EQ(seen_markets, id_set.size());
-	ASSERT_EQ(unknown_markets, 0);
+// Test that markets are partitioned into contiguous batches of similar weight
+// and scheduled heaviest first.
+TEST(analyse_test, batches)
+{
+	std::vector<uint64_t> weights = {10, 10, 10, 10, 100, 5, 5, 5, 5};
+
+	auto batches = janus::partition_batches(weights, 3);
+	ASSERT_EQ(batches.size(), 3);
+	uint64_t offset = 0;
+	for (const auto& batch : batches) {
+		EXPECT_EQ(batch.offset, offset);
+		EXPECT_GT(batch.num_markets, 0);
+		offset += batch.num_markets;
+	}
+	EXPECT_EQ(offset, weights.size());
+
+	EXPECT_EQ(batches[0].num_markets, 4);
+	EXPECT_EQ(batches[0].weight, 40);
+	EXPECT_EQ(batches[1].num_markets, 1);
+	EXPECT_EQ(batches[1].weight, 100);
+	EXPECT_EQ(batches[2].num_markets, 4);
+	EXPECT_EQ(batches[2].weight, 20);
+
+	std::vector<uint64_t> schedule = janus::schedule_batches(batches);
+	EXPECT_EQ(schedule, std::vector<uint64_t>({1, 0, 2}));
+
+	// Never more batches than markets, each of which is non-empty.
+	batches = janus::partition_batches({1000, 1, 1}, 8);
+	ASSERT_EQ(batches.size(), 3);
+	for (const auto& batch : batches) {
+		EXPECT_EQ(batch.num_markets, 1);
+	}
 
-	EXPECT_FALSE(res.failed);
-	EXPECT_EQ(res.num_iters, 30);
+	batches = janus::partition_batches(weights, 1);
+	ASSERT_EQ(batches.size(), 1);
+	EXPECT_EQ(batches[0].num_markets, weights.size());
+}
 
-	ASSERT_EQ(res.workers.size(), 9);
-	for (const auto& worker : res.workers) {
-		ASSERT_TRUE(id_set.contains(worker.market_id));
-		switch (worker.market_id) {
-		case 170462852:
-			EXPECT_EQ(worker.num_updates, 19851);
-			EXPECT_DOUBLE_EQ(round_2dp(worker.traded_vol), 64034.97);
-			break;
-		case 170462855:
-			EXPECT_EQ(worker.num_updates, 21868);
-			EXPECT_DOUBLE_EQ(round_2dp(worker.traded_vol), 39810.30);
-			break;
-		case 170462859:
-			EXPECT_EQ(worker.num_updates, 14528);
-			EXPECT_DOUBLE_EQ(round_2dp(worker.traded_vol), 49683.60);
-			break;
-		case 170462863:
-			EXPECT_EQ(worker.num_updates, 26779);
-			EXPECT_DOUBLE_EQ(round_2dp(worker.traded_vol), 77970.46);
-			break;
-		case 170462866:
-			EXPECT_EQ(worker.num_updates, 34789);
-			EXPECT_DOUBLE_EQ(round_2dp(worker.traded_vol), 34093.09);
-			break;
-		case 170462892:
-			EXPECT_EQ(worker.num_updates, 29122);
-			EXPECT_DOUBLE_EQ(round_2dp(worker.traded_vol), 32303.18);
-			break;
-		case 170462893:
-			EXPECT_EQ(worker.num_updates, 22679);
-			EXPECT_DOUBLE_EQ(round_2dp(worker.traded_vol), 78655.02);
-			break;
-		case 170462894:
-			EXPECT_EQ(worker.num_updates, 18316);
-			EXPECT_DOUBLE_EQ(round_2dp(worker.traded_vol), 32131.79);
-			break;
-		case 170462895:
-			EXPECT_EQ(worker.num_updates, 14376);
-			EXPECT_DOUBLE_EQ(round_2dp(worker.traded_vol), 34531.72);
+// Test that sweeping configurations in lanes and resuming replays from
+// checkpoints give the same result as replaying each market in full for each
+// configuration.
+TEST(analyse_test, sweep)
+{
+	janus::config config = {
+		.json_data_root = "../test/test-json",
+		.binary_data_root = "../test/test-analyse-binary",
+	};
+
+	static constexpr uint64_t NUM_CONFIGS = 3;
+
+	auto predicate = [](const janus::meta_view& meta, const janus::stats& stats) -> bool {
+		return true;
+	};
+
+	struct worker_state
+	{
+		uint64_t num_updates;
+		bool backed;
+	};
+
+	struct market_agg_state
+	{
+		uint64_t num_updates;
+		uint64_t num_aborted;
+		double traded_vol;
+		double pl;
+	};
+
+	struct node_agg_state
+	{
+		uint64_t config_index;
+		std::array<market_agg_state, NUM_CONFIGS> configs;
+	};
+
+	using result = std::array<market_agg_state, NUM_CONFIGS>;
+
+	auto checkpoint_time = [](const janus::meta_view& meta) -> uint64_t {
+		return meta.market_start_timestamp() - 10 * 60 * 1000;
+	};
+
+	// If set, workers in processes other than this one kill them.
+	bool crash = false;
+	::pid_t parent_pid = ::getpid();
+	// If set, workers throw.
+	bool fail = false;
+
+	// Workers count every update but take no action prior to 10 minutes
+	// before the off. Config 0 does nothing, config 1 aborts part way
+	// through long markets and config 2 backs the first runner.
+	auto update_worker = [&](int core, const janus::meta_view& meta,
+				 janus::betfair::market& market, janus::sim& sim,
+				 const node_agg_state& node_agg_state, worker_state& state,
+				 spdlog::logger* logger) -> bool {
+		if (crash && ::getpid() != parent_pid)
+			::raise(SIGKILL);
+		if (fail)
+			throw std::runtime_error("Worker failed");
+
+		state.num_updates++;
+		if (market.last_timestamp() < checkpoint_time(meta))
+			return true;
+
+		switch (node_agg_state.config_index) {
+		case 1:
+			return state.num_updates < 1000;
+		case 2:
+			if (!state.backed && !market.runners().empty()) {
+				sim.add_bet(market.runners()[0].id(), 1.01, 10, true);
+				state.backed = true;
+			}
 			break;
 		}
+
+		return true;
+	};
+
+	auto market_reducer = [](int core, const worker_state& worker_state, janus::sim& sim,
+				 janus::betfair::market& market, bool worker_aborted,
+				 market_agg_state& state, spdlog::logger* logger) -> bool {
+		state.num_updates += worker_state.num_updates;
+		if (worker_aborted)
+			state.num_aborted++;
+		state.traded_vol += market.traded_vol();
+		state.pl += sim.pl();
+		return true;
+	};
+
+	auto node_reducer = [](int core, const market_agg_state& market_agg_state,
+			       bool market_reducer_aborted, node_agg_state& state,
+			       spdlog::logger* logger) -> bool {
+		state.configs[state.config_index] = market_agg_state;
+		state.config_index++;
+		return state.config_index < NUM_CONFIGS;
+	};
+
+	auto reducer = [](const std::vector<node_agg_state>& states) -> result {
+		result ret = {};
+		for (const auto& state : states) {
+			for (uint64_t i = 0; i < NUM_CONFIGS; i++) {
+				ret[i].num_updates += state.configs[i].num_updates;
+				ret[i].num_aborted += state.configs[i].num_aborted;
+				ret[i].traded_vol += state.configs[i].traded_vol;
+				ret[i].pl += state.configs[i].pl;
+			}
+		}
+		return ret;
+	};
+
+	auto make_analyser = [&] {
+		return std::make_unique<
+			janus::analyser<worker_state, market_agg_state, node_agg_state, result>>(
+			predicate, update_worker, market_reducer, node_reducer, reducer,
+			worker_state{}, market_agg_state{}, node_agg_state{});
+	};
+
+	result expected = make_analyser()->run(config, 2);
+	EXPECT_GT(expected[0].num_updates, expected[1].num_updates);
+	EXPECT_EQ(expected[0].num_updates, expected[2].num_updates);
+	EXPECT_EQ(expected[0].num_aborted, 0);
+	EXPECT_EQ(expected[1].num_aborted, 9);
+	EXPECT_GT(expected[0].traded_vol, expected[1].traded_vol);
+	EXPECT_DOUBLE_EQ(expected[0].pl, 0);
+	EXPECT_NE(expected[2].pl, 0);
+
+	auto check = [&](const result& res) {
+		for (uint64_t i = 0; i < NUM_CONFIGS; i++) {
+			EXPECT_EQ(res[i].num_updates, expected[i].num_updates);
+			EXPECT_EQ(res[i].num_aborted, expected[i].num_aborted);
+			EXPECT_DOUBLE_EQ(res[i].traded_vol, expected[i].traded_vol);
+			EXPECT_DOUBLE_EQ(res[i].pl, expected[i].pl);
+		}
+	};
+
+	auto lane_init = [](uint64_t lane, node_agg_state& state) { state.config_index = lane; };
+	for (uint64_t width : {0, 2}) {
+		check(make_analyser()->sweep(config, NUM_CONFIGS, lane_init,
+					     {.num_cores = 2, .sweep_width = width}));
 	}
+
+	// Resuming from checkpoints restores the worker state and sim along
+	// with the market, however many checkpoints can be held.
+	for (uint64_t max_bytes : {janus::DEFAULT_ANALYSE_CHECKPOINT_MAX_BYTES, 100'000UL}) {
+		check(make_analyser()->run(config, {.num_cores = 2,
+						    .checkpoint_time = checkpoint_time,
+						    .checkpoint_max_bytes = max_bytes}));
+		check(make_analyser()->sweep(config, NUM_CONFIGS, lane_init,
+					     {.num_cores = 2,
+					      .sweep_width = 1,
+					      .checkpoint_time = checkpoint_time,
+					      .checkpoint_max_bytes = max_bytes}));
+	}
+
+	// Batches sharded across processes reduce to the same result.
+	check(make_analyser()->run(config, {.num_cores = 2, .num_processes = 2}));
+	check(make_analyser()->sweep(config, NUM_CONFIGS, lane_init,
+				     {.num_cores = 3, .num_processes = 2, .sweep_width = 2}));
+
+	// Merging cached results rather than replaying markets gives the same
+	// result. Only the first iteration of a run is cached.
+	config.result_cache_root = std::filesystem::temp_directory_path() / "analyse_test_results";
+	std::filesystem::remove_all(config.result_cache_root);
+	auto market_merger = [](const market_agg_state& market, market_agg_state& state) {
+		state.num_updates += market.num_updates;
+		state.num_aborted += market.num_aborted;
+		state.traded_vol += market.traded_vol;
+		state.pl += market.pl;
+	};
+	auto make_caching_analyser = [&] {
+		auto a = make_analyser();
+		a->set_market_merger(market_merger);
+		return a;
+	};
+	auto total_metrics = [](const auto& a) {
+		janus::core_metrics total = {};
+		for (const auto& metrics : a->metrics()) {
+			total.merge(metrics);
+		}
+		return total;
+	};
+
+	// Configs are described by their index, which the worker acts on.
+	auto describe = [](uint64_t config_index) {
+		return "config " + std::to_string(config_index);
+	};
+	janus::analyse_options sweep_options = {
+		.num_cores = 2,
+		.sweep_width = 2,
+		.result_cache_key = "sweep",
+		.result_cache_version = 1,
+		.result_cache_config = describe,
+	};
+	auto a = make_caching_analyser();
+	check(a->sweep(config, NUM_CONFIGS, lane_init, sweep_options));
+	EXPECT_EQ(total_metrics(a).num_cached, 0);
+	EXPECT_EQ(total_metrics(a).num_replays, 18);
+	// Markets cached for every config aren't loaded.
+	a = make_caching_analyser();
+	check(a->sweep(config, NUM_CONFIGS, lane_init, sweep_options));
+	EXPECT_EQ(total_metrics(a).num_cached, 18);
+	EXPECT_EQ(total_metrics(a).num_replays, 0);
+	EXPECT_EQ(total_metrics(a).load_ns, 0);
+
+	// Nor streamed.
+	janus::analyse_options stream_options = sweep_options;
+	stream_options.stream_window = 2;
+	a = make_caching_analyser();
+	check(a->sweep(config, NUM_CONFIGS, lane_init, stream_options));
+	EXPECT_EQ(total_metrics(a).num_cached, 18);
+	EXPECT_EQ(total_metrics(a).load_ns, 0);
+
+	janus::analyse_options process_options = sweep_options;
+	process_options.num_cores = 3;
+	process_options.num_processes = 2;
+	a = make_caching_analyser();
+	check(a->sweep(config, NUM_CONFIGS, lane_init, process_options));
+	EXPECT_EQ(total_metrics(a).num_cached, 18);
+
+	// Results are matched to configs by their description rather than
+	// their lane, so sweeping the configs in another order reuses them.
+	auto reversed_lane_init = [](uint64_t lane, node_agg_state& state) {
+		state.config_index = NUM_CONFIGS - 1 - lane;
+	};
+	janus::analyse_options reversed_options = sweep_options;
+	reversed_options.result_cache_config = [&](uint64_t lane) {
+		return describe(NUM_CONFIGS - 1 - lane);
+	};
+	a = make_caching_analyser();
+	check(a->sweep(config, NUM_CONFIGS, reversed_lane_init, reversed_options));
+	EXPECT_EQ(total_metrics(a).num_cached, 18);
+
+	// As does the first iteration of a run.
+	janus::analyse_options run_options = {
+		.num_cores = 2,
+		.result_cache_key = "sweep",
+		.result_cache_version = 1,
+		.result_cache_config = describe,
+	};
+	a = make_caching_analyser();
+	check(a->run(config, run_options));
+	EXPECT_EQ(total_metrics(a).num_cached, 9);
+	EXPECT_EQ(total_metrics(a).num_replays, 18);
+
+	// A config described differently is replayed, here config 1 in the
+	// first pass along with config 0.
+	janus::analyse_options changed_options = sweep_options;
+	changed_options.result_cache_config = [&](uint64_t config_index) {
+		return describe(config_index) + (config_index == 1 ? " changed" : "");
+	};
+	a = make_caching_analyser();
+	check(a->sweep(config, NUM_CONFIGS, lane_init, changed_options));
+	EXPECT_EQ(total_metrics(a).num_cached, 9);
+	EXPECT_EQ(total_metrics(a).num_replays, 9);
+
+	// A new version of the strategy starts afresh, leaving the results of
+	// the old version for any build still using it.
+	janus::analyse_options version_options = sweep_options;
+	version_options.result_cache_version = 2;
+	a = make_caching_analyser();
+	check(a->sweep(config, NUM_CONFIGS, lane_init, version_options));
+	EXPECT_EQ(total_metrics(a).num_cached, 0);
+	a = make_caching_analyser();
+	check(a->sweep(config, NUM_CONFIGS, lane_init, sweep_options));
+	EXPECT_EQ(total_metrics(a).num_cached, 18);
+
+	// The version must be set, and configs described distinctly.
+	janus::analyse_options unversioned_options = sweep_options;
+	unversioned_options.result_cache_version = 0;
+	EXPECT_THROW(make_caching_analyser()->sweep(config, NUM_CONFIGS, lane_init,
+						    unversioned_options),
+		     std::runtime_error);
+	janus::analyse_options undescribed_options = sweep_options;
+	undescribed_options.result_cache_config = nullptr;
+	EXPECT_THROW(make_caching_analyser()->sweep(config, NUM_CONFIGS, lane_init,
+						    undescribed_options),
+		     std::runtime_error);
+	janus::analyse_options ambiguous_options = sweep_options;
+	ambiguous_options.result_cache_config = [](uint64_t config_index) {
+		return std::string("config");
+	};
+	EXPECT_THROW(make_caching_analyser()->sweep(config, NUM_CONFIGS, lane_init,
+						    ambiguous_options),
+		     std::runtime_error);
+
+	// Cached results can't be merged without a market merger.
+	EXPECT_THROW(make_analyser()->sweep(config, NUM_CONFIGS, lane_init, sweep_options),
+		     std::runtime_error);
+	std::filesystem::remove_all(config.result_cache_root);
+	config.result_cache_root = "";
+
+	// A process crashing fails the run without taking us down.
+	crash = true;
+	EXPECT_THROW(make_analyser()->run(config, {.num_cores = 2, .num_processes = 2}),
+		     std::runtime_error);
+	crash = false;
+
+	// As does a process which can't be reaped, here as ignoring SIGCHLD
+	// has the kernel reap them for us.
+	auto prev_handler = std::signal(SIGCHLD, SIG_IGN);
+	EXPECT_THROW(make_analyser()->run(config, {.num_cores = 2, .num_processes = 2}),
+		     std::runtime_error);
+	std::signal(SIGCHLD, prev_handler);
+
+	// A worker throwing fails the run rather than the incomplete results
+	// of its batch being reduced.
+	fail = true;
+	EXPECT_THROW(make_analyser()->run(config, 2), std::runtime_error);
+	EXPECT_THROW(make_analyser()->sweep(config, NUM_CONFIGS, lane_init, {.num_cores = 2}),
+		     std::runtime_error);
+	EXPECT_THROW(make_analyser()->run(config, {.num_cores = 2, .num_processes = 2}),
+		     std::runtime_error);
 }
 } // namespace
@@ -0,0 +1,126 @@
+#include "janus.hh"
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+// Test that replay times are counted in power of 2 microsecond buckets.
+TEST(analyse_metrics_test, buckets)
+{
+	EXPECT_EQ(janus::get_replay_time_bucket(0), 0);
+	EXPECT_EQ(janus::get_replay_time_bucket(999), 0);
+	EXPECT_EQ(janus::get_replay_time_bucket(1000), 1);
+	EXPECT_EQ(janus::get_replay_time_bucket(1999), 1);
+	EXPECT_EQ(janus::get_replay_time_bucket(2000), 2);
+	EXPECT_EQ(janus::get_replay_time_bucket(1'000'000), 10);
+	EXPECT_EQ(janus::get_replay_time_bucket(~0UL), janus::NUM_REPLAY_TIME_BUCKETS - 1);
+}
+
+// Test that replays are counted and the slowest markets tracked, slowest first
+// and each at most once.
+TEST(analyse_metrics_test, replays)
+{
+	janus::core_metrics metrics = {};
+	for (uint64_t i = 1; i <= janus::NUM_SLOWEST_MARKETS + 5; i++) {
+		metrics.add_replay(i, 100, i * 1000);
+	}
+	// Repeat replays only count if slower.
+	metrics.add_replay(1, 100, 500);
+	metrics.add_replay(15, 100, 500);
+	metrics.add_replay(10, 100, 50'000);
+
+	EXPECT_EQ(metrics.num_replays, janus::NUM_SLOWEST_MARKETS + 8);
+	EXPECT_EQ(metrics.num_updates, 100 * (janus::NUM_SLOWEST_MARKETS + 8));
+	EXPECT_EQ(metrics.replay_ns, 171'000);
+	uint64_t num_bucketed = 0;
+	for (uint64_t count : metrics.replay_time_buckets) {
+		num_bucketed += count;
+	}
+	EXPECT_EQ(num_bucketed, metrics.num_replays);
+
+	ASSERT_EQ(metrics.num_slowest, janus::NUM_SLOWEST_MARKETS);
+	EXPECT_EQ(metrics.slowest[0].market_id, 10);
+	EXPECT_EQ(metrics.slowest[0].ns, 50'000);
+	EXPECT_EQ(metrics.slowest[1].market_id, 15);
+	EXPECT_EQ(metrics.slowest[1].ns, 15'000);
+	for (uint64_t i = 1; i < metrics.num_slowest; i++) {
+		EXPECT_GE(metrics.slowest[i - 1].ns, metrics.slowest[i].ns);
+		EXPECT_GT(metrics.slowest[i].market_id, 5);
+	}
+
+	// Merging combines counts and keeps the slowest overall.
+	janus::core_metrics other = {};
+	other.run_ns = 1000;
+	other.apply_ns = 600;
+	other.add_replay(100, 10, 20'000);
+	other.add_replay(15, 10, 40'000);
+	metrics.merge(other);
+	EXPECT_EQ(metrics.num_replays, janus::NUM_SLOWEST_MARKETS + 10);
+	EXPECT_EQ(metrics.run_ns, 1000);
+	EXPECT_EQ(metrics.apply_ns, 600);
+	ASSERT_EQ(metrics.num_slowest, janus::NUM_SLOWEST_MARKETS);
+	EXPECT_EQ(metrics.slowest[0].market_id, 10);
+	EXPECT_EQ(metrics.slowest[1].market_id, 15);
+	EXPECT_EQ(metrics.slowest[1].ns, 40'000);
+	EXPECT_EQ(metrics.slowest[2].market_id, 100);
+}
+
+// Test that the JSON report is valid and holds each core and the totals.
+TEST(analyse_metrics_test, json)
+{
+	std::vector<janus::core_metrics> cores(2);
+	cores[0].num_batches = 1;
+	cores[0].run_ns = janus::NS_PER_SEC;
+	cores[0].add_replay(123, 1000, 2 * janus::NS_PER_MS);
+	cores[1].num_batches = 2;
+	cores[1].run_ns = janus::NS_PER_SEC;
+	cores[1].add_replay(456, 3000, 5 * janus::NS_PER_MS);
+
+	std::string path = std::filesystem::temp_directory_path() / "analyse_metrics_test.json";
+	janus::write_metrics_json(path, cores);
+	std::stringstream ss;
+	ss << std::ifstream(path).rdbuf();
+	std::string str = ss.str();
+	std::filesystem::remove(path);
+	EXPECT_EQ(str, janus::format_metrics_json(cores) + "\n");
+
+	sajson::document doc =
+		janus::internal::parse_json("", str.data(), str.size());
+	const sajson::value& root = doc.get_root();
+
+	const sajson::value& cores_node = root.get_value_of_key(sajson::literal("cores"));
+	ASSERT_EQ(cores_node.get_length(), 2);
+	const sajson::value& core = cores_node.get_array_element(1);
+	EXPECT_EQ(core.get_value_of_key(sajson::literal("batches")).get_integer_value(), 2);
+	EXPECT_DOUBLE_EQ(
+		core.get_value_of_key(sajson::literal("updates_per_sec")).get_number_value(),
+		3000);
+
+	const sajson::value& total = root.get_value_of_key(sajson::literal("total"));
+	EXPECT_EQ(total.get_value_of_key(sajson::literal("replays")).get_integer_value(), 2);
+	EXPECT_EQ(total.get_value_of_key(sajson::literal("updates")).get_integer_value(), 4000);
+	EXPECT_DOUBLE_EQ(total.get_value_of_key(sajson::literal("replay_ms")).get_number_value(),
+			 7);
+
+	const sajson::value& histogram =
+		root.get_value_of_key(sajson::literal("replay_time_histogram"));
+	EXPECT_EQ(histogram.get_length(), janus::NUM_REPLAY_TIME_BUCKETS);
+
+	const sajson::value& slowest = root.get_value_of_key(sajson::literal("slowest_markets"));
+	ASSERT_EQ(slowest.get_length(), 2);
+	const sajson::value& first = slowest.get_array_element(0);
+	EXPECT_EQ(first.get_value_of_key(sajson::literal("market_id")).get_integer_value(), 456);
+	EXPECT_DOUBLE_EQ(first.get_value_of_key(sajson::literal("replay_ms")).get_number_value(),
+			 5);
+
+	EXPECT_THROW(janus::write_metrics_json("/nonexistent/metrics.json", cores),
+		     std::runtime_error);
+}
+} // namespace
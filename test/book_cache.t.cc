@@ -0,0 +1,81 @@
+#include "janus.hh"
+
+#include <gtest/gtest.h>
+#include <memory>
+
+namespace
+{
+// Test that the book cache correctly tracks best prices, overrounds and
+// favourites as updates are applied to a universe.
+TEST(book_cache_test, basic)
+{
+	auto ptr = std::make_unique<janus::betfair::universe<1>>();
+	auto& universe = *ptr;
+
+	universe.apply_update(janus::make_market_id_update(123456));
+	universe.apply_update(janus::make_timestamp_update(1000));
+	universe.apply_update(janus::make_runner_id_update(1));
+	// 3.0 to back, 3.05 to lay.
+	universe.apply_update(janus::make_runner_unmatched_atb_update(149, 10));
+	universe.apply_update(janus::make_runner_unmatched_atl_update(150, 20));
+	universe.apply_update(janus::make_runner_id_update(2));
+	// 2.0 to back, 2.02 to lay.
+	universe.apply_update(janus::make_runner_unmatched_atb_update(99, 5));
+	universe.apply_update(janus::make_runner_unmatched_atl_update(100, 7));
+	universe.apply_update(janus::make_runner_ltp_update(99));
+	universe.apply_update(janus::make_runner_id_update(3));
+
+	const auto& book = universe[123456].book();
+	ASSERT_EQ(book.num_runners(), 3);
+
+	EXPECT_EQ(book.back_index(0), 149);
+	EXPECT_DOUBLE_EQ(book.back_vol(0), 10);
+	EXPECT_EQ(book.lay_index(0), 150);
+	EXPECT_DOUBLE_EQ(book.lay_vol(0), 20);
+	EXPECT_EQ(book.back_index(1), 99);
+	EXPECT_EQ(book.ltp(1), 99);
+	EXPECT_EQ(book.back_index(2), janus::betfair::INVALID_PRICE_INDEX);
+	EXPECT_DOUBLE_EQ(book.back_vol(2), 0);
+	EXPECT_EQ(book.lay_index(2), janus::betfair::INVALID_PRICE_INDEX);
+
+	EXPECT_DOUBLE_EQ(book.back_overround(), 1. / 3 + 1. / 2);
+	EXPECT_DOUBLE_EQ(book.lay_overround(), 1. / 3.05 + 1. / 2.02);
+
+	EXPECT_EQ(book.favourite(0), 1);
+	EXPECT_EQ(book.favourite(1), 0);
+	EXPECT_EQ(book.favourite(2), 2);
+	EXPECT_EQ(book.rank(1), 0);
+	EXPECT_EQ(book.rank(2), 2);
+
+	// Runner 3 shortens to 1.5, becoming favourite.
+	universe.apply_update(janus::make_runner_unmatched_atb_update(49, 3));
+	EXPECT_EQ(book.favourite(0), 2);
+	EXPECT_EQ(book.favourite(1), 1);
+	EXPECT_EQ(book.favourite(2), 0);
+	EXPECT_DOUBLE_EQ(book.back_overround(), 1. / 3 + 1. / 2 + 1. / 1.5);
+
+	// Removed runners no longer contribute and rank last.
+	universe.apply_update(janus::make_runner_id_update(2));
+	universe.apply_update(janus::make_runner_removal_update(20));
+	EXPECT_EQ(book.state(1), janus::betfair::runner_state::REMOVED);
+	EXPECT_EQ(book.favourite(0), 2);
+	EXPECT_EQ(book.favourite(1), 0);
+	EXPECT_EQ(book.favourite(2), 1);
+	EXPECT_DOUBLE_EQ(book.back_overround(), 1. / 3 + 1. / 1.5);
+	EXPECT_DOUBLE_EQ(book.lay_overround(), 1. / 3.05);
+
+	// Clearing unmatched volume removes the runner's prices.
+	universe.apply_update(janus::make_runner_id_update(3));
+	universe.apply_update(janus::make_runner_clear_unmatched());
+	EXPECT_EQ(book.back_index(2), janus::betfair::INVALID_PRICE_INDEX);
+	EXPECT_EQ(book.favourite(0), 0);
+	EXPECT_DOUBLE_EQ(book.back_overround(), 1. / 3);
+
+	// Clearing the market clears everything.
+	universe.apply_update(janus::make_market_clear_update());
+	EXPECT_EQ(book.back_index(0), janus::betfair::INVALID_PRICE_INDEX);
+	EXPECT_DOUBLE_EQ(book.back_overround(), 0);
+	EXPECT_DOUBLE_EQ(book.lay_overround(), 0);
+	EXPECT_EQ(book.favourite(0), 0);
+}
+} // namespace
@@ -0,0 +1,87 @@
+#include "janus.hh"
+
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <vector>
+
+namespace
+{
+// Test basic functionality of change set.
+TEST(change_set_test, basic)
+{
+	janus::betfair::change_set<janus::betfair::MAX_RUNNERS> changes;
+	for (uint64_t i = 0; i < 8; i++) {
+		changes.add_runner(i);
+	}
+	EXPECT_EQ(changes.timestamp(), 0);
+	EXPECT_FALSE(changes.market_changed());
+	EXPECT_EQ(changes.runner_mask(), 0);
+	EXPECT_EQ(changes.num_changed_runners(), 0);
+
+	changes.mark_market(1000);
+	changes.mark_unmatched(1000, 3, 20, true);
+	changes.mark_unmatched(1000, 3, 17, true);
+	changes.mark_unmatched(1000, 3, 12, false);
+	changes.mark_matched(1000, 3, 15);
+	changes.mark_runner(1000, 7);
+	EXPECT_EQ(changes.timestamp(), 1000);
+	EXPECT_TRUE(changes.market_changed());
+	EXPECT_EQ(changes.num_changed_runners(), 2);
+	EXPECT_TRUE(changes.runner_changed(3));
+	EXPECT_TRUE(changes.runner_changed(7));
+	EXPECT_FALSE(changes.runner_changed(0));
+
+	std::vector<uint64_t> indexes;
+	changes.for_each_changed_runner([&](uint64_t i) { indexes.push_back(i); });
+	EXPECT_EQ(indexes, std::vector<uint64_t>({3, 7}));
+
+	auto atl = changes.atl_range(3);
+	EXPECT_EQ(atl.min, 17);
+	EXPECT_EQ(atl.max, 20);
+	EXPECT_TRUE(atl.contains(18));
+	EXPECT_FALSE(atl.contains(21));
+	auto atb = changes.atb_range(3);
+	EXPECT_EQ(atb.min, 12);
+	EXPECT_EQ(atb.max, 12);
+	auto matched = changes.matched_range(3);
+	EXPECT_EQ(matched.min, 15);
+	EXPECT_EQ(matched.max, 15);
+
+	// Runners changed without ladder changes have empty ranges.
+	EXPECT_TRUE(changes.atl_range(7).empty());
+	EXPECT_TRUE(changes.atb_range(7).empty());
+	EXPECT_TRUE(changes.matched_range(7).empty());
+
+	// A change at a new timestamp discards previous changes, including
+	// the ranges of runners which change again.
+	changes.mark_unmatched(2000, 3, 30, true);
+	EXPECT_EQ(changes.timestamp(), 2000);
+	EXPECT_FALSE(changes.market_changed());
+	EXPECT_EQ(changes.runner_mask(), 1UL << 3);
+	EXPECT_EQ(changes.atl_range(3).min, 30);
+	EXPECT_EQ(changes.atl_range(3).max, 30);
+	EXPECT_TRUE(changes.atb_range(3).empty());
+
+	// Ranges of changes, e.g. several levels being cleared, extend those
+	// already recorded.
+	changes.mark_unmatched_range(2000, 3, {.min = 25, .max = 27}, true);
+	changes.mark_unmatched_range(2000, 3, janus::betfair::EMPTY_INDEX_RANGE, false);
+	EXPECT_EQ(changes.atl_range(3).min, 25);
+	EXPECT_EQ(changes.atl_range(3).max, 30);
+	EXPECT_TRUE(changes.atb_range(3).empty());
+
+	changes.mark_all_unmatched(2000, 4);
+	EXPECT_EQ(changes.atl_range(4).min, 0);
+	EXPECT_EQ(changes.atb_range(4).max, janus::betfair::NUM_PRICES - 1);
+	EXPECT_TRUE(changes.matched_range(4).empty());
+
+	changes.mark_all(3000, 5);
+	EXPECT_TRUE(changes.market_changed());
+	EXPECT_EQ(changes.runner_mask(), 0b11111);
+	EXPECT_EQ(changes.matched_range(2).max, janus::betfair::NUM_PRICES - 1);
+
+	changes.clear();
+	EXPECT_EQ(changes.timestamp(), 0);
+	EXPECT_EQ(changes.runner_mask(), 0);
+}
+} // namespace
@@ -0,0 +1,54 @@
+#include "janus.hh"
+
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+
+namespace
+{
+// Test that a oneshot channel delivers its value whether it is sent before or
+// after the receiver starts waiting.
+TEST(channel_test, oneshot)
+{
+	janus::oneshot_channel<uint64_t> before;
+	EXPECT_FALSE(before.ready());
+	before.send(123);
+	EXPECT_TRUE(before.ready());
+	EXPECT_EQ(before.receive(), 123);
+
+	static constexpr uint64_t NUM_CHANNELS = 64;
+	std::vector<janus::oneshot_channel<uint64_t>> chans(NUM_CHANNELS);
+	std::thread sender([&] {
+		for (uint64_t i = 0; i < NUM_CHANNELS; i++) {
+			chans[i].send(i);
+		}
+	});
+	for (uint64_t i = 0; i < NUM_CHANNELS; i++) {
+		EXPECT_EQ(chans[i].receive(), i);
+	}
+	sender.join();
+}
+
+// Test that a channel delivers every value sent exactly once and in order,
+// including values sent before the receiver waits.
+TEST(channel_test, rendezvous)
+{
+	static constexpr uint64_t NUM_VALUES = 1000;
+
+	janus::channel<uint64_t> chan;
+	std::thread sender([&] {
+		for (uint64_t i = 0; i < NUM_VALUES; i++) {
+			chan.send(i);
+		}
+	});
+
+	for (uint64_t i = 0; i < NUM_VALUES; i++) {
+		// Give the sender a head start some of the time.
+		if (i % 100 == 0)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		EXPECT_EQ(chan.receive(), i);
+	}
+	sender.join();
+}
+} // namespace
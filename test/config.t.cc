@@ -22,6 +22,10 @@ TEST(config_test, parse)
 		"{\"ladderLevels\":10,\"fields\":[\"EX_ALL_OFFERS\",\"EX_TRADED\",\"EX_TRADED_VOL\",\"EX_LTP\",\"EX_MARKET_DEF\"]}");
 	EXPECT_STREQ(config1.json_data_root.c_str(), "/home/foo/bar");
 	EXPECT_STREQ(config1.binary_data_root.c_str(), "/home/baz/blah");
+	// Not specified so should be set to the default.
+	EXPECT_EQ(config1.market_evict_grace_ms, janus::DEFAULT_MARKET_EVICT_GRACE_MS);
+	EXPECT_TRUE(config1.dataset_image_root.empty());
+	EXPECT_TRUE(config1.result_cache_root.empty());
 
 	janus::config config2 = janus::parse_config("../test/test-config/config2.json");
 	EXPECT_STREQ(config2.username.c_str(), "barrycunslow");
@@ -34,6 +38,9 @@ TEST(config_test, parse)
 	EXPECT_STREQ(config2.market_stream_data_filter_json.c_str(), "{}");
 	EXPECT_STREQ(config2.json_data_root.c_str(), "/home/foo/bar");
 	EXPECT_STREQ(config2.binary_data_root.c_str(), "/home/baz/blah");
+	EXPECT_EQ(config2.market_evict_grace_ms, 60000);
+	EXPECT_STREQ(config2.dataset_image_root.c_str(), "/home/baz/images");
+	EXPECT_STREQ(config2.result_cache_root.c_str(), "/home/baz/results");
 
 	std::string default_path = janus::internal::get_default_config_path();
 	std::string expected_default_path = std::string(::getenv("HOME")) + "/.janus/config.json";
@@ -0,0 +1,130 @@
+#include "janus.hh"
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <gtest/gtest.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+namespace
+{
+// Count the files in the specified directory.
+static auto count_files(const std::string& dir) -> int64_t
+{
+	return std::distance(std::filesystem::directory_iterator(dir),
+			     std::filesystem::directory_iterator{});
+}
+
+// Get the inode of the file at the specified path, which changes if it is
+// rebuilt.
+static auto get_inode(const std::string& path) -> uint64_t
+{
+	struct ::stat st = {};
+	EXPECT_EQ(::stat(path.c_str(), &st), 0);
+	return st.st_ino;
+}
+
+// Test that dataset images hold the decompressed updates of each market, are
+// reused while the markets and their data are unchanged, evicted once
+// superseded and are rejected if invalid.
+TEST(dataset_image_test, basic)
+{
+	std::string tmp_dir = std::filesystem::temp_directory_path() / "dataset_image_test";
+	std::filesystem::remove_all(tmp_dir);
+	std::string dir = tmp_dir + "/images";
+
+	// Market data is copied so that it can be rewritten.
+	janus::config config = {
+		.json_data_root = "../test/test-json",
+		.binary_data_root = tmp_dir + "/binary",
+	};
+	std::filesystem::create_directories(config.binary_data_root);
+	std::filesystem::copy("../test/test-binary/market", config.binary_data_root + "/market");
+
+	// Images of a key are superseded when markets are added.
+	std::vector<uint64_t> ids = {170358161, 168216153, 144697391};
+	std::vector<uint64_t> prev_ids = {170358161, 168216153};
+	EXPECT_NE(janus::get_dataset_version(config, prev_ids),
+		  janus::get_dataset_version(config, ids));
+	auto prev = janus::dataset_image::open(config, dir, "test", prev_ids);
+	std::string prev_path =
+		janus::get_dataset_image_path(dir, prev->key_hash(), prev->data_version());
+	EXPECT_TRUE(std::filesystem::exists(prev_path));
+
+	auto image = janus::dataset_image::open(config, dir, "test", ids);
+	ASSERT_EQ(image->num_markets(), ids.size());
+	EXPECT_EQ(image->key_hash(), janus::hash_dataset_key("test"));
+	EXPECT_EQ(image->data_version(), janus::get_dataset_version(config, ids));
+	EXPECT_FALSE(std::filesystem::exists(prev_path));
+	EXPECT_EQ(count_files(dir), 1);
+	// Mappings of evicted images remain valid.
+	EXPECT_EQ(prev->updates(0).size(), 1843);
+
+	for (uint64_t i = 0; i < ids.size(); i++) {
+		EXPECT_EQ(image->market_id(i), ids[i]);
+
+		janus::dynamic_buffer buf = janus::read_market_updates(config, ids[i]);
+		auto updates = image->updates(i);
+		ASSERT_EQ(updates.size() * sizeof(janus::update), buf.size());
+		EXPECT_EQ(std::memcmp(updates.data(), buf.data(), buf.size()), 0);
+	}
+	EXPECT_EQ(image->updates(0).size(), 1843);
+	EXPECT_EQ(image->updates(1).size(), 109648);
+
+	// The same markets map the existing image.
+	std::string path = janus::get_dataset_image_path(dir, image->key_hash(),
+							 image->data_version());
+	uint64_t inode = get_inode(path);
+	auto reopened = janus::dataset_image::open(config, dir, "test", ids);
+	EXPECT_EQ(get_inode(path), inode);
+	EXPECT_EQ(reopened->size(), image->size());
+
+	// Other keys are different images.
+	std::vector<uint64_t> other_ids = {170358161, 144697391};
+	auto other = janus::dataset_image::open(config, dir, "other", other_ids);
+	ASSERT_EQ(other->num_markets(), 2);
+	EXPECT_EQ(other->market_id(1), 144697391);
+	EXPECT_EQ(count_files(dir), 2);
+
+	// Markets which can't be read fail the build leaving no image.
+	EXPECT_THROW(janus::dataset_image::open(config, dir, "test", {170358161, 1}),
+		     std::runtime_error);
+	EXPECT_EQ(count_files(dir), 2);
+
+	// Rewriting a market's data supersedes the image of the same markets,
+	// which is evicted once the new one is built. The mapping of the old
+	// image remains valid.
+	std::string market_path = config.binary_data_root + "/market/170358161.jan";
+	auto last_write = std::filesystem::last_write_time(market_path);
+	std::filesystem::last_write_time(market_path, last_write - std::chrono::hours(1));
+	auto rebuilt = janus::dataset_image::open(config, dir, "test", ids);
+	EXPECT_NE(rebuilt->data_version(), image->data_version());
+	EXPECT_FALSE(std::filesystem::exists(path));
+	EXPECT_EQ(count_files(dir), 2);
+	EXPECT_EQ(image->updates(0).size(), 1843);
+
+	// Images of other keys are only evicted once idle.
+	std::string other_path = janus::get_dataset_image_path(dir, other->key_hash(),
+							       other->data_version());
+	std::filesystem::last_write_time(other_path,
+					 std::filesystem::file_time_type::clock::now() -
+						 std::chrono::milliseconds(
+							 janus::DATASET_IMAGE_MAX_IDLE_MS + 1000));
+	auto single = janus::dataset_image::open(config, dir, "single", {144697391});
+	EXPECT_FALSE(std::filesystem::exists(other_path));
+	EXPECT_EQ(count_files(dir), 2);
+
+	// Files which aren't images are rejected.
+	std::string bad_path = dir + "/bad.img";
+	janus::write_checkpoint_file(bad_path, janus::read_market_updates(config, ids[0]));
+	EXPECT_THROW(janus::dataset_image{bad_path}, std::runtime_error);
+	EXPECT_THROW(janus::dataset_image{dir + "/missing.img"}, std::runtime_error);
+
+	std::filesystem::remove_all(tmp_dir);
+}
+} // namespace
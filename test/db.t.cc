@@ -110,5 +110,11 @@ TEST(db_test, read_stats)
 	// Only check a couple parameters just to make sure stats loaded.
 	EXPECT_EQ(stats.num_updates, 98941);
 	EXPECT_EQ(stats.num_runners, 10);
+
+	janus::stats try_stats = {};
+	EXPECT_TRUE(janus::try_read_market_stats(config, 170358161, try_stats));
+	EXPECT_EQ(try_stats.num_updates, 98941);
+	EXPECT_EQ(try_stats.num_runners, 10);
+	EXPECT_FALSE(janus::try_read_market_stats(config, 123, try_stats));
 }
 } // namespace
@@ -103,5 +103,47 @@ TEST(dynamic_array_test, ctor_dtor)
 
 	arr3.truncate();
 	EXPECT_EQ(num_dtors, 0);
+
+	// Replacing an element in place should destroy the old element and
+	// construct the new one without changing the size of the array.
+
+	num_ctors = 0;
+	num_dtors = 0;
+
+	janus::dynamic_array<foo, 10> arr4;
+	for (uint64_t i = 0; i < 3; i++) {
+		arr4.emplace_back(i);
+	}
+
+	foo& f = arr4.emplace_at(1, 123);
+	EXPECT_EQ(f.n, 123);
+	EXPECT_EQ(&f, &arr4[1]);
+	EXPECT_EQ(arr4[0].n, 0);
+	EXPECT_EQ(arr4[2].n, 2);
+	EXPECT_EQ(arr4.size(), 3);
+	EXPECT_EQ(num_ctors, 4);
+	EXPECT_EQ(num_dtors, 1);
+
+	// Popping the last element should destroy it and shrink the array.
+	arr4.pop_back();
+	EXPECT_EQ(arr4.size(), 2);
+	EXPECT_EQ(num_dtors, 2);
+	EXPECT_EQ(arr4[1].n, 123);
+}
+
+// Test that elements are aligned as their type requires, even following the
+// array's size.
+TEST(dynamic_array_test, alignment)
+{
+	struct alignas(64) aligned
+	{
+		uint64_t n;
+	};
+
+	janus::dynamic_array<aligned, 3> arr;
+	for (uint64_t i = 0; i < 3; i++) {
+		aligned& a = arr.emplace_back(aligned{i});
+		EXPECT_EQ(reinterpret_cast<uintptr_t>(&a) % alignof(aligned), 0);
+	}
 }
 } // namespace
@@ -0,0 +1,112 @@
+#include "janus.hh"
+
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <memory>
+
+namespace
+{
+// Test that indicators are maintained as updates are applied to a universe.
+TEST(indicators_test, basic)
+{
+	auto ptr = std::make_unique<janus::betfair::universe<1>>();
+	auto& universe = *ptr;
+
+	universe.apply_update(janus::make_timestamp_update(1000));
+	universe.apply_update(janus::make_market_id_update(123));
+	universe.apply_update(janus::make_runner_id_update(1));
+	universe.apply_update(janus::make_runner_unmatched_atl_update(21, 30));
+	universe.apply_update(janus::make_runner_unmatched_atl_update(22, 10));
+
+	auto& market = universe[123];
+	EXPECT_EQ(market.indicators(), nullptr);
+	market.enable_indicators({
+		.wom_levels = 2,
+		.window_ms = 10'000,
+	});
+	ASSERT_NE(market.indicators(), nullptr);
+	EXPECT_EQ(market.indicators()->config().wom_levels, 2);
+
+	universe.apply_update(janus::make_runner_id_update(2));
+	universe.apply_update(janus::make_runner_id_update(1));
+	universe.apply_update(janus::make_runner_unmatched_atb_update(20, 40));
+	universe.apply_update(janus::make_runner_unmatched_atb_update(19, 20));
+	universe.apply_update(janus::make_runner_unmatched_atb_update(18, 1000));
+
+	auto& first = (*market.indicators())[0];
+	// Only the best 2 levels on each side are considered.
+	EXPECT_DOUBLE_EQ(first.wom(), 40. / 100);
+	// Runners added after enabling are attached too.
+	EXPECT_DOUBLE_EQ((*market.indicators())[1].wom(), 0);
+
+	universe.apply_update(janus::make_runner_matched_update(20, 100));
+	universe.apply_update(janus::make_runner_matched_update(21, 100));
+	universe.apply_update(janus::make_runner_traded_vol_update(200));
+	universe.apply_update(janus::make_runner_ltp_update(21));
+	double price20 = janus::betfair::price_range::index_to_price(20);
+	double price21 = janus::betfair::price_range::index_to_price(21);
+	EXPECT_DOUBLE_EQ(first.vwap(), (price20 + price21) / 2);
+
+	// Matched volume replaces the prior value at a price.
+	universe.apply_update(janus::make_timestamp_update(6000));
+	universe.apply_update(janus::make_runner_matched_update(20, 300));
+	universe.apply_update(janus::make_runner_traded_vol_update(400));
+	universe.apply_update(janus::make_runner_unmatched_atl_update(21, 0));
+	universe.apply_update(janus::make_runner_unmatched_atb_update(20, 0));
+	EXPECT_DOUBLE_EQ(first.vwap(), (3 * price20 + price21) / 4);
+	EXPECT_DOUBLE_EQ(first.wom(), 10. / 1030);
+
+	// Entries at the same timestamp are coalesced.
+	ASSERT_EQ(first.num_history(), 2);
+	EXPECT_EQ(first.history(0).timestamp, 6000);
+	EXPECT_EQ(first.history(0).atl_index, 22);
+	EXPECT_EQ(first.history(0).atb_index, 19);
+	EXPECT_EQ(first.history(1).timestamp, 1000);
+	EXPECT_EQ(first.history(1).atl_index, 21);
+	EXPECT_EQ(first.history(1).atb_index, 20);
+
+	// The whole history lies within the window.
+	EXPECT_DOUBLE_EQ(first.traded_vol_delta(6000), 200);
+	EXPECT_EQ(first.atl_tick_move(6000), 1);
+	EXPECT_EQ(first.atb_tick_move(6000), -1);
+	EXPECT_EQ(first.ltp_tick_move(6000), 0);
+
+	// Once the window has moved past the first entry nothing has changed.
+	EXPECT_DOUBLE_EQ(first.traded_vol_delta(16000), 0);
+	EXPECT_EQ(first.atl_tick_move(16000), 0);
+
+	// Clearing the market resets the VWAP.
+	universe.apply_update(janus::make_market_clear_update());
+	EXPECT_DOUBLE_EQ(first.vwap(), 0);
+	EXPECT_DOUBLE_EQ(first.wom(), 0);
+}
+
+// Test that the top-of-book history is bounded.
+TEST(indicators_test, history)
+{
+	auto ptr = std::make_unique<janus::betfair::universe<1>>();
+	auto& universe = *ptr;
+
+	universe.apply_update(janus::make_timestamp_update(1));
+	universe.apply_update(janus::make_market_id_update(123));
+	universe.apply_update(janus::make_runner_id_update(1));
+	universe[123].enable_indicators();
+	auto& indicators = (*universe[123].indicators())[0];
+
+	uint64_t num = janus::betfair::TOP_OF_BOOK_HISTORY_SIZE * 2;
+	for (uint64_t i = 2; i <= num; i++) {
+		universe.apply_update(janus::make_timestamp_update(i));
+		universe.apply_update(janus::make_runner_traded_vol_update(i));
+	}
+
+	ASSERT_EQ(indicators.num_history(), janus::betfair::TOP_OF_BOOK_HISTORY_SIZE);
+	EXPECT_EQ(indicators.history(0).timestamp, num);
+	EXPECT_EQ(indicators.history(janus::betfair::TOP_OF_BOOK_HISTORY_SIZE - 1).timestamp,
+		  num - janus::betfair::TOP_OF_BOOK_HISTORY_SIZE + 1);
+
+	// The window extends beyond the history retained so the oldest entry
+	// is used.
+	EXPECT_DOUBLE_EQ(indicators.traded_vol_delta(num),
+			 janus::betfair::TOP_OF_BOOK_HISTORY_SIZE - 1);
+}
+} // namespace
@@ -656,4 +656,84 @@ TEST(ladder_test, clear_1000_atb_resets_no_back)
 	// We should see max ATB cleared too.
 	EXPECT_EQ(ladder.max_atb_index(), 0);
 }
+
+// Test that the cumulative depth index correctly answers depth queries as
+// unmatched volume is set and cleared.
+TEST(ladder_test, depth_index)
+{
+	janus::betfair::ladder ladder;
+	EXPECT_FALSE(ladder.depth_index_enabled());
+
+	// Volume set prior to enabling should be picked up.
+	ladder.set_unmatched_at(98, -100); // 1.99
+	ladder.set_unmatched_at(97, -200); // 1.98
+	ladder.set_unmatched_at(100, 50);  // 2.02
+	ladder.enable_depth_index();
+	EXPECT_TRUE(ladder.depth_index_enabled());
+	ladder.set_unmatched_at(95, -300); // 1.96
+	ladder.set_unmatched_at(102, 150); // 2.06
+	ladder.set_unmatched_at(110, 400); // 2.22
+
+	EXPECT_DOUBLE_EQ(ladder.atb_depth(0), 100);
+	EXPECT_DOUBLE_EQ(ladder.atb_depth(1), 300);
+	EXPECT_DOUBLE_EQ(ladder.atb_depth(3), 600);
+	EXPECT_DOUBLE_EQ(ladder.atb_depth(1000), 600);
+	EXPECT_DOUBLE_EQ(ladder.atl_depth(0), 50);
+	EXPECT_DOUBLE_EQ(ladder.atl_depth(2), 200);
+	EXPECT_DOUBLE_EQ(ladder.atl_depth(10), 600);
+	EXPECT_DOUBLE_EQ(ladder.atl_depth(1000), 600);
+
+	EXPECT_EQ(ladder.atb_index_for_vol(100), 98);
+	EXPECT_EQ(ladder.atb_index_for_vol(150), 97);
+	EXPECT_EQ(ladder.atb_index_for_vol(600), 95);
+	EXPECT_EQ(ladder.atb_index_for_vol(601), janus::betfair::INVALID_PRICE_INDEX);
+	EXPECT_EQ(ladder.atl_index_for_vol(201), 110);
+	EXPECT_EQ(ladder.atl_index_for_vol(601), janus::betfair::INVALID_PRICE_INDEX);
+
+	EXPECT_DOUBLE_EQ(ladder.atb_vwap_to_fill(150), (100 * 1.99 + 50 * 1.98) / 150);
+	EXPECT_DOUBLE_EQ(ladder.atl_vwap_to_fill(600), (50 * 2.02 + 150 * 2.06 + 400 * 2.22) / 600);
+	EXPECT_DOUBLE_EQ(ladder.atl_vwap_to_fill(601), 0);
+
+	// Copies retain the index.
+	janus::betfair::ladder copy = ladder;
+	EXPECT_DOUBLE_EQ(copy.atl_depth(2), 200);
+
+	// Clearing the best ATB and replacing the best ATL with an ATB.
+	ladder.clear_unmatched_at(98);
+	ladder.set_unmatched_at(100, -30);
+	EXPECT_DOUBLE_EQ(ladder.atb_depth(0), 30);
+	EXPECT_DOUBLE_EQ(ladder.atb_depth(1000), 530);
+	EXPECT_EQ(ladder.atb_index_for_vol(31), 97);
+	EXPECT_DOUBLE_EQ(ladder.atl_depth(0), 150);
+	EXPECT_DOUBLE_EQ(ladder.atl_depth(1000), 550);
+
+	ladder.clear_unmatched();
+	EXPECT_TRUE(ladder.depth_index_enabled());
+	EXPECT_DOUBLE_EQ(ladder.atb_depth(1000), 0);
+	EXPECT_DOUBLE_EQ(ladder.atl_depth(1000), 0);
+	EXPECT_EQ(ladder.atl_index_for_vol(1), janus::betfair::INVALID_PRICE_INDEX);
+}
+
+// Test that try_set_unmatched_at() reports rather than throws on volume which
+// would cross the book.
+TEST(ladder_test, try_set_unmatched_at)
+{
+	janus::betfair::ladder ladder;
+	ladder.set_unmatched_at(10, -100);
+	ladder.set_unmatched_at(12, 100);
+
+	EXPECT_FALSE(ladder.try_set_unmatched_at(5, 100));
+	EXPECT_FALSE(ladder.try_set_unmatched_at(15, -100));
+	EXPECT_THROW(ladder.set_unmatched_at(5, 100), janus::betfair::invalid_unmatched_update);
+	EXPECT_DOUBLE_EQ(ladder.unmatched(5), 0);
+	EXPECT_DOUBLE_EQ(ladder.unmatched(15), 0);
+
+	// Trivial crossing volume is ignored.
+	EXPECT_TRUE(ladder.try_set_unmatched_at(5, 10));
+	EXPECT_DOUBLE_EQ(ladder.unmatched(5), 0);
+
+	EXPECT_TRUE(ladder.try_set_unmatched_at(11, 100));
+	EXPECT_DOUBLE_EQ(ladder.unmatched(11), 100);
+	EXPECT_EQ(ladder.min_atl_index(), 11);
+}
 } // namespace
@@ -86,4 +86,44 @@ TEST(market_test, clear_state)
 	// Mutable.
 	EXPECT_DOUBLE_EQ(market.traded_vol(), 0);
 }
+
+// Test that runners are stored contiguously, at stable addresses up to the
+// number reserved, and that their state and indicators survive the storage
+// growing beyond it.
+TEST(market_test, runner_storage)
+{
+	janus::betfair::market market(123456);
+	market.reserve_runners(2);
+	market.enable_indicators();
+	EXPECT_EQ(market.runners().size(), 0);
+
+	janus::betfair::runner& first = market.add_runner(1);
+	first.ladder().set_unmatched_at(10, 100);
+	market.add_runner(2);
+	EXPECT_EQ(&market[0], &first);
+	EXPECT_EQ(&market[1], &market[0] + 1);
+
+	for (uint64_t id = 3; id <= janus::betfair::MAX_RUNNERS; id++) {
+		market.add_runner(id);
+	}
+	EXPECT_EQ(market.num_runners(), janus::betfair::MAX_RUNNERS);
+	EXPECT_EQ(market.runners().size(), janus::betfair::MAX_RUNNERS);
+	EXPECT_EQ(market.book().num_runners(), janus::betfair::MAX_RUNNERS);
+	EXPECT_THROW(market.add_runner(999), std::runtime_error);
+
+	EXPECT_DOUBLE_EQ(market[0].ladder().unmatched(10), 100);
+	// Indicators follow the runners as they move.
+	market[0].ladder().set_unmatched_at(9, -50);
+	(*market.indicators())[0].on_unmatched(1000);
+	EXPECT_DOUBLE_EQ((*market.indicators())[0].wom(), 100. / 150);
+
+	for (uint64_t i = 0; i < janus::betfair::MAX_RUNNERS; i++) {
+		EXPECT_EQ(market[i].id(), i + 1);
+		EXPECT_EQ(market.find_runner(i + 1), &market[i]);
+		EXPECT_EQ(market.find_runner_index(i + 1), i);
+		EXPECT_EQ(market.runner_index(market[i]), i);
+	}
+	EXPECT_EQ(market.find_runner(999), nullptr);
+	EXPECT_EQ(market.find_runner_index(999), janus::betfair::MAX_RUNNERS);
+}
 } // namespace
@@ -0,0 +1,55 @@
+#include "janus.hh"
+
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+// Test that the market prefetcher delivers markets in order, cycling through
+// them, and reports markets which can't be loaded.
+TEST(prefetch_test, basic)
+{
+	janus::config config = {
+		.json_data_root = "../test/test-json",
+		.binary_data_root = "../test/test-binary",
+	};
+
+	// 1 doesn't exist.
+	std::vector<uint64_t> ids = {170358161, 168216153, 1, 144697391};
+	std::vector<uint64_t> sizes;
+	for (uint64_t id : ids) {
+		if (id == 1)
+			sizes.push_back(0);
+		else
+			sizes.push_back(janus::read_market_updates(config, id).size());
+	}
+	EXPECT_EQ(sizes[0], 1843 * sizeof(janus::update));
+	EXPECT_EQ(sizes[1], 109648 * sizeof(janus::update));
+
+	for (uint64_t num_loaders : {1, 3}) {
+		janus::market_prefetcher prefetcher(config, ids, 2, num_loaders);
+		ASSERT_EQ(prefetcher.num_markets(), ids.size());
+
+		for (uint64_t i = 0; i < 3 * ids.size(); i++) {
+			uint64_t index = i % ids.size();
+			if (ids[index] == 1) {
+				EXPECT_THROW(prefetcher.next(), std::runtime_error);
+				continue;
+			}
+
+			janus::dynamic_buffer buf = prefetcher.next();
+			EXPECT_EQ(buf.size(), sizes[index]);
+		}
+
+		// Skipping moves over markets, including those that fail.
+		prefetcher.skip(3);
+		janus::dynamic_buffer buf = prefetcher.next();
+		EXPECT_EQ(buf.size(), sizes[3]);
+	}
+
+	EXPECT_THROW(janus::market_prefetcher(config, {}, 1), std::runtime_error);
+	EXPECT_THROW(janus::market_prefetcher(config, ids, 0), std::runtime_error);
+}
+} // namespace
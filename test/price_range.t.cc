@@ -891,4 +891,42 @@ TEST(price_range_test, price_to_nearest_index_up)
 			i++;
 	}
 }
+
+// Test that the .offset_index(), .offset_pricex100() and .tick_distance()
+// methods correctly perform tick arithmetic across price bands.
+TEST(price_range_test, tick_arithmetic)
+{
+	using janus::betfair::price_range;
+
+	// 1.99 + 1 tick = 2, + 2 ticks = 2.02.
+	uint64_t i = price_range::pricex100_to_index(199);
+	EXPECT_EQ(price_range::offset_index(i, 1), price_range::pricex100_to_index(200));
+	EXPECT_EQ(price_range::offset_index(i, 2), price_range::pricex100_to_index(202));
+	EXPECT_EQ(price_range::offset_index(i, -98), 0);
+	EXPECT_EQ(price_range::offset_index(i, -99), janus::betfair::INVALID_PRICE_INDEX);
+	EXPECT_EQ(price_range::offset_index(janus::betfair::NUM_PRICES - 1, 1),
+		  janus::betfair::INVALID_PRICE_INDEX);
+	EXPECT_EQ(price_range::offset_index(janus::betfair::INVALID_PRICE_INDEX, 0),
+		  janus::betfair::INVALID_PRICE_INDEX);
+
+	// 6.27 rounds down to 6.2 prior to being offset.
+	EXPECT_EQ(price_range::offset_pricex100(627, 1), 640);
+	EXPECT_EQ(price_range::offset_pricex100(627, -11), 500);
+	EXPECT_EQ(price_range::offset_pricex100(100000, 1), janus::betfair::INVALID_PRICEX100);
+	EXPECT_EQ(price_range::offset_pricex100(100, 1), janus::betfair::INVALID_PRICEX100);
+
+	EXPECT_EQ(price_range::tick_distance(0, janus::betfair::NUM_PRICES - 1), 349);
+	EXPECT_EQ(price_range::tick_distance(janus::betfair::NUM_PRICES - 1, 0), -349);
+	EXPECT_EQ(price_range::pricex100_tick_distance(300, 400), 20);
+	EXPECT_EQ(price_range::pricex100_tick_distance(1000, 1010), 0);
+	EXPECT_EQ(price_range::pricex100_tick_distance(990, 101), -208);
+
+	EXPECT_EQ(price_range::nearest_pricex100_up(627), 640);
+	EXPECT_EQ(price_range::nearest_pricex100_up(100), janus::betfair::INVALID_PRICEX100);
+	EXPECT_EQ(price_range::nearest_pricex100(100001), janus::betfair::INVALID_PRICEX100);
+
+	// Everything should be usable at compile time.
+	static_assert(price_range::pricex100_to_index(1000) == 209);
+	static_assert(price_range::pricex100_to_nearest_index_up(627) == 191);
+}
 } // namespace
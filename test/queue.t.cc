@@ -0,0 +1,166 @@
+#include "janus.hh"
+
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace
+{
+// Push values through an SPSC queue from another thread and check they all
+// arrive in order.
+template<typename WaitPolicy>
+void check_spsc_threaded()
+{
+	static constexpr uint64_t NUM_VALUES = 100000;
+
+	janus::spsc_queue<uint64_t, WaitPolicy> queue(16);
+	std::thread producer([&] {
+		for (uint64_t i = 0; i < NUM_VALUES; i++) {
+			queue.push(i);
+		}
+	});
+
+	uint64_t num_out_of_order = 0;
+	for (uint64_t i = 0; i < NUM_VALUES; i++) {
+		if (queue.pop() != i)
+			num_out_of_order++;
+	}
+	producer.join();
+
+	EXPECT_EQ(num_out_of_order, 0);
+	uint64_t val;
+	EXPECT_FALSE(queue.try_pop(val));
+}
+
+// Push values through an MPSC queue from several threads and check each
+// producer's values arrive exactly once and in the order it pushed them.
+template<typename WaitPolicy>
+void check_mpsc_threaded()
+{
+	static constexpr uint64_t NUM_PRODUCERS = 4;
+	static constexpr uint64_t NUM_VALUES = 50000;
+
+	// The producer index is held in the top bits of each value.
+	static constexpr uint64_t PRODUCER_SHIFT = 32;
+
+	janus::mpsc_queue<uint64_t, WaitPolicy> queue(8);
+	std::vector<std::thread> producers;
+	for (uint64_t p = 0; p < NUM_PRODUCERS; p++) {
+		producers.emplace_back([&, p] {
+			for (uint64_t i = 0; i < NUM_VALUES; i++) {
+				// Mix both ways of pushing.
+				uint64_t val = (p << PRODUCER_SHIFT) | i;
+				if (i % 2 == 0) {
+					queue.push(val);
+					continue;
+				}
+				while (!queue.try_push(val)) {
+					std::this_thread::yield();
+				}
+			}
+		});
+	}
+
+	std::vector<uint64_t> next(NUM_PRODUCERS);
+	uint64_t num_out_of_order = 0;
+	for (uint64_t i = 0; i < NUM_PRODUCERS * NUM_VALUES; i++) {
+		uint64_t val = queue.pop();
+		uint64_t p = val >> PRODUCER_SHIFT;
+		ASSERT_LT(p, NUM_PRODUCERS);
+		if ((val & ((1UL << PRODUCER_SHIFT) - 1)) != next[p])
+			num_out_of_order++;
+		next[p]++;
+	}
+	for (auto& producer : producers) {
+		producer.join();
+	}
+
+	EXPECT_EQ(num_out_of_order, 0);
+	for (uint64_t p = 0; p < NUM_PRODUCERS; p++) {
+		EXPECT_EQ(next[p], NUM_VALUES);
+	}
+	uint64_t val;
+	EXPECT_FALSE(queue.try_pop(val));
+}
+
+// Test that an SPSC queue holds up to its capacity in FIFO order.
+TEST(queue_test, spsc_basic)
+{
+	EXPECT_THROW(janus::spsc_queue<uint64_t>(0), std::runtime_error);
+
+	// Capacity is rounded up to a power of 2.
+	janus::spsc_queue<uint64_t> queue(3);
+	ASSERT_EQ(queue.cap(), 4);
+
+	uint64_t val;
+	EXPECT_FALSE(queue.try_pop(val));
+
+	for (uint64_t i = 0; i < 4; i++) {
+		EXPECT_TRUE(queue.try_push(i));
+	}
+	EXPECT_FALSE(queue.try_push(4));
+
+	EXPECT_TRUE(queue.try_pop(val));
+	EXPECT_EQ(val, 0);
+	EXPECT_TRUE(queue.try_push(4));
+
+	// Wrap around the ring a few times.
+	for (uint64_t i = 1; i < 20; i++) {
+		EXPECT_EQ(queue.pop(), i);
+		queue.push(i + 4);
+	}
+	for (uint64_t i = 20; i < 24; i++) {
+		EXPECT_EQ(queue.pop(), i);
+	}
+	EXPECT_FALSE(queue.try_pop(val));
+}
+
+// Test that an SPSC queue delivers values between threads with each wait
+// policy.
+TEST(queue_test, spsc_threaded)
+{
+	check_spsc_threaded<janus::block_wait>();
+	check_spsc_threaded<janus::spin_wait>();
+}
+
+// Test that an MPSC queue holds up to its capacity in FIFO order.
+TEST(queue_test, mpsc_basic)
+{
+	EXPECT_THROW(janus::mpsc_queue<uint64_t>(0), std::runtime_error);
+
+	janus::mpsc_queue<uint64_t> queue(4);
+	ASSERT_EQ(queue.cap(), 4);
+
+	uint64_t val;
+	EXPECT_FALSE(queue.try_pop(val));
+
+	for (uint64_t i = 0; i < 4; i++) {
+		EXPECT_TRUE(queue.try_push(i));
+	}
+	EXPECT_FALSE(queue.try_push(4));
+
+	EXPECT_TRUE(queue.try_pop(val));
+	EXPECT_EQ(val, 0);
+	EXPECT_TRUE(queue.try_push(4));
+	EXPECT_FALSE(queue.try_push(5));
+
+	for (uint64_t i = 1; i < 20; i++) {
+		EXPECT_EQ(queue.pop(), i);
+		queue.push(i + 4);
+	}
+	for (uint64_t i = 20; i < 24; i++) {
+		EXPECT_EQ(queue.pop(), i);
+	}
+	EXPECT_FALSE(queue.try_pop(val));
+}
+
+// Test that an MPSC queue delivers values from several producers with each
+// wait policy.
+TEST(queue_test, mpsc_threaded)
+{
+	check_mpsc_threaded<janus::block_wait>();
+	check_mpsc_threaded<janus::spin_wait>();
+}
+} // namespace
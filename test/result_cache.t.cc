@@ -0,0 +1,86 @@
+#include "janus.hh"
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <string>
+
+namespace
+{
+// Test that cached market results are read back only for the version of the
+// market's data, strategy and result size they were written for.
+TEST(result_cache_test, basic)
+{
+	std::string root = std::filesystem::temp_directory_path() / "result_cache_test";
+	std::filesystem::remove_all(root);
+
+	static constexpr uint64_t RESULT_SIZE = 16;
+	janus::result_cache cache(root, "test", 1, RESULT_SIZE);
+	EXPECT_EQ(cache.dir(),
+		  janus::get_result_cache_dir(root, janus::hash_dataset_key("test"), 1));
+	EXPECT_TRUE(std::filesystem::is_directory(cache.dir()));
+
+	std::string results;
+	EXPECT_EQ(cache.read(123, 456, results), 0);
+	EXPECT_TRUE(results.empty());
+
+	std::string written(3 * RESULT_SIZE, 'x');
+	written[RESULT_SIZE] = 'y';
+	cache.write(123, 456, written);
+	EXPECT_EQ(cache.read(123, 456, results), 3);
+	EXPECT_EQ(results, written);
+
+	// Results of other versions of the data are stale.
+	EXPECT_EQ(cache.read(123, 789, results), 0);
+	EXPECT_TRUE(results.empty());
+
+	// Writing replaces the results of the market.
+	cache.write(123, 789, written.substr(RESULT_SIZE));
+	EXPECT_EQ(cache.read(123, 789, results), 2);
+	EXPECT_EQ(results, written.substr(RESULT_SIZE));
+	EXPECT_EQ(cache.read(123, 456, results), 0);
+
+	// Other result sizes don't see the results.
+	janus::result_cache resized(root, "test", 1, RESULT_SIZE * 2);
+	EXPECT_EQ(resized.dir(), cache.dir());
+	EXPECT_EQ(resized.read(123, 789, results), 0);
+
+	// Truncated files are ignored.
+	std::filesystem::resize_file(cache.path(123), 20);
+	EXPECT_EQ(cache.read(123, 789, results), 0);
+	{
+		auto file = std::ofstream(cache.path(123), std::ios::trunc);
+		file << "garbage";
+	}
+	EXPECT_EQ(cache.read(123, 789, results), 0);
+
+	// Other strategy versions don't see the results, but leave them be
+	// while they may yet be used.
+	cache.write(123, 789, written);
+	janus::result_cache other(root, "test", 2, RESULT_SIZE);
+	EXPECT_NE(other.dir(), cache.dir());
+	EXPECT_EQ(other.read(123, 789, results), 0);
+	EXPECT_EQ(cache.read(123, 789, results), 3);
+
+	// Until they are idle, whatever their key.
+	janus::result_cache unrelated(root, "unrelated", 1, RESULT_SIZE);
+	auto idle_time = std::filesystem::file_time_type::clock::now() -
+			 std::chrono::milliseconds(janus::RESULT_CACHE_MAX_IDLE_MS + 1000);
+	std::filesystem::last_write_time(cache.dir(), idle_time);
+	std::filesystem::last_write_time(unrelated.dir(), idle_time);
+	EXPECT_EQ(janus::evict_result_caches(root, janus::hash_dataset_key("test"), 2), 2);
+	EXPECT_FALSE(std::filesystem::exists(cache.dir()));
+	EXPECT_FALSE(std::filesystem::exists(unrelated.dir()));
+	EXPECT_TRUE(std::filesystem::is_directory(other.dir()));
+
+	// Opening a cache records that it is in use so it isn't evicted.
+	std::filesystem::last_write_time(other.dir(), idle_time);
+	janus::result_cache reopened(root, "test", 2, RESULT_SIZE);
+	EXPECT_GT(std::filesystem::last_write_time(other.dir()), idle_time);
+	EXPECT_TRUE(std::filesystem::is_directory(other.dir()));
+
+	std::filesystem::remove_all(root);
+}
+} // namespace
@@ -0,0 +1,101 @@
+#include "janus.hh"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+
+namespace
+{
+// Test that basic seqlock store/load functionality works correctly.
+TEST(seqlock_test, basic)
+{
+	struct foo
+	{
+		uint64_t x;
+		double y;
+	};
+
+	janus::seqlock<foo> lock;
+	EXPECT_EQ(lock.version(), 0);
+
+	foo val = {.x = 1, .y = 2};
+	// Nothing published yet so we should get a zeroed value.
+	EXPECT_EQ(lock.load(val), 0);
+	EXPECT_EQ(val.x, 0);
+	EXPECT_DOUBLE_EQ(val.y, 0);
+
+	lock.store({.x = 123, .y = 456.5});
+	EXPECT_EQ(lock.version(), 1);
+	EXPECT_EQ(lock.load(val), 1);
+	EXPECT_EQ(val.x, 123);
+	EXPECT_DOUBLE_EQ(val.y, 456.5);
+
+	lock.store({.x = 789, .y = 1.5});
+	uint64_t version;
+	ASSERT_TRUE(lock.try_load(val, version));
+	EXPECT_EQ(version, 2);
+	EXPECT_EQ(val.x, 789);
+	EXPECT_DOUBLE_EQ(val.y, 1.5);
+}
+
+// Test that readers always see consistent values while a writer is publishing
+// concurrently.
+TEST(seqlock_test, concurrent)
+{
+	static constexpr uint64_t NUM_WORDS = 64;
+	static constexpr uint64_t NUM_WRITES = 20000;
+	static constexpr uint64_t NUM_READERS = 3;
+
+	// Every word is set to the same value, so a torn read is detectable.
+	struct payload
+	{
+		std::array<uint64_t, NUM_WORDS> words;
+	};
+
+	janus::seqlock<payload> lock;
+	std::atomic<bool> done{false};
+	std::atomic<uint64_t> num_torn{0};
+	std::atomic<uint64_t> num_backwards{0};
+
+	std::vector<std::thread> readers;
+	for (uint64_t i = 0; i < NUM_READERS; i++) {
+		readers.emplace_back([&] {
+			payload val;
+			uint64_t prev_version = 0;
+			while (!done.load()) {
+				uint64_t version = lock.load(val);
+				if (version < prev_version)
+					num_backwards++;
+				prev_version = version;
+
+				for (uint64_t word : val.words) {
+					if (word != val.words[0]) {
+						num_torn++;
+						break;
+					}
+				}
+			}
+		});
+	}
+
+	payload val;
+	for (uint64_t i = 1; i <= NUM_WRITES; i++) {
+		val.words.fill(i);
+		lock.store(val);
+	}
+	done.store(true);
+
+	for (auto& reader : readers) {
+		reader.join();
+	}
+
+	EXPECT_EQ(num_torn.load(), 0);
+	EXPECT_EQ(num_backwards.load(), 0);
+
+	EXPECT_EQ(lock.load(val), NUM_WRITES);
+	EXPECT_EQ(val.words[0], NUM_WRITES);
+}
+} // namespace
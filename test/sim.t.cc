@@ -2,6 +2,7 @@
 #include "test_util.hh"
 
 #include <gtest/gtest.h>
+#include <stdexcept>
 
 namespace
 {
@@ -11,6 +12,9 @@ TEST(sim_test, basic)
 	janus::betfair::price_range range;
 
 	janus::betfair::market market1(123456);
+	// A second runner is added later so we reserve for it to keep runner1
+	// valid.
+	market1.reserve_runners(2);
 	janus::betfair::runner& runner1 = market1.add_runner(123);
 	janus::betfair::ladder& ladder1 = runner1.ladder();
 	ladder1.set_unmatched_at(range.price_to_nearest_index(6.4), 123.45);
@@ -364,6 +368,7 @@ TEST(sim_test, hedge_all)
 		janus::betfair::price_range range;
 
 		janus::betfair::market market1(123456);
+		market1.reserve_runners(3);
 
 		janus::betfair::runner& runner1 = market1.add_runner(123);
 		janus::betfair::ladder& ladder1 = runner1.ladder();
@@ -478,4 +483,181 @@ TEST(sim_test, handle_inplay_bets)
 		    janus::bet_flags::CANCELLED);
 	EXPECT_DOUBLE_EQ(persist_bet->unmatched(), 1000);
 }
+
+// Test that sims sharing a bet pool reuse its storage and that bets don't move
+// as the pool grows.
+TEST(sim_test, bet_pool)
+{
+	janus::betfair::price_range range;
+
+	janus::betfair::market market1(123456);
+	market1.add_runner(123);
+
+	janus::sim_bet_pool pool;
+	EXPECT_EQ(pool.size(), 0);
+	EXPECT_EQ(pool.capacity(), 0);
+
+	uint64_t num_bets = 3 * janus::SIM_BET_POOL_CHUNK_SIZE + 1;
+	{
+		janus::sim sim(range, market1, pool);
+		janus::bet* first = sim.add_bet(123, 6.4, 10, true);
+		ASSERT_NE(first, nullptr);
+		for (uint64_t i = 1; i < num_bets; i++) {
+			ASSERT_NE(sim.add_bet(123, 6.4, 10, true), nullptr);
+		}
+		EXPECT_EQ(&sim.bets()[0], first);
+		EXPECT_EQ(first->bet_id(), 0);
+		EXPECT_EQ(sim.bets()[num_bets - 1].bet_id(), num_bets - 1);
+		EXPECT_EQ(pool.size(), num_bets);
+	}
+	uint64_t cap = pool.capacity();
+	EXPECT_EQ(cap, 4 * janus::SIM_BET_POOL_CHUNK_SIZE);
+
+	// A new sim starts afresh without allocating.
+	janus::sim sim(range, market1, pool);
+	EXPECT_EQ(sim.bets().size(), 0);
+	janus::bet* bet = sim.add_bet(123, 6.4, 10, true);
+	ASSERT_NE(bet, nullptr);
+	EXPECT_EQ(bet->bet_id(), 0);
+	EXPECT_EQ(pool.capacity(), cap);
+
+	// The number of bets in a sim remains bounded.
+	for (uint64_t i = 1; i < janus::MAX_SIM_BETS; i++) {
+		ASSERT_NE(sim.add_bet(123, 6.4, 10, true), nullptr);
+	}
+	EXPECT_EQ(sim.add_bet(123, 6.4, 10, true), nullptr);
+}
+
+// Test that bets completed outside of an update stop being matched, that bets
+// on runners added after the sim was created are updated and that removals
+// void completed bets.
+TEST(sim_test, runner_bets)
+{
+	janus::betfair::price_range range;
+	uint64_t index_6_4 = range.price_to_nearest_index(6.4);
+
+	janus::betfair::market market1(123456);
+	janus::betfair::runner& runner1 = market1.add_runner(123);
+	runner1.ladder().set_unmatched_at(index_6_4, 10);
+
+	janus::sim sim(range, market1);
+
+	janus::bet* bet1 = sim.add_bet(123, 6.4, 100, true);
+	janus::bet* bet2 = sim.add_bet(123, 6.4, 100, true);
+	ASSERT_NE(bet1, nullptr);
+	ASSERT_NE(bet2, nullptr);
+	bet1->cancel();
+
+	runner1.ladder().set_matched_at(index_6_4, 2 * 10 + 20);
+	sim.update();
+	EXPECT_DOUBLE_EQ(bet1->matched(), 0);
+	EXPECT_DOUBLE_EQ(bet2->matched(), 10);
+
+	// Runners can be added to the market at any time.
+	janus::betfair::runner& runner2 = market1.add_runner(456);
+	runner2.ladder().set_unmatched_at(index_6_4, 10);
+	janus::bet* bet3 = sim.add_bet(456, 6.4, 100, true);
+	ASSERT_NE(bet3, nullptr);
+	runner2.ladder().set_matched_at(index_6_4, 2 * 10 + 40);
+	sim.update();
+	EXPECT_DOUBLE_EQ(bet3->matched(), 20);
+
+	// The removal voids all bets on the runner including completed ones.
+	bet3->cancel();
+	runner2.set_removed(0);
+	sim.update();
+	EXPECT_TRUE((bet3->flags() & janus::bet_flags::VOIDED) == janus::bet_flags::VOIDED);
+	EXPECT_DOUBLE_EQ(bet3->matched(), 0);
+	EXPECT_DOUBLE_EQ(bet2->matched(), 10);
+}
+
+// Test that bets are matched as the matched volume at their price passes their
+// target and when the market moves past them, but not once cancelled.
+TEST(sim_test, triggers)
+{
+	janus::betfair::price_range range;
+	uint64_t index_6_4 = range.price_to_nearest_index(6.4);
+	uint64_t index_6_6 = range.price_to_nearest_index(6.6);
+
+	janus::betfair::market market1(123456);
+	janus::betfair::runner& runner1 = market1.add_runner(123);
+	janus::betfair::ladder& ladder1 = runner1.ladder();
+	ladder1.set_unmatched_at(index_6_4, 10);
+	ladder1.set_unmatched_at(index_6_6, 50);
+
+	janus::sim sim(range, market1);
+
+	janus::bet* back = sim.add_bet(123, 6.4, 100, true);
+	janus::bet* cancelled = sim.add_bet(123, 6.6, 100, true);
+	ASSERT_NE(back, nullptr);
+	ASSERT_NE(cancelled, nullptr);
+	EXPECT_DOUBLE_EQ(back->target_matched(), 2 * 10);
+	EXPECT_DOUBLE_EQ(cancelled->target_matched(), 2 * 50);
+	cancelled->cancel();
+
+	// Nothing changed so nothing matches.
+	sim.update();
+	EXPECT_DOUBLE_EQ(back->matched(), 0);
+
+	// Volume up to the target doesn't match us.
+	ladder1.set_matched_at(index_6_4, 20);
+	sim.update();
+	EXPECT_DOUBLE_EQ(back->matched(), 0);
+
+	ladder1.set_matched_at(index_6_4, 30);
+	sim.update();
+	EXPECT_DOUBLE_EQ(back->matched(), 5);
+	sim.update();
+	EXPECT_DOUBLE_EQ(back->matched(), 5);
+
+	ladder1.set_matched_at(index_6_4, 60);
+	ladder1.set_matched_at(index_6_6, 300);
+	sim.update();
+	EXPECT_DOUBLE_EQ(back->matched(), 20);
+	EXPECT_DOUBLE_EQ(cancelled->matched(), 0);
+
+	// Lay volume at our price means the market has moved past us.
+	ladder1.set_unmatched_at(index_6_6, 0);
+	ladder1.set_unmatched_at(index_6_4, -10);
+	sim.update();
+	EXPECT_DOUBLE_EQ(back->matched(), back->stake() - 20);
+	EXPECT_DOUBLE_EQ(cancelled->matched(), 0);
+}
+
+// Test that a sim restored from a checkpoint applies removals it hadn't seen
+// when the checkpoint was taken, as the sim it was taken from would.
+TEST(sim_test, checkpoint)
+{
+	janus::betfair::price_range range;
+
+	janus::betfair::market market1(123456);
+	market1.add_runner(123);
+	janus::betfair::runner& runner2 = market1.add_runner(456);
+
+	janus::sim sim1(range, market1);
+	runner2.set_removed(20);
+
+	janus::dynamic_buffer dyn_buf(sim1.checkpoint_size());
+	sim1.save_checkpoint(dyn_buf);
+	EXPECT_EQ(dyn_buf.size(), sim1.checkpoint_size());
+
+	// A new sim sees the removal as having already happened.
+	janus::sim fresh(range, market1);
+	janus::bet* bet = fresh.add_bet(123, 6.4, 10, true);
+	ASSERT_NE(bet, nullptr);
+	fresh.update();
+	EXPECT_DOUBLE_EQ(bet->stake(), 10);
+
+	janus::sim sim2(range, market1);
+	sim2.load_checkpoint(dyn_buf);
+	bet = sim2.add_bet(123, 6.4, 10, true);
+	ASSERT_NE(bet, nullptr);
+	EXPECT_EQ(bet->bet_id(), 0);
+	sim2.update();
+	EXPECT_DOUBLE_EQ(bet->stake(), 0);
+
+	// Sims with bets can't be checkpointed.
+	janus::dynamic_buffer bets_buf(sim2.checkpoint_size());
+	EXPECT_THROW(sim2.save_checkpoint(bets_buf), std::runtime_error);
+}
 } // namespace
@@ -0,0 +1,201 @@
+#include "janus.hh"
+
+#include <atomic>
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <map>
+#include <memory>
+#include <span>
+#include <thread>
+#include <vector>
+
+namespace
+{
+// Test that market snapshots correctly capture market, runner and ladder state.
+TEST(snapshot_test, make_market_snapshot)
+{
+	janus::betfair::market market(123456);
+	market.set_traded_vol(1234.5);
+	market.set_last_timestamp(987654321);
+	market.set_inplay(true);
+
+	janus::betfair::runner& runner1 = market.add_runner(111);
+	runner1.set_ltp(50);
+	runner1.set_traded_vol(345.6);
+	runner1.ladder().set_unmatched_at(48, -100);
+	runner1.ladder().set_unmatched_at(49, -200);
+	runner1.ladder().set_unmatched_at(51, 300);
+
+	janus::betfair::runner& runner2 = market.add_runner(222);
+	runner2.set_removed(0.5);
+
+	auto snap = std::make_unique<janus::betfair::market_snapshot>();
+	janus::betfair::make_market_snapshot(market, *snap);
+
+	EXPECT_EQ(snap->id, 123456);
+	EXPECT_EQ(snap->state, janus::betfair::market_state::OPEN);
+	EXPECT_TRUE(snap->inplay);
+	EXPECT_DOUBLE_EQ(snap->traded_vol, 1234.5);
+	EXPECT_EQ(snap->last_timestamp, 987654321);
+	ASSERT_EQ(snap->num_runners, 2);
+
+	const auto& runner_snap1 = snap->runners[0];
+	EXPECT_EQ(runner_snap1.id, 111);
+	EXPECT_EQ(runner_snap1.state, janus::betfair::runner_state::ACTIVE);
+	EXPECT_EQ(runner_snap1.ltp, 50);
+	EXPECT_DOUBLE_EQ(runner_snap1.traded_vol, 345.6);
+
+	ASSERT_EQ(runner_snap1.num_atl, 1);
+	EXPECT_EQ(runner_snap1.atl_price_indexes[0], 51);
+	EXPECT_DOUBLE_EQ(runner_snap1.atl_vols[0], 300);
+
+	// ATB volumes are expressed as positive values, best first.
+	ASSERT_EQ(runner_snap1.num_atb, 2);
+	EXPECT_EQ(runner_snap1.atb_price_indexes[0], 49);
+	EXPECT_DOUBLE_EQ(runner_snap1.atb_vols[0], 200);
+	EXPECT_EQ(runner_snap1.atb_price_indexes[1], 48);
+	EXPECT_DOUBLE_EQ(runner_snap1.atb_vols[1], 100);
+
+	const auto& runner_snap2 = snap->runners[1];
+	EXPECT_EQ(runner_snap2.id, 222);
+	EXPECT_EQ(runner_snap2.state, janus::betfair::runner_state::REMOVED);
+	EXPECT_DOUBLE_EQ(runner_snap2.adj_factor, 0.5);
+	EXPECT_EQ(runner_snap2.num_atl, 0);
+	EXPECT_EQ(runner_snap2.num_atb, 0);
+}
+
+// Test that published snapshots can be read back.
+TEST(snapshot_test, publish)
+{
+	janus::betfair::market market(123456);
+	janus::betfair::runner& runner = market.add_runner(111);
+	runner.set_ltp(17);
+
+	auto pub = std::make_unique<janus::betfair::market_snapshot_publisher>();
+	auto snap = std::make_unique<janus::betfair::market_snapshot>();
+	janus::betfair::publish_market_snapshot(market, *snap, *pub);
+
+	auto read = std::make_unique<janus::betfair::market_snapshot>();
+	EXPECT_EQ(pub->load(*read), 1);
+	EXPECT_EQ(read->id, 123456);
+	ASSERT_EQ(read->num_runners, 1);
+	EXPECT_EQ(read->runners[0].ltp, 17);
+
+	runner.set_ltp(18);
+	janus::betfair::publish_market_snapshot(market, *snap, *pub);
+	EXPECT_EQ(pub->load(*read), 2);
+	EXPECT_EQ(read->runners[0].ltp, 18);
+}
+
+// Check that two market snapshots hold the same state.
+static void expect_snapshots_eq(const janus::betfair::market_snapshot& a,
+				const janus::betfair::market_snapshot& b)
+{
+	EXPECT_EQ(a.id, b.id);
+	EXPECT_EQ(a.state, b.state);
+	EXPECT_EQ(a.inplay, b.inplay);
+	EXPECT_DOUBLE_EQ(a.traded_vol, b.traded_vol);
+	EXPECT_EQ(a.last_timestamp, b.last_timestamp);
+	ASSERT_EQ(a.num_runners, b.num_runners);
+	for (uint64_t i = 0; i < a.num_runners; i++) {
+		const auto& runner_a = a.runners[i];
+		const auto& runner_b = b.runners[i];
+		EXPECT_EQ(runner_a.id, runner_b.id);
+		EXPECT_EQ(runner_a.state, runner_b.state);
+		EXPECT_EQ(runner_a.ltp, runner_b.ltp);
+		EXPECT_DOUBLE_EQ(runner_a.traded_vol, runner_b.traded_vol);
+		ASSERT_EQ(runner_a.num_atl, runner_b.num_atl);
+		for (uint64_t j = 0; j < runner_a.num_atl; j++) {
+			EXPECT_EQ(runner_a.atl_price_indexes[j], runner_b.atl_price_indexes[j]);
+			EXPECT_DOUBLE_EQ(runner_a.atl_vols[j], runner_b.atl_vols[j]);
+		}
+		ASSERT_EQ(runner_a.num_atb, runner_b.num_atb);
+		for (uint64_t j = 0; j < runner_a.num_atb; j++) {
+			EXPECT_EQ(runner_a.atb_price_indexes[j], runner_b.atb_price_indexes[j]);
+			EXPECT_DOUBLE_EQ(runner_a.atb_vols[j], runner_b.atb_vols[j]);
+		}
+	}
+}
+
+// Test that a reader thread obtains consistent snapshots of a watched market,
+// published by the universe at each timestamp boundary, while a writer thread
+// applies the market's updates.
+TEST(snapshot_test, watch_market)
+{
+	janus::config config = {
+		.json_data_root = "../test/test-json",
+		.binary_data_root = "../test/test-binary",
+	};
+	static constexpr uint64_t MARKET_ID = 170358161;
+	janus::dynamic_buffer buf = janus::read_market_updates(config, MARKET_ID);
+	std::span<const janus::update> updates = janus::read_updates(buf);
+
+	auto ptr = std::make_unique<janus::betfair::universe<1>>();
+	auto& universe = *ptr;
+	auto pub = universe.watch_market(MARKET_ID);
+	EXPECT_EQ(universe.watch_market(MARKET_ID), pub);
+	EXPECT_EQ(pub->version(), 0);
+
+	// The writer records the state of the market at the end of each
+	// timestamp to compare with what the reader sees.
+	std::map<uint64_t, std::unique_ptr<janus::betfair::market_snapshot>> expected;
+	std::atomic<bool> done = false;
+	std::thread writer([&] {
+		// Market update files don't include their market ID.
+		universe.apply_update(janus::make_market_id_update(MARKET_ID));
+		uint64_t pos = 0;
+		while (pos < updates.size()) {
+			uint64_t end = janus::find_next_timestamp(updates, pos + 1);
+			uint64_t num_applied = 0;
+			universe.apply_updates(updates.subspan(pos, end - pos), num_applied);
+			pos = end;
+
+			janus::betfair::market* market = universe.find_market(MARKET_ID);
+			if (market == nullptr)
+				continue;
+			auto snap = std::make_unique<janus::betfair::market_snapshot>();
+			janus::betfair::make_market_snapshot(*market, *snap);
+			expected[snap->last_timestamp] = std::move(snap);
+		}
+		universe.publish_snapshots();
+		done = true;
+	});
+
+	std::vector<std::unique_ptr<janus::betfair::market_snapshot>> reads;
+	uint64_t last_version = 0;
+	auto read = [&] {
+		if (pub->version() == last_version)
+			return;
+		auto snap = std::make_unique<janus::betfair::market_snapshot>();
+		uint64_t version = pub->load(*snap);
+		EXPECT_GT(version, last_version);
+		last_version = version;
+		reads.push_back(std::move(snap));
+	};
+	while (!done) {
+		read();
+	}
+	writer.join();
+	read();
+
+	// Every snapshot read is the state of the market at the end of a
+	// timestamp, and the last is its final state.
+	ASSERT_FALSE(reads.empty());
+	EXPECT_GT(expected.size(), 10);
+	for (const auto& snap : reads) {
+		auto it = expected.find(snap->last_timestamp);
+		ASSERT_NE(it, expected.end());
+		expect_snapshots_eq(*snap, *it->second);
+	}
+	expect_snapshots_eq(*reads.back(), *expected.rbegin()->second);
+
+	// Removing the market stops publication but readers keep the
+	// publisher.
+	uint64_t version = pub->version();
+	EXPECT_TRUE(universe.remove_market(MARKET_ID));
+	universe.apply_update(janus::make_market_id_update(MARKET_ID));
+	universe.apply_update(janus::make_timestamp_update(~0UL));
+	universe.publish_snapshots();
+	EXPECT_EQ(pub->version(), version);
+}
+} // namespace
@@ -0,0 +1,104 @@
+#include "janus.hh"
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+// Test that sysfs CPU lists are parsed correctly.
+TEST(topology_test, parse_cpu_list)
+{
+	EXPECT_EQ(janus::parse_cpu_list("0-3,8,10-11\n"),
+		  std::vector<uint64_t>({0, 1, 2, 3, 8, 10, 11}));
+	EXPECT_EQ(janus::parse_cpu_list("5"), std::vector<uint64_t>({5}));
+	EXPECT_EQ(janus::parse_cpu_list("4,0-1,1"), std::vector<uint64_t>({0, 1, 4}));
+	EXPECT_TRUE(janus::parse_cpu_list("\n").empty());
+
+	EXPECT_THROW(janus::parse_cpu_list("0-"), std::runtime_error);
+	EXPECT_THROW(janus::parse_cpu_list("3-1"), std::runtime_error);
+	EXPECT_THROW(janus::parse_cpu_list("1,,2"), std::runtime_error);
+	EXPECT_THROW(janus::parse_cpu_list("a"), std::runtime_error);
+}
+
+// Test that the NUMA topology is read from sysfs and restricted to the CPUs we
+// are permitted to run on.
+TEST(topology_test, read)
+{
+	std::string root = std::filesystem::temp_directory_path() / "topology_test";
+	std::filesystem::remove_all(root);
+
+	auto add_node = [&](const std::string& name, const std::string& cpulist) {
+		std::filesystem::create_directories(root + "/" + name);
+		std::ofstream(root + "/" + name + "/cpulist") << cpulist << "\n";
+	};
+	add_node("node1", "4-7");
+	add_node("node0", "0-3");
+	// No permitted CPUs.
+	add_node("node2", "8-11");
+	std::filesystem::create_directories(root + "/power");
+
+	janus::cpu_topology topology = janus::read_cpu_topology(root, {1, 2, 5, 6, 7});
+	ASSERT_EQ(topology.nodes.size(), 2);
+	EXPECT_EQ(topology.nodes[0].id, 0);
+	EXPECT_EQ(topology.nodes[0].cpus, std::vector<uint64_t>({1, 2}));
+	EXPECT_EQ(topology.nodes[1].id, 1);
+	EXPECT_EQ(topology.nodes[1].cpus, std::vector<uint64_t>({5, 6, 7}));
+	EXPECT_EQ(topology.num_cpus(), 5);
+
+	// Without NUMA information everything is on node 0.
+	std::filesystem::remove_all(root);
+	topology = janus::read_cpu_topology(root, {0, 3});
+	ASSERT_EQ(topology.nodes.size(), 1);
+	EXPECT_EQ(topology.nodes[0].id, 0);
+	EXPECT_EQ(topology.nodes[0].cpus, std::vector<uint64_t>({0, 3}));
+
+	// We must be permitted to run somewhere.
+	topology = janus::get_cpu_topology();
+	EXPECT_GT(topology.num_cpus(), 0);
+}
+
+// Test that workers are spread across nodes then packed within them.
+TEST(topology_test, place_workers)
+{
+	janus::cpu_topology topology = {
+		.nodes = {{.id = 0, .cpus = {0, 1, 2}}, {.id = 1, .cpus = {8}}},
+	};
+
+	auto placements = janus::place_workers(topology, 6);
+	ASSERT_EQ(placements.size(), 6);
+	std::vector<uint64_t> cpus;
+	std::vector<uint64_t> nodes;
+	for (const auto& placement : placements) {
+		cpus.push_back(placement.cpu);
+		nodes.push_back(placement.node);
+	}
+	// Once node 1 is full node 0 takes the rest, then we wrap.
+	EXPECT_EQ(cpus, std::vector<uint64_t>({0, 8, 1, 2, 0, 8}));
+	EXPECT_EQ(nodes, std::vector<uint64_t>({0, 1, 0, 0, 0, 1}));
+
+	EXPECT_EQ(janus::describe_placements(topology, placements),
+		  "node 0: CPUs 0,1,2,0 node 1: CPUs 8,8");
+
+	EXPECT_THROW(janus::place_workers(janus::cpu_topology{}, 1), std::runtime_error);
+}
+
+// Test that local buffers can hold data whether or not huge pages are used.
+TEST(topology_test, make_local_buffer)
+{
+	for (bool huge_pages : {false, true}) {
+		janus::dynamic_buffer buf = janus::make_local_buffer(5 * 1024 * 1024, huge_pages);
+		EXPECT_EQ(buf.cap(), 5 * 1024 * 1024);
+		EXPECT_EQ(buf.size(), 0);
+
+		std::string str(buf.cap(), 'x');
+		buf.add_raw(str.c_str(), str.size());
+		EXPECT_EQ(buf.size(), str.size());
+		EXPECT_EQ(reinterpret_cast<const char*>(buf.data())[buf.size() - 1], 'x');
+	}
+}
+} // namespace
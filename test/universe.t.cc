@@ -1,8 +1,13 @@
 #include "janus.hh"
 
+#include <cstdint>
+#include <filesystem>
 #include <gtest/gtest.h>
 #include <memory>
+#include <span>
 #include <stdexcept>
+#include <string>
+#include <vector>
 
 namespace
 {
@@ -248,6 +253,32 @@ TEST(universe_test, dont_time_travel)
 	universe1.apply_update(janus::make_timestamp_update(1234567));
 	ASSERT_THROW(universe1.apply_update(janus::make_timestamp_update(234567)),
 		     janus::universe_apply_error);
+	// The rejected timestamp is still adopted so it isn't repeated.
+	EXPECT_EQ(universe1.last_timestamp(), 234567);
+
+	// A single out of order timestamp doesn't cause those after it to be
+	// rejected, and markets carry on being timestamped.
+	universe1.apply_update(janus::make_market_id_update(123));
+	universe1.apply_update(janus::make_timestamp_update(9999999));
+	ASSERT_THROW(universe1.apply_update(janus::make_timestamp_update(2000000)),
+		     janus::universe_apply_error);
+	for (uint64_t timestamp : {2000001, 2000002, 2000003}) {
+		ASSERT_NO_THROW(universe1.apply_update(janus::make_timestamp_update(timestamp)));
+		EXPECT_EQ(universe1.last_timestamp(), timestamp);
+		EXPECT_EQ(universe1[123].last_timestamp(), timestamp);
+	}
+}
+
+// Ensure that markets are stored aligned as their type requires.
+TEST(universe_test, market_alignment)
+{
+	auto ptr = std::make_unique<janus::betfair::universe<3>>();
+	auto& universe = *ptr;
+
+	for (uint64_t id = 1; id <= 3; id++) {
+		janus::betfair::market& m = universe.add_market(id);
+		EXPECT_EQ(reinterpret_cast<uintptr_t>(&m) % alignof(janus::betfair::market), 0);
+	}
 }
 
 // Ensure that clearing the universe clears all markets down.
@@ -265,4 +296,418 @@ TEST(universe_test, clear)
 	EXPECT_EQ(universe.last_market(), nullptr);
 	EXPECT_EQ(universe.last_runner(), nullptr);
 }
+
+// Ensure that closed markets are evicted after the grace period, freeing
+// capacity, and that only live markets remain in markets().
+TEST(universe_test, evict_closed_markets)
+{
+	auto ptr = std::make_unique<janus::betfair::universe<2>>();
+	auto& universe = *ptr;
+
+	universe.apply_update(janus::make_timestamp_update(1000));
+	universe.apply_update(janus::make_market_id_update(123));
+	universe.apply_update(janus::make_market_close_update());
+	universe.apply_update(janus::make_market_id_update(456));
+	universe.apply_update(janus::make_market_traded_vol_update(123.45));
+	EXPECT_EQ(universe.num_markets(), 2);
+
+	// We're at capacity.
+	EXPECT_THROW(universe.add_market(789), std::runtime_error);
+
+	// Nothing has passed the grace period yet.
+	EXPECT_EQ(universe.evict_closed_markets(500), 0);
+	EXPECT_EQ(universe.num_markets(), 2);
+
+	universe.apply_update(janus::make_timestamp_update(1500));
+	EXPECT_EQ(universe.evict_closed_markets(500), 1);
+	EXPECT_EQ(universe.num_markets(), 1);
+	EXPECT_EQ(universe.num_evicted(), 1);
+	EXPECT_FALSE(universe.contains_market(123));
+	EXPECT_TRUE(universe.contains_market(456));
+
+	// The remaining market moves into the evicted market's place so
+	// iterating markets only sees live ones.
+	EXPECT_EQ(universe.markets().size(), 1);
+	EXPECT_EQ(universe.markets()[0].id(), 456);
+	EXPECT_EQ(universe.last_market(), &universe.markets()[0]);
+
+	// The freed capacity should be reused.
+	universe.apply_update(janus::make_market_id_update(789));
+	EXPECT_EQ(universe.num_markets(), 2);
+	EXPECT_EQ(universe[789].id(), 789);
+	EXPECT_DOUBLE_EQ(universe[789].traded_vol(), 0);
+	EXPECT_EQ(&universe[789], &universe.markets()[1]);
+	EXPECT_DOUBLE_EQ(universe[456].traded_vol(), 123.45);
+
+	// The last updated market is never evicted, even if closed.
+	universe.apply_update(janus::make_market_close_update());
+	universe.apply_update(janus::make_timestamp_update(5000));
+	EXPECT_EQ(universe.evict_closed_markets(500), 0);
+	EXPECT_TRUE(universe.contains_market(789));
+
+	// Explicitly removing the last market invalidates it.
+	EXPECT_TRUE(universe.remove_market(789));
+	EXPECT_FALSE(universe.remove_market(789));
+	EXPECT_EQ(universe.last_market(), nullptr);
+	EXPECT_EQ(universe.num_markets(), 1);
+	EXPECT_EQ(universe.num_evicted(), 2);
+	EXPECT_EQ(universe.markets().size(), 1);
+	EXPECT_EQ(universe.markets()[0].id(), 456);
+
+	// Removing a market other than the last moves the last market, along
+	// with the last market and runner pointers, into its place.
+	universe.apply_update(janus::make_market_id_update(789));
+	universe.apply_update(janus::make_runner_id_update(1));
+	universe.apply_update(janus::make_runner_traded_vol_update(10));
+	janus::betfair::runner* runner = universe.last_runner();
+	EXPECT_TRUE(universe.remove_market(456));
+	ASSERT_EQ(universe.markets().size(), 1);
+	EXPECT_EQ(universe.markets()[0].id(), 789);
+	EXPECT_EQ(universe.last_market(), &universe.markets()[0]);
+	EXPECT_EQ(universe.last_runner(), runner);
+	EXPECT_EQ(&universe.markets()[0][0], runner);
+	universe.apply_update(janus::make_runner_traded_vol_update(20));
+	EXPECT_DOUBLE_EQ(universe[789][0].traded_vol(), 20);
+}
+
+// Ensure that applying a batch of updates is equivalent to applying them one at
+// a time and that faults are reported via status rather than thrown.
+TEST(universe_test, apply_updates)
+{
+	auto ptr = std::make_unique<janus::betfair::universe<1>>();
+	auto& universe = *ptr;
+
+	std::vector<janus::update> updates = {
+		janus::make_timestamp_update(1000),
+		janus::make_market_id_update(123),
+		janus::make_market_open_update(),
+		janus::make_runner_id_update(456),
+		janus::make_runner_matched_update(10, 123.5),
+		janus::make_runner_unmatched_atl_update(20, 100),
+		janus::make_runner_unmatched_atb_update(15, 50),
+		janus::make_timestamp_update(2000),
+		janus::make_runner_ltp_update(17),
+	};
+
+	uint64_t num_applied = 0;
+	EXPECT_EQ(universe.apply_updates(updates, num_applied), janus::betfair::apply_status::OK);
+	EXPECT_EQ(num_applied, updates.size());
+	EXPECT_EQ(universe.num_updates(), updates.size());
+	EXPECT_EQ(universe.last_timestamp(), 2000);
+
+	auto& market = universe[123];
+	EXPECT_EQ(market.state(), janus::betfair::market_state::OPEN);
+	EXPECT_EQ(market.last_timestamp(), 2000);
+	auto& runner = market[0];
+	EXPECT_EQ(runner.ltp(), 17);
+	EXPECT_DOUBLE_EQ(runner.ladder().matched(10), 123.5);
+	EXPECT_DOUBLE_EQ(runner.ladder().unmatched(20), 100);
+	EXPECT_DOUBLE_EQ(runner.ladder().unmatched(15), -50);
+
+	// An empty batch is trivially applied.
+	EXPECT_EQ(universe.apply_updates({}, num_applied), janus::betfair::apply_status::OK);
+	EXPECT_EQ(num_applied, 0);
+
+	// Faulty updates stop the batch and are reported by index.
+	std::vector<janus::update> faulty = {
+		janus::make_runner_traded_vol_update(999),
+		janus::make_timestamp_update(1500),
+		janus::make_runner_traded_vol_update(1234),
+	};
+	EXPECT_EQ(universe.apply_updates(faulty, num_applied),
+		  janus::betfair::apply_status::TIMESTAMP_BACKWARDS);
+	EXPECT_EQ(num_applied, 1);
+	EXPECT_DOUBLE_EQ(runner.traded_vol(), 999);
+	EXPECT_EQ(universe.last_timestamp(), 1500);
+
+	// We can resume after the faulty update.
+	std::span<const janus::update> rest(faulty);
+	EXPECT_EQ(universe.apply_updates(rest.subspan(num_applied + 1), num_applied),
+		  janus::betfair::apply_status::OK);
+	EXPECT_EQ(num_applied, 1);
+	EXPECT_DOUBLE_EQ(runner.traded_vol(), 1234);
+
+	janus::update bad_price = janus::make_runner_matched_update(janus::betfair::NUM_PRICES, 1);
+	EXPECT_EQ(universe.apply_updates({&bad_price, 1}, num_applied),
+		  janus::betfair::apply_status::INVALID_PRICE_INDEX);
+	EXPECT_EQ(num_applied, 0);
+	EXPECT_THROW(universe.apply_update(bad_price), janus::universe_apply_error);
+
+	janus::update unknown = janus::make_runner_won_update();
+	unknown.type = static_cast<janus::update_type>(janus::NUM_UPDATE_TYPES);
+	EXPECT_EQ(universe.apply_updates({&unknown, 1}, num_applied),
+		  janus::betfair::apply_status::UNKNOWN_UPDATE);
+
+	// Updates requiring a market, runner or timestamp are reported
+	// accordingly.
+	universe.clear();
+	janus::update won = janus::make_runner_won_update();
+	EXPECT_EQ(universe.apply_updates({&won, 1}, num_applied),
+		  janus::betfair::apply_status::NO_MARKET);
+	universe.apply_update(janus::make_market_id_update(123));
+	EXPECT_EQ(universe.apply_updates({&won, 1}, num_applied),
+		  janus::betfair::apply_status::NO_RUNNER);
+	universe.apply_update(janus::make_runner_id_update(456));
+	EXPECT_EQ(universe.apply_updates({&won, 1}, num_applied),
+		  janus::betfair::apply_status::NO_TIMESTAMP);
+
+	// Clearing the market mid-batch invalidates the runner for the
+	// updates which follow it.
+	std::vector<janus::update> cleared = {
+		janus::make_timestamp_update(3000),
+		janus::make_runner_id_update(456),
+		janus::make_runner_ltp_update(17),
+		janus::make_market_clear_update(),
+		janus::make_runner_ltp_update(18),
+	};
+	EXPECT_EQ(universe.apply_updates(cleared, num_applied),
+		  janus::betfair::apply_status::NO_RUNNER);
+	EXPECT_EQ(num_applied, 4);
+}
+
+// Ensure that data faults are reported via status and counted by category
+// rather than thrown.
+TEST(universe_test, faults)
+{
+	auto ptr = std::make_unique<janus::betfair::universe<1>>();
+	auto& universe = *ptr;
+	uint64_t num_applied;
+
+	universe.apply_update(janus::make_market_id_update(123));
+	universe.apply_update(janus::make_timestamp_update(1000));
+	universe.apply_update(janus::make_runner_id_update(456));
+	universe.apply_update(janus::make_runner_unmatched_atb_update(10, 100));
+
+	// An ATL below the best ATB crosses the book.
+	janus::update crossed = janus::make_runner_unmatched_atl_update(5, 100);
+	EXPECT_EQ(universe.apply_updates({&crossed, 1}, num_applied),
+		  janus::betfair::apply_status::CROSSED_BOOK);
+	EXPECT_EQ(num_applied, 0);
+	EXPECT_DOUBLE_EQ(universe[123][0].ladder().unmatched(5), 0);
+	EXPECT_THROW(universe.apply_update(crossed), janus::universe_apply_error);
+	EXPECT_EQ(universe.num_faults(janus::betfair::apply_status::CROSSED_BOOK), 2);
+
+	// Faulty updates leave the runner's timestamp untouched.
+	universe.apply_update(janus::make_timestamp_update(2000));
+	EXPECT_EQ(universe.apply_updates({&crossed, 1}, num_applied),
+		  janus::betfair::apply_status::CROSSED_BOOK);
+	EXPECT_EQ(universe[123][0].last_timestamp(), 1000);
+
+	// A removed runner cannot win.
+	universe.apply_update(janus::make_runner_removal_update(10));
+	janus::update won = janus::make_runner_won_update();
+	EXPECT_EQ(universe.apply_updates({&won, 1}, num_applied),
+		  janus::betfair::apply_status::INVALID_TRANSITION);
+
+	// A closed market cannot reopen.
+	universe.apply_update(janus::make_market_close_update());
+	janus::update open = janus::make_market_open_update();
+	EXPECT_EQ(universe.apply_updates({&open, 1}, num_applied),
+		  janus::betfair::apply_status::INVALID_TRANSITION);
+	EXPECT_EQ(universe[123].state(), janus::betfair::market_state::CLOSED);
+	EXPECT_EQ(universe.num_faults(janus::betfair::apply_status::INVALID_TRANSITION), 2);
+
+	// Counts are retained over a clear.
+	universe.clear();
+	EXPECT_EQ(universe.apply_updates({&won, 1}, num_applied),
+		  janus::betfair::apply_status::NO_MARKET);
+	EXPECT_EQ(universe.num_faults(janus::betfair::apply_status::NO_MARKET), 1);
+	EXPECT_EQ(universe.num_faults(janus::betfair::apply_status::CROSSED_BOOK), 3);
+	EXPECT_EQ(universe.num_faults(janus::betfair::apply_status::OK), 0);
+
+	universe.reset_num_faults();
+	EXPECT_EQ(universe.num_faults(janus::betfair::apply_status::CROSSED_BOOK), 0);
+}
+
+// Ensure we can read a timeslice of updates directly from a dynamic buffer.
+TEST(universe_test, read_updates)
+{
+	janus::dynamic_buffer dyn_buf(1000);
+	dyn_buf.add(janus::make_timestamp_update(1000));
+	dyn_buf.add(janus::make_market_id_update(123));
+	dyn_buf.add(janus::make_market_open_update());
+	dyn_buf.add(janus::make_timestamp_update(2000));
+	dyn_buf.add(janus::make_market_close_update());
+
+	auto updates = janus::read_updates(dyn_buf);
+	ASSERT_EQ(updates.size(), 5);
+	EXPECT_EQ(dyn_buf.read_offset(), dyn_buf.size());
+	EXPECT_EQ(janus::read_updates(dyn_buf).size(), 0);
+
+	EXPECT_EQ(janus::find_next_timestamp(updates, 0), 0);
+	EXPECT_EQ(janus::find_next_timestamp(updates, 1), 3);
+	EXPECT_EQ(janus::find_next_timestamp(updates, 4), 5);
+
+	auto ptr = std::make_unique<janus::betfair::universe<1>>();
+	uint64_t num_applied = 0;
+	EXPECT_EQ(ptr->apply_updates(updates.first(3), num_applied),
+		  janus::betfair::apply_status::OK);
+	EXPECT_EQ((*ptr)[123].state(), janus::betfair::market_state::OPEN);
+}
+
+// Ensure that a universe restored from a checkpoint matches the original and
+// that updates can continue to be applied from the point it was saved.
+TEST(universe_test, checkpoint)
+{
+	auto ptr = std::make_unique<janus::betfair::universe<3>>();
+	auto& universe = *ptr;
+
+	universe.apply_update(janus::make_timestamp_update(1000));
+	universe.apply_update(janus::make_market_id_update(123));
+	universe.apply_update(janus::make_market_close_update());
+	universe.apply_update(janus::make_market_id_update(456));
+	universe.apply_update(janus::make_market_traded_vol_update(1234.5));
+	universe.apply_update(janus::make_market_inplay_update());
+	universe.apply_update(janus::make_runner_id_update(1));
+	universe.apply_update(janus::make_runner_removal_update(12.5));
+	universe.apply_update(janus::make_runner_id_update(2));
+	universe.apply_update(janus::make_runner_matched_update(10, 100));
+	universe.apply_update(janus::make_runner_unmatched_atl_update(20, 50));
+	universe.apply_update(janus::make_runner_unmatched_atb_update(15, 25));
+	universe.apply_update(janus::make_runner_ltp_update(17));
+	universe.apply_update(janus::make_runner_sp_update(3.5));
+	universe.apply_update(janus::make_timestamp_update(2000));
+	// Evicted markets are not saved.
+	EXPECT_TRUE(universe.remove_market(123));
+
+	janus::dynamic_buffer dyn_buf(universe.checkpoint_size());
+	universe.save_checkpoint(dyn_buf);
+	EXPECT_EQ(dyn_buf.size(), universe.checkpoint_size());
+
+	std::string path = std::filesystem::temp_directory_path() / "universe_test.ckpt";
+	janus::write_checkpoint_file(path, dyn_buf);
+	janus::dynamic_buffer file_buf = janus::read_checkpoint_file(path);
+	std::filesystem::remove(path);
+	ASSERT_EQ(file_buf.size(), dyn_buf.size());
+
+	auto restored_ptr = std::make_unique<janus::betfair::universe<3>>();
+	auto& restored = *restored_ptr;
+	restored.apply_update(janus::make_market_id_update(999));
+	restored.load_checkpoint(file_buf);
+
+	EXPECT_EQ(restored.num_markets(), 1);
+	EXPECT_FALSE(restored.contains_market(999));
+	EXPECT_EQ(restored.last_timestamp(), 2000);
+	EXPECT_EQ(restored.num_updates(), universe.num_updates());
+
+	auto& market = restored[456];
+	EXPECT_EQ(restored.last_market(), &market);
+	EXPECT_EQ(market.state(), janus::betfair::market_state::OPEN);
+	EXPECT_TRUE(market.inplay());
+	EXPECT_DOUBLE_EQ(market.traded_vol(), 1234.5);
+	EXPECT_EQ(market.last_timestamp(), 2000);
+	ASSERT_EQ(market.num_runners(), 2);
+
+	auto& removed = market[0];
+	EXPECT_EQ(removed.id(), 1);
+	EXPECT_EQ(removed.state(), janus::betfair::runner_state::REMOVED);
+	EXPECT_DOUBLE_EQ(removed.adj_factor(), 12.5);
+
+	auto& runner = market[1];
+	EXPECT_EQ(restored.last_runner(), &runner);
+	EXPECT_EQ(runner.id(), 2);
+	EXPECT_EQ(runner.ltp(), 17);
+	EXPECT_DOUBLE_EQ(runner.sp(), 3.5);
+	EXPECT_EQ(runner.last_timestamp(), 1000);
+
+	auto& ladder = runner.ladder();
+	EXPECT_DOUBLE_EQ(ladder.matched(10), 100);
+	EXPECT_DOUBLE_EQ(ladder.total_matched(), 100);
+	EXPECT_DOUBLE_EQ(ladder.unmatched(20), 50);
+	EXPECT_DOUBLE_EQ(ladder.unmatched(15), -25);
+	EXPECT_EQ(ladder.best_atl().first, 20);
+	EXPECT_EQ(ladder.best_atb().first, 15);
+
+	// Updates continue to implicitly apply to the last market and runner.
+	restored.apply_update(janus::make_runner_traded_vol_update(999));
+	EXPECT_DOUBLE_EQ(runner.traded_vol(), 999);
+
+	// Checkpoints from other versions are rejected.
+	dyn_buf.reset_read();
+	dyn_buf.data()[0] = janus::betfair::CHECKPOINT_VERSION + 1;
+	EXPECT_THROW(restored.load_checkpoint(dyn_buf), std::runtime_error);
+}
+
+// Ensure that the universe records what changed in each market per timestamp.
+TEST(universe_test, changes)
+{
+	auto ptr = std::make_unique<janus::betfair::universe<1>>();
+	auto& universe = *ptr;
+
+	universe.apply_update(janus::make_timestamp_update(1000));
+	universe.apply_update(janus::make_market_id_update(123));
+	universe.apply_update(janus::make_runner_id_update(1));
+	universe.apply_update(janus::make_runner_id_update(2));
+	universe.apply_update(janus::make_runner_unmatched_atl_update(20, 50));
+	universe.apply_update(janus::make_runner_unmatched_atb_update(15, 25));
+
+	auto& market = universe[123];
+	const auto& changes = market.changes();
+	EXPECT_EQ(changes.timestamp(), 1000);
+	EXPECT_FALSE(changes.market_changed());
+	// Newly added runners are marked changed. Unmatched updates may change
+	// either side.
+	EXPECT_EQ(changes.runner_mask(), 0b11);
+	EXPECT_EQ(changes.atl_range(1).min, 15);
+	EXPECT_EQ(changes.atl_range(1).max, 20);
+	EXPECT_EQ(changes.atb_range(1).min, 15);
+	EXPECT_EQ(changes.atb_range(1).max, 20);
+	EXPECT_TRUE(changes.atl_range(0).empty());
+
+	universe.apply_update(janus::make_timestamp_update(2000));
+	// Nothing has changed at this timestamp yet.
+	EXPECT_EQ(changes.timestamp(), 1000);
+
+	universe.apply_update(janus::make_market_traded_vol_update(123.45));
+	universe.apply_update(janus::make_runner_id_update(1));
+	universe.apply_update(janus::make_runner_matched_update(10, 100));
+	EXPECT_EQ(changes.timestamp(), 2000);
+	EXPECT_TRUE(changes.market_changed());
+	EXPECT_EQ(changes.runner_mask(), 0b1);
+	EXPECT_EQ(changes.matched_range(0).min, 10);
+	EXPECT_TRUE(changes.atl_range(0).empty());
+
+	universe.apply_update(janus::make_timestamp_update(3000));
+	universe.apply_update(janus::make_market_clear_update());
+	EXPECT_EQ(changes.runner_mask(), 0b11);
+	EXPECT_EQ(changes.matched_range(1).max, janus::betfair::NUM_PRICES - 1);
+
+	// An ATL update at the best ATB replaces it, changing the ATB side.
+	universe.apply_update(janus::make_timestamp_update(4000));
+	universe.apply_update(janus::make_runner_id_update(2));
+	universe.apply_update(janus::make_runner_unmatched_atb_update(15, 100));
+	universe.apply_update(janus::make_runner_unmatched_atl_update(20, 100));
+	universe.apply_update(janus::make_timestamp_update(5000));
+	universe.apply_update(janus::make_runner_unmatched_atl_update(15, 100));
+	const auto& ladder = market[1].ladder();
+	EXPECT_EQ(ladder.best_atl().first, 15);
+	EXPECT_TRUE(changes.atb_range(1).contains(15));
+
+	// Trivial ATL volume cleared to make way for an ATB update is changed
+	// on the ATL side.
+	universe.apply_update(janus::make_timestamp_update(6000));
+	universe.apply_update(janus::make_runner_unmatched_atb_update(12, 100));
+	universe.apply_update(janus::make_runner_unmatched_atl_update(14, 10));
+	universe.apply_update(janus::make_timestamp_update(7000));
+	universe.apply_update(janus::make_runner_unmatched_atb_update(15, 100));
+	EXPECT_DOUBLE_EQ(ladder.unmatched(14), 0);
+	EXPECT_EQ(ladder.best_atb().first, 15);
+	EXPECT_EQ(changes.runner_mask(), 0b10);
+	EXPECT_EQ(changes.atl_range(1).min, 14);
+	EXPECT_EQ(changes.atl_range(1).max, 15);
+	EXPECT_EQ(changes.atb_range(1).min, 15);
+	EXPECT_EQ(changes.atb_range(1).max, 15);
+
+	// As is the case if the update then crosses the book.
+	universe.apply_update(janus::make_timestamp_update(8000));
+	universe.apply_update(janus::make_runner_unmatched_atl_update(17, 10));
+	universe.apply_update(janus::make_runner_unmatched_atl_update(18, 100));
+	universe.apply_update(janus::make_timestamp_update(9000));
+	EXPECT_THROW(universe.apply_update(janus::make_runner_unmatched_atb_update(19, 100)),
+		     janus::universe_apply_error);
+	EXPECT_DOUBLE_EQ(ladder.unmatched(17), 0);
+	EXPECT_EQ(changes.timestamp(), 9000);
+	EXPECT_EQ(changes.atl_range(1).min, 17);
+	EXPECT_EQ(changes.atl_range(1).max, 17);
+}
 } // namespace